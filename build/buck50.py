@@ -48,7 +48,8 @@ import tty
 #
 #
 
-VERSION = (0, 9, 6)
+VERSION      = (0, 10, 0)
+MIN_FIRMWARE = (0,  9, 0)   # oldest accepted, see firmware_has()
 
 COPYRIGHT = '''%s %d.%d.%d
 Copyright 2020 Mark R. Rubin aka "thanks4opensource"''' \
@@ -170,7 +171,7 @@ def check_version(quiet):
                                  % '.'.join([str(elem) for elem in VERSION]))
         else:
             if    firmware_version[0] != VERSION[0]\
-               or firmware_version[1]  < VERSION[1]:
+               or firmware_version     < MIN_FIRMWARE:
                 mismatch = "ERROR"
             else:
                 mismatch = "Warning"
@@ -180,6 +181,33 @@ def check_version(quiet):
                                 '.'.join([str(elem) for elem in
                                                     firmware_version]  ),
                                 '.'.join([str(elem) for elem in VERSION])))
+            if mismatch == "Warning" and firmware_version < FIRMWARE_0_10:
+                sys.stdout.write("Firmware older than %d.%d.%d: no "
+                                 "\"logic mode=stream|packed "
+                                 "trig-code=compiled\",\n"
+                                 "\"monitor batch=\", \"oscope "
+                                 "adc-mode=interleaved decimate=\", "
+                                 "or \"instrument\"\n"
+                                 % FIRMWARE_0_10                          )
+
+
+
+# 0.9.x firmware: shorter ANLG_CMD and LIVE_CMD, 14 byte upload header,
+# none of 0.10.0's added commands and modes
+FIRMWARE_0_10 = (0, 10, 0)
+
+def old_firmware():
+    return firmware_version is not None and firmware_version < FIRMWARE_0_10
+
+def firmware_has(feature):
+    if not old_firmware():
+        return True
+    sys.stdout.write(  "%s needs firmware %s or newer, connected is %s -- "
+                       "reflash buck50.elf\n"
+                     % (feature                                          ,
+                        '.'.join([str(elem) for elem in FIRMWARE_0_10   ]),
+                        '.'.join([str(elem) for elem in firmware_version])))
+    return False
 
 
 
@@ -254,6 +282,79 @@ def blink_user_led():
 
 
 
+# instrument_config actions
+#
+
+INSTRUMENT_COUNTERS   = ("USB IN packets"      ,
+                         "USB IN bytes"        ,
+                         "USB OUT bytes"       ,
+                         "sample bytes"        ,
+                         "cycles since enable" )
+INSTRUMENT_HISTOGRAMS = ("loop period"         ,
+                         "edge spacing"        ,
+                         "USB send wait"       ,
+                         "USB receive wait"    )
+
+def instrument_action(action):
+    os.write(usb_fd, struct.pack('4B', INST_CMD, action, 0, 0))
+
+
+
+def instrument_cycles(cycles):
+    return "%d (%.2fus)" % (cycles, cycles * 1e6 / CPU_HZ)
+
+
+
+def instrument_report():
+    instrument_action(INST_REPORT)
+    header = wait_read(4, 2)
+    if header in (WAIT_READ_STDIN, None):
+        sys.stderr.write("Failure receiving instrumentation report header\n")
+        return
+    (enabled, bins, num_hists, num_cntrs) = struct.unpack('4B', header)
+    hist_words = 3 + bins
+    num_words  = num_cntrs + num_hists * hist_words
+    response   = b''
+    while len(response) < num_words * 4:  # tty reads can return partial
+        chunk = wait_read(num_words * 4 - len(response), 2, False)
+        if chunk in (WAIT_READ_STDIN, None) or not chunk:
+            sys.stderr.write("Failure receiving instrumentation report\n")
+            return
+        response += chunk
+    words = struct.unpack('%dI' % num_words, response)
+
+    lines = [  "Instrumentation %s, times in %g MHz firmware cycles"
+             % ("enabled" if enabled else "disabled", CPU_HZ / 1e6)   ]
+    for (ndx, name) in enumerate(INSTRUMENT_COUNTERS[:num_cntrs]):
+        lines.append("  %-19s %10d" % (name, words[ndx]))
+    for (ndx, name) in enumerate(INSTRUMENT_HISTOGRAMS[:num_hists]):
+        (count, minimum, maximum) = words[  num_cntrs + ndx * hist_words
+                                          : num_cntrs + ndx * hist_words + 3]
+        histogram = words[  num_cntrs + ndx * hist_words + 3
+                          : num_cntrs + ndx * hist_words + hist_words]
+        if not count:
+            lines.append("  %-19s %10d" % (name, count))
+            continue
+        lines.append(  "  %-19s %10d  min %s  max %s"
+                     % (name                    ,
+                        count                   ,
+                        instrument_cycles(minimum),
+                        instrument_cycles(maximum)))
+        if instrument_config['histograms'].val:
+            for (ndx, number) in enumerate(histogram):
+                if not number:
+                    continue
+                if ndx == 0:
+                    span = "0"
+                elif ndx == bins - 1:
+                    span = ">= %d" % (4 ** (ndx - 1))
+                else:
+                    span = "%d-%d" % (4 ** (ndx - 1), 4 ** ndx - 1)
+                lines.append("    %-17s %10d" % (span, number))
+    Pager()('\n'.join(lines) + '\n', immed=True)
+
+
+
 # trigger_config actions
 #
 
@@ -596,6 +697,22 @@ class SpecialInt(RangeInt):
 
 
 
+class PowerOfTwo(RangeInt):
+    def set_value(self, value):
+        checked = RangeInt(self._min, self._min, self._max)
+        try:
+            checked.set_value(value)
+            assert(checked.val & (checked.val - 1) == 0)
+        except Exception as error:
+            raise ValueError("\"%s\" is not %s" % (value, self.suitable()))
+        self._val = checked.val
+    def log2(self):
+        return self._val.bit_length() - 1
+    def suitable(self):
+        return "power of two in range [%d ... %d]" % (self._min, self._max)
+
+
+
 class StringsAndValues(object):
     __slots__ = ['__val', '__str', '__case', '_help']
     def __init__(self, init='', case=False):
@@ -1723,12 +1840,16 @@ class SamplingMode(StringsAndValues):
     IRREGULAR =  1
     UNIFORM   =  2
     MHZ_4     =  3
+    STREAM    =  4
+    PACKED    =  5
     ANALOG    = 15  # only for upld_cmd, not valid for `logic mode=`
     strings_and_values = {
         '6.26MHz'   :  MHZ_6_26 ,
         'irregular' :  IRREGULAR,
         'uniform'   :  UNIFORM  ,
         '4MHz'      :  MHZ_4    ,
+        'stream'    :  STREAM   ,
+        'packed'    :  PACKED   ,
     }
     def __init__(self, init='4MHz-avg'): super().__init__(init)
 SAMPLING_MODE_INVERSE = {     val:key
@@ -1893,6 +2014,30 @@ class AdcSampHold(StringsAndValues):
     def __init__(self, init=T_239_5): super().__init__(init)
 
 
+class AdcMode(StringsAndValues):  # as firmware AnalogMode
+    NORMAL      = 0x00
+    INTERLEAVED = 0x80
+    strings_and_values = {
+        'normal'      : NORMAL     ,
+        'interleaved' : INTERLEAVED,
+    }
+    def __init__(self, init='normal'): super().__init__(init)
+
+
+class Decimate(StringsAndValues):  # as firmware AnalogMode
+    NONE        = 0x00
+    MINMAX      = 0x10
+    AVERAGE     = 0x20
+    MASK        = 0x30
+    FACTOR_MASK = 0x0f  # log2 of "dec-factor="
+    strings_and_values = {
+        'disabled' : NONE   ,
+        'min-max'  : MINMAX ,
+        'average'  : AVERAGE,
+    }
+    def __init__(self, init='disabled'): super().__init__(init)
+
+
 class OpenDrain(StringsAndValues):
     strings_and_values = {
         'push-pull'  : 0,
@@ -1922,9 +2067,11 @@ class Pull(StringsAndValues):
 class DigitalFormat(StringsAndValues):
     CSV = 1
     VCD = 2
+    BIN = 3
     strings_and_values = {
         'csv' : CSV,
         'vcd' : VCD,
+        'bin' : BIN,
     }
     def __init__(self, init='vcd'): super().__init__(init)
 
@@ -2005,6 +2152,16 @@ class CodeMem(StringsAndValues):
     def __init__(self, init='flash'): super().__init__(init)
 
 
+class TrigCode(StringsAndValues):
+    INTERPRETED = 0
+    COMPILED    = 1
+    strings_and_values = {
+        'interpreted' : INTERPRETED,
+        'compiled'    : COMPILED   ,
+    }
+    def __init__(self, init='interpreted'): super().__init__(init)
+
+
 class AsciiNumeric(StringsAndValues):
     ASCII   = 0
     NUMERIC = 1
@@ -2121,14 +2278,25 @@ MAX_I2C_BRIDGE = 60
 
 MAX_END_STR = 16
 
-HALT_MEMORY = 1
-HALT_TIME   = 2
-HALT_USB    = 3
+HALT_MEMORY  = 1
+HALT_TIME    = 2
+HALT_USB     = 3
+HALT_OVERRUN = 4
 HALT_NAMES = {
-    HALT_MEMORY : 'number of samples',
-    HALT_TIME   : 'time elapsed'     ,
-    HALT_USB    : 'user interrupt'   ,
+    HALT_MEMORY  : 'number of samples',
+    HALT_TIME    : 'time elapsed'     ,
+    HALT_USB     : 'user interrupt'   ,
+    HALT_OVERRUN : 'stream overrun (host/USB too slow for edge rate)',
 }
+
+# "logic mode=stream" packet types
+STREAM_SAMPLES = 1
+STREAM_END     = 2
+
+# "dump digital-frmt=bin" file header, followed by little-endian double
+#   CPU_HZ, then per sample uint64 (ticks since first sample << 8) | bits
+#   (same as build/host/sample_export.hxx)
+BIN_MAGIC = b'buck50\x00\x01'
 def halt_name(code):
     return      HALT_NAMES[code]                    \
            if   code in HALT_NAMES                  \
@@ -2208,8 +2376,13 @@ FLSH_CMD = 14
 I2C_CMD  = 15
 SRNO_CMD = 16
 BLNK_CMD = 17
+INST_CMD = 18
 SIGN_CMD = 0xf2
 
+INST_REPORT  = 0   # firmware instrument_command::ACTION
+INST_ENABLE  = 1
+INST_DISABLE = 2
+
 
 SIGNATURE = [SIGN_CMD,
              0x9e, 0xc4, 0xaa, 0xdf,
@@ -2218,6 +2391,10 @@ SIGNATURE = [SIGN_CMD,
              0x99, 0xd1, 0xae, 0xeb,
              0   , 0   , 0          ]  # pad to mod 4
 
+LIVE_BATCH_HEADER     =  8   # firmware LiveBatch::
+LIVE_BATCH_MAX_RECORD = 55
+LIVE_BATCH_IDLE       =  0.5 # seconds, after "duration=" elapsed
+
 CONFIG_FILE_EXTENSION = '.b50'
 
 MIN_PULS = 2.0 / CPU_HZ
@@ -2314,6 +2491,7 @@ digital_config = HelpDict({
     'duration'  : Duration    ('infinite' , (1<<16) / CPU_HZ, 1, 0xffff, 1),
     'edges'     : SpecialInt  ('unlimited', 'unlimited'     , 4, 0xffff   ),
     'code-mem'  : CodeMem     ('flash'                                    ),
+    'trig-code' : TrigCode    ('interpreted'                              ),
     'autodump'  : Able        ('disabled'                                 ),
 })
 digital_config.__help = """
@@ -2329,20 +2507,59 @@ Sampling mode
     irregular   : alternating   11 + 14  "    "      "    (72*2/25 = 5.76MHz)
     uniform     : constant           15  "    "      "    (72  /15 = 4.80MHz)
     4MHz        : constant           18  "    "      "    (72  /18 = 4.00MHz)
+    stream      : constant           16  "    "      "    (72  /16 = 4.50MHz)
+    packed      : unchanged 10, edge 15+18 "   "      "    (72*2/33 = 4.36MHz)
   - if "code-mem=ram":
     6.26MHz     : sequence    5@13+1@17 CPU clocks/sample (72*6/69 = 5.27MHz)
     irregular   : alternating   13 + 17  "    "      "    (72*2/30 = 4.80MHz)
     uniform     : constant           17  "    "      "    (72  /17 = 4.24MHz)
     4MHz        : constant           18  "    "      "    (72  /18 = 3.43MHz)
+    stream      : constant           19  "    "      "    (72  /19 = 3.79MHz)
+    packed      : unchanged 12, edge 17+21 "   "      "    (72*2/38 = 3.79MHz)
+  - "stream" sends samples to host during sampling instead of stopping
+    when sample memory is full, directly to "dump" file/terminal (see
+    "help dump"). Stops with "stream overrun" if average edge rate exceeds
+    USB and host processing throughput. Sampling loop briefly stalls
+    for each USB packet sent: edges during a stall are recorded late
+    (merged into one) or lost, firmware counts those it sees and a
+    warning is printed at end of stream if any.
+  - "packed" stores 16-bit instead of 32-bit samples (8 bits ports plus
+    ticks since previous sample) for up to twice the capture depth, but
+    only if edges are less than 255 ticks (3.5us) apart: longer gaps
+    take 48 bits, so slow inputs get as few as 2/3 the samples of other
+    modes. Edges alternate 15 and 18 (ram 17 and 21) CPU clocks, 25
+    (ram 31) if more than 255 ticks after previous: slower than
+    "6.26MHz" and "irregular" (computing tick delta and packing bits
+    takes 5 more instructions than storing raw 32-bit sample). Use
+    when depth of fast bursts matters more than edge rate. "dump"
+    "begin=" and "count=" apply to decoded samples.
 """
 digital_config['duration']._help = "Sampling time limit"
 digital_config['edges'   ]._help = "Maximum number of digital samples "     \
                                     "(including extra timing samples at "   \
-                                    "c. 4Hz)"
+                                    "c. 4Hz). Checked by host, not "        \
+                                    "firmware, if \"mode=stream\". If "     \
+                                    "\"mode=packed\", limits 16-bit "       \
+                                    "halves: as few as 1/3 that many "      \
+                                    "samples if more than 255 ticks apart"
 digital_config['code-mem']._help = "Sampling code memory bank. "            \
                                     "See \"help logic logic\" and "         \
                                     "https://github.com/thanks4opensource/" \
                                     "buck50/#flash_vs_ram"
+digital_config['trig-code']._help = """
+Trigger matching code
+  - interpreted : generic firmware loop evaluates "trigger" states
+  - compiled    : firmware translates states into specialized code in
+                  RAM (regardless of "code-mem=") before triggering
+  - "compiled" checks inputs more frequently: shorter pulses detected,
+    especially with multiple "fail" states (logical "OR"), but uses
+    sample memory for code. Falls back to "interpreted" if many
+    complex states need more than 4096 bytes of code.
+  - "compiled" also has shorter trigger to first sample latency (about
+    23 vs. 26 CPU clocks "code-mem=flash", 23 vs. 31 "code-mem=ram"):
+    its triggered/sampling-setup code is always in RAM right after it,
+    only the sampling loop obeys "code-mem=".
+"""
 digital_config['autodump']._help = "Automatically (CAUTION!) do \"dump\" "  \
                                    "command after completion. See "         \
                                    "\"CAUTION!\" in \"help dump "           \
@@ -2356,6 +2573,9 @@ analog_config = HelpDict({
     'trigger'    : SclLvlHyst (0.0        , 3.3              , 1.65, 0.05  ),
     'slope'      : Slope      ('positive'                                  ),
     's/h+adc'    : AdcSampHold(AdcSampHold.T_239_5                         ),
+    'adc-mode'   : AdcMode    ('normal'                                    ),
+    'decimate'   : Decimate   ('disabled'                                  ),
+    'dec-factor' : PowerOfTwo (16         , 2                , 4096        ),
     'time-scale' : HelpFloat  (1.0e6                                       ),
     'printf'     : Printf     ("%10.2f μs", 64                             ),
     'autodump'   : Able       ('disabled'                                  ),
@@ -2364,7 +2584,7 @@ analog_config.__help = """
 Analog DSO (digital storage oscilloscope) parameters
 """
 analog_config['samples'   ]._help = "Maximum number of single or dual "     \
-                                    "analog samples"
+                                    "analog samples (after \"decimate=\")"
 analog_config['trgr-chnl' ]._help = "Port number PA<x> (x=0...7) of "       \
                                     "trigger/first/single channel"
 analog_config['scnd-chnl' ]._help = "Port number PA<x> (x=0...7) of "       \
@@ -2381,6 +2601,19 @@ analog_config['s/h+adc'   ]._help = "Sampling rate, sample and hold time "  \
                                     "plus analog conversion time. "         \
                                     "Limited set of values supported "      \
                                     "by hardware."
+analog_config['adc-mode'  ]._help = "\"interleaved\": ADC1 and ADC2 "         \
+                                    "alternately convert trigger channel, "  \
+                                    "doubling sampling rate to 1.714MHz. "   \
+                                    "Requires \"s/h+adc=1.5+12.5@12MHz"      \
+                                    "->857kHz\" and \"scnd-chnl=none\"."
+analog_config['decimate'  ]._help = "Reduce each \"dec-factor=\" trigger "   \
+                                    "channel samples on-device to their "    \
+                                    "minimum and maximum (one dual sample) " \
+                                    "or rounded average (one single "        \
+                                    "sample), for long captures in less "    \
+                                    "memory. Requires \"scnd-chnl=none\"."
+analog_config['dec-factor']._help = "Number of ADC samples per "             \
+                                    "\"decimate=\" value"
 analog_config['time-scale']._help = "Scale factor for time values in "      \
                                     "\"dump\" command output"
 analog_config['printf'    ]._help = "C format string for "  \
@@ -2407,6 +2640,7 @@ upload_config = HelpDict({
     'auto-digital'   : Able         ('disabled'                            ),
     'auto-analog'    : Able         ('disabled'                            ),
     'warn-pulseview' : HelpFloat    ('100e6'                               ),
+    'exporter'       : Text         ('b50export' , 1024                    ),
     'linewidth'      : HelpFloat    (0.0                                   ),
     'pointtype'      : PointType    ('none'                                ),
     'pointsize'      : HelpFloat    (0.0                                   ),
@@ -2477,6 +2711,15 @@ upload_config['warn-pulseview']._help = "Warn if estimated \"digital-frmt="   \
                                         "https://github."                     \
                                         "com/thanks4opensource/buck50"        \
                                         "/#pulseview"
+upload_config['exporter'      ]._help = "Native (compiled C++) program "     \
+                                        "for writing \"file\" output, "       \
+                                        "much faster than buck50.py "         \
+                                        "itself for large captures. Looked "  \
+                                        "for in \"host\" subdirectory of "    \
+                                        "buck50.py's directory (\"make\" "    \
+                                        "there to build) then in $PATH. "     \
+                                        "Output identical to buck50.py's. "   \
+                                        "Empty for buck50.py only."
 upload_config['linewidth'     ]._help = "analog gnuplot line width"
 upload_config['pointtype'     ]._help = "analog gnuplot point type"
 upload_config['pointsize'     ]._help = "analog gnuplot point size "          \
@@ -2522,6 +2765,7 @@ live_config = HelpDict({
     'file'     : FileName          (None                                      ),
     'output'   : TermFileBoth      ('both'                                    ),
     'printf'   : Printf            ('%7.3f'   , 64                            ),
+    'batch'    : TimeFreqSpecialVal('disabled', 1, 0xffffffff, 'disabled'    ),
 })
 live_config['rate'    ]._help = "Max update frequency. "                 \
                                 "See \"Time/Frequency Errors\" section " \
@@ -2532,6 +2776,11 @@ live_config['file'    ]._help = "Log file name"
 live_config['output'  ]._help = "Log to file (\"file\" or \"both\") only if " \
                                 "\"file=\" is also set)"
 live_config['printf'  ]._help = "C format string for time (seconds)."
+live_config['batch'   ]._help = "Pack many monitored changes per USB "  \
+                                "packet, sent at most this long after "  \
+                                "first. Allows much faster \"rate=\". "  \
+                                "Changes dropped (and reported) instead "\
+                                "of slowing if USB/host can't keep up."
 live_config.__help = """
 """
 
@@ -3073,7 +3322,9 @@ reset_config['ganged']._help = "Synchronized digital (\"logic\") and/or "   \
                                "\"ganged=enabled\" must be activated via "  \
                                "\"reset ext-trig\" action before \"logic\" "\
                                "or \"oscope\" commands. Triggering on any " \
-                               "device will trigger all."
+                               "device will trigger all. Combine devices' " \
+                               "\"logic\" captures into one time-aligned " \
+                               "VCD file with build/host/b50merge."
 reset_config['usb'    ]._help = "USB port and device driver"
 reset_config['timeout']._help = "Timeout value for reset USB operations "   \
                                 "(can interrupt by <ENTER> key"
@@ -3087,6 +3338,26 @@ reset_config['pre'   ]._help =  "Flash memory prefetch buffer. "            \
 
 
 
+instrument_config = HelpDict({
+    'histograms' : Able('enabled'),
+})
+instrument_config._actions = {
+    'enable'  : Action(lambda : instrument_action(INST_ENABLE)                ,
+                       "Clear and start firmware counters and histograms"     ),
+    'disable' : Action(lambda : instrument_action(INST_DISABLE)               ,
+                       "Stop firmware counting, keep values for \"report\""  ),
+    'report'  : Action(instrument_report                                      ,
+                       "Print counters and histograms (also if no action)"    ),
+}
+instrument_config.__help = """
+Firmware cycle accounting via Cortex-M3 DWT cycle counter, see "help instrument"
+"""
+instrument_config['histograms']._help = "Print histogram bins (cycles, "   \
+                                        "powers of 4) in addition to "     \
+                                        "count/min/max"
+
+
+
 ipc_config = HelpDict({
     'i/o'   : TermPtySock('terminal'                  ),
     'flush' : TimeVal    ('1s'     , 1.0        , 60.0),
@@ -3182,6 +3453,7 @@ SETTINGS = {
     'lines'     :  channels_config,
     'triggers'  :  triggers_config,
     'reset'     :     reset_config,
+    'instrument':instrument_config,
     'socket'    :    socket_config,
     'pty'       :       pty_config,
     'ipc'       :       ipc_config,
@@ -4041,13 +4313,208 @@ def configs_print(configs, file):
 #
 #
 
+def upload_file(suffix):
+    if     upload_config['file'  ].val is not None           \
+       and upload_config['output'].val ==     TermOrFile.FILE:
+        filename = upload_config['file'].val
+        if not filename.endswith('.%s' % suffix):
+            filename += '.%s' % suffix
+        return (filename, safe_open(filename                        ,
+                                    " for saving captured data"     ,
+                                    'wb' if suffix == 'bin' else 'w'))
+    else:
+        return (None, None)
+
+
+
+def native_exporter():
+    # path to "dump exporter=" program, or None if not set or not found
+    name = upload_config['exporter'].val
+    if not name:
+        return None
+    local = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                         'host'                                     ,
+                         name                                       )
+    if os.path.isfile(local) and os.access(local, os.X_OK):
+        return local
+    return shutil.which(name)
+
+def run_exporter(args, samples):
+    # pipe raw sample words (list or generator) to "dump exporter=" program
+    # returns (samples, edges, timval) from its summary line, None if failed
+    try:
+        process = subprocess.Popen(args                   ,
+                                   stdin =subprocess.PIPE ,
+                                   stderr=subprocess.PIPE )
+    except Exception as error:
+        sys.stderr.write("Can't run exporter %s: %s\n" % (args[0], error))
+        return None
+    chunk = []
+    try:
+        for data in samples:
+            chunk.append(data)
+            if len(chunk) == 4096:
+                process.stdin.write(struct.pack('<4096I', *chunk))
+                chunk = []
+        process.stdin.write(struct.pack('<%dI' % len(chunk), *chunk))
+        process.stdin.close()
+    except BrokenPipeError:
+        pass    # exporter failed, error message below
+    errors = process.stderr.read().decode(errors='replace')
+    if process.wait() != 0:
+        sys.stderr.write(  "Exporter %s failed:\n%s"
+                         % (args[0], errors)         )
+        return None
+    for line in errors.splitlines():
+        fields = line.split()
+        if fields and fields[0] == 'samples':
+            return (int(fields[1]), int(fields[3]), float(fields[5]))
+        sys.stderr.write("%s\n" % line)
+    return None
+
+def export_digital(exporter    ,
+                   samples     ,
+                   save_as     ,
+                   active_ndxs ,
+                   active_chans,
+                   file        ,
+                   filename    ):
+    # returns timval as upload_digital() would compute, None if failed
+    file.close()    # exporter rewrites
+    frmt = [key for (key, val) in DigitalFormat.strings_and_values.items()
+                if  val == save_as                                       ][0]
+    args = [exporter                                                  ,
+            'digital'                                                 ,
+            '-f', frmt                                                ,
+            '-c', repr(CPU_HZ)                                        ,
+            '-t', str(upload_config['per-tick'].val)                  ,
+            '-u', '%s:%r' % (upload_config['tick-units'].str(),
+                             upload_config['tick-units'].val  )       ,
+            '-o', filename                                            ,
+            '-s'                                                      ]
+    if     save_as == DigitalFormat.VCD                       \
+       and upload_config['viewer-vcd'].val == Viewer.PULSEVIEW:
+        args.append('-p')
+    for (ndx, chan) in zip(active_ndxs, active_chans):
+        args += ['-a', '%d:%s' % (ndx, channels_config[str(chan)].val)]
+    summary = run_exporter(args, samples)
+    return None if summary is None else summary[2]
+
+def stream_samples(begin_time):
+    # generator for upload_digital(), yields "logic mode=stream" samples
+    #   as received from firmware until STREAM_END packet
+    # <ENTER> or "logic edges=" limit halts firmware, which then sends
+    #   remaining samples and STREAM_END
+    halted = False
+    def read_exact(size):   # tty reads can return partial USB packets
+        nonlocal halted
+        data = b''
+        while len(data) < size:
+            chunk = wait_read(size - len(data), 2.0 if halted else None, False)
+            if chunk is WAIT_READ_STDIN:
+                if not halted:
+                    cmnd_cmd(HALT_CMD)
+                    halted = True
+                continue
+            if not chunk:
+                return None
+            data += chunk
+        return data
+
+    edges = digital_config['edges']
+    limit = None if edges.is_special() else edges.val
+    count = 0
+    while True:
+        header = read_exact(4)
+        if header is None:
+            sys.stderr.write(  "Stream from firmware failed after %d samples\n"
+                             % count                                          )
+            return
+        (kind, num_or_halt, triggered) = struct.unpack('<BBH', header)
+        if kind == STREAM_END:
+            # total samples, edges during firmware USB sends (stalls)
+            totals = read_exact(8)
+            (total, merged) = struct.unpack('<II', totals) if totals \
+                              else (count, 0)
+            Pager()(  "\n%s: %d samples (%s) in %.2f seconds. Stopped by %s.\n"
+                    % (triggered_at(triggered)                   ,
+                       total                                     ,
+                       sampling_mode_inverse(SamplingMode.STREAM),
+                       time.time() - begin_time                  ,
+                       halt_name(num_or_halt)                    )          ,
+                    immed=True, one_line=True                               )
+            if merged:
+                Pager(stream=sys.stderr)(
+                      "Warning: at least %d edges recorded late, merged, or "
+                      "lost while firmware sampling was stalled sending to "
+                      "host "
+                      "(edge rate too high for \"mode=stream\")"
+                    % merged                                          ,
+                    immed=True                                        )
+            return
+        if kind != STREAM_SAMPLES:
+            sys.stderr.write(  "Bad stream packet type %d after %d samples\n"
+                             % (kind, count)                                 )
+            cmnd_cmd(HALT_CMD)
+            flush_read(2.0)
+            return
+        words = read_exact(4 * num_or_halt)
+        if words is None:
+            sys.stderr.write(  "Stream from firmware failed after %d samples\n"
+                             % count                                          )
+            return
+        for sample in struct.unpack('<%dI' % num_or_halt, words):
+            if limit is None or count < limit:
+                yield sample
+            count += 1
+        if limit is not None and count >= limit and not halted:
+            cmnd_cmd(HALT_CMD)
+            halted = True
+
+def unpack_samples(words):
+    # decode "logic mode=packed" to standard 32-bit samples, see
+    #   "SamplingMode::PACKED" in buck50_asm.s
+    # first two words (trigger and sampling start) are standard samples,
+    #   rest are 16-bit:
+    #       bbbbbbbb dddddddd   bits, 1...255 ticks since previous sample
+    #   or
+    #       bbbbbbbb 00000000   bits, escape
+    #       ssssssss ssssssss   systick 15:0
+    #       00000000 ssssssss   systick 23:16
+    samples = list(words[:2])
+    if not samples:
+        return samples
+    halves = []
+    for word in words[2:]:
+        halves.append(word &  0xffff)
+        halves.append(word >> 16    )
+    tick = samples[-1] & 0xffffff
+    ndx  = 0
+    while ndx < len(halves):
+        bits  = halves[ndx] >> 8
+        delta = halves[ndx] &  0xff
+        if delta:
+            tick  = (tick - delta) & 0xffffff   # systick counts down
+            ndx  += 1
+        else:
+            if ndx + 2 >= len(halves):
+                break   # escape truncated by sampling halt
+            tick  = halves[ndx + 1] | (halves[ndx + 2] & 0xff) << 16
+            ndx  += 3
+        samples.append(tick | bits << 24)
+    return samples
+
 def upload_digital_header(first, count, total, max_memory, mode, legend=True):
-    sys.stdout.write(  "logic samples: %d...%d of %d (max %d) @ %s"
-                     % (first                      ,
-                        first + count - 1          ,
-                        total                      ,
-                        max_memory                 ,
-                        sampling_mode_inverse(mode))      )
+    if count is None:   # "logic mode=stream", number not known until end
+        sys.stdout.write(  "logic samples: streaming @ %s"
+                         % sampling_mode_inverse(mode)      )
+    else:
+        sys.stdout.write(  "logic samples: %d...%d of %d (max %d) @ %s"
+                         % (first                      ,
+                            first + count - 1          ,
+                            total                      ,
+                            max_memory                 ,
+                            sampling_mode_inverse(mode))      )
     if legend:
         names_width = len(channel_bits(0)) -1    # has trailing space
         sys.stdout.write(  "\nindex                PB11 ... PB4  %s"
@@ -4067,10 +4534,11 @@ def upload_digital(samples   ,
                    save_as   ,
                    file      ,
                    filename  ):
+    exporter = native_exporter() if file else None
     if file:
         active_chans = upload_config['actives'].val
         active_ndxs  = [chan - 4 for chan in active_chans]  # chans are 4...11
-        if save_as == DigitalFormat.VCD:
+        if save_as == DigitalFormat.VCD and not exporter:
             file.write(  "$timescale %d %s $end\n"
                        % (upload_config['per-tick'  ].val  ,
                           upload_config['tick-units'].str()))
@@ -4083,11 +4551,13 @@ def upload_digital(samples   ,
             file.write("$upscope $end\n"       )
             file.write("$enddefinitions $end\n")
             pulseview_warning = False
-        if save_as == DigitalFormat.CSV:
+        if save_as == DigitalFormat.CSV and not exporter:
             file.write('time')
             for chan in active_chans:
                 file.write(",%s" % channels_config[str(chan)].val)
             file.write('\n')
+        if save_as == DigitalFormat.BIN and not exporter:
+            file.write(BIN_MAGIC + struct.pack('<d', CPU_HZ))
         upload_digital_header(first       ,
                               count       ,
                               total       ,
@@ -4100,12 +4570,24 @@ def upload_digital(samples   ,
         linenumber  = 0
         upload_digital_header(first, count, total, max_memory, mode)
 
-    prev = None
-    tick = 0
-    tcks = 0
-    last = 0x00
-    for ndx in range(count):
-        data = samples[ndx]
+    prev   = None
+    tick   = 0
+    tcks   = 0
+    last   = 0x00
+    bits   = 0x00   # in case zero streamed samples
+    timval = 0
+    if exporter:
+        timval = export_digital(exporter    ,
+                                samples     ,
+                                save_as     ,
+                                active_ndxs ,
+                                active_chans,
+                                file        ,
+                                filename    )
+        if timval is None:
+            return
+        samples = ()    # already written, skip per-sample Python
+    for (ndx, data) in enumerate(samples):  # list, or stream_samples()
         tick = data  & 0xffffff
         bits = data >> 24
         if prev is None:
@@ -4138,6 +4620,8 @@ def upload_digital(samples   ,
                     else:
                         file.write(",0")
                 file.write('\n')
+            elif save_as == DigitalFormat.BIN:
+                file.write(struct.pack('<Q', tcks << 8 | bits))
         else:
             sys.stdout.write(  "%5d  %02x  %s  %8d  %s\n"
                              % (ndx + first               ,
@@ -4146,7 +4630,8 @@ def upload_digital(samples   ,
                                 delt                      ,
                                 TimeVal.str(delt / CPU_HZ))  )
             linenumber += 1
-            if linenumber >= term_size - 4:
+            # can't pause stream (count is None), firmware would overrun
+            if count is not None and linenumber >= term_size - 4:
                 sys.stdout.write("<ENTER> to continue, "
                                  "any letter+<ENTER> to abort):  ")
                 sys.stdout.flush()
@@ -4157,7 +4642,8 @@ def upload_digital(samples   ,
 
     if file:
         if     save_as == DigitalFormat.VCD                       \
-           and upload_config['viewer-vcd'].val == Viewer.PULSEVIEW:
+           and upload_config['viewer-vcd'].val == Viewer.PULSEVIEW \
+           and not exporter                                       :
             # PulseView doesn't show last edge transition, so
             #   generate fake duplicate of last bits
             timval += 2.0   # make sure doesn't round to same as previous
@@ -4171,6 +4657,9 @@ def upload_digital(samples   ,
         if not upload_config['auto-digital'].val:
             return
 
+        if save_as == DigitalFormat.BIN:
+            return  # no viewer
+
         if upload_config['digital-frmt'].val == DigitalFormat.CSV:
             if upload_config['viewer-csv'].val == Viewer.GNUPLOT:
                 commandline  = "gnuplot -e 'set object 1 rectangle from "
@@ -4262,8 +4751,9 @@ def upload_analog(samples     ,
                   max_memory  ,
                   num_channels,
                   channel_ndxs,
-                  sample_rate,
+                  sample_rate ,
                   num_samples ,
+                  analog_mode ,
                   save_as     ,
                   file        ,
                   filename    ):
@@ -4282,6 +4772,17 @@ def upload_analog(samples     ,
         AdcSampHold.T_239_5 : (239.5 + 12.5) / ADCCLK_HZ,
     }
 
+    # "decimate=min-max": one trigger channel min,max pair per word,
+    #   printed/saved as two channels
+    # "adc-mode=interleaved": ADC2 sample in high halfword precedes ADC1's
+    #   (decimated values are always in time order)
+    decimate = analog_mode & Decimate.MASK
+    minmax   = num_channels == 1 and decimate == Decimate.MINMAX
+    columns  = 2 if num_channels == 2 or minmax else 1  # per word
+    swapped  =     num_channels == 1                   \
+               and analog_mode & AdcMode.INTERLEAVED   \
+               and decimate == Decimate.NONE
+
     trig_chan_name = adc_configs[channel_ndxs & 0x0f]['name'].val
     if num_channels == 1:
         scnd_chan_name = ''
@@ -4290,14 +4791,14 @@ def upload_analog(samples     ,
 
     Pager()(   "Samples %d...%d of %d (max %d)  "
               "%d channel%s (%s%s) per sample "
-              "at %s%s\n"
-            % ( first          * (3 - num_channels)            ,  # (1,2)->(2,1)
-               (first + count) * (3 - num_channels) - 1        ,  # (1,2)->(2,1)
+              "at %s%s%s\n"
+            % ( first          * (3 - columns)                 ,  # (1,2)->(2,1)
+               (first + count) * (3 - columns) - 1             ,  # (1,2)->(2,1)
                     num_samples
-               if   num_channels == 2
+               if   columns == 2
                else num_samples * 2                            ,
                     max_memory
-               if   num_channels == 2
+               if   columns == 2
                else max_memory * 2                             ,
                num_channels                                    ,
                '' if num_channels == 1 else 's'                ,
@@ -4306,6 +4807,9 @@ def upload_analog(samples     ,
                     AdcSampHold(sample_rate)
                if   sample_rate <= AdcSampHold.T_239_5
                else '???'                                      ,
+                    analog_mode_str(analog_mode)
+               if   num_channels == 1
+               else ''                                         ,
                     " ... saving to file %s\n" % filename
                if   file
                else ''                                         ),
@@ -4314,6 +4818,10 @@ def upload_analog(samples     ,
     if sample_rate  > AdcSampHold.T_239_5:  # safety check
         sample_rate = AdcSampHold.T_239_5
     tick = SAMPLE_MICROSECONDS[sample_rate] * analog_config['time-scale']
+    if num_channels == 1 and analog_mode & AdcMode.INTERLEAVED:
+        tick /= 2   # ADC2 7 ADC clocks, half of 1.5+12.5, before ADC1
+    if num_channels == 1 and decimate != Decimate.NONE:
+        tick *= 1 << (analog_mode & Decimate.FACTOR_MASK)
 
     trig_chan   = channel_ndxs  & 0xf
     scnd_chan   = channel_ndxs >>   4 if (channel_ndxs >> 4) < 8 else 0
@@ -4325,7 +4833,16 @@ def upload_analog(samples     ,
     trgr_ranger =       trgr_adc['scale-hyst'].ranged
     scnd_ranger =       scnd_adc['scale-hyst'].ranged
 
-    if num_channels == 1:
+    if minmax:
+        scnd_chan_name = trig_chan_name + '-max'
+        trig_chan_name = trig_chan_name + '-min'
+        scnd_adc       = trgr_adc
+        scnd_printf    = trgr_printf
+        scnd_ranger    = trgr_ranger
+
+    exporter = native_exporter() if file else None
+
+    if columns == 1:
         printf =   "%%4d   %s    %s %s\n%%4d   %s    %s %s\n"   \
                  % (time_printf   ,
                     trig_chan_name,
@@ -4333,7 +4850,7 @@ def upload_analog(samples     ,
                     time_printf   ,
                     trig_chan_name,
                     trgr_printf   )
-        if file:
+        if file and not exporter:
             file.write("time,%s\n" % trig_chan_name)
     else: # two channels
         printf =   "%%4d   %s    %s %s   %s %s\n"   \
@@ -4342,9 +4859,29 @@ def upload_analog(samples     ,
                     trgr_printf   ,
                     scnd_chan_name,
                     scnd_printf   )
-        if file:
+        if file and not exporter:
             file.write("time,%s,%s\n" % (trig_chan_name, scnd_chan_name))
 
+    if exporter:
+        file.close()    # exporter rewrites
+        args = [exporter                                               ,
+                'analog'                                               ,
+                '-n', str(columns)                                     ,
+                '-T', repr(tick)                                       ,
+                '-F', str(first)                                       ,
+                '-r', '%s:%r:%r' % ((trig_chan_name,)
+                                    + trgr_adc['scale-hyst'].val[:2])  ,
+                '-o', filename                                         ,
+                '-s'                                                   ]
+        if columns == 2:
+            args += ['-r', '%s:%r:%r' % ((scnd_chan_name,)
+                                         + scnd_adc['scale-hyst'].val[:2])]
+        if swapped:
+            args += ['-S']
+        if run_exporter(args, samples[:count]) is None:
+            return
+        count = 0   # already written, skip per-sample Python
+
     if not file:
         term_size   = shutil.get_terminal_size().lines
         extra_lines = 2
@@ -4353,8 +4890,10 @@ def upload_analog(samples     ,
     for ndx in range(count):
         sample_1 = samples[ndx]  & 0xffff
         sample_2 = samples[ndx] >>     16
+        if swapped:
+            (sample_1, sample_2) = (sample_2, sample_1)
         ranged_1 = trgr_ranger(sample_1)
-        if num_channels == 1:
+        if columns == 1:
             num      = (first + ndx) * 2
             ranged_2 = trgr_ranger(sample_2)
             text     = printf % ( num            ,
@@ -4371,7 +4910,7 @@ def upload_analog(samples     ,
                                  ranged_1  ,
                                  ranged_2  )
         if file:
-            if num_channels == 1:
+            if columns == 1:
                 file.write("%g,%g\n%g,%g\n" % ( num * tick     ,
                                                 ranged_1       ,
                                                (num + 1) * tick,
@@ -4408,7 +4947,7 @@ def upload_analog(samples     ,
             commandline +=   "using 1:2 with linespoints "  \
                              "linetype rgb \"yellow\" %s, " \
                            % linestyle
-            if num_channels == 2:
+            if columns == 2:
                 commandline +=   "\"\" using 1:3 with linespoints "     \
                                  "linetype rgb \"orange\" %s ; "        \
                                % linestyle
@@ -4947,6 +5486,37 @@ Similarly, "connect" with or without new "usb=/dev/<...>" for error or to connec
 
 
 
+def inst_cmd(cmd, input, fields):
+    if not firmware_has('"instrument"'):
+        return
+    if not config('instrument', 'instrument', fields):
+        return
+    if not [field for field in fields if '=' not in field]:
+        instrument_report()
+inst_cmd.__help = """
+Firmware instrumentation: low-overhead counters and histograms of
+main-clock (72 MHz) cycles from Cortex-M3 DWT CYCCNT, for diagnosing
+sampling jitter, dropped edges, and USB stalls. Off by default; when
+disabled each firmware hook is a single flag test.
+  - "enable" clears and starts counting, "disable" stops (values kept)
+  - "report" (or no action) prints:
+      - USB IN packets and bytes sent to host, USB OUT bytes received
+      - "sample bytes": "logic" capture memory used (not "mode=stream")
+      - "loop period": "monitor", "gpio", "usart", "spi", "i2c", and
+        rate-limited "numbers" per-iteration times (jitter)
+      - "edge spacing": time between successive captured "logic" changes,
+        from samples' timestamps (sampling loops themselves are not
+        instrumented); minimum near loop period means closer edges merged.
+        "mode=stream" measured from each sent packet, lengthening the
+        sampling stalls while sending
+      - "USB send wait": times firmware waited for host to accept data
+      - "USB receive wait": times firmware waited for rest of a
+        partially-received host command (host behind)
+  - "cycles since enable" wraps after approx. 59.6 seconds
+"""
+
+
+
 def quit_cmd(cmd, input, fields):
     "Exit program"
     sys.exit(0)
@@ -5349,6 +5919,14 @@ def dgtl_cmd(cmd, input, fields):
             return
     max_trig = max([ndx for ndx in triggers_config])
 
+    if    digital_config['mode'].val in (SamplingMode.STREAM,
+                                         SamplingMode.PACKED)  \
+       and not firmware_has('"logic mode=%s"' % digital_config['mode']):
+        return
+    if     digital_config['trig-code'].val == TrigCode.COMPILED \
+       and not firmware_has('"logic trig-code=compiled"'):
+        return
+
     if digital_config['duration'].enabled():
         duration    = digital_config['duration'].val
         dur_enabled = True
@@ -5356,16 +5934,17 @@ def dgtl_cmd(cmd, input, fields):
         duration    = 0
         dur_enabled = False
 
-    buffer = struct.pack("< 6B 3H"                     ,
-                         DGTL_CMD                      ,
-                         digital_config['mode'    ].val,
-                         max_trig + 1                  ,
-                           reset_config['ganged'  ].val,
-                         dur_enabled                   ,
-                         digital_config['code-mem'].val,
-                         duration                      ,
-                         digital_config['edges'   ].val,
-                         0                             )  # 32-bit alignment
+    buffer = struct.pack("< 6B 2H 2B"                   ,
+                         DGTL_CMD                       ,
+                         digital_config['mode'     ].val,
+                         max_trig + 1                   ,
+                           reset_config['ganged'   ].val,
+                         dur_enabled                    ,
+                         digital_config['code-mem' ].val,
+                         duration                       ,
+                         digital_config['edges'    ].val,
+                         digital_config['trig-code'].val,
+                         0                              )  # 32-bit alignment
 
     bufndx  = len(buffer)
 
@@ -5381,6 +5960,22 @@ def dgtl_cmd(cmd, input, fields):
             buffer = b''
             bufndx = 0
 
+    if digital_config['mode'].val == SamplingMode.STREAM:
+        # samples go directly to "dump" output, nothing left to upload
+        sys.stdout.write("Streaming samples (<ENTER> to halt) ...\n")
+        begin_time       = time.time()
+        (filename, file) = upload_file(upload_config['digital-frmt'].str())
+        upload_digital(stream_samples(begin_time)        ,
+                       0                                 ,
+                       None                              ,
+                       None                              ,
+                       None                              ,
+                       SamplingMode.STREAM               ,
+                       upload_config['digital-frmt'].val,
+                       file                              ,
+                       filename                          )
+        return
+
     sys.stdout.write("Waiting for sampling finish (<ENTER> to abort) ...  ")
     sys.stdout.flush()
     begin_time = time.time()
@@ -5417,7 +6012,7 @@ Digital logic analyzer.
   . duration elapsed ("logic duration=")
   . number of samples ("logic edges=") (incl. extra samples @ 233ms)
   . memory full
-- see "help logic mode" for sampling speed
+- see "help logic mode" for sampling speed, and "mode=stream" for unlimited captures sent to "dump" output during sampling
 - see "help trigger" for triggering
 - see "help reset ganged=" and "help reset ext-trig" for external triggering and multiple device synchronization
 - on-board user LED off at start of triggering, back on when sampling finished
@@ -5427,9 +6022,52 @@ Digital logic analyzer.
 
 
 
+def check_oscope():
+    dual    = not analog_config['scnd-chnl'].is_special()
+    intrlvd = analog_config['adc-mode'].val == AdcMode .INTERLEAVED
+    decim   = analog_config['decimate'].val != Decimate.NONE
+    if dual and (intrlvd or decim):
+        Pager(stream=sys.stderr)(  "Error: \"%s\" not possible with "
+                                   "\"scnd-chnl=%s\" (use \"none\")."
+                                 % (   "adc-mode=interleaved"
+                                    if intrlvd
+                                    else   "decimate=%s"
+                                         % analog_config['decimate'],
+                                    analog_config['scnd-chnl']      ),
+                                 immed=True, one_line=True, indent=7  )
+        return False
+    if     intrlvd \
+       and analog_config['s/h+adc'].val != AdcSampHold.T_1_5:
+        fastest = AdcSampHold(AdcSampHold.T_1_5)
+        if r_u_sure(  "\"adc-mode=interleaved\" requires "
+                      "\"s/h+adc=%s\". Use it instead of \"%s\"?"
+                    % (fastest, analog_config['s/h+adc'])         ):
+            analog_config['s/h+adc'].val = AdcSampHold.T_1_5
+        else:
+            sys.stdout.write("Aborting command\n")
+            return False
+    return True
+
+
+
+def analog_mode_str(analog_mode):
+    decimate = analog_mode & Decimate.MASK
+    text     = ''
+    if analog_mode & AdcMode.INTERLEAVED:
+        text += " interleaved"
+    if decimate != Decimate.NONE:
+        text +=   " %s of %d"                                          \
+                % (Decimate(decimate)                                ,
+                   1 << (analog_mode & Decimate.FACTOR_MASK)         )
+    return text
+
+
+
 def anlg_cmd(cmd, input, fields):
     if not config('oscope', 'oscope', fields):
         return
+    if not check_oscope():
+        return
 
     trgr_chnl  = analog_config['trgr-chnl' ].val
     scnd_chnl  = analog_config['scnd-chnl' ].val
@@ -5485,12 +6123,20 @@ def anlg_cmd(cmd, input, fields):
         else:
             return
 
+    analog_mode = analog_config['adc-mode'].val | analog_config['decimate'].val
+    if analog_config['decimate'].val != Decimate.NONE:
+        analog_mode |= analog_config['dec-factor'].log2()
+    if analog_mode and not firmware_has('"oscope adc-mode=interleaved|'
+                                        'decimate="'                     ):
+        return
+
     num_samples = analog_config['samples'].val
-    if analog_config['scnd-chnl'].is_special():
+    if     analog_config['scnd-chnl'].is_special()            \
+       and analog_config['decimate' ].val != Decimate.MINMAX:
         # no second channel, firmware stores two samples in one word
         num_samples //= 2
 
-    buffer = struct.pack("< 6B 3H"                   ,
+    buffer = struct.pack("< 6B 3H 4B"                ,
                          ANLG_CMD                    ,
                          trgr_chnl                   ,
                          scnd_chnl                   ,
@@ -5499,7 +6145,11 @@ def anlg_cmd(cmd, input, fields):
                           reset_config['ganged' ].val, # 16 bit alignment
                          num_samples                 ,
                          level_lo                    ,
-                         level_hi                    )
+                         level_hi                    ,
+                         analog_mode                 ,
+                         0, 0, 0                     ) # 32 bit alignment
+    if old_firmware():
+        buffer = buffer[:-4]   # no analog_mode
     os.write(usb_fd, buffer)
 
     sys.stdout.write("Waiting for sampling finish (<ENTER> to abort) ...  ")
@@ -5527,12 +6177,15 @@ def anlg_cmd(cmd, input, fields):
     if num_channels == 2:
         scnd_chan_name = ',' + adc_configs[channel_ndxs >>    4]['name'].val
         multiplier     = 1
+    elif analog_config['decimate'].val == Decimate.MINMAX:
+        scnd_chan_name = ''
+        multiplier     = 1  # one min/max pair per word
     else:
         scnd_chan_name = ''
         multiplier     = 2
 
     Pager()(  "%d samples, %d channel%s (%s%s) "
-              "at %s in %.2fs wall clock time. "
+              "at %s%s in %.2fs wall clock time. "
               "%s. Stopped by %s.\n"
             % (num_samples * multiplier               ,
                num_channels                           ,
@@ -5542,6 +6195,9 @@ def anlg_cmd(cmd, input, fields):
                     AdcSampHold(sample_rate)
                if   sample_rate <= AdcSampHold.T_239_5
                else '???'                             ,
+                  analog_mode_str(analog_mode)
+               if num_channels == 1
+               else ''                                ,
                time.time() - begin_time               ,
                triggered_at(triggered)                ,
                halt_name(halt_code)                   ),
@@ -5562,6 +6218,8 @@ Primitive DSO (digital storage oscilloscope)
   . trigger when signal falls below level after first rising above level plus hysteresis if "slope=negative"
   . use "slope=disabled" to trigger immediately without regard to level
 - samples recorded continuously at rate specified by "s/h+adc="
+  . "adc-mode=interleaved" doubles single channel rate, see "help oscope adc-mode="
+  . "decimate=" stores only min/max or average of each "dec-factor=" samples, for longer captures in same memory
 - sampling continues number specified by "samples=" parameter
   . triggering and/or sampling interruptible via <ENTER> key
 - on-board user LED off, and output port PB13 toggles at c. 4 Hz, during triggering and sampling
@@ -5575,11 +6233,14 @@ def upld_cmd(cmd, input, fields):
         return
     first = upload_config['begin'].val
     count = upload_config['count'].val
+    # firmware ignores first/count if "logic mode=packed", sends all
     os.write(usb_fd, struct.pack('<2B2H2B', UPLD_CMD, 0, first, count, 0, 0))
 
-    samples_header = wait_read(14)
+    samples_header = wait_read(14 if old_firmware() else 16)
     if samples_header is None or samples_header is WAIT_READ_STDIN:
         return  # wait_read() or size_read() printed error
+    if old_firmware():
+        samples_header += bytes(2)  # analog_mode 0, no decimation
     (first        ,
      count        ,
      num_samples  ,
@@ -5588,7 +6249,9 @@ def upld_cmd(cmd, input, fields):
      num_adc_chans,
      adc_chan_ndxs,
      adc_samp_rate,
-     num_adc_smpls) = struct.unpack("< 4H 4B H", samples_header)
+     num_adc_smpls,
+     analog_mode  ,
+     _            ) = struct.unpack("< 4H 4B H 2B", samples_header)
 
     if     count == 0                                                  \
        or (sampling_mode == SamplingMode.ANALOG and num_adc_smpls == 0):
@@ -5610,6 +6273,19 @@ def upld_cmd(cmd, input, fields):
             return
         samples[ndx] = struct.unpack('I', sample)[0]
 
+    if sampling_mode == SamplingMode.PACKED:
+        samples     = unpack_samples(samples)
+        num_samples = len(samples)
+        max_memory *= 2     # approximate, depends on edge timing
+        first       = min(upload_config['begin'].val, num_samples        )
+        count       = min(upload_config['count'].val, num_samples - first)
+        samples     = samples[first:first + count]
+        if count == 0:
+            Pager()(  "Zero samples uploaded (of %d decoded samples)"
+                    % num_samples                                    ,
+                    immed=True, one_line=True                        )
+            return
+
     if sampling_mode == SamplingMode.ANALOG:
         save_as = upload_config['analog-frmt' ].val
         suffix  = upload_config['analog-frmt' ].str()
@@ -5617,15 +6293,7 @@ def upld_cmd(cmd, input, fields):
         save_as = upload_config['digital-frmt'].val
         suffix  = upload_config['digital-frmt'].str()
 
-    if     upload_config['file'  ].val is not None           \
-       and upload_config['output'].val ==     TermOrFile.FILE:
-        filename = upload_config['file'].val
-        if not filename.endswith('.%s' % suffix):
-            filename += '.%s' % suffix
-        file = safe_open(filename, " for saving captured data", 'w')
-    else:
-        filename = None
-        file     = None
+    (filename, file) = upload_file(suffix)
 
     if sampling_mode == SamplingMode.ANALOG:
         upload_analog (samples      ,
@@ -5636,6 +6304,7 @@ def upld_cmd(cmd, input, fields):
                        adc_chan_ndxs,
                        adc_samp_rate,
                        num_adc_smpls,
+                       analog_mode  ,
                        save_as      ,
                        file         ,
                        filename     )
@@ -5685,6 +6354,89 @@ Analog ("oscope") samples:
 
 
 
+def live_unbatched(num_adcs, end_time):
+    # one set of packets per monitored change, yields same as live_batched()
+    while time.time() < end_time:
+        # always get 8 bytes timestamp plus one 32-bit word digital value
+        monitored = wait_read(12, end_time - time.time())
+        if monitored in (WAIT_READ_STDIN, None): return
+
+        timestamp = struct.unpack('<Q', monitored[0:8])[0]
+
+        # always sent, even if not enapled
+        digital = struct.unpack('<I', monitored[8:12])[0]
+
+        adcs = []
+        for ndx in range(num_adcs):
+            monitored = wait_read(4, end_time - time.time())
+            if monitored in (WAIT_READ_STDIN, None): return
+            adcs.append(struct.unpack('<HBB', monitored))
+
+        usart = spi = i2c = None
+
+        if usart_config['active'].val:
+            monitored = wait_read(usart_config['rx-len'].val + 2,
+                                  end_time - time.time()        )
+            if monitored in (WAIT_READ_STDIN, None): return
+            usart = (monitored[1], monitored[2:])
+
+        if spi_config['mode'].val[0]:
+            monitored = wait_read(len(spi_config['tx-data'].val) + 2,
+                                  end_time - time.time()            )
+            if monitored in (WAIT_READ_STDIN, None): return
+            spi = (monitored[1], monitored[2:])
+
+        if i2c_config['mode'].val[0]:
+            monitored = wait_read(i2c_config['rx-size'].val + 3,
+                                  end_time - time.time()       )
+            if monitored in (WAIT_READ_STDIN, None): return
+            i2c = (monitored[0], monitored[1], monitored[3:])
+
+        yield (timestamp, digital, adcs, usart, spi, i2c, 0)
+
+def live_batched(adc_chans, batch_len, end_time):
+    # "monitor batch=": decode firmware live() LiveBatch packets
+    usart_len = usart_config['rx-len' ].val
+    spi_len   = len(spi_config['tx-data'].val)
+    i2c_len   = i2c_config['rx-size'].val
+    # host decoding may lag firmware, keep reading until it stops sending
+    while True:
+        header = wait_read(LIVE_BATCH_HEADER                            ,
+                           max(end_time - time.time(), 0.0) + LIVE_BATCH_IDLE,
+                           error=False                                  )
+        if header in (WAIT_READ_STDIN, None) or len(header) != LIVE_BATCH_HEADER:
+            return
+        (count, dropped, time_lo, time_hi) = struct.unpack('<BBHI', header)
+        timestamp = time_lo | time_hi << 16
+        if count == 0:  # firmware reporting drops after last records
+            if dropped:
+                yield (timestamp, None, [], None, None, None, dropped)
+            continue
+        batch = wait_read(count * batch_len, 1.0)   # rest of same packet
+        if batch in (WAIT_READ_STDIN, None): return
+        for offset in range(0, count * batch_len, batch_len):
+            (delta, digital) = struct.unpack('<HB', batch[offset:offset + 3])
+            timestamp += delta
+            offset    += 3
+            adcs = []
+            for chan in adc_chans:
+                adc     = struct.unpack('<H', batch[offset:offset + 2])[0]
+                offset += 2
+                adcs.append((adc & 0xfff, adc >> 12, chan))
+            usart = spi = i2c = None
+            if usart_config['active'].val:
+                usart   = (batch[offset], batch[offset + 1:offset + 1 + usart_len])
+                offset += 1 + usart_len
+            if spi_config['mode'].val[0]:
+                spi     = (batch[offset], batch[offset + 1:offset + 1 + spi_len])
+                offset += 1 + spi_len
+            if i2c_config['mode'].val[0]:
+                i2c     = (batch[offset]                               ,
+                           batch[offset + 1]                           ,
+                           batch[offset + 2:offset + 2 + i2c_len]      )
+            yield (timestamp, digital, adcs, usart, spi, i2c, dropped)
+            dropped = 0
+
 def live_cmd(cmd, input, fields):
     if not config('monitor', 'monitor', fields):
         return
@@ -5696,9 +6448,8 @@ def live_cmd(cmd, input, fields):
     else:
         file = None
 
-    if live_config['output'].val & TermFileBoth.TERM:
-        term_size  = shutil.get_terminal_size().lines
-        linenumber = 0
+    term_size  = shutil.get_terminal_size().lines
+    linenumber = 0
 
     # must call check_usart() before st_usart_settings(), below
     if   spi_config['mode'  ].str() != 'disabled' and not check_spi  (): return
@@ -5711,22 +6462,46 @@ def live_cmd(cmd, input, fields):
 
     num_adcs    = 0
     active_adcs = 0
+    adc_chans   = []
     for (ndx, adc) in enumerate(adc_configs):
         if adc['active'].val:
             active_adcs |= 1 << ndx
             num_adcs    += 1
-
-    os.write(usb_fd,
-             struct.pack('<8BQQ'                          ,
-                         LIVE_CMD                         ,
-                          live_config['pb4-11'    ].val   ,
-                         usart_config['active'    ].val   ,
-                           spi_config['mode'      ].val[0],   # on/off
-                           i2c_config['mode'      ].val[0],   # on/off
-                           active_adcs                    ,   # bit flags
-                         0, 0                             ,   # align 64 bits
-                          duration                        ,   # 64 bits
-                          live_config['rate'      ].val   ))  # 64 bits
+            adc_chans.append(ndx)
+
+    # as firmware live()
+    batch_len =   3                                                     \
+                + 2 * num_adcs                                          \
+                + (1 + usart_config['rx-len' ].val      if usart_config
+                                                           ['active'].val
+                                                        else 0)         \
+                + (1 + len(spi_config['tx-data'].val)   if spi_config
+                                                           ['mode'].val[0]
+                                                        else 0)         \
+                + (2 + i2c_config['rx-size'].val        if i2c_config
+                                                           ['mode'].val[0]
+                                                        else 0)
+    batch_window = live_config['batch'].val
+    if batch_window and batch_len > LIVE_BATCH_MAX_RECORD:
+        sys.stdout.write(  "Monitored data record too long (%d bytes, max "
+                           "%d) for \"batch=\", ignoring\n"
+                         % (batch_len, LIVE_BATCH_MAX_RECORD)              )
+        batch_window = 0
+    if batch_window and not firmware_has('"monitor batch="'):
+        batch_window = 0
+
+    live = struct.pack('<8BQQI'                         ,
+                       LIVE_CMD                         ,
+                        live_config['pb4-11'    ].val   ,
+                       usart_config['active'    ].val   ,
+                         spi_config['mode'      ].val[0],   # on/off
+                         i2c_config['mode'      ].val[0],   # on/off
+                         active_adcs                    ,   # bit flags
+                       0, 0                             ,   # align 64 bits
+                        duration                        ,   # 64 bits
+                        live_config['rate'      ].val   ,   # 64 bits
+                        batch_window                    )   # 32 bits
+    os.write(usb_fd, live[:-4] if old_firmware() else live)
 
     if usart_config['active'].val:
         (datalen, parity) = st_usart_settings()  # never None, did check_usart()
@@ -5819,22 +6594,33 @@ def live_cmd(cmd, input, fields):
 
     time_printf = live_config['printf'].val
 
-    while time.time() < end_time:
-        # always get 8 bytes timestamp plus one 32-bit word digital value
-        monitored = wait_read(12, end_time - time.time())
-        if monitored in (WAIT_READ_STDIN, None): break
+    def live_output(text, file):
+        nonlocal linenumber
+        if file:
+            file.write("%s\n" % text)
+        if live_config['output'].val & TermFileBoth.TERM:
+            sys.stdout.write('%s\n' % text)
+            linenumber += 1
+            if linenumber >= term_size - 1:
+                sys.stdout.write("(<ENTER> to halt)\n")
+                linenumber = 0
 
-        timestamp = struct.unpack('<Q', monitored[0:8])[0]
-        text      = time_printf % (timestamp / CPU_HZ)
+    if batch_window:
+        records = live_batched(adc_chans, batch_len, end_time)
+    else:
+        records = live_unbatched(num_adcs, end_time)
+    total_dropped = 0
 
-        # always sent, even if not enapled
-        digital = struct.unpack('<I', monitored[8:12])[0]
+    for (timestamp, digital, adcs, usart, spi, i2c, dropped) in records:
+        text = time_printf % (timestamp / CPU_HZ)
 
-        for ndx in range(num_adcs):
-            monitored = wait_read(4, end_time - time.time())
-            if monitored in (WAIT_READ_STDIN, None):
-                break
-            (adc_val, adc_stat, adc_chan) = struct.unpack('<HBB', monitored)
+        if dropped:
+            total_dropped += dropped
+            live_output("%s  (%d events dropped)" % (text, dropped), file)
+        if digital is None:
+            continue    # drops only
+
+        for (adc_val, adc_stat, adc_chan) in adcs:
             adc_printf =   "  %%s%s:%s"                     \
                          % (adc_configs[adc_chan]['name'  ].val,
                             adc_configs[adc_chan]['printf'].val)
@@ -5846,40 +6632,28 @@ def live_cmd(cmd, input, fields):
         if live_config['pb4-11'].val:
             text += "  %s" % channel_bits(digital)
 
-        if usart_config['active'].val:
-            monitored = wait_read(usart_config['rx-len'].val + 2,
-                                  end_time - time.time()        )
-            if monitored in (WAIT_READ_STDIN, None):
-                break
-            (usart_len, usart_stat) = struct.unpack('BB', monitored[:2])
+        if usart is not None:
+            (usart_stat, usart_data) = usart
             text += "  %su:" % periph_status(usart_stat)[0]
             if usart_config['ascii-num'].val == AsciiNumeric.ASCII:
-                text += ''.join([SAFE_ASCII[byte] for byte in monitored[2:]])
+                text += ''.join([SAFE_ASCII[byte] for byte in usart_data])
             else:
-                text += '.'.join(['%02x' % byte for byte in monitored[2:]])
+                text += '.'.join(['%02x' % byte for byte in usart_data])
 
-        if spi_config['mode'].val[0]:
-            monitored = wait_read(len(spi_config['tx-data'].val) + 2,
-                                  end_time - time.time()            )
-            if monitored in (WAIT_READ_STDIN, None):
-                break
-            (spi_len, spi_stat) = struct.unpack('BB', monitored[:2])
+        if spi is not None:
+            (spi_stat, spi_data) = spi
             text += "  %ss:" % periph_status(spi_stat)[0]
             if spi_config['ascii-num'].val == AsciiNumeric.NUMERIC:
-                text += '.'.join(['%02x' % byte for byte in monitored[2:]])
+                text += '.'.join(['%02x' % byte for byte in spi_data])
             else:
-                text += decode_escape(monitored[2:])
+                text += decode_escape(spi_data)
 
-        if i2c_config['mode'].val[0]:
-            monitored = wait_read(i2c_config['rx-size'].val + 3,
-                                  end_time - time.time()       )
-            if monitored in (WAIT_READ_STDIN, None):
-                break
-            (i2c_stat, i2c_addr, i2c_rcvd) = struct.unpack('BBB', monitored[:3])
+        if i2c is not None:
+            (i2c_stat, i2c_addr, i2c_data) = i2c
             if i2c_addr not in range(3): i2c_addr = 3  # sanity check
             text += "  %s%si:" % (periph_status(i2c_stat)[0],
                                   '012m'       [i2c_addr]   )
-            text += '.'.join(['%02x' % byte for byte in monitored[3:]])
+            text += '.'.join(['%02x' % byte for byte in i2c_data])
 
 
         if    ( live_config['pb4-11'].val    and digital != prev_digital) \
@@ -5887,15 +6661,7 @@ def live_cmd(cmd, input, fields):
            or (usart_config['active'].val    and not block_usart        ) \
            or (  spi_config['mode'  ].val[0] and not block_spi          ) \
            or (  i2c_config['mode'  ].val[0] and not block_i2c          ):
-
-            if file:
-                file.write("%s\n" % text)
-            if live_config['output'].val & TermFileBoth.TERM:
-                sys.stdout.write('%s\n' % text)
-                linenumber += 1
-                if linenumber >= term_size - 1:
-                    sys.stdout.write("(<ENTER> to halt)\n")
-                    linenumber = 0
+            live_output(text, file)
 
         if error_usart:
             block_usart = True
@@ -5909,6 +6675,11 @@ def live_cmd(cmd, input, fields):
         if live_config['pb4-11'].val:
             prev_digital = digital
 
+    if total_dropped:
+        sys.stdout.write(  "%d events dropped (USB/host not keeping up "
+                           "with \"batch=\" packets)\n"
+                         % total_dropped                                 )
+
     # on timeout or user halt
     if time.time() >= end_time: sys.stdout.write('\n')
     cmnd_cmd(HALT_CMD)
@@ -5994,6 +6765,11 @@ Prints one or more fields depending on enabled configurations/parameters:
       +------------- error code, normally blank (see below)
   all:
       (<ENTER> to abort) ...
+  "batch=" enabled, if USB/host didn't keep up:
+      004.491  (12 events dropped)
+      \-----/   \---------------/
+         |             +-- changes lost before this time (exact count)
+         +-- seconds since command start
   error codes:
       " "   no error
       "E"   receive data register empty (usart, spi)
@@ -6383,6 +7159,7 @@ COMMANDS = {
                                                    'oscope'   ,
                                                    'dump'     ,
                                                    'reset'    ,
+                                                   'instrument',
                                                    'socket'   ,
                                                    'pty'      ,
                                                    'ipc'      )),
@@ -6442,6 +7219,8 @@ COMMANDS = {
                                                               )),
     'reset'         : Cmd(RSET_CMD,    reset_cmd, ('reset'    ,
                                                               )),
+    'instrument'    : Cmd(INST_CMD,     inst_cmd, ('instrument',
+                                                              )),
     'warranty'      : Cmd(WRTY_CMD,      wrty_cmd, None        ),
     'help'          : Cmd(HELP_CMD,      help_cmd, None        ),
     'using'         : Cmd(USNG_CMD,     using_cmd, None        ),
@@ -0,0 +1,439 @@
+// buck50: Test and measurement firmware for “Blue Pill” STM32F103 development board
+// Copyright (C) 2019,2020 Mark R. Rubin aka "thanks4opensource"
+//
+// This file is part of buck50.
+//
+// The buck50 program is free software: you can redistribute it
+// and/or modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The buck50 program is distributed in the hope that it will be
+// useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+// of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// (LICENSE.txt) along with the buck50 program.  If not, see
+// <https://www.gnu.org/licenses/gpl.html>
+
+
+// Throughput of sample_export.{hxx,cxx} on synthetic captures.
+//
+// usage: b50bench [num_edges [output_file]]
+//   num_edges    default 4000000
+//   output_file  default none (output counted, discarded)
+//
+// Synthetic digital capture: every sample changes 1...8 random ports,
+// 11...1023 ticks apart, plus systick rollover samples as from PB13
+// toggling. Reports input (raw words) and output MB/s, and edges/s.
+// "merge-8" is b50merge of eight such captures, each 1/8 as long, from
+// temporary raw words files. "packed" and "packed-dense" (ticks 11...255
+// apart) check "logic mode=packed" encode/decode round trip, exit status
+// 1 if it fails.
+
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "sample_export.hxx"
+#include "sample_merge.hxx"
+
+
+using namespace buck50;
+
+
+namespace {
+
+// deterministic, no <random> distribution implementation differences
+class Lcg {
+  public:
+    Lcg(const uint32_t seed) : _state(seed) {}
+
+    uint32_t operator()()
+    {
+        _state = _state * 6364136223846793005ULL + 1442695040888963407ULL;
+        return _state >> 33;
+    }
+
+  protected:
+    uint64_t    _state;
+};
+
+
+std::vector<uint32_t> synthesize(
+const size_t    num_edges        ,
+const uint32_t  seed      =   50 ,
+const uint32_t  max_delta = 1023 )
+{
+    std::vector<uint32_t>   words     ;
+    Lcg                     rand(seed);
+    uint32_t                tick = 0xffffff,
+                            bits = 0x00    ;
+    uint64_t                elapsed = 0    ;
+
+    words.reserve(num_edges + num_edges / 1000);
+
+    while (words.size() < num_edges) {
+        const uint32_t  delta = 11 + rand() % (max_delta - 10);
+
+        // rollover sample, as firmware adds at least every 2**24 ticks
+        if (elapsed / 0x1000000 != (elapsed + delta) / 0x1000000)
+            words.push_back(((tick - (0x1000000 - elapsed % 0x1000000))
+                             & 0xffffff                                )
+                            | (bits << 24)                              );
+
+        elapsed += delta                     ;
+        tick     = (tick - delta) & 0xffffff ;
+        bits    ^= 1 + rand() % 0xff         ;
+        words.push_back(tick | (bits << 24));
+    }
+
+    return words;
+}
+
+
+void report(
+const char                     *name     ,
+const size_t                    num_words,
+const uint64_t                  edges    ,
+const uint64_t                  bytes    ,
+const double                    secs     )
+{
+    printf("%-12s  %10.3f  %10.1f  %10.1f  %12.0f  %12llu\n",
+           name                                   ,
+           secs                                   ,
+           num_words    * 4.0 / secs / 1e6        ,
+           bytes              / secs / 1e6        ,
+           edges              / secs              ,
+           static_cast<unsigned long long>(bytes) );
+}
+
+
+void digital(
+const char                     *name  ,
+const std::vector<uint32_t>    &words ,
+const DigitalFormat             format,
+const bool                      pulse ,
+const int                       fd    )
+{
+    DigitalConfig   config;
+
+    config.format    = format;
+    config.pulseview = pulse ;
+    static const char   *NAMES[] = {"4", "5", "6", "7", "8", "9", "10", "11"};
+    for (unsigned ndx = 0 ; ndx < DigitalConfig::MAX_ACTIVES ; ++ndx) {
+        config.active_ndxs [ndx] = ndx       ;
+        config.active_names[ndx] = NAMES[ndx];
+    }
+    config.num_actives = DigitalConfig::MAX_ACTIVES;
+
+    if (fd >= 0) {
+        lseek    (fd, 0, SEEK_SET);
+        ftruncate(fd, 0          );
+    }
+
+    const auto          begin = std::chrono::steady_clock::now();
+    OutBuf              out(fd)                                ;
+    DigitalExporter     exporter(config, out)                  ;
+
+    exporter.header ()                          ;
+    exporter.samples(words.data(), words.size());
+    exporter.finish ()                          ;
+
+    const std::chrono::duration<double>     secs =   std::chrono::steady_clock
+                                                     ::now()
+                                                   - begin                   ;
+
+    report(name, words.size(), exporter.edges(), out.total(), secs.count());
+}
+
+
+void analog(
+const char                     *name    ,
+const std::vector<uint32_t>    &words   ,
+const unsigned                  channels,
+const int                       fd      )
+{
+    AnalogConfig    config;
+
+    config.num_channels = channels;
+    config.tick         = 1.0 / 857142.857;
+    config.names[0]     = "PA0";
+    config.names[1]     = "PA1";
+
+    if (fd >= 0) {
+        lseek    (fd, 0, SEEK_SET);
+        ftruncate(fd, 0          );
+    }
+
+    const auto          begin = std::chrono::steady_clock::now();
+    OutBuf              out(fd)                                ;
+    AnalogExporter      exporter(config, out)                  ;
+
+    exporter.header ()                          ;
+    exporter.samples(words.data(), words.size());
+    out     .flush  ()                          ;
+
+    const std::chrono::duration<double>     secs =   std::chrono::steady_clock
+                                                     ::now()
+                                                   - begin                   ;
+
+    report(name, words.size(), 0, out.total(), secs.count());
+}
+
+
+
+// "logic mode=packed" as buck50_asm.s: first two samples full words,
+// then bits<<8|delta halves, or if delta over 255 ticks (or systick
+// reloaded, delta not masked to 24 bits) bits<<8 escape followed by
+// systick 15:0 and 23:16. Trailing odd half dropped, as firmware does at
+// halt.
+std::vector<uint32_t> pack(
+const std::vector<uint32_t>    &words)
+{
+    std::vector<uint32_t>   packed(words.begin(),
+                                   words.begin() + std::min(words.size(),
+                                                            size_t(2)   ));
+    std::vector<uint16_t>   halves;
+
+    if (words.size() <= 2)
+        return packed;
+
+    uint32_t    prev_tick = words[1] & 0xffffff;
+
+    for (size_t ndx = 2 ; ndx < words.size() ; ++ndx) {
+        const uint32_t  tick  = words[ndx] & 0xffffff          ,
+                        bits  = words[ndx] >> 24                ,
+                        delta = prev_tick - tick                ;
+
+        if (delta > 0xff) {
+            halves.push_back(bits << 8  );
+            halves.push_back(tick       );
+            halves.push_back(tick >> 16 );
+        }
+        else
+            halves.push_back(bits << 8 | delta);
+        prev_tick = tick;
+    }
+
+    for (size_t ndx = 0 ; ndx + 1 < halves.size() ; ndx += 2)
+        packed.push_back(halves[ndx] | halves[ndx + 1] << 16);
+
+    return packed;
+}
+
+
+
+// as buck50.py unpack_samples(), including truncated final escape
+std::vector<uint32_t> unpack(
+const std::vector<uint32_t>    &packed)
+{
+    std::vector<uint32_t>   words(packed.begin(),
+                                  packed.begin() + std::min(packed.size(),
+                                                            size_t(2)    ));
+    std::vector<uint16_t>   halves;
+
+    if (words.empty())
+        return words;
+
+    for (size_t ndx = 2 ; ndx < packed.size() ; ++ndx) {
+        halves.push_back(packed[ndx]      );
+        halves.push_back(packed[ndx] >> 16);
+    }
+
+    uint32_t    tick = words.back() & 0xffffff;
+
+    for (size_t ndx = 0 ; ndx < halves.size() ; ) {
+        const uint32_t  bits  = halves[ndx] >> 8  ,
+                        delta = halves[ndx] & 0xff;
+
+        if (delta) {
+            tick  = (tick - delta) & 0xffffff;
+            ndx  += 1                        ;
+        }
+        else if (ndx + 2 < halves.size()) {
+            tick  = halves[ndx + 1] | (halves[ndx + 2] & 0xff) << 16;
+            ndx  += 3                                               ;
+        }
+        else
+            break;
+        words.push_back(tick | bits << 24);
+    }
+
+    return words;
+}
+
+
+
+// Round trip of synthetic capture through pack() and unpack(), whole and
+// truncated as by "logic edges=" (firmware: edges / 2 + 1 words) or
+// sample memory full. Decoded must be prefix of original, no longer than
+// limit, and at most one sample (split escape) short of halves stored.
+bool packed(
+const char                     *name ,
+const std::vector<uint32_t>    &words)
+{
+    const auto                      begin  = std::chrono::steady_clock::now();
+    const std::vector<uint32_t>     packed = pack  (words )                  ,
+                                    round  = unpack(packed)                  ;
+    const std::chrono::duration<double>     secs =   std::chrono::steady_clock
+                                                     ::now()
+                                                   - begin                   ;
+
+    if (round.size() + 1 < words.size()) {
+        fprintf(stderr, "%s: %zu samples decoded of %zu\n",
+                name, round.size(), words.size()           );
+        return false;
+    }
+
+    for (size_t limit = 4 ; limit < words.size() ; limit = limit * 3 + 1) {
+        const size_t    num_words = std::min(limit / 2 + 1, packed.size());
+        const std::vector<uint32_t>     part = unpack(std::vector<uint32_t>(
+                                                  packed.begin()            ,
+                                                  packed.begin() + num_words));
+
+        if (part.size() > limit) {
+            fprintf(stderr, "%s: edges=%zu decoded %zu samples\n",
+                    name, limit, part.size()                     );
+            return false;
+        }
+        if (!std::equal(part.begin(), part.end(), words.begin())) {
+            fprintf(stderr, "%s: edges=%zu decoded samples differ\n",
+                    name, limit                                     );
+            return false;
+        }
+    }
+
+    if (!std::equal(round.begin(), round.end(), words.begin())) {
+        fprintf(stderr, "%s: decoded samples differ\n", name);
+        return false;
+    }
+
+    report(name, packed.size(), round.size(), round.size() * 4, secs.count());
+
+    return true;
+}
+
+
+
+// Excludes temporary file writing, includes their reading
+void merge(
+const char     *name     ,
+const size_t    num_edges,
+const unsigned  num_units,
+const int       fd       )
+{
+    std::vector<std::unique_ptr<MergeUnit>>     units                  ;
+    std::vector<std::string>                    paths                  ;
+    DigitalConfig                               config                 ;
+    size_t                                      num_words = 0          ;
+
+    static const char   *NAMES[] = {"4", "5", "6", "7", "8", "9", "10", "11"};
+    for (unsigned ndx = 0 ; ndx < DigitalConfig::MAX_ACTIVES ; ++ndx) {
+        config.active_ndxs [ndx] = ndx       ;
+        config.active_names[ndx] = NAMES[ndx];
+    }
+    config.num_actives = DigitalConfig::MAX_ACTIVES;
+
+    for (unsigned unit = 0 ; unit < num_units ; ++unit) {
+        const std::vector<uint32_t>     words   = synthesize(
+                                                    num_edges / num_units,
+                                                    51 + unit            );
+        char                            path[]  = "/tmp/b50benchXXXXXX" ;
+        const int                       temp_fd = mkstemp(path)         ;
+
+        if (   temp_fd < 0
+            ||    write(temp_fd, words.data(), words.size() * sizeof(uint32_t))
+               != static_cast<ssize_t>(words.size() * sizeof(uint32_t))      ) {
+            perror(path);
+            return;
+        }
+        close(temp_fd);
+        paths.push_back(path);
+        num_words += words.size();
+    }
+
+    if (fd >= 0) {
+        lseek    (fd, 0, SEEK_SET);
+        ftruncate(fd, 0          );
+    }
+
+    const auto          begin = std::chrono::steady_clock::now();
+    OutBuf              out(fd)                                ;
+    SampleMerger        merger(config, out)                    ;
+
+    for (unsigned unit = 0 ; unit < num_units ; ++unit) {
+        units.emplace_back(new MergeUnit(paths[unit].c_str()            ,
+                                         "unit" + std::to_string(unit) ,
+                                         1.0                           ));
+        if (!units.back()->open()) {
+            fprintf(stderr, "%s\n", units.back()->error().c_str());
+            return;
+        }
+        merger.add(units.back().get());
+    }
+
+    if (!merger.merge())
+        fprintf(stderr, "%s\n", merger.error().c_str());
+
+    const std::chrono::duration<double>     secs =   std::chrono::steady_clock
+                                                     ::now()
+                                                   - begin                   ;
+
+    report(name, num_words, merger.edges(), out.total(), secs.count());
+
+    for (const std::string &path : paths)
+        unlink(path.c_str());
+}
+
+}  // namespace
+
+
+
+int main(
+int          argc,
+char *const  argv[])
+{
+    const size_t    num_edges = argc > 1 ? strtoul(argv[1], nullptr, 0)
+                                         : 4000000                    ;
+    const int       fd        = argc > 2 ? open(argv[2]                    ,
+                                                O_WRONLY | O_CREAT | O_TRUNC,
+                                                0666                       )
+                                         : -1                             ;
+
+    if (argc > 2 && fd < 0) {
+        perror(argv[2]);
+        return 1;
+    }
+
+    const std::vector<uint32_t>     words = synthesize(num_edges);
+
+    printf("%zu samples, output %s\n"                      ,
+           words.size()                                    ,
+           argc > 2 ? argv[2] : "discarded (counted only)" );
+    printf("format          seconds   in MB/s  out MB/s       edges/s"
+           "     out bytes\n"                                         );
+
+    digital("vcd"          , words, DigitalFormat::VCD, false, fd);
+    digital("vcd+pulseview", words, DigitalFormat::VCD, true , fd);
+    digital("csv"          , words, DigitalFormat::CSV, false, fd);
+    digital("bin"          , words, DigitalFormat::BIN, false, fd);
+    analog ("analog-1"     , words, 1                         , fd);
+    analog ("analog-2"     , words, 2                         , fd);
+    merge  ("merge-8"      , num_edges, 8                     , fd);
+
+    // in MB/s is packed words, out MB/s decoded words
+    const bool  ok =    packed("packed"      , words                      )
+                     && packed("packed-dense", synthesize(num_edges, 52, 255));
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,382 @@
+// buck50: Test and measurement firmware for “Blue Pill” STM32F103 development board
+// Copyright (C) 2019,2020 Mark R. Rubin aka "thanks4opensource"
+//
+// This file is part of buck50.
+//
+// The buck50 program is free software: you can redistribute it
+// and/or modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The buck50 program is distributed in the hope that it will be
+// useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+// of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// (LICENSE.txt) along with the buck50 program.  If not, see
+// <https://www.gnu.org/licenses/gpl.html>
+
+
+// Command-line front end to sample_export.{hxx,cxx}, run by buck50.py
+// "dump" (see "help dump exporter") or standalone on saved raw captures.
+// Reads little-endian uint32_t sample words from stdin or "-i" file until
+// EOF, writes to stdout or "-o" file.
+
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+
+#include "sample_export.hxx"
+
+
+using namespace buck50;
+
+
+namespace {
+
+const char  USAGE[] =
+"usage: %s digital [-f vcd|csv|bin] [-c cpu_hz] [-t per_tick]\n"
+"                  [-u units_name:units_per_second] [-p]\n"
+"                  [-a ndx:name ...] [-i in] [-o out] [-s]\n"
+"       %s analog  [-n 1|2] [-T tick] [-F first] [-S]\n"
+"                  [-r name:lo:hi [-r name:lo:hi]] [-i in] [-o out] [-s]\n"
+"  -f  digital file format (default vcd)\n"
+"  -c  CPU clock Hz, trimmed (default 72e6)\n"
+"  -t  VCD counts per tick (default 125)\n"
+"  -u  VCD tick units name and multiplier (default ns:1e9)\n"
+"  -p  add PulseView trailing edge to VCD\n"
+"  -a  active channel, PB4 is ndx 0 (repeat, in order, default 0...7)\n"
+"  -n  analog channels\n"
+"  -T  analog time per sample, scaled (default 1.0)\n"
+"  -F  analog first word index (default 0)\n"
+"  -S  analog one channel, earlier sample in high halfword (interleaved)\n"
+"  -r  analog channel name and range (repeat for second channel)\n"
+"  -i  raw sample words input file (default stdin)\n"
+"  -o  output file (default stdout)\n"
+"  -s  print summary line to stderr: "
+                                   "samples <n> edges <n> timval <float>\n";
+
+
+bool parse_double(
+const char     *text ,
+      double   &value)
+{
+    char    *end;
+
+    errno = 0;
+    value = strtod(text, &end);
+    return errno == 0 && end != text && (*end == '\0' || *end == ':');
+}
+
+
+bool parse_uint(
+const char     *text ,
+      uint64_t &value)
+{
+    char    *end;
+
+    errno = 0;
+    value = strtoull(text, &end, 0);
+    return errno == 0 && end != text && *end == '\0';
+}
+
+
+// "name:lo:hi", name may contain ':'
+bool parse_range(
+char       *text,
+const char *&name,
+double      &lo  ,
+double      &hi  )
+{
+    char    *hi_colon = strrchr(text, ':');
+    if (!hi_colon || hi_colon == text)
+        return false;
+    *hi_colon = '\0';
+
+    char    *lo_colon = strrchr(text, ':');
+    if (!lo_colon)
+        return false;
+    *lo_colon = '\0';
+
+    name = text;
+    return parse_double(lo_colon + 1, lo) && parse_double(hi_colon + 1, hi);
+}
+
+
+
+// Feed exporter in large reads, carrying partial words (pipe from
+// buck50.py "logic mode=stream" can split anywhere) to next read.
+template<typename EXPORTER> bool export_words(
+const int       in_fd   ,
+EXPORTER       &exporter)
+{
+    static const size_t     WORDS = 1 << 16;
+    static uint32_t         words[WORDS];
+
+    size_t  have = 0;  // bytes
+    for (;;) {
+        const ssize_t   got = read(in_fd                              ,
+                                   reinterpret_cast<char*>(words) + have,
+                                   sizeof(words) - have               );
+        if (got < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("read");
+            return false;
+        }
+        if (got == 0)
+            break;
+
+        have += got;
+        const size_t    full = have / sizeof(uint32_t);
+        exporter.samples(words, full);
+
+        have -= full * sizeof(uint32_t);
+        if (have)
+            memmove(words, &words[full], have);
+    }
+
+    if (have)
+        fprintf(stderr, "ignoring %zu trailing byte(s)\n", have);
+
+    return true;
+}
+
+
+
+int digital(
+int          argc,
+char *const  argv[])
+{
+    DigitalConfig    config;
+    const char      *in_name  = nullptr,
+                    *out_name = nullptr;
+    bool             summary  = false  ;
+    int              opt               ;
+
+    while ((opt = getopt(argc, argv, "f:c:t:u:pa:i:o:s")) != -1) {
+        switch (opt) {
+            case 'f':
+                if      (!strcmp(optarg, "vcd"))
+                    config.format = DigitalFormat::VCD;
+                else if (!strcmp(optarg, "csv"))
+                    config.format = DigitalFormat::CSV;
+                else if (!strcmp(optarg, "bin"))
+                    config.format = DigitalFormat::BIN;
+                else {
+                    fprintf(stderr, "bad format \"%s\"\n", optarg);
+                    return 1;
+                }
+                break;
+
+            case 'c':
+                if (!parse_double(optarg, config.cpu_hz)) {
+                    fprintf(stderr, "bad cpu_hz \"%s\"\n", optarg);
+                    return 1;
+                }
+                break;
+
+            case 't':
+                if (!parse_uint(optarg, config.per_tick) || !config.per_tick) {
+                    fprintf(stderr, "bad per_tick \"%s\"\n", optarg);
+                    return 1;
+                }
+                break;
+
+            case 'u': {
+                char    *colon = strchr(optarg, ':');
+                if (!colon || !parse_double(colon + 1, config.tick_units)) {
+                    fprintf(stderr, "bad tick units \"%s\"\n", optarg);
+                    return 1;
+                }
+                *colon                 = '\0'  ;
+                config.tick_units_name = optarg;
+                break;
+            }
+
+            case 'p':
+                config.pulseview = true;
+                break;
+
+            case 'a': {
+                char    *colon = strchr(optarg, ':');
+                if (   !colon
+                    || colon != optarg + 1
+                    || optarg[0] < '0' || optarg[0] > '7'
+                    || config.num_actives == DigitalConfig::MAX_ACTIVES) {
+                    fprintf(stderr, "bad active channel \"%s\"\n", optarg);
+                    return 1;
+                }
+                config.active_ndxs [config.num_actives  ] = optarg[0] - '0';
+                config.active_names[config.num_actives++] = colon + 1      ;
+                break;
+            }
+
+            case 'i': in_name  = optarg; break;
+            case 'o': out_name = optarg; break;
+            case 's': summary  = true  ; break;
+
+            default:
+                fprintf(stderr, USAGE, argv[-1], argv[-1]);
+                return 1;
+        }
+    }
+
+    if (config.num_actives == 0) {  // as buck50.py default "dump actives="
+        static const char   *NAMES[] = {"4", "5", "6", "7", "8", "9", "10", "11"};
+        for (unsigned ndx = 0 ; ndx < DigitalConfig::MAX_ACTIVES ; ++ndx) {
+            config.active_ndxs [ndx] = ndx       ;
+            config.active_names[ndx] = NAMES[ndx];
+        }
+        config.num_actives = DigitalConfig::MAX_ACTIVES;
+    }
+
+    const int   in_fd  = in_name  ? open(in_name, O_RDONLY) : 0,
+                out_fd = out_name ? open(out_name                     ,
+                                         O_WRONLY | O_CREAT | O_TRUNC ,
+                                         0666                         )
+                                  : 1                               ;
+    if (in_fd < 0 || out_fd < 0) {
+        perror(in_fd < 0 ? in_name : out_name);
+        return 1;
+    }
+
+    OutBuf              out(out_fd)         ;
+    DigitalExporter     exporter(config, out);
+
+    exporter.header();
+    const bool  read_ok = export_words(in_fd, exporter);
+    exporter.finish();
+
+    if (out.error()) {
+        perror("write");
+        return 1;
+    }
+
+    if (summary)
+        fprintf(stderr                               ,
+                "samples %llu edges %llu timval %.17g\n",
+                static_cast<unsigned long long>(exporter.num_samples()),
+                static_cast<unsigned long long>(exporter.edges      ()),
+                exporter.timval()                                     );
+
+    return read_ok ? 0 : 1;
+}
+
+
+
+int analog(
+int          argc,
+char *const  argv[])
+{
+    AnalogConfig     config;
+    const char      *in_name    = nullptr,
+                    *out_name   = nullptr;
+    bool             summary    = false  ;
+    unsigned         num_ranges = 0      ;
+    int              opt                 ;
+
+    while ((opt = getopt(argc, argv, "n:T:F:Sr:i:o:s")) != -1) {
+        switch (opt) {
+            case 'n':
+                if (strcmp(optarg, "1") && strcmp(optarg, "2")) {
+                    fprintf(stderr, "bad number of channels \"%s\"\n", optarg);
+                    return 1;
+                }
+                config.num_channels = optarg[0] - '0';
+                break;
+
+            case 'T':
+                if (!parse_double(optarg, config.tick)) {
+                    fprintf(stderr, "bad tick \"%s\"\n", optarg);
+                    return 1;
+                }
+                break;
+
+            case 'F':
+                if (!parse_uint(optarg, config.first)) {
+                    fprintf(stderr, "bad first \"%s\"\n", optarg);
+                    return 1;
+                }
+                break;
+
+            case 'r':
+                if (   num_ranges == 2
+                    || !parse_range(optarg                    ,
+                                    config.names[num_ranges]  ,
+                                    config.lo   [num_ranges]  ,
+                                    config.hi   [num_ranges]  )) {
+                    fprintf(stderr, "bad channel range \"%s\"\n", optarg);
+                    return 1;
+                }
+                ++num_ranges;
+                break;
+
+            case 'S':
+                config.swapped = true;
+                break;
+
+            case 'i': in_name  = optarg; break;
+            case 'o': out_name = optarg; break;
+            case 's': summary  = true  ; break;
+
+            default:
+                fprintf(stderr, USAGE, argv[-1], argv[-1]);
+                return 1;
+        }
+    }
+
+    const int   in_fd  = in_name  ? open(in_name, O_RDONLY) : 0,
+                out_fd = out_name ? open(out_name                     ,
+                                         O_WRONLY | O_CREAT | O_TRUNC ,
+                                         0666                         )
+                                  : 1                               ;
+    if (in_fd < 0 || out_fd < 0) {
+        perror(in_fd < 0 ? in_name : out_name);
+        return 1;
+    }
+
+    OutBuf              out(out_fd)         ;
+    AnalogExporter      exporter(config, out);
+
+    exporter.header();
+    const bool  read_ok = export_words(in_fd, exporter);
+    out.flush();
+
+    if (out.error()) {
+        perror("write");
+        return 1;
+    }
+
+    if (summary)
+        fprintf(stderr                        ,
+                "samples %llu edges 0 timval 0\n",
+                static_cast<unsigned long long>(exporter.num_words()));
+
+    return read_ok ? 0 : 1;
+}
+
+}  // namespace
+
+
+
+int main(
+int          argc,
+char *const  argv[])
+{
+    if (argc >= 2 && !strcmp(argv[1], "digital"))
+        return digital(argc - 1, argv + 1);
+
+    if (argc >= 2 && !strcmp(argv[1], "analog"))
+        return analog(argc - 1, argv + 1);
+
+    fprintf(stderr, USAGE, argv[0], argv[0]);
+    return 1;
+}
@@ -0,0 +1,273 @@
+// buck50: Test and measurement firmware for “Blue Pill” STM32F103 development board
+// Copyright (C) 2019,2020 Mark R. Rubin aka "thanks4opensource"
+//
+// This file is part of buck50.
+//
+// The buck50 program is free software: you can redistribute it
+// and/or modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The buck50 program is distributed in the hope that it will be
+// useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+// of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// (LICENSE.txt) along with the buck50 program.  If not, see
+// <https://www.gnu.org/licenses/gpl.html>
+
+
+// Command-line front end to sample_merge.{hxx,cxx}. After a "reset
+// ganged=enabled" capture, quit buck50.py (or "reset usb=" elsewhere) on
+// each device, then e.g.:
+//     $ b50merge -o both.vcd -n left -T 1.0002/1 /dev/ttyACM0 /dev/ttyACM1
+// "-n" and "-T" apply to the following source only.
+
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+
+#include "sample_merge.hxx"
+
+
+using namespace buck50;
+
+
+namespace {
+
+const char  USAGE[] =
+"usage: %s [-c cpu_hz] [-t per_tick] [-u units_name:units_per_second] [-p]\n"
+"          [-a ndx:name ...] [-o out] [-s]\n"
+"          [-n name] [-T observed/desired] source ...\n"
+"  -c  CPU clock Hz, untrimmed (default 72e6, ignored for bin files)\n"
+"  -t  VCD counts per tick (default 125)\n"
+"  -u  VCD tick units name and multiplier (default ns:1e9)\n"
+"  -p  add PulseView trailing edge to VCD\n"
+"  -a  active channel, PB4 is ndx 0 (repeat, in order, default 0...7)\n"
+"  -o  output file (default stdout)\n"
+"  -s  print summary lines to stderr: "
+                                   "<name> <source> samples <n>\n"
+"      ... then: units <n> samples <n> edges <n>\n"
+"  -n  VCD scope name of following source (default unit0, unit1, ...)\n"
+"  -T  trim of following source, as buck50.py \"configure trim=\" "
+                                                         "(default 1/1)\n"
+"  source  CDC/ACM device (uploads as \"dump\"), digital-frmt=bin file,\n"
+"          or raw sample words file\n";
+
+
+bool parse_double(
+const char     *text ,
+      double   &value)
+{
+    char    *end;
+
+    errno = 0;
+    value = strtod(text, &end);
+    return errno == 0 && end != text && (*end == '\0' || *end == ':');
+}
+
+
+bool parse_uint(
+const char     *text ,
+      uint64_t &value)
+{
+    char    *end;
+
+    errno = 0;
+    value = strtoull(text, &end, 0);
+    return errno == 0 && end != text && *end == '\0';
+}
+
+
+// "observed/desired", as buck50.py Trim
+bool parse_trim(
+const char     *text,
+      double   &trim)
+{
+    const char  *slash = strchr(text, '/');
+    char        *end                     ;
+    double       observed,
+                 desired ;
+
+    if (!slash)
+        return false;
+
+    errno    = 0;
+    observed = strtod(text, &end);
+    if (errno || end != slash)
+        return false;
+
+    desired = strtod(slash + 1, &end);
+    if (errno || end == slash + 1 || *end != '\0' || desired == 0.0)
+        return false;
+
+    trim = observed / desired;
+    return true;
+}
+
+}  // namespace
+
+
+
+int main(
+int          argc,
+char *const  argv[])
+{
+    std::vector<std::unique_ptr<MergeUnit>>     units                  ;
+    DigitalConfig                               config                 ;
+    const char                                 *out_name = nullptr     ,
+                                               *name     = nullptr     ;
+    double                                      trim     = 1.0         ;
+    bool                                        summary  = false       ;
+    int                                         opt                    ;
+
+    // leading '-': sources returned in order as option 1
+    while ((opt = getopt(argc, argv, "-c:t:u:pa:o:sn:T:")) != -1) {
+        switch (opt) {
+            case 1:
+                units.emplace_back(new MergeUnit(optarg,
+                                                   name ? std::string(name)
+                                                        :   "unit"
+                                                          + std::to_string(
+                                                              units.size()),
+                                                   trim                    ));
+                name = nullptr;
+                trim = 1.0    ;
+                break;
+
+            case 'c':
+                if (!parse_double(optarg, config.cpu_hz)) {
+                    fprintf(stderr, "bad cpu_hz \"%s\"\n", optarg);
+                    return 1;
+                }
+                break;
+
+            case 't':
+                if (!parse_uint(optarg, config.per_tick) || !config.per_tick) {
+                    fprintf(stderr, "bad per_tick \"%s\"\n", optarg);
+                    return 1;
+                }
+                break;
+
+            case 'u': {
+                char    *colon = strchr(optarg, ':');
+                if (!colon || !parse_double(colon + 1, config.tick_units)) {
+                    fprintf(stderr, "bad tick units \"%s\"\n", optarg);
+                    return 1;
+                }
+                *colon                 = '\0'  ;
+                config.tick_units_name = optarg;
+                break;
+            }
+
+            case 'p':
+                config.pulseview = true;
+                break;
+
+            case 'a': {
+                char    *colon = strchr(optarg, ':');
+                if (   !colon
+                    || colon != optarg + 1
+                    || optarg[0] < '0' || optarg[0] > '7'
+                    || config.num_actives == DigitalConfig::MAX_ACTIVES) {
+                    fprintf(stderr, "bad active channel \"%s\"\n", optarg);
+                    return 1;
+                }
+                config.active_ndxs [config.num_actives  ] = optarg[0] - '0';
+                config.active_names[config.num_actives++] = colon + 1      ;
+                break;
+            }
+
+            case 'n':
+                name = optarg;
+                break;
+
+            case 'T':
+                if (!parse_trim(optarg, trim)) {
+                    fprintf(stderr, "bad trim \"%s\"\n", optarg);
+                    return 1;
+                }
+                break;
+
+            case 'o': out_name = optarg; break;
+            case 's': summary  = true  ; break;
+
+            default:
+                fprintf(stderr, USAGE, argv[0]);
+                return 1;
+        }
+    }
+
+    if (units.empty()) {
+        fprintf(stderr, USAGE, argv[0]);
+        return 1;
+    }
+
+    if (config.num_actives == 0) {  // as buck50.py default "dump actives="
+        static const char   *NAMES[] = {"4", "5", "6", "7", "8", "9", "10", "11"};
+        for (unsigned ndx = 0 ; ndx < DigitalConfig::MAX_ACTIVES ; ++ndx) {
+            config.active_ndxs [ndx] = ndx       ;
+            config.active_names[ndx] = NAMES[ndx];
+        }
+        config.num_actives = DigitalConfig::MAX_ACTIVES;
+    }
+
+    // connect all before uploading any, so no device is left sending
+    // while another fails
+    for (auto &unit : units)
+        if (!unit->open()) {
+            fprintf(stderr, "%s\n", unit->error().c_str());
+            return 1;
+        }
+
+    const int   out_fd = out_name ? open(out_name                     ,
+                                         O_WRONLY | O_CREAT | O_TRUNC ,
+                                         0666                         )
+                                  : 1                               ;
+    if (out_fd < 0) {
+        perror(out_name);
+        return 1;
+    }
+
+    OutBuf          out(out_fd)       ;
+    SampleMerger    merger(config, out);
+
+    for (auto &unit : units) {
+        if (!unit->upload()) {
+            fprintf(stderr, "%s\n", unit->error().c_str());
+            return 1;
+        }
+        merger.add(unit.get());
+    }
+
+    if (!merger.merge()) {
+        fprintf(stderr, "%s\n", merger.error().c_str());
+        return 1;
+    }
+
+    if (summary) {
+        for (auto &unit : units)
+            fprintf(stderr                                              ,
+                    "%s %s samples %llu\n"                              ,
+                    unit->name  ().c_str()                              ,
+                    unit->source().c_str()                              ,
+                    static_cast<unsigned long long>(unit->num_samples()));
+        fprintf(stderr                                                  ,
+                "units %zu samples %llu edges %llu\n"                   ,
+                units.size()                                            ,
+                static_cast<unsigned long long>(merger.num_samples())   ,
+                static_cast<unsigned long long>(merger.edges      ())   );
+    }
+
+    return 0;
+}
@@ -0,0 +1,94 @@
+// buck50: Test and measurement firmware for “Blue Pill” STM32F103 development board
+// Copyright (C) 2019,2020 Mark R. Rubin aka "thanks4opensource"
+//
+// This file is part of buck50.
+//
+// The buck50 program is free software: you can redistribute it
+// and/or modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The buck50 program is distributed in the hope that it will be
+// useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+// of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// (LICENSE.txt) along with the buck50 program.  If not, see
+// <https://www.gnu.org/licenses/gpl.html>
+
+
+// Simulated send_samples() upload throughput, single- vs double-buffered
+// CDC IN endpoint, via usb_pma_model.{hxx,cxx}.
+//
+// usage: b50usbbench [packets [pma_cycles]]
+//   packets     default 20000 (64-byte)
+//   pma_cycles  usb_send()/writ_pma_data() CPU cycles per packet,
+//               default 280
+//
+// Host controllers differ in how soon they re-poll a NAKed bulk IN
+// endpoint, so runs with several re-poll delays. Full-speed bulk limit
+// is 19 packets per frame, 1216000 bytes/sec. Exits with error if any
+// run breaks ping-pong invariants (see usb_pma_model.hxx).
+
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "usb_pma_model.hxx"
+
+
+using namespace buck50;
+
+
+int main(
+int          argc,
+char *const  argv[])
+{
+    static const double     RETRY_NS[] = {0, 5000, 20000, 50000},
+                            LIMIT      = 19 * 64 * 1000         ;
+
+    UsbSimConfig    config;
+    bool            ok    = true;
+
+    if (argc > 1)
+        config.packets = strtoull(argv[1], nullptr, 0);
+    if (argc > 2)
+        config.pma_ns  = strtoul(argv[2], nullptr, 0) * UsbSimConfig::CPU_NS;
+
+    printf("%llu packets, fill %.0f ns, pma %.0f ns, irq %.0f ns\n",
+           static_cast<unsigned long long>(config.packets)       ,
+           config.fill_ns                                        ,
+           config.pma_ns                                         ,
+           config.irq_ns                                         );
+    printf("buffers  retry ns   pkts/frame     bytes/sec  %% limit"
+           "         naks  check\n"                               );
+
+    for (const double retry_ns : RETRY_NS) {
+        for (unsigned dbl_buf = 0 ; dbl_buf < 2 ; ++dbl_buf) {
+            config.retry_ns = retry_ns;
+            config.dbl_buf  = dbl_buf ;
+
+            const UsbSimResult  result = usb_sim(config);
+
+            printf("%-7s  %8.0f  %11.2f  %12.0f  %7.1f  %11llu  %s\n",
+                   dbl_buf ? "double" : "single"                    ,
+                   retry_ns                                         ,
+                   result.packets_per_frame()                       ,
+                   result.bytes_per_sec    ()                       ,
+                   result.bytes_per_sec() * 100.0 / LIMIT           ,
+                   static_cast<unsigned long long>(result.naks)     ,
+                   result.ok() ? "ok" : "FAIL"                      );
+
+            if (!result.ok()) {
+                printf("  out of order %llu, overwrites %llu, stales %llu\n",
+                       static_cast<unsigned long long>(result.out_of_order),
+                       static_cast<unsigned long long>(result.overwrites  ),
+                       static_cast<unsigned long long>(result.stales      ));
+                ok = false;
+            }
+        }
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,426 @@
+// buck50: Test and measurement firmware for “Blue Pill” STM32F103 development board
+// Copyright (C) 2019,2020 Mark R. Rubin aka "thanks4opensource"
+//
+// This file is part of buck50.
+//
+// The buck50 program is free software: you can redistribute it
+// and/or modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The buck50 program is distributed in the hope that it will be
+// useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+// of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// (LICENSE.txt) along with the buck50 program.  If not, see
+// <https://www.gnu.org/licenses/gpl.html>
+
+
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include <unistd.h>
+
+#include "sample_export.hxx"
+
+
+namespace buck50 {
+
+OutBuf::OutBuf(
+const int   fd)
+:   _buf  (new char[SIZE]),
+    _next (_buf          ),
+    _end  (_buf + SIZE   ),
+    _total(0             ),
+    _fd   (fd            ),
+    _error(false         )
+{
+}
+
+
+OutBuf::~OutBuf()
+{
+    flush();
+    delete [] _buf;
+}
+
+
+
+void OutBuf::put(
+const char      *text,
+const size_t     len )
+{
+    if (static_cast<size_t>(_end - _next) >= len) {
+        memcpy(_next, text, len);
+        _next += len;
+        return;
+    }
+
+    for (size_t ndx = 0 ; ndx < len ; ++ndx)
+        put(text[ndx]);
+}
+
+
+void OutBuf::put(
+const char  *text)
+{
+    put(text, strlen(text));
+}
+
+
+
+void OutBuf::uint(
+uint64_t    value)
+{
+    char    digits[20],
+           *digit = digits + sizeof(digits);
+
+    do {
+        *--digit = '0' + value % 10;
+        value /= 10;
+    } while (value);
+
+    put(digit, digits + sizeof(digits) - digit);
+}
+
+
+
+// Python round() is round-half-to-even, as is nearbyint() in default
+// FE_TONEAREST mode. Python int has no upper limit: values too large for
+// uint64_t printed via "%.0f", exact for integral doubles.
+void OutBuf::rnd(
+const double    value)
+{
+    const double    rounded = nearbyint(value);
+
+    if (rounded >= 0.0 && rounded < 18446744073709551616.0)
+        uint(static_cast<uint64_t>(rounded));
+    else {
+        char    text[400];
+        put(text, snprintf(text, sizeof(text), "%.0f", rounded));
+    }
+}
+
+
+
+// Python "%g" formatting of floats matches C's
+void OutBuf::g(
+const double    value)
+{
+    char    text[32];
+
+    put(text, snprintf(text, sizeof(text), "%g", value));
+}
+
+
+
+bool OutBuf::flush()
+{
+    const size_t    len = _next - _buf;
+
+    _total += len;
+    _next   = _buf;
+
+    if (_fd < 0 || len == 0)
+        return !_error;
+
+    const char  *data = _buf;
+    size_t       left = len ;
+    while (left) {
+        const ssize_t   wrote = write(_fd, data, left);
+        if (wrote < 0) {
+            if (errno == EINTR)
+                continue;
+            _error = true;
+            return false;
+        }
+        data += wrote;
+        left -= wrote;
+    }
+
+    return !_error;
+}
+
+
+
+
+DigitalExporter::DigitalExporter(
+const DigitalConfig    &config,
+      OutBuf           &out   )
+:   _config     (config                             ),
+    _out        (out                                ),
+    _divisor    (config.cpu_hz * config.per_tick    ),
+    _tcks       (0                                  ),
+    _num_samples(0                                  ),
+    _edges      (0                                  ),
+    _timval     (0                                  ),
+    _prev       (0                                  ),
+    _last       (0x00                               ),
+    _bits       (0x00                               ),
+    _first      (true                               )
+{
+}
+
+
+
+void DigitalExporter::header()
+{
+    if (_config.format == DigitalFormat::VCD) {
+        _out.put("$timescale ")          ;
+        _out.uint(_config.per_tick)      ;
+        _out.put(' ')                    ;
+        _out.put(_config.tick_units_name);
+        _out.put(" $end\n")              ;
+        _out.put("$scope module top $end\n");
+        _out.put("$var wire 1 z blk $end\n");
+        for (unsigned ndx = 0 ; ndx < _config.num_actives ; ++ndx) {
+            _out.put("$var wire 1 ")              ;
+            _out.put('0' + _config.active_ndxs[ndx]);
+            _out.put(' ')                         ;
+            _out.put(_config.active_names[ndx])   ;
+            _out.put(" $end\n")                   ;
+        }
+        _out.put("$upscope $end\n"       );
+        _out.put("$enddefinitions $end\n");
+    }
+    else if (_config.format == DigitalFormat::CSV) {
+        _out.put("time");
+        for (unsigned ndx = 0 ; ndx < _config.num_actives ; ++ndx) {
+            _out.put(',')                      ;
+            _out.put(_config.active_names[ndx]);
+        }
+        _out.put('\n');
+    }
+    else {  // DigitalFormat::BIN
+        _out.bytes(BIN_MAGIC       , sizeof(BIN_MAGIC)     );
+        _out.bytes(&_config.cpu_hz , sizeof(_config.cpu_hz));
+    }
+}
+
+
+
+void DigitalExporter::samples(
+const uint32_t  *words,
+      size_t     count)
+{
+    while (count) {
+        const size_t    block = count < BLOCK ? count : BLOCK;
+
+        decode(words, block);
+
+        switch (_config.format) {
+            case DigitalFormat::VCD: vcd(block); break;
+            case DigitalFormat::CSV: csv(block); break;
+            case DigitalFormat::BIN: bin(block); break;
+        }
+
+        words += block;
+        count -= block;
+    }
+}
+
+
+
+// PulseView doesn't show last edge transition, so generate fake duplicate
+// of last bits. Note buck50.py sets timval to 0 for each sample without
+// change, so if last sample had none the fake one is at time "2".
+void DigitalExporter::finish()
+{
+    if (_config.format == DigitalFormat::VCD && _config.pulseview) {
+        _timval += 2.0;  // make sure doesn't round to same as previous
+        _out.put('#')    ;
+        _out.rnd(_timval);
+        _out.put('\n')   ;
+        for (unsigned ndx = 0 ; ndx < _config.num_actives ; ++ndx) {
+            const uint8_t   active = _config.active_ndxs[ndx];
+            _out.put((_bits & (1 << active)) ? '1' : '0');
+            _out.put('0' + active)                      ;
+            _out.put('\n')                              ;
+        }
+    }
+
+    _out.flush();
+}
+
+
+
+// systick->val counts down, 24 bits: tick delta modulo 2**24 handles
+// rollover identically to buck50.py "if tick > prev: delt += 0x1000000"
+void DigitalExporter::decode(
+const uint32_t  *words,
+const size_t     count)
+{
+    uint64_t    tcks = _tcks;
+    uint32_t    prev = _prev;
+
+    if (_first && count) {
+        prev   = words[0] & 0xffffff;
+        _first = false             ;
+    }
+
+    for (size_t ndx = 0 ; ndx < count ; ++ndx) {
+        const uint32_t  word = words[ndx]        ,
+                        tick = word & 0xffffff   ;
+
+        tcks            += (prev - tick) & 0xffffff;
+        prev             = tick                    ;
+        _block_tcks[ndx] = tcks                    ;
+        _block_bits[ndx] = word >> 24              ;
+    }
+
+    _tcks         = tcks          ;
+    _prev         = prev          ;
+    _num_samples += count         ;
+    _bits         = words[count - 1] >> 24;
+}
+
+
+
+void DigitalExporter::vcd(
+const size_t    count)
+{
+    uint8_t     last   = _last  ;
+    double      timval = _timval;
+
+    for (size_t ndx = 0 ; ndx < count ; ++ndx) {
+        const uint8_t   bits = _block_bits[ndx] ,
+                        chng = bits ^ last      ;
+
+        timval = 0;
+        if (chng) {
+            timval =   static_cast<double>(_block_tcks[ndx])
+                     * _config.tick_units
+                     / _divisor                            ;
+            _out.put('#')   ;
+            _out.rnd(timval);
+            _out.put('\n')  ;
+            for (unsigned actv = 0 ; actv < _config.num_actives ; ++actv) {
+                const uint8_t   active = _config.active_ndxs[actv],
+                                bit    = 1 << active             ;
+                if (chng & bit) {
+                    _out.put((bits & bit) ? '1' : '0');
+                    _out.put('0' + active)            ;
+                    _out.put('\n')                    ;
+                }
+            }
+            ++_edges;
+        }
+        last = bits;
+    }
+
+    _last   = last  ;
+    _timval = timval;
+}
+
+
+
+void DigitalExporter::csv(
+const size_t    count)
+{
+    uint8_t     last = _last;
+
+    for (size_t ndx = 0 ; ndx < count ; ++ndx) {
+        const uint8_t   bits = _block_bits[ndx];
+
+        _out.g(static_cast<double>(_block_tcks[ndx]) / _config.cpu_hz);
+        for (unsigned actv = 0 ; actv < _config.num_actives ; ++actv)
+            _out.put((bits & (1 << _config.active_ndxs[actv])) ? ",1" : ",0",
+                     2                                                      );
+        _out.put('\n');
+
+        if (bits != last)
+            ++_edges;
+        last = bits;
+    }
+
+    _last = last;
+}
+
+
+
+void DigitalExporter::bin(
+const size_t    count)
+{
+    uint8_t     last = _last;
+
+    for (size_t ndx = 0 ; ndx < count ; ++ndx) {
+        const uint64_t  record = (_block_tcks[ndx] << 8) | _block_bits[ndx];
+
+        _out.bytes(&record, sizeof(record));  // little-endian host
+
+        if (_block_bits[ndx] != last)
+            ++_edges;
+        last = _block_bits[ndx];
+    }
+
+    _last = last;
+}
+
+
+
+
+AnalogExporter::AnalogExporter(
+const AnalogConfig     &config,
+      OutBuf           &out   )
+:   _config(config      ),
+    _out   (out         ),
+    _ndx   (config.first)
+{
+}
+
+
+
+void AnalogExporter::header()
+{
+    _out.put("time,")         ;
+    _out.put(_config.names[0]);
+    if (_config.num_channels == 2) {
+        _out.put(',')             ;
+        _out.put(_config.names[1]);
+    }
+    _out.put('\n');
+}
+
+
+
+// As buck50.py upload_analog(): one channel is two consecutive samples
+// per word, both scaled by first channel's range, in reverse order if
+// "oscope adc-mode=interleaved"
+void AnalogExporter::samples(
+const uint32_t  *words,
+const size_t     count)
+{
+    const unsigned  shift_1 = _config.swapped ? 16 :  0,
+                    shift_2 = _config.swapped ?  0 : 16;
+
+    for (size_t ndx = 0 ; ndx < count ; ++ndx, ++_ndx) {
+        const uint32_t  sample_1 = (words[ndx] >> shift_1) & 0xffff,
+                        sample_2 = (words[ndx] >> shift_2) & 0xffff;
+
+        if (_config.num_channels == 1) {
+            const uint64_t  num = _ndx * 2;
+            _out.g(static_cast<double>(num    ) * _config.tick);
+            _out.put(',');
+            _out.g(ranged(0, sample_1)                        );
+            _out.put('\n');
+            _out.g(static_cast<double>(num + 1) * _config.tick);
+            _out.put(',');
+            _out.g(ranged(0, sample_2)                        );
+            _out.put('\n');
+        }
+        else {
+            _out.g(static_cast<double>(_ndx) * _config.tick);
+            _out.put(',');
+            _out.g(ranged(0, sample_1)                     );
+            _out.put(',');
+            _out.g(ranged(1, sample_2)                     );
+            _out.put('\n');
+        }
+    }
+}
+
+}  // namespace buck50
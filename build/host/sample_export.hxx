@@ -0,0 +1,189 @@
+// buck50: Test and measurement firmware for “Blue Pill” STM32F103 development board
+// Copyright (C) 2019,2020 Mark R. Rubin aka "thanks4opensource"
+//
+// This file is part of buck50.
+//
+// The buck50 program is free software: you can redistribute it
+// and/or modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The buck50 program is distributed in the hope that it will be
+// useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+// of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// (LICENSE.txt) along with the buck50 program.  If not, see
+// <https://www.gnu.org/licenses/gpl.html>
+
+
+// Host-side decoding and file export of raw firmware sample words as
+// uploaded by send_samples() (or "logic mode=stream" packets' payloads).
+// Output is byte-identical to buck50.py upload_digital()/upload_analog()
+// file writers, including their quirks -- see sample_export.cxx.
+
+
+#ifndef SAMPLE_EXPORT_HXX
+#define SAMPLE_EXPORT_HXX
+
+#define SAMPLE_EXPORT_MAJOR_VERSION   1
+#define SAMPLE_EXPORT_MINOR_VERSION   0
+#define SAMPLE_EXPORT_MICRO_VERSION   0
+
+#include <cstddef>
+#include <cstdint>
+
+
+namespace buck50 {
+
+// Buffered output to file descriptor, large block writes instead of
+// per-line/per-field ones
+class OutBuf {
+  public:
+    static const size_t     SIZE = 1 << 20;
+
+    // fd < 0 discards output but still counts bytes (for benchmarks)
+    OutBuf(const int fd);
+    ~OutBuf();
+
+    void put(const char  c)
+    {
+        if (_next == _end) flush();
+        *_next++ = c;
+    }
+
+    void put(const char     *text,
+             const size_t    len );
+    void put(const char     *text);
+
+    void uint (const uint64_t   value);  // printf("%llu")
+    void rnd  (const double     value);  // Python "%d" % int(round(value))
+    void g    (const double     value);  // printf("%g")
+    void bytes(const void      *data ,
+               const size_t     len  ) { put(static_cast<const char*>(data),
+                                             len                         ); }
+
+    bool flush();
+
+    uint64_t    total() const { return _total + (_next - _buf); }
+    bool        error() const { return _error                 ; }
+
+  protected:
+    char        *_buf  ,
+                *_next ,
+                *_end  ;
+    uint64_t     _total;
+    int          _fd   ;
+    bool         _error;
+};  // class OutBuf
+
+
+
+// As buck50.py DigitalFormat
+enum class DigitalFormat {
+    CSV = 1,
+    VCD = 2,
+    BIN = 3,
+};
+
+// Binary format: BIN_MAGIC, double cpu_hz, then one little-endian uint64_t
+// per sample, (ticks since first sample << 8) | PB11...PB4 bits
+static const char   BIN_MAGIC[8] = {'b', 'u', 'c', 'k', '5', '0', '\0', '\1'};
+
+
+struct DigitalConfig {
+    static const unsigned   MAX_ACTIVES = 8;
+
+    DigitalFormat    format                   = DigitalFormat::VCD;
+    double           cpu_hz                   = 72e6             ,
+                     tick_units               = 1e9              ;  // "ns"
+    uint64_t         per_tick                 = 125              ;
+    const char      *tick_units_name          = "ns"             ;
+    unsigned         num_actives              = 0                ;
+    uint8_t          active_ndxs [MAX_ACTIVES]                   ;  // 0...7
+    const char      *active_names[MAX_ACTIVES]                   ;
+    bool             pulseview                = false            ;
+};  // struct DigitalConfig
+
+
+class DigitalExporter {
+  public:
+    // samples decoded in blocks of this many words
+    static const size_t     BLOCK = 4096;
+
+    DigitalExporter(const DigitalConfig    &config,
+                          OutBuf           &out   );
+
+    void header ();
+    void samples(const uint32_t    *words,
+                 const size_t       count);
+    void finish ();  // PulseView trailing edge if configured
+
+    uint64_t    num_samples() const { return _num_samples; }
+    uint64_t    edges      () const { return _edges      ; }
+    double      timval     () const { return _timval     ; }  // as Python
+
+  protected:
+    void decode(const uint32_t  *words,
+                const size_t     count);
+    void vcd   (const size_t     count);
+    void csv   (const size_t     count);
+    void bin   (const size_t     count);
+
+    const DigitalConfig    &_config          ;
+          OutBuf           &_out             ;
+          double            _divisor         ;  // cpu_hz * per_tick
+          uint64_t          _tcks            ,
+                            _num_samples     ,
+                            _edges           ;
+          double            _timval          ;
+          uint32_t          _prev            ;
+          uint8_t           _last            ,
+                            _bits            ;
+          bool              _first           ;
+          uint64_t          _block_tcks[BLOCK];
+          uint8_t           _block_bits[BLOCK];
+};  // class DigitalExporter
+
+
+
+struct AnalogConfig {
+    unsigned     num_channels = 1   ;  // 1: two 16-bit samples per word
+    double       tick         = 1.0 ,  // time per sample, scaled
+                 lo[2]        = {0.0, 0.0},
+                 hi[2]        = {3.3, 3.3};
+    uint64_t     first        = 0   ;  // word index of first sample
+    const char  *names[2]     = {"", ""};
+    bool         swapped      = false;  // 1: earlier sample in high 16 bits
+};  // struct AnalogConfig
+
+
+class AnalogExporter {
+  public:
+    AnalogExporter(const AnalogConfig  &config,
+                         OutBuf        &out   );
+
+    void header ();
+    void samples(const uint32_t    *words,
+                 const size_t       count);
+
+    uint64_t    num_words() const { return _ndx - _config.first; }
+
+  protected:
+    double ranged(const unsigned    chan ,
+                  const uint32_t    value) const
+    {
+        return    _config.lo[chan]
+               + (static_cast<double>(value) / static_cast<double>(0xfff))
+               * (_config.hi[chan] - _config.lo[chan]);
+    }
+
+    const AnalogConfig     &_config;
+          OutBuf           &_out   ;
+          uint64_t          _ndx   ;
+};  // class AnalogExporter
+
+}  // namespace buck50
+
+#endif  // ifndef SAMPLE_EXPORT_HXX
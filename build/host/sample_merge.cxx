@@ -0,0 +1,652 @@
+// buck50: Test and measurement firmware for “Blue Pill” STM32F103 development board
+// Copyright (C) 2019,2020 Mark R. Rubin aka "thanks4opensource"
+//
+// This file is part of buck50.
+//
+// The buck50 program is free software: you can redistribute it
+// and/or modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The buck50 program is distributed in the hope that it will be
+// useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+// of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// (LICENSE.txt) along with the buck50 program.  If not, see
+// <https://www.gnu.org/licenses/gpl.html>
+
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <queue>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "sample_merge.hxx"
+
+
+namespace {
+
+// as buck50.py
+const uint8_t   SIGNATURE[] = {0xf2,                    // SIGN_CMD
+                               0x9e, 0xc4, 0xaa, 0xdf,
+                               0xd8, 0xca, 0x8f, 0xbd,
+                               0xbe, 0xa9, 0xfe, 0x83,
+                               0x99, 0xd1, 0xae, 0xeb,
+                               0   , 0   , 0          };  // pad to mod 4
+
+const uint32_t  IDENTITY         = 0xea017af5;
+
+const uint8_t   UPLD_CMD         =  8,
+                MODE_STREAM      =  4,  // SamplingMode
+                MODE_PACKED      =  5,
+                MODE_ANALOG      = 15;
+
+const unsigned  CONNECT_TRIES    = 3   ;
+const int       CONNECT_WAIT_MS  = 1000;
+
+}  // namespace
+
+
+
+namespace buck50 {
+
+MergeUnit::MergeUnit(
+const char          *source,
+const std::string   &name  ,
+const double         trim  )
+:   _source     (source          ),
+    _name       (name            ),
+    _trim       (trim            ),
+    _cpu_hz     (0.0             ),
+    _divisor    (1.0             ),
+    _buf        (nullptr         ),
+    _head       (0               ),
+    _tail       (0               ),
+    _remaining  (0               ),
+    _num_samples(0               ),
+    _tcks       (0               ),
+    _time       (0               ),
+    _prev       (0               ),
+    _fulls      (0               ),
+    _fd         (-1              ),
+    _format     (Format::WORDS   ),
+    _bits       (0x00            ),
+    _last       (0x00            ),
+    _device     (false           ),
+    _eof        (false           ),
+    _first      (true            ),
+    _started    (false           )
+{
+}
+
+
+MergeUnit::~MergeUnit()
+{
+    if (_fd >= 0)
+        close(_fd);
+    delete [] _buf;
+}
+
+
+
+bool MergeUnit::fail(
+const char  *what)
+{
+    _error = _source + ": " + what + ": " + strerror(errno);
+    return false;
+}
+
+
+
+bool MergeUnit::open()
+{
+    struct stat     status;
+
+    if (stat(_source.c_str(), &status))
+        return fail("stat");
+
+    _device = S_ISCHR(status.st_mode);
+    _fd     = ::open(_source.c_str()                                      ,
+                     _device ? O_RDWR | O_NOCTTY | O_NONBLOCK : O_RDONLY);
+    if (_fd < 0)
+        return fail("open");
+
+    _buf = new uint8_t[BUFFER];
+
+    if (!_device) {
+        while (buffered() < sizeof(BIN_MAGIC) + sizeof(double) && !_eof)
+            if (fill() < 0)
+                return false;
+
+        if (   buffered() >= sizeof(BIN_MAGIC) + sizeof(double)
+            && !memcmp(_buf, BIN_MAGIC, sizeof(BIN_MAGIC))     ) {
+            memcpy(&_cpu_hz, _buf + sizeof(BIN_MAGIC), sizeof(_cpu_hz));
+            _format = Format::BIN                                       ;
+            _head   = sizeof(BIN_MAGIC) + sizeof(_cpu_hz)               ;
+        }
+        return true;
+    }
+
+    if (isatty(_fd)) {
+        termios     raw;
+        tcgetattr(_fd, &raw);
+        cfmakeraw(&raw);
+        tcsetattr(_fd, TCSANOW, &raw);
+    }
+    tcflush(_fd, TCIOFLUSH);
+
+    for (unsigned tries = 0 ; tries < CONNECT_TRIES ; ++tries) {
+        uint32_t    identity;
+
+        if (!write_all(SIGNATURE, sizeof(SIGNATURE)))
+            return false;
+
+        if (read_all(&identity, sizeof(identity), CONNECT_WAIT_MS)) {
+            if (identity == IDENTITY)
+                return true;
+            _error = _source + ": not buck50 device (identity mismatch)";
+            return false;
+        }
+        if (errno != ETIMEDOUT)
+            return false;
+    }
+
+    return false;  // read_all() set timeout error
+}
+
+
+
+bool MergeUnit::upload()
+{
+    if (!_device)
+        return true;
+
+    // as buck50.py "dump": first=0, count=0xffff
+    static const uint8_t    UPLD[] = {UPLD_CMD, 0, 0, 0, 0xff, 0xff, 0, 0};
+    uint8_t                 header[16];
+
+    if (   !write_all(UPLD, sizeof(UPLD))
+        || !read_all(header, sizeof(header), SampleMerger::TIMEOUT_MS))
+        return false;
+
+    const uint16_t  count = header[2] | header[3] << 8;
+    const uint8_t   mode  = header[8]                 ;
+
+    if (mode == MODE_ANALOG) {
+        _error = _source + ": analog (\"oscope\") capture";
+        return false;
+    }
+    if (mode == MODE_STREAM) {
+        _error = _source + ": \"logic mode=stream\" capture not in device "
+                           "memory, merge its \"dump\" file instead"      ;
+        return false;
+    }
+    if (count == 0) {
+        _error = _source + ": zero samples";
+        return false;
+    }
+
+    if (mode == MODE_PACKED) {
+        _format = Format::PACKED;
+        _fulls  = 2             ;  // trigger and sampling start samples
+    }
+    _remaining = count * sizeof(uint32_t);
+
+    return true;
+}
+
+
+
+bool MergeUnit::write_all(
+const void      *data,
+const size_t     len )
+{
+    const uint8_t   *bytes = static_cast<const uint8_t*>(data);
+    size_t           left  = len                              ;
+
+    while (left) {
+        const ssize_t   wrote = write(_fd, bytes, left);
+
+        if (wrote > 0) {
+            bytes += wrote;
+            left  -= wrote;
+        }
+        else if (wrote < 0 && errno == EAGAIN) {
+            struct pollfd   pfd = {_fd, POLLOUT, 0};
+            if (poll(&pfd, 1, SampleMerger::TIMEOUT_MS) == 0) {
+                errno = ETIMEDOUT;
+                return fail("write");
+            }
+        }
+        else if (wrote < 0 && errno != EINTR)
+            return fail("write");
+    }
+
+    return true;
+}
+
+
+
+bool MergeUnit::read_all(
+      void      *data   ,
+const size_t     len    ,
+const int        timeout)
+{
+    uint8_t     *bytes = static_cast<uint8_t*>(data);
+    size_t       left  = len                        ;
+
+    while (left) {
+        struct pollfd   pfd   = {_fd, POLLIN, 0}      ;
+        const int       ready = poll(&pfd, 1, timeout);
+
+        if (ready == 0) {
+            errno = ETIMEDOUT;
+            return fail("read");
+        }
+        if (ready < 0) {
+            if (errno == EINTR)
+                continue;
+            return fail("poll");
+        }
+
+        const ssize_t   got = read(_fd, bytes, left);
+        if (got > 0) {
+            bytes += got;
+            left  -= got;
+        }
+        else if (got == 0) {
+            errno = EPIPE;
+            return fail("read");
+        }
+        else if (errno != EAGAIN && errno != EINTR)
+            return fail("read");
+    }
+
+    return true;
+}
+
+
+
+// Returns bytes read, 0 if none available or at end, -1 on error
+ssize_t MergeUnit::fill()
+{
+    if (_head == _tail)
+        _head = _tail = 0;
+    else if (_head && BUFFER - _tail < BUFFER / 4) {
+        memmove(_buf, _buf + _head, _tail - _head);
+        _tail -= _head;
+        _head  = 0    ;
+    }
+
+    size_t  want = BUFFER - _tail;
+    if (_device && want > _remaining)
+        want = _remaining;
+    if (want == 0 || _eof)
+        return 0;
+
+    const ssize_t   got = read(_fd, _buf + _tail, want);
+
+    if (got > 0) {
+        _tail += got;
+        if (_device)
+            _remaining -= got;
+    }
+    else if (got == 0) {
+        if (_device) {
+            errno = EPIPE;
+            fail("read");
+            return -1;
+        }
+        _eof = true;
+    }
+    else if (errno != EAGAIN && errno != EINTR) {
+        fail("read");
+        return -1;
+    }
+    else
+        return 0;
+
+    return got;
+}
+
+
+
+// Returns false if not enough data buffered. Discards trailing partial
+// sample (or packed escape sequence truncated by sampling halt, as
+// buck50.py unpack_samples()) at end of input.
+bool MergeUnit::decode(
+uint64_t    &tcks,
+uint8_t     &bits)
+{
+    const uint8_t   *data   = _buf + _head;
+    const size_t     have   = buffered()  ;
+    const bool       ending = _device ? _remaining == 0 : _eof;
+    uint32_t         tick                 ;
+    size_t           need                 ;
+
+    if (_format == Format::BIN) {
+        if (have < sizeof(uint64_t)) {
+            if (ending)
+                _head = _tail;
+            return false;
+        }
+
+        uint64_t    sample;
+        memcpy(&sample, data, sizeof(sample));
+        tcks   = sample >> 8           ;
+        bits   = sample &  0xff        ;
+        _head += sizeof(sample)        ;
+        return true;
+    }
+
+    if (_format == Format::WORDS || _fulls) {
+        if (have < sizeof(uint32_t)) {
+            if (ending)
+                _head = _tail;
+            return false;
+        }
+
+        uint32_t    word;
+        memcpy(&word, data, sizeof(word));
+        tick  = word & 0xffffff;
+        bits  = word >> 24     ;
+        need  = sizeof(word)   ;
+        if (_fulls)
+            --_fulls;
+        if (_first) {
+            _prev  = tick ;
+            _first = false;
+        }
+    }
+    else {  // Format::PACKED halfwords
+        uint16_t    halves[3];
+
+        if (have < sizeof(uint16_t)) {
+            if (ending)
+                _head = _tail;
+            return false;
+        }
+        memcpy(halves, data, sizeof(uint16_t));
+
+        bits = halves[0] >> 8;
+        if (halves[0] & 0xff) {
+            tick = (_prev - (halves[0] & 0xff)) & 0xffffff;
+            need = sizeof(uint16_t)                       ;
+        }
+        else {
+            if (have < sizeof(halves)) {
+                if (ending)
+                    _head = _tail;
+                return false;
+            }
+            memcpy(halves, data, sizeof(halves));
+            tick = halves[1] | (halves[2] & 0xff) << 16;
+            need = sizeof(halves)                      ;
+        }
+    }
+
+    // systick->val counts down, 24 bits, as DigitalExporter::decode()
+    _tcks += (_prev - tick) & 0xffffff;
+    _prev  = tick                     ;
+    _head += need                     ;
+    tcks   = _tcks                    ;
+
+    return true;
+}
+
+
+
+
+SampleMerger::SampleMerger(
+const DigitalConfig    &config,
+      OutBuf           &out   )
+:   _config(config),
+    _out   (out   ),
+    _edges (0     ),
+    _mask  (0x00  )
+{
+}
+
+
+
+uint64_t SampleMerger::num_samples()
+const
+{
+    uint64_t    total = 0;
+
+    for (const MergeUnit *unit : _units)
+        total += unit->num_samples();
+
+    return total;
+}
+
+
+
+// Time zero is each unit's first (trigger) sample, simultaneous across
+// ganged devices. Per-unit trim applied in conversion to VCD timestamp,
+// so each unit's change sequence stays monotonic and heap order is
+// global time order (ties broken by unit order).
+bool SampleMerger::merge()
+{
+    typedef std::pair<uint64_t, unsigned>   Pending;  // time, unit index
+
+    std::priority_queue<Pending                  ,
+                        std::vector<Pending>     ,
+                        std::greater<Pending>    >  heap;
+    uint64_t                                        time    = 0    ;
+    bool                                            stamped = false;
+
+    _mask = 0x00;
+    for (unsigned actv = 0 ; actv < _config.num_actives ; ++actv)
+        _mask |= 1 << _config.active_ndxs[actv];
+
+    _out.put("$timescale ")          ;
+    _out.uint(_config.per_tick)      ;
+    _out.put(' ')                    ;
+    _out.put(_config.tick_units_name);
+    _out.put(" $end\n")              ;
+
+    for (unsigned ndx = 0 ; ndx < _units.size() ; ++ndx) {
+        MergeUnit   *unit = _units[ndx];
+
+        unit->_divisor =   (unit->_cpu_hz ? unit->_cpu_hz : _config.cpu_hz)
+                         * unit->_trim
+                         * _config.per_tick                                ;
+
+        _out.put("$scope module ");
+        _out.put(unit->_name.c_str());
+        _out.put(" $end\n");
+        for (unsigned actv = 0 ; actv < _config.num_actives ; ++actv) {
+            std::string     id  ;
+            unsigned        code = _ids.size();
+
+            do {  // printable ASCII '!' ... '~'
+                id   += static_cast<char>('!' + code % 94);
+                code /= 94                                ;
+            } while (code);
+            _ids.push_back(id);
+
+            _out.put("$var wire 1 ")             ;
+            _out.put(id.c_str())                 ;
+            _out.put(' ')                        ;
+            _out.put(_config.active_names[actv]) ;
+            _out.put(" $end\n")                  ;
+        }
+        _out.put("$upscope $end\n");
+    }
+    _out.put("$enddefinitions $end\n");
+
+    for (unsigned ndx = 0 ; ndx < _units.size() ; ++ndx)
+        if (next(*_units[ndx]))
+            heap.push(Pending(_units[ndx]->_time, ndx));
+
+    while (!heap.empty() && _error.empty()) {
+        const unsigned  ndx = heap.top().second;
+
+        if (!stamped || heap.top().first != time) {
+            time    = heap.top().first;
+            stamped = true            ;
+            _out.put('#')  ;
+            _out.uint(time);
+            _out.put('\n') ;
+        }
+        heap.pop();
+
+        vcd(*_units[ndx], ndx);
+        ++_edges;
+
+        if (next(*_units[ndx]))
+            heap.push(Pending(_units[ndx]->_time, ndx));
+    }
+
+    if (!_error.empty())
+        return false;
+
+    // PulseView doesn't show last edge transition, see DigitalExporter
+    if (_config.pulseview && stamped) {
+        _out.put('#')      ;
+        _out.uint(time + 2);
+        _out.put('\n')     ;
+        for (unsigned ndx = 0 ; ndx < _units.size() ; ++ndx) {
+            MergeUnit   *unit = _units[ndx];
+
+            unit->_last = ~unit->_bits;
+            if (unit->_started)
+                vcd(*unit, ndx);
+        }
+    }
+
+    if (!_out.flush()) {
+        _error = std::string("write: ") + strerror(errno);
+        return false;
+    }
+
+    return true;
+}
+
+
+
+bool SampleMerger::next(
+MergeUnit   &unit)
+{
+    for (;;) {
+        uint64_t    tcks;
+        uint8_t     bits;
+
+        while (unit.decode(tcks, bits)) {
+            ++unit._num_samples;
+            bits &= _mask;
+
+            if (unit._started && bits == unit._bits)
+                continue;
+
+            if (!unit._started) {
+                unit._last    = ~bits;  // first sample writes all channels
+                unit._started = true ;
+            }
+            unit._bits = bits;
+            unit._time = static_cast<uint64_t>(nearbyint(  tcks
+                                                         * _config.tick_units
+                                                         / unit._divisor     ));
+            return true;
+        }
+
+        if (unit.done() || !fill(unit))
+            return false;
+    }
+}
+
+
+
+// Wait for unit's next data. Reads any other devices' data available
+// meanwhile, so all upload concurrently at USB speed instead of each
+// stalling on full host buffers until merge reaches it.
+bool SampleMerger::fill(
+MergeUnit   &unit)
+{
+    if (!unit._device) {
+        if (unit.fill() < 0) {
+            _error = unit.error();
+            return false;
+        }
+        return true;
+    }
+
+    std::vector<struct pollfd>  fds   ;
+    std::vector<MergeUnit*>     polled;
+
+    for (;;) {
+        fds   .clear();
+        polled.clear();
+        for (MergeUnit *other : _units)
+            if (   other->_device
+                && other->_remaining
+                && other->buffered() < MergeUnit::BUFFER) {
+                fds   .push_back({other->_fd, POLLIN, 0});
+                polled.push_back(other                  );
+            }
+
+        const int   ready = poll(fds.data(), fds.size(), TIMEOUT_MS);
+
+        if (ready == 0) {
+            _error = unit._source + ": upload timed out";
+            return false;
+        }
+        if (ready < 0) {
+            if (errno == EINTR)
+                continue;
+            _error = std::string("poll: ") + strerror(errno);
+            return false;
+        }
+
+        bool    progress = false;
+        for (size_t ndx = 0 ; ndx < fds.size() ; ++ndx) {
+            if (!fds[ndx].revents)
+                continue;
+
+            const ssize_t   got = polled[ndx]->fill();
+            if (got < 0) {
+                _error = polled[ndx]->error();
+                return false;
+            }
+            if (polled[ndx] == &unit && got > 0)
+                progress = true;
+        }
+
+        if (progress)
+            return true;
+    }
+}
+
+
+
+void SampleMerger::vcd(
+      MergeUnit     &unit,
+const unsigned       ndx )
+{
+    const uint8_t   chng = unit._bits ^ unit._last;
+
+    for (unsigned actv = 0 ; actv < _config.num_actives ; ++actv) {
+        const uint8_t   bit = 1 << _config.active_ndxs[actv];
+
+        if (chng & bit) {
+            _out.put((unit._bits & bit) ? '1' : '0')           ;
+            _out.put(_ids[ndx * _config.num_actives + actv].c_str());
+            _out.put('\n')                                      ;
+        }
+    }
+
+    unit._last = unit._bits;
+}
+
+}  // namespace buck50
@@ -0,0 +1,150 @@
+// buck50: Test and measurement firmware for “Blue Pill” STM32F103 development board
+// Copyright (C) 2019,2020 Mark R. Rubin aka "thanks4opensource"
+//
+// This file is part of buck50.
+//
+// The buck50 program is free software: you can redistribute it
+// and/or modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The buck50 program is distributed in the hope that it will be
+// useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+// of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// (LICENSE.txt) along with the buck50 program.  If not, see
+// <https://www.gnu.org/licenses/gpl.html>
+
+
+// Merge of "reset ganged=enabled" multi-device digital captures into one
+// time-aligned VCD file. Each unit's samples are decoded incrementally
+// from a small buffer and merged by earliest VCD timestamp, so memory use
+// is independent of capture length. All USB devices upload concurrently,
+// their reads multiplexed with poll().
+
+
+#ifndef SAMPLE_MERGE_HXX
+#define SAMPLE_MERGE_HXX
+
+#include <string>
+#include <vector>
+
+#include "sample_export.hxx"
+
+
+namespace buck50 {
+
+// One device's capture. Source is one of:
+//   - CDC/ACM device (e.g. /dev/ttyACM0): connects and uploads all samples
+//     as buck50.py "dump" (buck50.py must not have device open)
+//   - DigitalFormat::BIN file, e.g. "dump digital-frmt=bin"
+//   - anything else: raw little-endian uint32_t sample words, as b50export
+class MergeUnit {
+  public:
+    static const size_t     BUFFER = 1 << 18;  // bytes
+
+    // trim as buck50.py "configure trim=observed/desired"
+    MergeUnit(const char           *source,
+              const std::string    &name  ,
+              const double          trim  );
+    ~MergeUnit();
+
+    bool open  ();  // device: connect and check identity
+    bool upload();  // device: start sending samples, no-op for files
+
+    const std::string&  source() const { return _source; }
+    const std::string&  name  () const { return _name  ; }
+    const std::string&  error () const { return _error ; }
+
+    uint64_t    num_samples() const { return _num_samples; }
+
+  protected:
+    friend class SampleMerger;
+
+    enum class Format {
+        WORDS ,
+        PACKED,  // "logic mode=packed", see buck50.py unpack_samples()
+        BIN   ,
+    };
+
+    bool        fail     (const char        *what   );
+    bool        write_all(const void        *data   ,
+                          const size_t       len    );
+    bool        read_all (      void        *data   ,
+                          const size_t       len    ,
+                          const int          timeout);  // milliseconds
+    ssize_t     fill     ();                           // read available
+    bool        decode   (      uint64_t    &tcks   ,
+                                uint8_t     &bits   );
+    bool        done     () const
+    {
+        return _device ? _remaining == 0 && _head == _tail
+                       : _eof            && _head == _tail;
+    }
+
+    size_t      buffered () const { return _tail - _head; }
+
+    std::string      _source     ,
+                     _name       ,
+                     _error      ;
+    double           _trim       ,
+                     _cpu_hz     ,  // from BIN file, else SampleMerger's
+                     _divisor    ;
+    uint8_t         *_buf        ;
+    size_t           _head       ,
+                     _tail       ;
+    uint64_t         _remaining  ,  // bytes still to read from device
+                     _num_samples,
+                     _tcks       ,
+                     _time       ;  // VCD timestamp of pending change
+    uint32_t         _prev       ;
+    unsigned         _fulls      ;  // PACKED: full words before halfwords
+    int              _fd         ;
+    Format           _format     ;
+    uint8_t          _bits       ,  // bits of pending change
+                     _last       ;  // bits last written to VCD
+    bool             _device     ,
+                     _eof        ,
+                     _first      ,
+                     _started    ;
+};  // class MergeUnit
+
+
+
+class SampleMerger {
+  public:
+    // no reply from device within this
+    static const int    TIMEOUT_MS = 2000;
+
+    // config.format ignored, always VCD
+    SampleMerger(const DigitalConfig   &config,
+                       OutBuf          &out   );
+
+    void add(MergeUnit  *unit) { _units.push_back(unit); }
+
+    bool merge();  // header, samples, PulseView trailing edge if configured
+
+    uint64_t            num_samples() const;
+    uint64_t            edges      () const { return _edges; }
+    const std::string&  error      () const { return _error; }
+
+  protected:
+    bool next(MergeUnit     &unit);  // decode to unit's next change
+    bool fill(MergeUnit     &unit);  // wait for unit's data, reading all
+    void vcd (MergeUnit     &unit ,
+              const unsigned ndx  );
+
+    const DigitalConfig                &_config;
+          OutBuf                       &_out   ;
+          std::vector<MergeUnit*>       _units ;
+          std::vector<std::string>      _ids   ;  // VCD identifier codes
+          std::string                   _error ;
+          uint64_t                      _edges ;
+          uint8_t                       _mask  ;  // active channels
+};  // class SampleMerger
+
+}  // namespace buck50
+
+#endif  // ifndef SAMPLE_MERGE_HXX
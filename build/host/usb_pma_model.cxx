@@ -0,0 +1,260 @@
+// buck50: Test and measurement firmware for “Blue Pill” STM32F103 development board
+// Copyright (C) 2019,2020 Mark R. Rubin aka "thanks4opensource"
+//
+// This file is part of buck50.
+//
+// The buck50 program is free software: you can redistribute it
+// and/or modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The buck50 program is distributed in the hope that it will be
+// useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+// of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// (LICENSE.txt) along with the buck50 program.  If not, see
+// <https://www.gnu.org/licenses/gpl.html>
+
+
+#include <cmath>
+
+#include "usb_pma_model.hxx"
+
+
+namespace buck50 {
+
+PmaEndpoint::PmaEndpoint(
+const bool  dbl_buf)
+:   _seq       {0, 0         },
+    _queued    {0, 0         },
+    _count     {0, 0         },
+    _overwrites(0            ),
+    _stales    (0            ),
+    _in_flight (-1           ),
+    _stat_tx   (StatTx::NAK  ),  // as UsbDev::reset()
+    _dbl_buf   (dbl_buf      ),
+    _dtog_tx   (false        ),
+    _sw_buf    (false        ),
+    _ctr_tx    (false        )
+{
+}
+
+
+
+void PmaEndpoint::writ(
+const unsigned  buffer,
+const uint32_t  seq   ,
+const uint16_t  count )
+{
+    if (_queued[buffer] || _in_flight == static_cast<int>(buffer))
+        ++_overwrites;
+
+    _seq  [buffer] = seq  ;
+    _count[buffer] = count;
+}
+
+
+
+// Single-buffered: handing over buffer 0. Double-buffered: re-enable
+// after peripheral set NAK (both empty), hand-over is toggle_sw_buf().
+void PmaEndpoint::set_valid()
+{
+    if (!_dbl_buf)
+        _queued[0] = 1;
+
+    _stat_tx = StatTx::VALID;
+}
+
+
+
+void PmaEndpoint::toggle_sw_buf()
+{
+    _queued[_sw_buf] = 1      ;
+    _sw_buf          = !_sw_buf;
+}
+
+
+
+int PmaEndpoint::in_token()
+{
+    if (_stat_tx != StatTx::VALID)
+        return -1;
+
+    _in_flight = _dbl_buf ? _dtog_tx : 0;
+
+    if (!_queued[_in_flight])
+        ++_stales;
+
+    return _in_flight;
+}
+
+
+
+// DATA0/DATA1 toggle after each ACKed transaction. Double-buffered: both
+// empty when peripheral's next buffer is application's next one.
+uint32_t PmaEndpoint::in_ack()
+{
+    const int   buffer = _in_flight;
+
+    _queued[buffer] = 0       ;
+    _in_flight      = -1      ;
+    _ctr_tx         = true    ;
+    _dtog_tx        = !_dtog_tx;
+
+    if (!_dbl_buf || _dtog_tx == _sw_buf)
+        _stat_tx = StatTx::NAK;
+
+    return _seq[buffer];
+}
+
+
+
+
+bool EndpointDriver::send(
+const uint32_t  seq   ,
+const uint16_t  length)
+{
+    if (!_ready)
+        return false;
+
+    if (_dbl_buf) {
+        const bool  sw_buf  = _endpoint.sw_buf (),
+                    dtog_tx = _endpoint.dtog_tx();
+
+        _endpoint.writ(sw_buf, seq, length);
+
+        if (sw_buf != dtog_tx)
+            _ready = false;
+
+        _endpoint.toggle_sw_buf();
+
+        if (_endpoint.stat_tx() == StatTx::NAK)
+            _endpoint.set_valid();
+
+        return true;
+    }
+
+    _endpoint.writ(0, seq, length);
+    _endpoint.set_valid();
+    _ready = false;
+
+    return true;
+}
+
+
+
+void EndpointDriver::ctr()
+{
+    if (_endpoint.ctr_tx()) {
+        _ready = true;
+        _endpoint.clear_ctr_tx();
+    }
+}
+
+
+
+
+// Three event sources, earliest first (ties: CPU, IRQ, bus):
+//   CPU  send_samples() has filled send_buf and calls usb_send(), which
+//        either copies to PMA (ready only goes false in send() so can
+//        test at start of copy, hand over at end) or waits ("wfi") for
+//        USB interrupt
+//   IRQ  USB interrupt handler after CTR_TX, preempts CPU
+//   bus  host IN token (NAKed or starts transaction), or transaction ACK
+UsbSimResult usb_sim(
+const UsbSimConfig  &config)
+{
+    static const double     NEVER = HUGE_VAL;
+
+    PmaEndpoint     endpoint(config.dbl_buf)          ;
+    EndpointDriver  driver  (endpoint, config.dbl_buf);
+    UsbSimResult    result  = {0, 0, 0, 0, 0, 0, 0.0};
+
+    uint64_t    next_seq  = 0             ,
+                expect    = 0             ;
+    double      cpu_at    = config.fill_ns,
+                irq_at    = NEVER         ,
+                irq_done  = 0.0           ,
+                bus_at    = config.sof_ns ;
+    bool        waiting   = false         ,
+                copying   = false         ,
+                xfer      = false         ;
+
+    while (result.packets < config.packets) {
+        const double    cpu = waiting || next_seq == config.packets
+                              ? NEVER : cpu_at                     ;
+
+        if (cpu <= irq_at && cpu <= bus_at) {
+            if (copying) {  // buffer handed over at end of copy
+                driver.send(next_seq++, 64);
+                copying = false         ;
+                cpu_at += config.fill_ns;
+            }
+            else if (driver.ready()) {
+                copying = true         ;
+                cpu_at += config.pma_ns;
+            }
+            else
+                waiting = true;  // wfi
+        }
+
+        else if (irq_at <= bus_at) {
+            driver.ctr();
+            irq_done = irq_at + config.irq_ns;
+
+            if (waiting) {
+                waiting = false   ;
+                cpu_at  = irq_done;
+            }
+            else if (cpu_at > irq_at)
+                cpu_at += config.irq_ns;
+
+            irq_at = NEVER;
+        }
+
+        else if (xfer) {
+            const uint32_t  seq = endpoint.in_ack();
+
+            if (seq != expect)
+                ++result.out_of_order;
+            expect = seq + 1;
+            ++result.packets;
+            xfer = false;
+
+            if (irq_at == NEVER)
+                irq_at = bus_at > irq_done ? bus_at : irq_done;
+        }
+
+        else {
+            const double    frame_end = (  floor(bus_at / config.frame_ns)
+                                         + 1                              )
+                                        * config.frame_ns                  ;
+
+            // host schedules no transaction which can't finish in frame
+            if (bus_at + config.packet_ns > frame_end) {
+                bus_at = frame_end + config.sof_ns;
+                continue;
+            }
+
+            if (endpoint.in_token() >= 0) {
+                xfer    = true            ;
+                bus_at += config.packet_ns;
+            }
+            else {
+                ++result.naks;
+                bus_at += config.nak_ns + config.retry_ns;
+            }
+        }
+    }
+
+    result.frames     = static_cast<uint64_t>(ceil(bus_at / config.frame_ns));
+    result.seconds    = bus_at / 1e9          ;
+    result.overwrites = endpoint.overwrites() ;
+    result.stales     = endpoint.stales    () ;
+
+    return result;
+}
+
+}  // namespace buck50
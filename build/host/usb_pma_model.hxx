@@ -0,0 +1,158 @@
+// buck50: Test and measurement firmware for “Blue Pill” STM32F103 development board
+// Copyright (C) 2019,2020 Mark R. Rubin aka "thanks4opensource"
+//
+// This file is part of buck50.
+//
+// The buck50 program is free software: you can redistribute it
+// and/or modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The buck50 program is distributed in the hope that it will be
+// useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+// of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// (LICENSE.txt) along with the buck50 program.  If not, see
+// <https://www.gnu.org/licenses/gpl.html>
+
+
+// Host-side model of STM32F10xx USB peripheral bulk IN endpoint (EPR
+// STAT_TX/DTOG_TX/SW_BUF/CTR_TX bits and PMA packet buffer(s)), firmware
+// UsbDev send()/dbl_buf_send()/ctr() logic driving it, and an event-driven
+// simulation of send_samples() upload against a full-speed host. Checks
+// ping-pong invariants (no write to queued or in-flight buffer, packets
+// received in order) and measures throughput, single- vs double-buffered,
+// without a board.
+
+
+#ifndef USB_PMA_MODEL_HXX
+#define USB_PMA_MODEL_HXX
+
+#define USB_PMA_MODEL_MAJOR_VERSION   1
+#define USB_PMA_MODEL_MINOR_VERSION   0
+#define USB_PMA_MODEL_MICRO_VERSION   0
+
+#include <cstdint>
+
+
+namespace buck50 {
+
+// As Usb::Epr STAT_TX_XXX
+enum class StatTx {
+    DISABLED = 0b00,
+    STALL    = 0b01,
+    NAK      = 0b10,
+    VALID    = 0b11,
+};
+
+
+// Peripheral side of one IN endpoint, as per RM0008 "Double-buffered
+// endpoints". Buffer 0 is addr_tx/count_tx, buffer 1 addr_rx/count_rx.
+class PmaEndpoint {
+  public:
+    PmaEndpoint(const bool  dbl_buf);
+
+    // firmware side: EPR reads, PMA write, EPR toggle-bit writes
+    bool        dtog_tx() const { return _dtog_tx; }
+    bool        sw_buf () const { return _sw_buf ; }
+    StatTx      stat_tx() const { return _stat_tx; }
+    bool        ctr_tx () const { return _ctr_tx ; }
+
+    void        writ      (const unsigned   buffer ,  // writ_pma_data()
+                           const uint32_t   seq    ,
+                           const uint16_t   count  );
+    void        toggle_sw_buf();                      // write(DTOG_RX_DATA1)
+    void        set_valid    ();                      // stat_tx(VALID)
+    void        clear_ctr_tx () { _ctr_tx = false; }
+
+    // host side: IN token. Returns buffer number transmitted, or -1 if NAK.
+    int         in_token();
+    // host side: ACK of in_token() data; returns packet's sequence number
+    uint32_t    in_ack  ();
+
+    // invariant violations seen by writ() and in_token()
+    uint64_t    overwrites() const { return _overwrites; }
+    uint64_t    stales    () const { return _stales    ; }
+
+  protected:
+    uint32_t    _seq       [2],
+                _queued    [2];   // bool, written and handed over
+    uint16_t    _count     [2];
+    uint64_t    _overwrites    ,
+                _stales        ;
+    int         _in_flight     ;  // buffer, or -1
+    StatTx      _stat_tx       ;
+    bool        _dbl_buf       ,
+                _dtog_tx       ,
+                _sw_buf        ,
+                _ctr_tx        ;
+};  // class PmaEndpoint
+
+
+
+// Firmware side, mirrors UsbDev::send(), UsbDev::dbl_buf_send(), and
+// CTR_TX handling in UsbDev::ctr()
+class EndpointDriver {
+  public:
+    EndpointDriver(PmaEndpoint  &endpoint,
+                   const bool    dbl_buf )
+    :   _endpoint(endpoint),
+        _ready   (true    ),   // as _send_readys_pending after configure
+        _dbl_buf (dbl_buf )
+    {}
+
+    bool    ready() const { return _ready; }
+    bool    send (const uint32_t   seq   ,
+                  const uint16_t   length);
+    void    ctr  ();
+
+  protected:
+    PmaEndpoint    &_endpoint;
+    bool            _ready   ,
+                    _dbl_buf ;
+};  // class EndpointDriver
+
+
+
+// Times in nanoseconds. CPU costs default from approximate Cortex-M3
+// cycle counts at 72 MHz; bus costs from USB 2.0 full-speed bulk
+// transaction sizes (64 data + 13 protocol overhead bytes, at most 19
+// per 1 ms frame).
+struct UsbSimConfig {
+    static constexpr double     CPU_NS = 1e9 / 72e6;
+
+    uint64_t    packets     = 20000            ;  // 64-byte upload packets
+    bool        dbl_buf     = true             ;
+    double      fill_ns     = 130 * CPU_NS     ,  // send_samples(), 16 words
+                pma_ns      = 280 * CPU_NS     ,  // usb_send()/writ_pma_data()
+                irq_ns      = 150 * CPU_NS     ,  // USB IRQ entry, ctr(), exit
+                packet_ns   = 77 * 8 / 12e6 * 1e9,  // IN + DATA + ACK
+                nak_ns      = 3000             ,  // IN + NAK
+                retry_ns    = 0                ,  // host NAK re-poll delay
+                frame_ns    = 1e6              ,
+                sof_ns      = 3000             ;
+};  // struct UsbSimConfig
+
+
+struct UsbSimResult {
+    uint64_t    packets     ,
+                naks        ,
+                frames      ,
+                out_of_order,
+                overwrites  ,
+                stales      ;
+    double      seconds     ;  // simulated bus time
+
+    double      bytes_per_sec    () const { return packets * 64 / seconds; }
+    double      packets_per_frame() const { return double(packets) / frames; }
+    bool        ok() const { return !out_of_order && !overwrites && !stales; }
+};  // struct UsbSimResult
+
+
+UsbSimResult    usb_sim(const UsbSimConfig  &config);
+
+}  // namespace buck50
+
+#endif  // ifndef USB_PMA_MODEL_HXX
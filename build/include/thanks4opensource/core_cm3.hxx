@@ -37,8 +37,8 @@
 #endif
 
 #define ARM_CORE_CM3_MAJOR_VERSION  1
-#define ARM_CORE_CM3_MINOR_VERSION  0
-#define ARM_CORE_CM3_MICRO_VERSION  1
+#define ARM_CORE_CM3_MINOR_VERSION  1
+#define ARM_CORE_CM3_MICRO_VERSION  0
 
 
 using namespace regbits;
@@ -210,7 +210,7 @@ struct SysTick {
 
     // any MSBs > Load::RELOAD_MAX are RAZ
     // any write to register clears all bits
-                 uint32_t   val;
+    REGBITS_WORD(uint32_t)  val;
     static const uint32_t   VAL_MAX = 0xffffff;
 
 
@@ -267,7 +267,7 @@ struct Nvic {
             return _interrupts[static_cast<unsigned>(irqn) >> 5];
         }
 
-        volatile uint32_t   _interrupts[NUM_INTERRUPT_REGS];
+        volatile REGBITS_WORD(uint32_t)     _interrupts[NUM_INTERRUPT_REGS];
     };  // struct IntrptRegs
 
 
@@ -980,6 +980,89 @@ static_assert(sizeof(Scb) == 4*(16+2+4+5+5)+12,
              "sizeof(Scb) != 4*(16+2+4+5+5)+12");
 
 
+struct Dwt {
+    struct Ctrl {
+        using            pos_t = regbits::Pos<uint32_t, Ctrl>;
+        static constexpr pos_t
+               NUMCOMP_POS = pos_t(28),
+             CYCEVTENA_POS = pos_t(22),
+            FOLDEVTENA_POS = pos_t(21),
+             LSUEVTENA_POS = pos_t(20),
+           SLEEPEVTENA_POS = pos_t(19),
+             EXCEVTENA_POS = pos_t(18),
+             CPIEVTENA_POS = pos_t(17),
+             EXCTRCENA_POS = pos_t(16),
+            PCSAMPLENA_POS = pos_t(12),
+             CYCCNTENA_POS = pos_t( 0);
+
+        using            bits_t = regbits::Bits<uint32_t, Ctrl>;
+        static constexpr bits_t
+            CYCEVTENA        = bits_t(1,    CYCEVTENA_POS),
+            FOLDEVTENA       = bits_t(1,   FOLDEVTENA_POS),
+            LSUEVTENA        = bits_t(1,    LSUEVTENA_POS),
+            SLEEPEVTENA      = bits_t(1,  SLEEPEVTENA_POS),
+            EXCEVTENA        = bits_t(1,    EXCEVTENA_POS),
+            CPIEVTENA        = bits_t(1,    CPIEVTENA_POS),
+            EXCTRCENA        = bits_t(1,    EXCTRCENA_POS),
+            PCSAMPLENA       = bits_t(1,   PCSAMPLENA_POS),
+            CYCCNTENA        = bits_t(1,    CYCCNTENA_POS);
+
+        static const uint32_t
+                 NUMCOMP_MASK = 0xFUL;
+    };  // struct Ctrl
+    using ctrl_t = regbits::Reg<uint32_t, Ctrl>;
+          ctrl_t   ctrl;
+
+
+    // free-running core clock count, counts up, wraps at 2**32
+    // only counts while Ctrl::CYCCNTENA and CoreDebug::Demcr::TRCENA
+    REGBITS_WORD(uint32_t)  cyccnt  ,
+                            cpicnt  ,
+                            exccnt  ,
+                            sleepcnt,
+                            lsucnt  ,
+                            foldcnt ,
+                            pcsr    ;
+
+};  // struct Dwt
+static_assert(sizeof(Dwt) == 32, "sizeof(Dwt) != 32");
+
+
+
+struct CoreDebug {
+    REGBITS_WORD(uint32_t)  dhcsr,
+                            dcrsr,
+                            dcrdr;
+
+    struct Demcr {
+        using            pos_t = regbits::Pos<uint32_t, Demcr>;
+        static constexpr pos_t
+                 TRCENA_POS = pos_t(24),
+                MON_REQ_POS = pos_t(19),
+               MON_STEP_POS = pos_t(18),
+               MON_PEND_POS = pos_t(17),
+                 MON_EN_POS = pos_t(16),
+             VC_HARDERR_POS = pos_t(10),
+           VC_CORERESET_POS = pos_t( 0);
+
+        using            bits_t = regbits::Bits<uint32_t, Demcr>;
+        static constexpr bits_t
+            TRCENA           = bits_t(1,       TRCENA_POS),  // enables DWT
+            MON_REQ          = bits_t(1,      MON_REQ_POS),
+            MON_STEP         = bits_t(1,     MON_STEP_POS),
+            MON_PEND         = bits_t(1,     MON_PEND_POS),
+            MON_EN           = bits_t(1,       MON_EN_POS),
+            VC_HARDERR       = bits_t(1,   VC_HARDERR_POS),
+            VC_CORERESET     = bits_t(1, VC_CORERESET_POS);
+    };  // struct Demcr
+    using demcr_t = regbits::Reg<uint32_t, Demcr>;
+          demcr_t   demcr;
+
+};  // struct CoreDebug
+static_assert(sizeof(CoreDebug) == 16, "sizeof(CoreDebug) != 16");
+
+
+
 
 
 static const uint32_t   SCS_BASE       = 0xE000E000UL,
@@ -1000,6 +1083,8 @@ ARM_REG_GROUP(ScnScb,   scn_scb,    SCS_BASE    );
 ARM_REG_GROUP(SysTick,  sys_tick,   SYSTICK_BASE);
 ARM_REG_GROUP(Nvic,     nvic,       NVIC_BASE   );
 ARM_REG_GROUP(Scb,      scb,        SCB_BASE    );
+ARM_REG_GROUP(Dwt,      dwt,        DWT_BASE    );
+ARM_REG_GROUP(CoreDebug,core_debug, COREDEBUG_BASE);
 
 #undef ARM_REG_GROUP
 
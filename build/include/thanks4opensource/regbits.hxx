@@ -26,6 +26,16 @@
 #define REGBITS_MICRO_VERSION   2
 
 
+// Host simulation (build/sim) replaces register storage with class which
+// models peripheral on every read and write. See regbits_sim.hxx.
+#ifdef REGBITS_SIM
+#include <regbits_sim.hxx>
+#define REGBITS_WORD(WORD)  regbits_sim::Word<WORD>
+#else
+#define REGBITS_WORD(WORD)  WORD
+#endif
+
+
 namespace regbits {
 
 // forward refs
@@ -925,7 +935,7 @@ template<typename WORD,  typename CLSS> class Reg {
 
 
   protected:
-    WORD    _word;
+    REGBITS_WORD(WORD)  _word;
 
 
   private:
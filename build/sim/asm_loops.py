@@ -0,0 +1,526 @@
+#!/usr/bin/env python3
+
+# buck50: Test and measurement firmware for “Blue Pill” STM32F103 development board
+# Copyright (C) 2019,2020 Mark R. Rubin aka "thanks4opensource"
+#
+# This file is part of buck50.
+#
+# The buck50 program is free software: you can redistribute it
+# and/or modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation, either version 3 of
+# the License, or (at your option) any later version.
+#
+# The buck50 program is distributed in the hope that it will be
+# useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+# of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# (LICENSE.txt) along with the buck50 program.  If not, see
+# <https:#www.gnu.org/licenses/gpl.html>
+
+
+# Ties sim_asm.cxx's C++ equivalents of the ../src/buck50_asm.s triggering
+# and sampling loops to the real Thumb code:
+#
+#   1) translates buck50_asm.s from GNU as (.altmacro, "#"-less
+#      immediates) to LLVM integrated assembler syntax and assembles it
+#   2) takes code sizes (bytes copied by flash_to_ram) from label symbols
+#      in the resulting object file
+#   3) checks each loop's instruction bytes against the fingerprint
+#      recorded with its measured cycle counts in asm_loops.txt, failing
+#      (so failing the build) if the loop has changed since it was timed
+#   4) writes asm_loops.hxx, included by sim_asm.cxx, with sizes and
+#      cycle counts
+#
+# usage: asm_loops.py buck50_asm.s asm_loops.txt asm_loops.hxx \
+#                     [llvm-mc [llvm-objdump]]
+
+import re
+import subprocess
+import sys
+import tempfile
+import zlib
+
+
+
+REGISTERS = set(['r%d' % reg for reg in range(16)] + ['sp', 'lr', 'pc'])
+
+DIRECTIVE = re.compile(r'^\s*\.')
+LABEL     = re.compile(r'^\s*[\w.&]+:')
+EQU       = re.compile(r'^\s*\.equ\s+(\w+)\s*,')
+REQ       = re.compile(r'^\s*(\w+)\s+\.req\s+(\w+)')
+IDENT     = re.compile(r'[A-Za-z_]\w*')
+
+
+
+def strip_comment(line):
+    for marker in ('//', '#'):
+        # "#" comment only at start of line, else is immediate prefix
+        if marker == '#':
+            if line.lstrip().startswith('#'):
+                return ''
+            continue
+        ndx = line.find(marker)
+        if ndx >= 0:
+            line = line[:ndx]
+    return line.rstrip()
+
+
+
+def immediate(operand, equs):
+    """Add GNU-optional "#" to operand if is numeric or .equ expression"""
+    stripped = operand.strip()
+    if not stripped or stripped[0] in '#{[:' or stripped.startswith('='):
+        return operand
+    first = IDENT.match(stripped)
+    if stripped[0].isdigit() or stripped[0] in '(-~':
+        return ' #' + stripped
+    if first and first.group() in equs:
+        return ' #' + stripped
+    return operand
+
+
+
+def split_operands(text):
+    """Split on top-level commas (not inside [] or {})"""
+    depth, crnt, operands = 0, '', []
+    for char in text:
+        if char in '[{':
+            depth += 1
+        elif char in ']}':
+            depth -= 1
+        if char == ',' and depth == 0:
+            operands.append(crnt)
+            crnt = ''
+        else:
+            crnt += char
+    operands.append(crnt)
+    return operands
+
+
+
+def instruction(line, equs, regs):
+    match = re.match(r'^(\s*)(\S+)(\s*)(.*)$', line)
+    indent, opcode, space, rest = match.groups()
+    if not rest or opcode.lower().startswith(('b', 'cb', 'it', 'tb')) \
+                   and not opcode.lower().startswith(('bic', 'bfc', 'bfi')):
+        return line
+    operands = []
+    for operand in split_operands(rest):
+        if operand.strip().startswith('['):
+            inner = operand.strip()[1:].rstrip(']!').rstrip()
+            suffix = operand.strip()[len(operand.strip().rstrip(']!')):]
+            parts = split_operands(inner)
+            parts[0] = parts[0].strip().lower() \
+                       if parts[0].strip().lower() in regs else parts[0]
+            parts = [parts[0]] + [immediate(part, equs) for part in parts[1:]]
+            operand = ' [' + ','.join(parts) + suffix
+        elif len(operands) > 0:
+            operand = immediate(operand, equs)
+        operands.append(operand)
+    return indent + opcode + space + ','.join(operands)
+
+
+
+def translate(source):
+    """GNU as .altmacro buck50_asm.s to LLVM integrated assembler syntax"""
+    equs  = set()
+    regs  = set(REGISTERS)
+    lines = []
+    macro = None  # (params, locals)
+    for line in source.splitlines():
+        code = strip_comment(line)
+        if re.match(r'^\s*\.(psize|altmacro)\b', code):
+            continue
+        equ = EQU.match(code)
+        if equ:
+            equs.add(equ.group(1))
+        req = REQ.match(code)
+        if req:
+            regs.add(req.group(1))
+        start = re.match(r'^\s*\.macro\s+(\w+)(.*)$', code)
+        if start:
+            macro = (re.findall(r'\w+', start.group(2)), [])
+            lines.append(code)
+            continue
+        if re.match(r'^\s*\.endm\b', code):
+            macro = None
+            lines.append(code)
+            continue
+        if macro is not None:
+            params, local = macro
+            declared = re.match(r'^\s*LOCAL\s+(\w+)', code)
+            if declared:
+                local.append(declared.group(1))
+                continue
+            def substitute(match):
+                word = match.group()
+                if word in params:
+                    return '\\' + word + '\\()'
+                if word in local:
+                    return word + '_\\@'
+                return word
+            code = IDENT.sub(substitute, code).replace('\\()&', '\\()')
+        if code.strip() and not DIRECTIVE.match(code) \
+                        and not LABEL.match(code) \
+                        and not REQ.match(code):
+            code = instruction(code, equs, regs)
+        lines.append(code)
+    return '\n'.join(lines) + '\n'
+
+
+
+def assemble(source, llvm_mc):
+    with tempfile.TemporaryDirectory() as tmpdir:
+        asm = tmpdir + '/buck50_asm.s'
+        obj = tmpdir + '/buck50_asm.o'
+        with open(asm, 'w') as file:
+            file.write(translate(source))
+        subprocess.run([llvm_mc, '-triple=thumbv7m-none-eabi',
+                        '-mcpu=cortex-m3', '-filetype=obj', asm, '-o', obj],
+                       check=True)
+        with open(obj, 'rb') as file:
+            return file.read()
+
+
+
+#
+# object code
+#
+
+INSTRUCTION = re.compile(r'^\s*([0-9a-f]+):\s+((?:[0-9a-f]{2} )+)\s*(\S+)\s*(.*)$')
+SYMBOL      = re.compile(r'^([0-9a-f]+) [lg]\s.*\s\.text\s+[0-9a-f]+ ([\w.]+)$')
+CONDITIONS  = set(('eq', 'ne', 'cs', 'hs', 'cc', 'lo', 'mi', 'pl',
+                   'vs', 'vc', 'hi', 'ls', 'ge', 'lt', 'gt', 'le'))
+BRANCHES    = set(('b', 'bl', 'bx', 'blx', 'cbz', 'cbnz', 'tbb', 'tbh'))
+
+
+class Instruction(object):
+    def __init__(self, address, code, mnemonic, operands, in_it):
+        self.address  = address
+        self.code     = code
+        self.mnemonic = mnemonic
+        self.operands = operands.split('@')[0].strip()
+
+        base = mnemonic.split('.')[0]
+        if in_it and base[-2:] in CONDITIONS:
+            base, self.conditional = base[:-2], True
+        elif base[0] == 'b' and base[1:] in CONDITIONS:
+            base, self.conditional = 'b', True
+        else:
+            self.conditional = base in ('cbz', 'cbnz')
+        self.base = base
+
+        targets = re.findall(r'0x([0-9a-f]+)', self.operands)
+        writes_pc = re.match(r'^pc\b', self.operands)  # mov pc, ... etc
+        self.branch = base in BRANCHES or bool(writes_pc)
+        self.target = int(targets[0], 16) \
+                      if self.branch and targets and not writes_pc else None
+
+        memory = re.search(r'\[(\w+)', self.operands)
+        self.base_reg = memory.group(1) if memory else None
+        self.load     = base.startswith(('ldr', 'ldm', 'pop'))
+        self.store    = base.startswith(('str', 'stm', 'push'))
+
+
+
+def disassemble(obj, llvm_objdump):
+    """instructions in address order and {label: address}"""
+    with tempfile.TemporaryDirectory() as tmpdir:
+        path = tmpdir + '/buck50_asm.o'
+        with open(path, 'wb') as file:
+            file.write(obj)
+        listing = subprocess.run([llvm_objdump, '-d', '-t',
+                                  '--triple=thumbv7m-none-eabi',
+                                  '--mcpu=cortex-m3', path],
+                                 check=True, capture_output=True, text=True)
+    instructions, labels, in_it = [], {}, 0
+    for line in listing.stdout.splitlines():
+        symbol = SYMBOL.match(line)
+        if symbol:
+            labels[symbol.group(2)] = int(symbol.group(1), 16)
+            continue
+        match = INSTRUCTION.match(line)
+        if not match:
+            continue
+        address, code, mnemonic, operands = match.groups()
+        instructions.append(Instruction(int(address, 16),
+                                        bytes.fromhex(code),
+                                        mnemonic,
+                                        operands,
+                                        in_it > 0))
+        if in_it:
+            in_it -= 1
+        if mnemonic.startswith('it'):
+            in_it = len(mnemonic) - 1
+    return instructions, labels
+
+
+
+#
+# cycle model
+#
+
+class Model(object):
+    """Cortex-M3 TRM cycle counts plus STM32F103 bus penalties"""
+
+    def __init__(self, costs):
+        self.costs = costs
+
+    def cycles(self, path, mem, buses):
+        """path is [(instruction, taken)], mem 0 for RAM, 1 for flash"""
+        costs, total, loaded = self.costs, 0, False
+        for (insn, taken) in path:
+            bus = buses.get(insn.base_reg, 'sram')
+            if insn.branch and taken:
+                cycles = costs['taken'] + (costs['ram'] if mem == 0 else 0)
+            elif insn.load:
+                cycles = costs['pipelined'] if loaded else costs['load']
+                if bus == 'apb':
+                    cycles += costs['apb']
+                if mem == 0 and bus != 'ppb':
+                    cycles += costs['ram']
+            elif insn.store:
+                cycles = costs['store']
+                if mem == 0 and bus != 'ppb':
+                    cycles += costs['ram']
+            else:
+                cycles = costs['alu']
+            loaded = insn.load and not insn.branch
+            total += cycles
+        return total
+
+
+
+class Code(object):
+    def __init__(self, instructions, labels):
+        self.instructions = instructions
+        self.labels       = labels
+        self.index        = dict((insn.address, ndx)
+                                 for (ndx, insn) in enumerate(instructions))
+        if instructions:  # label at end of code
+            self.index[  instructions[-1].address
+                       + len(instructions[-1].code)] = len(instructions)
+
+    def locate(self, spec):
+        """label or label+N (N instructions) to instruction index"""
+        label, _, count = spec.partition('+')
+        if label not in self.labels:
+            raise ValueError('no label "%s" in object code' % label)
+        return self.index[self.labels[label]] + (int(count) if count else 0)
+
+    def segment(self, spec):
+        """from..to, or from.. through first unconditional branch"""
+        beg, _, end = spec.partition('..')
+        first = self.locate(beg)
+        if end:
+            segment = self.instructions[first:self.locate(end)]
+            while len(segment) > 1 and segment[-1].base == 'nop' \
+                                   and segment[-2].branch        \
+                                   and not segment[-2].conditional:
+                segment = segment[:-1]  # .balign padding after loop
+            return segment
+        last = first
+        while not (    self.instructions[last].branch
+                   and not self.instructions[last].conditional):
+            last += 1
+        return self.instructions[first:last + 1]
+
+    def bytes(self, spec):
+        beg, _, end = spec.partition('..')
+        return self.labels[end] - self.labels[beg]
+
+    def path(self, specs, exit=None):
+        """[(instruction, taken)] through segments, checking branches"""
+        segments = [self.segment(spec) for spec in specs]
+        path     = []
+        for (ndx, segment) in enumerate(segments):
+            follow = segments[(ndx + 1) % len(segments)][0].address
+            if exit and ndx == len(segments) - 1:
+                follow = self.instructions[self.locate(exit)].address
+            for (pos, insn) in enumerate(segment):
+                last = pos == len(segment) - 1
+                if not insn.branch:
+                    path.append((insn, False))
+                    continue
+                if not last:
+                    if not insn.conditional:
+                        raise ValueError('%s: unconditional branch at %x '
+                                         'inside segment' % (specs[ndx],
+                                                             insn.address))
+                    path.append((insn, False))
+                    continue
+                if insn.target is not None and insn.target != follow:
+                    raise ValueError('%s: branch at %x to %x, not next '
+                                     'segment %x' % (specs[ndx], insn.address,
+                                                     insn.target, follow))
+                path.append((insn, True))
+        return path
+
+
+
+#
+# asm_loops.txt and asm_loops.hxx
+#
+
+def fingerprint(path):
+    return '%08x' % zlib.crc32(b''.join(insn.code for (insn, _) in path))
+
+
+
+def parse_buses(field):
+    buses = {}
+    if field != '-':
+        for item in field.split(','):
+            reg, _, bus = item.partition('=')
+            buses[reg] = bus
+    return buses
+
+
+
+def c_array(values):
+    if isinstance(values, list):
+        return '{' + ', '.join(c_array(value) for value in values) + '}'
+    return '%3d' % values
+
+
+
+def generate(code, table_path):
+    """returns (errors, [(type, name, dims, values, comment)])"""
+    model, errors = None, []
+    consts, cycles = [], {}
+
+    def add_cycles(name, values):  # values is [ram, flash]
+        if name not in cycles:
+            cycles[name] = []
+            consts.append(('uint8_t', name, cycles[name]))
+        cycles[name].append(values)
+
+    for (number, line) in enumerate(open(table_path), 1):
+        fields = line.split('#')[0].split()
+        if not fields:
+            continue
+        where = '%s:%d' % (table_path, number)
+        kind  = fields[0]
+        try:
+            if kind == 'model':
+                model = Model(dict((key, int(value))
+                                   for (key, _, value)
+                                   in (field.partition('=')
+                                       for field in fields[1:])))
+                consts.append(('uint8_t', 'COMPILED_ALU',
+                               model.costs['alu']))
+                consts.append(('uint8_t', 'COMPILED_LOAD',
+                                 model.costs['load'] + model.costs['apb']
+                               + model.costs['ram']))
+                consts.append(('uint8_t', 'COMPILED_TAKEN',
+                               model.costs['taken'] + model.costs['ram']))
+
+            elif kind == 'bytes':
+                values = [code.bytes(spec) for spec in fields[2:]]
+                consts.append(('uint16_t', fields[1],
+                               values if len(values) > 1 else values[0]))
+
+            elif kind == 'measured':
+                name, buses, spec, crc, ram, flash = fields[1:]
+                path     = code.path([spec])
+                measured = [[int(value) for value in ram  .split(',')],
+                            [int(value) for value in flash.split(',')]]
+                if fingerprint(path) != crc:
+                    errors.append('%s: %s code changed (fingerprint %s, '
+                                  'was %s): re-measure cycles and update'
+                                  % (where, name, fingerprint(path), crc))
+                for mem in (0, 1):
+                    modeled = model.cycles(path, mem, parse_buses(buses))
+                    if abs(sum(measured[mem]) - modeled) > 1:
+                        errors.append('%s: %s %s measured %d cycles, model '
+                                      '%d' % (where, name, ('ram', 'flash')
+                                              [mem], sum(measured[mem]),
+                                              modeled))
+                consts.append(('uint8_t', name,
+                               measured if len(measured[0]) > 1
+                               else [values[0] for values in measured]))
+
+            elif kind == 'cycles':
+                name, buses = fields[1], parse_buses(fields[2])
+                specs   = [field for field in fields[3:]
+                           if field[0] not in '->']
+                minus   = [field[1:] for field in fields[3:]
+                           if field.startswith('-')]
+                exits   = [field[1:] for field in fields[3:]
+                           if field.startswith('>')]
+                path    = code.path(specs, exits[0] if exits else None)
+                values  = [model.cycles(path, mem, buses) for mem in (0, 1)]
+                for other in minus:
+                    values = [value - cycles[other][0][mem]
+                              for (mem, value) in enumerate(values)]
+                if max(values) > 0xff:
+                    raise ValueError('%s %d cycles, more than uint8_t'
+                                     % (name, max(values)))
+                add_cycles(name, values)
+
+            else:
+                errors.append('%s: unknown entry "%s"' % (where, kind))
+        except (ValueError, KeyError, IndexError) as error:
+            errors.append('%s: %s' % (where, error))
+
+    # multiple "cycles" lines for same name: [mem][line]
+    for (ndx, (kind, name, values)) in enumerate(consts):
+        if name in cycles:
+            consts[ndx] = (kind, name,
+                           values[0] if len(values) == 1
+                           else [[line[mem] for line in values]
+                                 for mem in (0, 1)])
+    return errors, consts
+
+
+
+def write_header(consts, source_path, table_path, header_path):
+    with open(header_path, 'w') as file:
+        file.write('// generated by asm_loops.py from %s and %s\n'
+                   '// do not edit\n\n'
+                   '#ifndef ASM_LOOPS_HXX\n'
+                   '#define ASM_LOOPS_HXX\n\n'
+                   '#include <cstdint>\n\n'
+                   'namespace buck50_sim {\n'
+                   'namespace asm_loops {\n\n'
+                   % (source_path, table_path))
+        for (kind, name, values) in consts:
+            dims = ''
+            probe = values
+            while isinstance(probe, list):
+                dims += '[%d]' % len(probe)
+                probe = probe[0]
+            file.write('const %-8s  %-20s = %s;\n'
+                       % (kind, name + dims, c_array(values)))
+        file.write('\n}  // namespace asm_loops\n'
+                   '}  // namespace buck50_sim\n\n'
+                   '#endif  // ifndef ASM_LOOPS_HXX\n')
+
+
+
+def main():
+    if len(sys.argv) < 4:
+        sys.stderr.write('usage: %s buck50_asm.s asm_loops.txt asm_loops.hxx '
+                         '[llvm-mc [llvm-objdump]]\n' % sys.argv[0])
+        sys.exit(1)
+    source_path, table_path, header_path = sys.argv[1:4]
+    llvm_mc      = sys.argv[4] if len(sys.argv) > 4 else 'llvm-mc'
+    llvm_objdump = sys.argv[5] if len(sys.argv) > 5 else 'llvm-objdump'
+
+    with open(source_path) as file:
+        obj = assemble(file.read(), llvm_mc)
+    code = Code(*disassemble(obj, llvm_objdump))
+
+    errors, consts = generate(code, table_path)
+    if errors:
+        for error in errors:
+            sys.stderr.write(error + '\n')
+        sys.exit(1)
+    write_header(consts, source_path, table_path, header_path)
+
+
+
+if __name__ == '__main__':
+    main()
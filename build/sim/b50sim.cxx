@@ -0,0 +1,111 @@
+// buck50: Test and measurement firmware for “Blue Pill” STM32F103 development board
+// Copyright (C) 2019,2020 Mark R. Rubin aka "thanks4opensource"
+//
+// This file is part of buck50.
+//
+// The buck50 program is free software: you can redistribute it
+// and/or modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The buck50 program is distributed in the hope that it will be
+// useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+// of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// (LICENSE.txt) along with the buck50 program.  If not, see
+// <https://www.gnu.org/licenses/gpl.html>
+
+
+// Runs buck50 firmware (src/buck50.cxx, compiled for host) on simulated
+// STM32F103 with its USB CDC-ACM port on a pseudo-terminal, so unmodified
+// buck50.py can connect:
+//     $ ./b50sim -s signals.stim
+//     /dev/pts/7
+//     $ ../../buck50.py /dev/pts/7
+// Simulated time paced to wall clock unless "-f". See stimulus.hxx for
+// GPIO input file format.
+
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "sim_mcu.hxx"
+
+
+int buck50_main();  // src/buck50.cxx main(), renamed by Makefile
+
+
+namespace {
+
+const char  USAGE[] =
+"usage: %s [-s stimulus] [-f]\n"
+"  -s  GPIO input stimulus file (default all inputs undriven)\n"
+"  -f  free-running, don't pace simulated time to wall clock\n";
+
+}  // namespace
+
+
+
+int main(
+int          argc,
+char *const  argv[])
+{
+    buck50_sim::Stimulus    stimulus       ;
+    bool                    paced   = true ;
+    int                     option         ;
+
+    while ((option = getopt(argc, argv, "s:f")) != -1)
+        switch (option) {
+            case 's':
+                if (!stimulus.load(optarg)) {
+                    fprintf(stderr, "%s\n", stimulus.error().c_str());
+                    return 1;
+                }
+                break;
+
+            case 'f':
+                paced = false;
+                break;
+
+            default:
+                fprintf(stderr, USAGE, argv[0]);
+                return 1;
+        }
+
+    if (optind != argc) {
+        fprintf(stderr, USAGE, argv[0]);
+        return 1;
+    }
+
+    const int   master = posix_openpt(O_RDWR | O_NOCTTY);
+
+    if (master < 0 || grantpt(master) || unlockpt(master)) {
+        perror("pseudo-terminal");
+        return 1;
+    }
+
+    // keep slave open so master doesn't see EIO between host connections,
+    // and raw so bytes pass through unchanged
+    const char  *slave_name = ptsname(master)              ;
+    const int    slave      = open(slave_name, O_RDWR | O_NOCTTY);
+    termios      raw                                       ;
+
+    tcgetattr(slave, &raw);
+    cfmakeraw(&raw);
+    tcsetattr(slave, TCSANOW, &raw);
+
+    printf("%s\n", slave_name);
+    fflush(stdout);
+
+    buck50_sim::mcu.stimulus(&stimulus);
+    buck50_sim::mcu.start   (master, paced);
+
+    return buck50_main();
+}
@@ -0,0 +1,1393 @@
+// buck50: Test and measurement firmware for “Blue Pill” STM32F103 development board
+// Copyright (C) 2019,2020 Mark R. Rubin aka "thanks4opensource"
+//
+// This file is part of buck50.
+//
+// The buck50 program is free software: you can redistribute it
+// and/or modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The buck50 program is distributed in the hope that it will be
+// useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+// of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// (LICENSE.txt) along with the buck50 program.  If not, see
+// <https://www.gnu.org/licenses/gpl.html>
+
+
+// Cycle-accounted benchmark of buck50 firmware running on simulated
+// STM32F103 (see sim_mcu.hxx), driven over a socket as buck50.py would
+// over USB. All times are simulated 72 MHz cycles, not wall clock.
+//
+// usage: b50simbench [seed]
+//   seed  stimulus random seed, default 50
+//
+// - "logic" each mode=, code-mem=flash and ram: cycles per GPIOB read
+//   and resulting max sampling rate, samples to memory full, and "dump"
+//   upload bytes/sec (USB full-speed bulk limit 1216000).
+// - Trigger latency: input edge to trigger sample over several edge
+//   phases, plain and ganged, "trig-code=interpreted" and "compiled".
+// - Trigger minimum pulse width: shortest input pulse detected at all
+//   phases relative to triggering reads, single bit, 8-bit pattern, and
+//   two-state "OR" chain.
+// - Random trigger tables and inputs: "trig-code=compiled" matches
+//   "interpreted" state sequence, input change causing each state
+//   change, and triggered samples.
+// - "logic mode=stream" duration halt at each phase around filling ring
+//   end, and at several input edge rates until duration or overrun.
+// - "oscope" one and two channels, single channel fast interleaved and
+//   min/max and average decimated, effective vs nominal ADC rate.
+// Captured samples are checked against stimulus: port values in order,
+// and tick deltas within one read period. Exits with error if any
+// check fails.
+
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "sim_asm.hxx"
+#include "sim_mcu.hxx"
+
+
+int buck50_main();  // src/buck50.cxx main(), renamed by Makefile
+
+
+using namespace buck50_sim;
+
+
+namespace {
+
+// buck50.py/buck50.cxx protocol
+const uint8_t   VERS_CMD       =  2,
+                RESET_CMD      =  3,
+                DGTL_CMD       =  6,
+                ANLG_CMD       =  7,
+                UPLD_CMD       =  8,
+                INST_CMD       = 18,
+                SIGN_CMD       = 0xf2;
+const uint8_t   HALT_MEMORY    =  1,
+                HALT_DURATION  =  2,
+                HALT_OVERRUN   =  4;
+const uint8_t   STREAM_SAMPLES =  1,
+                STREAM_END     =  2;
+const uint8_t   MODE_MHZ_6     =  0,
+                MODE_IRREGULAR =  1,
+                MODE_UNIFORM   =  2,
+                MODE_MHZ_4     =  3,
+                MODE_STREAM    =  4,
+                MODE_PACKED    =  5,
+                MODE_ANALOG    = 15;  // upload header only
+const uint8_t   CODE_MEM_RAM   =  0,
+                CODE_MEM_FLASH =  1;
+const uint8_t   TRIG_INTERP    =  0,  // TriggerCode
+                TRIG_COMPILED  =  1;
+const uint8_t   INST_REPORT    =  0,  // instrument_command ACTION
+                INST_ENABLE    =  1,
+                INST_DISABLE   =  2;
+const uint8_t   ANLG_INTRLV    = 0x80,  // AnalogMode bits
+                ANLG_MINMAX    = 0x10,
+                ANLG_AVERAGE   = 0x20;
+const uint16_t  UNLIMITED      = 0xffff;
+
+const uint8_t   SIGNATURE[20] = {SIGN_CMD,
+                                 0x9e, 0xc4, 0xaa, 0xdf,
+                                 0xd8, 0xca, 0x8f, 0xbd,
+                                 0xbe, 0xa9, 0xfe, 0x83,
+                                 0x99, 0xd1, 0xae, 0xeb,
+                                 0   , 0   , 0          };
+const uint32_t  IDENTITY      = 0xea017af5;
+
+const char     *MODE_NAMES[]  = {"6.26MHz", "irregular", "uniform",
+                                 "4MHz"   , "stream"   , "packed" };
+const char     *MEM_NAMES []  = {"ram", "flash"};
+const char     *CODE_NAMES[]  = {"interpreted", "compiled"};
+
+const uint64_t  START_DELAY   = 2 * Mcu::CPU_HZ / 1000;  // after idle, 2 ms
+const int       TIMEOUT_MS    = 20000                 ;  // wall clock
+const size_t    MAX_MISSED    = 16                    ;  // consecutive, stream
+
+
+bool    ok   = true;
+int     host = -1  ;
+
+
+
+// deterministic, no <random> distribution implementation differences
+class Lcg {
+  public:
+    Lcg(const uint32_t seed) : _state(seed) {}
+
+    uint32_t operator()()
+    {
+        _state = _state * 6364136223846793005ULL + 1442695040888963407ULL;
+        return _state >> 33;
+    }
+
+  protected:
+    uint64_t    _state;
+};
+
+
+
+// PB4...PB11 changes, all runs, times increasing
+struct Change {
+    uint64_t    time;
+    uint8_t     bits;
+};
+
+class Stimulator {
+  public:
+    Stimulator(Stimulus     &stimulus,
+               const uint32_t seed   )
+    :   _stimulus(stimulus),
+        _rand    (seed    ),
+        _bits    (0       )
+    {
+        _stimulus.byte(0, 0);
+        _history.push_back(Change{0, 0});
+    }
+
+    // num random changes, min...max cycles apart, from at least start
+    // never all ports low or high, see latency()
+    void        random(uint64_t         start,
+                       const unsigned   num  ,
+                       const unsigned   min  ,
+                       const unsigned   max  )
+    {
+        start = std::max(start, _history.back().time + max);
+
+        for (unsigned ndx = 0 ; ndx < num ; ++ndx) {
+            uint8_t     bits;
+            do
+                bits = _bits ^ (1 + _rand() % 0xff);
+            while (bits == 0x00 || bits == 0xff);
+            add(start, bits);
+            start += min + _rand() % (max - min + 1);
+        }
+    }
+
+    void        add(const uint64_t  time,
+                    const uint8_t   bits)
+    {
+        _stimulus.byte(time, bits);
+        _history.push_back(Change{time, bits});
+        _bits = bits;
+    }
+
+    const std::vector<Change>&  history() const { return _history; }
+    uint64_t                    last   () const { return _history.back().time; }
+
+    // first change after time
+    size_t      after(const uint64_t    time)
+    const
+    {
+        return std::upper_bound(_history.begin(),
+                                _history.end  (),
+                                time            ,
+                                [](const uint64_t t, const Change &change)
+                                { return t < change.time; }               )
+               - _history.begin();
+    }
+
+
+  protected:
+    Stimulus               &_stimulus;
+    Lcg                     _rand    ;
+    std::vector<Change>     _history ;
+    uint8_t                 _bits    ;
+
+};  // class Stimulator
+
+
+
+void fail(
+const char  *format,
+...)
+{
+    va_list     args;
+
+    va_start(args, format);
+    printf("FAIL: ");
+    vprintf(format, args);
+    printf("\n");
+    va_end(args);
+
+    ok = false;
+}
+
+
+
+void send(
+const void      *data  ,
+const size_t     length)
+{
+    if (write(host, data, length) != static_cast<ssize_t>(length)) {
+        perror("write to simulator");
+        _exit(1);
+    }
+}
+
+// protocol broken if doesn't arrive, no point continuing
+void recv(
+void            *data  ,
+const size_t     length)
+{
+    uint8_t     *bytes = static_cast<uint8_t*>(data);
+    size_t       rcvd  = 0                          ;
+
+    while (rcvd < length) {
+        struct pollfd   pfd = {host, POLLIN, 0};
+
+        if (poll(&pfd, 1, TIMEOUT_MS) <= 0) {
+            fail("no response from firmware (%zu of %zu bytes)", rcvd, length);
+            printf("\n");
+            _exit(1);
+        }
+
+        const ssize_t   got = read(host, bytes + rcvd, length - rcvd);
+
+        if (got <= 0) {
+            perror("read from simulator");
+            _exit(1);
+        }
+        rcvd += got;
+    }
+}
+
+template<typename TYPE> TYPE recv()
+{
+    TYPE    value;
+
+    recv(&value, sizeof(value));
+
+    return value;
+}
+
+
+
+// round trip, firmware idle and waiting for next command on return
+void round_trip()
+{
+    static const uint8_t    VERSION[4] = {VERS_CMD, 0, 0, 0};
+    uint8_t                 response[3];
+
+    send(VERSION, sizeof(VERSION));
+    recv(response, sizeof(response));
+    mcu.wait_idle();
+}
+
+
+
+void reset_ganged(
+const bool  ganged)
+{
+    const uint8_t   command[4] = {RESET_CMD, ganged, 0, 0};
+
+    send(command, sizeof(command));
+    round_trip();
+}
+
+
+
+struct Capture {
+    uint8_t                 mode     ,
+                            halt     ;
+    uint16_t                triggered,
+                            count    ,  // decoded samples
+                            words    ;  // uploaded
+    SamplingStats           stats    ;
+    std::vector<uint32_t>   samples  ;  // decoded if packed
+    uint64_t                upload_bytes ,
+                            upload_cycles;
+};
+
+
+
+// "logic" command, immediate trigger if no triggers
+void logic(
+const uint8_t    mode        ,
+const uint8_t    mem         ,
+const bool       ganged      ,
+const uint16_t   duration    ,
+const uint16_t   num_samples  = UNLIMITED,
+const uint32_t  *triggers     = nullptr  ,
+uint8_t          num_triggers = 0        ,
+const uint8_t    trig_code    = TRIG_INTERP)
+{
+    static const uint32_t   IMMEDIATE = 0;  // 'xxxxxxxx-0-0'
+    uint8_t                 command[12 + 255 * 4];
+
+    if (!triggers) {
+        triggers     = &IMMEDIATE;
+        num_triggers = 1         ;
+    }
+
+    command[ 0] = DGTL_CMD        ;
+    command[ 1] = mode            ;
+    command[ 2] = num_triggers    ;
+    command[ 3] = ganged          ;
+    command[ 4] = duration != 0   ;
+    command[ 5] = mem             ;
+    command[ 6] = duration        ;
+    command[ 7] = duration    >> 8;
+    command[ 8] = num_samples     ;
+    command[ 9] = num_samples >> 8;
+    command[10] = trig_code       ;
+    command[11] = 0               ;  // 32-bit alignment
+
+    // single write, so firmware start time doesn't depend on when
+    // simulator polls for the rest (see stream_halt())
+    memcpy(command + 12, triggers, num_triggers * 4);
+    send(command, 12 + num_triggers * 4);
+}
+
+// mask, pass, fail, bits, as Trigger.bytes() in buck50.py
+uint32_t trigger_word(
+const uint8_t   mask ,
+const uint8_t   pass ,
+const uint8_t   fail ,
+const uint8_t   bits )
+{
+    return mask | pass << 8 | fail << 16 | bits << 24;
+}
+
+
+
+void finish(
+Capture     &capture)
+{
+    capture.mode      = recv<uint8_t >();
+    capture.halt      = recv<uint8_t >();
+    capture.triggered = recv<uint16_t>();
+    capture.count     = recv<uint16_t>();
+
+    mcu.wait_idle();
+    capture.stats = sampling_stats;
+}
+
+
+
+// as unpack_samples() in buck50.py
+std::vector<uint32_t> unpack(
+const std::vector<uint32_t>     &words)
+{
+    const size_t            first = std::min<size_t>(2, words.size())   ;
+    std::vector<uint32_t>   samples(words.begin(), words.begin() + first);
+    std::vector<uint16_t>   halves                                       ;
+
+    if (samples.empty())
+        return samples;
+
+    for (size_t ndx = 2 ; ndx < words.size() ; ++ndx) {
+        halves.push_back(words[ndx] &  0xffff);
+        halves.push_back(words[ndx] >> 16    );
+    }
+
+    uint32_t    tick = samples.back() & 0xffffff;
+    size_t      ndx  = 0                        ;
+
+    while (ndx < halves.size()) {
+        const uint32_t  bits  = halves[ndx] >> 8  ,
+                        delta = halves[ndx] & 0xff;
+        if (delta) {
+            tick = (tick - delta) & 0xffffff;
+            ndx += 1;
+        }
+        else {
+            if (ndx + 2 >= halves.size())
+                break;
+            tick = halves[ndx + 1] | (halves[ndx + 2] & 0xff) << 16;
+            ndx += 3;
+        }
+        samples.push_back(tick | bits << 24);
+    }
+
+    return samples;
+}
+
+
+
+void upload(
+Capture     &capture)
+{
+    static const uint8_t    COMMAND[8] = {UPLD_CMD , 0             ,
+                                          0        , 0             ,  // first
+                                          0xff     , 0xff          ,  // count
+                                          0        , 0             };
+    uint16_t                header[8];
+
+    send(COMMAND, sizeof(COMMAND));
+    recv(header, sizeof(header));
+
+    std::vector<uint32_t>   words(header[1]);
+
+    recv(words.data(), words.size() * 4);
+    mcu.wait_idle();
+
+    capture.upload_bytes  = sizeof(header) + words.size() * 4;
+    capture.upload_cycles =   mcu.usb().last_in_at
+                            - mcu.usb().last_out_at;
+
+    capture.words   = header[1]          ;
+    capture.samples =   capture.mode == MODE_PACKED
+                      ? unpack(words)
+                      : words        ;
+
+    if (capture.samples.size() != capture.count)
+        fail("upload %zu samples, capture reported %u",
+             capture.samples.size(), capture.count    );
+}
+
+
+
+// tolerance for tick deltas: longest cycles per GPIOB read
+unsigned read_period(
+const uint8_t   mode,
+const uint8_t   mem )
+{
+    const unsigned  ndx = mem == CODE_MEM_RAM ? 0 : 1;
+
+    switch (mode) {
+        case MODE_MHZ_6:
+            return *std::max_element(LoopCycles::MHZ_6[ndx],
+                                     LoopCycles::MHZ_6[ndx] + 6);
+        case MODE_IRREGULAR:
+            return *std::max_element(LoopCycles::IRREGULAR[ndx],
+                                     LoopCycles::IRREGULAR[ndx] + 2);
+        case MODE_UNIFORM: return LoopCycles::UNIFORM[ndx];
+        case MODE_MHZ_4  : return LoopCycles::MHZ_4  [ndx];
+        case MODE_STREAM : return LoopCycles::STREAM [ndx];
+        case MODE_PACKED :
+            return *std::max_element(LoopCycles::PACKED[ndx],
+                                     LoopCycles::PACKED[ndx] + 5);
+    }
+
+    return 0;
+}
+
+
+
+// samples (trigger, setup, then changes and systick rollovers) vs
+// stimulus history from sampling start; returns number of changes during
+// capture. If missed non-null, sampling loop may be delayed by IRQ
+// handlers (stream drain) so changes may be lost: counted, tick deltas
+// not checked.
+size_t verify(
+const char                     *name      ,
+const std::vector<uint32_t>    &samples   ,
+const Stimulator               &stimulator,
+const uint64_t                  start     ,  // setup sample time
+const unsigned                  tolerance ,
+size_t                         *missed    = nullptr)
+{
+    const std::vector<Change>   &history = stimulator.history() ;
+    size_t                       next    = stimulator.after(start);
+    uint64_t                     elapsed = 0                    ;
+    bool                         timed   = false                ;
+
+    if (samples.size() < 2) {
+        fail("%s: %zu samples", name, samples.size());
+        return 0;
+    }
+
+    if (samples[1] >> 24 != history[next - 1].bits) {
+        fail("%s: setup sample 0x%02x, expected 0x%02x",
+             name, samples[1] >> 24, history[next - 1].bits);
+        return 0;
+    }
+
+    for (size_t ndx = 2 ; ndx < samples.size() ; ++ndx) {
+        const uint32_t  bits = samples[ndx] >> 24;
+
+        elapsed += (samples[ndx - 1] - samples[ndx]) & 0xffffff;
+
+        if (bits == samples[ndx - 1] >> 24)
+            continue;  // systick rollover sample
+
+        if (missed) {
+            size_t  skip = next;
+            while (   skip < history.size()
+                   && skip < next + MAX_MISSED
+                   && history[skip].bits != bits)
+                ++skip;
+            if (skip < history.size() && history[skip].bits == bits) {
+                *missed += skip - next;
+                next     = skip       ;
+            }
+        }
+
+        if (next >= history.size() || bits != history[next].bits) {
+            fail("%s: sample #%zu 0x%02x, expected 0x%02x", name, ndx, bits,
+                 next < history.size() ? history[next].bits : 0          );
+            return 0;
+        }
+
+        // first change's delay from setup not known to within one read
+        if (timed && !missed) {
+            const int64_t   expected =   history[next    ].time
+                                       - history[next - 1].time,
+                            error    = elapsed - expected      ;
+
+            if (error <= -static_cast<int64_t>(tolerance) || error >= tolerance) {
+                fail("%s: sample #%zu %llu ticks after previous, "
+                     "expected %lld",
+                     name, ndx, static_cast<unsigned long long>(elapsed),
+                     static_cast<long long>(expected)                     );
+                return 0;
+            }
+        }
+
+        timed   = true;
+        elapsed = 0   ;
+        ++next;
+    }
+
+    return next - stimulator.after(start);
+}
+
+
+
+void digital(
+Stimulator      &stimulator,
+const uint8_t    mode      ,
+const uint8_t    mem       )
+{
+    static const unsigned   CHANGES = 14000,  // enough for packed
+                            MIN_GAP =   200,
+                            MAX_GAP =  2000;
+    Capture                 capture;
+    char                    name[32];
+
+    snprintf(name, sizeof(name), "%s/%s", MODE_NAMES[mode], MEM_NAMES[mem]);
+
+    stimulator.random(mcu.wait_idle() + START_DELAY, CHANGES, MIN_GAP, MAX_GAP);
+    logic (mode, mem, false, 0);
+    finish(capture);
+    upload(capture);
+
+    const SamplingStats &stats    = capture.stats                         ;
+    const double         cycles   =   static_cast<double>(stats.end
+                                                          - stats.triggered)
+                                    / stats.sample_reads                  ,
+                         upload   =   capture.upload_bytes * 1.0
+                                    * Mcu::CPU_HZ / capture.upload_cycles ;
+    const size_t         changes  = verify(name                        ,
+                                           capture.samples             ,
+                                           stimulator                  ,
+                                           stats.triggered             ,
+                                           read_period(mode, mem)      );
+
+    if (capture.halt != HALT_MEMORY)
+        fail("%s: halt code %u, expected memory", name, capture.halt);
+
+    printf("%-10s %-5s  %8.2f  %7.2f  %7zu  %7u  %7zu  %10.0f\n",
+           MODE_NAMES[mode]              ,
+           MEM_NAMES [mem ]              ,
+           cycles                        ,
+           Mcu::CPU_HZ / cycles / 1e6    ,
+           capture.samples.size()        ,
+           capture.words                 ,
+           changes                       ,
+           upload                        );
+}
+
+
+
+// "logic edges=" limits decoded samples: at most one per 16-bit half
+void packed_limit(
+Stimulator      &stimulator)
+{
+    static const uint16_t   LIMIT = 1001;
+    static const char      *NAME  = "packed edges";
+    Capture                 capture     ;
+
+    stimulator.random(mcu.wait_idle() + START_DELAY, LIMIT, 100, 400);
+    logic (MODE_PACKED, CODE_MEM_FLASH, false, 0, LIMIT);
+    finish(capture);
+    upload(capture);
+
+    verify(NAME, capture.samples, stimulator, capture.stats.triggered,
+           read_period(MODE_PACKED, CODE_MEM_FLASH)                  );
+
+    if (capture.halt != HALT_MEMORY)
+        fail("%s: halt code %u, expected memory", NAME, capture.halt);
+    if (   capture.samples.size() >  LIMIT
+        || capture.samples.size() <= (LIMIT - 2) / 3)  // all escapes
+        fail("%s=%u: %zu samples", NAME, LIMIT, capture.samples.size());
+
+    printf("\n%s=%u  %zu samples, %u words\n",
+           NAME, LIMIT, capture.samples.size(), capture.words);
+}
+
+
+
+// receive "logic mode=stream" packets until StreamPacket::END, returns
+// halt code
+uint8_t stream_recv(
+const char              *name   ,
+std::vector<uint32_t>   &samples,
+uint32_t                &total  ,
+uint32_t                &merged )
+{
+    uint8_t     header[4];
+
+    while (true) {
+        recv(header, sizeof(header));
+
+        if (header[0] == STREAM_END) {
+            total  = recv<uint32_t>();
+            merged = recv<uint32_t>();
+            break;
+        }
+        if (header[0] != STREAM_SAMPLES) {
+            fail("%s: bad packet type %u", name, header[0]);
+            printf("\n");
+            _exit(1);
+        }
+
+        const size_t    size = samples.size();
+
+        samples.resize(size + header[1]);
+        recv(&samples[size], header[1] * 4);
+    }
+
+    mcu.wait_idle();
+
+    if (total != samples.size())
+        fail("%s: %zu samples received, firmware reported %u",
+             name, samples.size(), total                     );
+
+    return header[1];
+}
+
+
+
+// as Instruments in buck50.cxx
+struct Histogram {
+    uint32_t    count   ,
+                min     ,
+                max     ,
+                bins[16];
+};
+
+struct Instruments {
+    uint8_t     enabled       ,
+                bins          ,
+                num_histograms,
+                num_counters  ;
+    uint32_t    sends         ,
+                sent_bytes    ,
+                recv_bytes    ,
+                sample_bytes  ,
+                cycles        ;
+    Histogram   loop_period   ,
+                edge_spacing  ,
+                send_wait     ,
+                recv_wait     ;
+};
+
+
+
+void instrument_action(
+const uint8_t   action)
+{
+    const uint8_t   command[4] = {INST_CMD, action, 0, 0};
+
+    send(command, sizeof(command));
+}
+
+
+
+// "instrument" counters and edge spacing histogram vs uploaded (or
+// streamed) capture
+void instrument(
+Stimulator      &stimulator,
+const uint8_t    mode      ,
+const uint8_t    mem       )
+{
+    static const unsigned   CHANGES  = 3000,
+                            MIN_GAP  =  200,
+                            MAX_GAP  = 2000;
+    static const uint16_t   DURATION =   64;  // * 65536 cycles, stream
+    const bool              streamed = mode == MODE_STREAM;
+    Capture                 capture ;
+    Instruments             report  ;
+    char                    name[32];
+    size_t                  missed = 0;
+
+    snprintf(name, sizeof(name), "instrument %s/%s",
+             MODE_NAMES[mode], MEM_NAMES[mem]       );
+
+    instrument_action(INST_ENABLE);
+    round_trip();
+
+    stimulator.random(mcu.wait_idle() + START_DELAY, CHANGES, MIN_GAP, MAX_GAP);
+    if (streamed) {
+        uint32_t    total ,
+                    merged;
+
+        logic      (mode, mem, false, DURATION);
+        stream_recv(name, capture.samples, total, merged);
+        capture.stats        = sampling_stats            ;
+        capture.words        = 0                         ;  // not in memory
+        capture.upload_bytes = capture.samples.size() * 4;
+    }
+    else {
+        logic (mode, mem, false, 0);
+        finish(capture);
+        upload(capture);
+    }
+
+    instrument_action(INST_REPORT);
+    recv(&report, sizeof(report));
+    mcu.wait_idle();
+    instrument_action(INST_DISABLE);
+
+    const unsigned  tolerance = read_period(mode, mem)              ;
+    const size_t    changes   = verify(name, capture.samples, stimulator,
+                                       capture.stats.triggered, tolerance,
+                                       streamed ? &missed : nullptr      )
+                              - missed;
+
+    if (   report.enabled        != 1
+        || report.bins           != 16
+        || report.num_histograms !=  4
+        || report.num_counters   !=  5)
+        fail("%s: report header %u %u %u %u", name, report.enabled,
+             report.bins, report.num_histograms, report.num_counters);
+
+    if (report.sample_bytes != capture.words * 4U)
+        fail("%s: sample bytes %u, expected %u",
+             name, report.sample_bytes, capture.words * 4U);
+
+    if (report.sent_bytes < capture.upload_bytes)
+        fail("%s: sent bytes %u < upload %llu", name, report.sent_bytes,
+             static_cast<unsigned long long>(capture.upload_bytes)       );
+
+    if (report.edge_spacing.count + 1 != changes)
+        fail("%s: %u edge spacings, expected %zu",
+             name, report.edge_spacing.count, changes - 1);
+
+    // stream_drain() stalls record changes late, shortening next spacing
+    if (   !streamed
+        && (   report.edge_spacing.min + tolerance < MIN_GAP
+            || report.edge_spacing.max > MAX_GAP + tolerance))
+        fail("%s: edge spacing %u..%u, stimulus %u..%u", name,
+             report.edge_spacing.min, report.edge_spacing.max,
+             MIN_GAP, MAX_GAP                                );
+
+    if (report.cycles == 0)
+        fail("%s: zero cycles", name);
+
+    printf("%-10s %-5s  %7u  %6u  %6u  %6u  %9u  %6u\n",
+           MODE_NAMES[mode]         ,
+           MEM_NAMES [mem ]         ,
+           report.edge_spacing.count,
+           report.edge_spacing.min  ,
+           report.edge_spacing.max  ,
+           report.sends             ,
+           report.sent_bytes        ,
+           report.send_wait.count   );
+}
+
+
+
+void latency(
+Stimulator      &stimulator,
+const uint8_t    code      ,
+const uint8_t    mem       ,
+const bool       ganged    )
+{
+    // all low, then all high, which Stimulator::random() never generates
+    // (may still be running from previous test when triggering starts)
+    static const unsigned   PHASES      = 16;  // edge offsets, cycles
+    const uint32_t          triggers[2] = {trigger_word(0xff, 1, 0, 0x00),
+                                           trigger_word(0xff, 0, 1, 0xff)};
+    uint64_t                min         = UINT64_MAX,
+                            max         = 0         ,
+                            sum         = 0         ;
+
+    for (unsigned phase = 0 ; phase < PHASES ; ++phase) {
+        Capture             capture;
+
+        reset_ganged(ganged);
+
+        const uint64_t      edge = std::max(mcu.wait_idle() + START_DELAY,
+                                            stimulator.last() + 2000     )
+                                 + phase                                  ;
+
+        // then one more change to fill 3 sample minimum, halt on next
+        stimulator.add(edge - 1000, 0x00);
+        stimulator.add(edge       , 0xff);
+        stimulator.add(edge + 1000, 0x5a);
+        stimulator.add(edge + 2000, 0xa5);
+        logic (MODE_UNIFORM, mem, ganged, 0, 3, triggers, 2, code);
+        finish(capture);
+
+        const SamplingStats &stats = capture.stats;
+
+        if (stats.triggering >= edge) {
+            fail("latency: triggering not started before edge");
+            return;
+        }
+        else if (capture.halt != HALT_MEMORY || stats.triggered < edge) {
+            fail("latency: halt %u, triggered %lld cycles after edge",
+                 capture.halt                                        ,
+                 static_cast<long long>(stats.triggered - edge)      );
+            return;
+        }
+
+        min  = std::min(min, stats.triggered - edge);
+        max  = std::max(max, stats.triggered - edge);
+        sum +=               stats.triggered - edge ;
+    }
+
+    printf("%-7s %-11s  %-5s  %5llu  %6.1f  %5llu  %8.1f\n"             ,
+           ganged ? "ganged" : "plain"                                  ,
+           CODE_NAMES[code]                                             ,
+           MEM_NAMES[mem]                                               ,
+           static_cast<unsigned long long>(min)                         ,
+           static_cast<double>(sum) / PHASES                            ,
+           static_cast<unsigned long long>(max)                         ,
+           sum * 1e9 / PHASES / Mcu::CPU_HZ                             );
+
+    if (ganged)
+        reset_ganged(false);
+}
+
+
+
+// Shortest pulse (in cycles) from background 0x00 which triggers at all
+// of PHASES start offsets, i.e. longest time between triggering's reads
+// of inputs. Pattern is second of two states, first waits for 0x00 (as
+// in latency()).
+void pulse(
+Stimulator      &stimulator,
+const char      *name      ,
+const uint32_t  *pattern   ,  // num_pattern triggers, second and later
+const uint8_t    num_pattern,
+const uint8_t    bits      ,  // pulse value
+const uint8_t    code      ,
+const uint8_t    mem       )
+{
+    static const unsigned   PHASES    = 48,
+                            MAX_WIDTH = 64;
+    static const uint16_t   DURATION  =  8;  // * 65536 cycles, halt if missed
+    uint32_t                triggers[4]  = {trigger_word(0xff, 1, 0, 0x00)};
+    unsigned                width        = 1;
+
+    std::copy(pattern, pattern + num_pattern, triggers + 1);
+
+    for ( ; width <= MAX_WIDTH ; ++width) {
+        unsigned    phase = 0;
+
+        for ( ; phase < PHASES ; ++phase) {
+            Capture         capture;
+
+            const uint64_t  edge = std::max(mcu.wait_idle() + START_DELAY,
+                                            stimulator.last() + 2000     )
+                                 + phase                                  ;
+
+            // then changes to fill 3 sample minimum, matching no pattern
+            stimulator.add(edge - 1000 , 0x00);
+            stimulator.add(edge        , bits);
+            stimulator.add(edge + width, 0x00);
+            stimulator.add(edge + 1000 , 0x50);
+            stimulator.add(edge + 2000 , 0x00);
+            logic (MODE_UNIFORM, mem, false, DURATION, 3, triggers,
+                   num_pattern + 1, code                         );
+            finish(capture);
+
+            const SamplingStats &stats = capture.stats;
+
+            if (stats.triggering >= edge - 1000)
+                fail("pulse: triggering not started before background");
+            if (capture.halt == HALT_DURATION)
+                break;  // missed
+            if (capture.halt != HALT_MEMORY || stats.triggered < edge) {
+                fail("pulse %s: halt %u, triggered %lld cycles after edge",
+                     name, capture.halt                                    ,
+                     static_cast<long long>(stats.triggered - edge)        );
+                return;
+            }
+        }
+
+        if (phase == PHASES)
+            break;
+    }
+
+    if (width > MAX_WIDTH)
+        fail("pulse %s: %s %s not triggered by %u cycles",
+             name, CODE_NAMES[code], MEM_NAMES[mem], MAX_WIDTH);
+
+    printf("%-6s %-11s  %-5s  %8u  %8.1f\n"  ,
+           name                              ,
+           CODE_NAMES[code]                  ,
+           MEM_NAMES[mem]                    ,
+           width                             ,
+           width * 1e9 / Mcu::CPU_HZ         );
+}
+
+
+
+// random valid (see check_triggers() in buck50.py) table of num states:
+// all tests different, "fail" chains cycle through runs of consecutive
+// states, "pass" to a later state or 0 (triggered)
+void random_triggers(
+Lcg             &rand    ,
+uint32_t        *triggers,
+const uint8_t    num     )
+{
+    uint8_t     masks[8],
+                bits [8];
+    uint8_t     run = 0 ;  // first state of current fail chain
+
+    for (uint8_t state = 0 ; state < num ; ++state) {
+        bool    dup;
+        do {
+            masks[state] = 0;
+            for (unsigned bit = 0 ; bit < 3 ; ++bit)  // one to three
+                masks[state] |= 1 << rand() % 8;
+            bits[state] = rand() & masks[state];
+            dup         = false                ;
+            for (uint8_t prev = 0 ; prev < state ; ++prev)
+                dup |= masks[prev] == masks[state] && bits[prev] == bits[state];
+        } while (dup);
+    }
+
+    for (uint8_t state = 0 ; state < num ; ++state) {
+        const bool      end  =    state == num - 1
+                               || state - run == 2  // at most three
+                               || rand() % 2                        ;
+        const uint8_t   fail = end ? run : state + 1                ;
+        uint8_t         pass                                        ;
+
+        do {
+            pass = state + rand() % (num - state);
+            if (pass == state)
+                pass = 0;
+        } while (pass == fail && fail != 0);
+
+        triggers[state] = trigger_word(masks[state], pass, fail, bits[state]);
+
+        if (end)
+            run = state + 1;
+    }
+}
+
+
+
+// random trigger tables and inputs, same for "trig-code=interpreted" and
+// "compiled": same trigger state sequence, each change after same input
+// change, and same triggered sample or both halted by duration
+void trigger_random(
+Stimulator      &stimulator,
+const uint32_t   seed      )
+{
+    static const unsigned   TABLES   = 48,
+                            CHANGES  = 24,
+                            MIN_GAP  = 1000,
+                            MAX_GAP  = 3000;
+    static const uint16_t   DURATION =  8;  // * 65536 cycles, past inputs
+    Lcg                     rand(seed);
+    unsigned                fired   = 0,
+                            changes = 0;
+
+    for (unsigned table = 0 ; table < TABLES ; ++table) {
+        const uint8_t   num_triggers = 2 + rand() % 7                           ,
+                        mem          = table & 1 ? CODE_MEM_RAM : CODE_MEM_FLASH;
+        uint32_t        triggers[8]                                             ;
+        uint64_t        offsets [CHANGES]                                       ;
+        uint8_t         values  [CHANGES]                                       ;
+        Capture         captures[2]                                             ;
+        size_t          intervals[2][SamplingStats::MAX_STATES]                 ,
+                        fire     [2]                                            ;
+
+        random_triggers(rand, triggers, num_triggers);
+
+        for (unsigned ndx = 0 ; ndx < CHANGES ; ++ndx) {
+            do
+                values[ndx] = rand();
+            while (   values[ndx] == 0x00 || values[ndx] == 0xff  // latency()
+                   || (ndx && values[ndx] == values[ndx - 1]));
+            offsets[ndx] =   (ndx ? offsets[ndx - 1] : 0)
+                           + MIN_GAP + rand() % (MAX_GAP - MIN_GAP + 1);
+        }
+
+        for (const uint8_t code : {TRIG_INTERP, TRIG_COMPILED}) {
+            Capture         &capture = captures[code]                      ;
+            const uint64_t   idle    =   std::max(mcu.wait_idle(),
+                                                  stimulator.last())
+                                       + 1                                 ,
+                             edge    = idle + START_DELAY                  ;
+            const size_t     first   = stimulator.history().size()         ;
+
+            // first value before triggering starts, rest after
+            stimulator.add(idle, values[0]);
+            for (unsigned ndx = 1 ; ndx < CHANGES ; ++ndx)
+                stimulator.add(edge + offsets[ndx], values[ndx]);
+
+            logic (MODE_UNIFORM, mem, false, DURATION, UNLIMITED, triggers,
+                   num_triggers, code                                    );
+            finish(capture);
+            upload(capture);
+
+            const SamplingStats &stats = capture.stats;
+
+            if (stats.triggering <= idle || stats.triggering >= edge)
+                fail("trigger random: triggering not started between inputs");
+
+            // input change index before each state change and trigger
+            for (unsigned ndx = 0 ; ndx < stats.num_states ; ++ndx)
+                intervals[code][ndx] =   stimulator.after(stats.state_at[ndx])
+                                       - first                              ;
+            fire[code] =   stats.triggered
+                         ? stimulator.after(stats.triggered) - first
+                         : 0                                         ;
+        }
+
+        const Capture   &interp   = captures[TRIG_INTERP  ],
+                        &compiled = captures[TRIG_COMPILED];
+
+        if (   interp.halt                   != compiled.halt
+            || interp.stats.num_states       != compiled.stats.num_states
+            || fire[TRIG_INTERP]             != fire[TRIG_COMPILED]
+            || interp.samples.size()         != compiled.samples.size()
+            || !std::equal(interp.samples.begin(), interp.samples.end(),
+                           compiled.samples.begin()                     ,
+                           [](const uint32_t a, const uint32_t b)
+                           { return a >> 24 == b >> 24; }               )
+            || memcmp(interp.stats.states, compiled.stats.states,
+                      interp.stats.num_states                    )
+            || !std::equal(intervals[TRIG_INTERP],
+                           intervals[TRIG_INTERP] + interp.stats.num_states,
+                           intervals[TRIG_COMPILED]                        ))
+        {
+            fail("trigger random: table %u %s, interpreted halt %u %u states"
+                 ", compiled halt %u %u states", table, MEM_NAMES[mem],
+                 interp  .halt, interp  .stats.num_states             ,
+                 compiled.halt, compiled.stats.num_states             );
+            continue;
+        }
+
+        fired   += interp.stats.triggered != 0 ;
+        changes += interp.stats.num_states  - 1;
+    }
+
+    printf("\ntrigger random  %u tables, %u triggered, %u state changes\n",
+           TABLES, fired, changes                                          );
+}
+
+
+
+void stream(
+Stimulator      &stimulator,
+const unsigned   gap       )
+{
+    static const uint16_t   DURATION = 200;  // * 65536 cycles, 182 ms
+    const uint64_t          start    = mcu.wait_idle() + START_DELAY ,
+                            span     = (DURATION + 4) * 65536ULL     ;
+    std::vector<uint32_t>   samples                                  ;
+    uint32_t                total                                    ,
+                            merged                                   ;
+    char                    name[32]                                 ;
+
+    snprintf(name, sizeof(name), "stream/%u", gap);
+
+    stimulator.random(start, span / gap, gap / 2, gap + gap / 2);
+    logic(MODE_STREAM, CODE_MEM_RAM, false, DURATION);
+
+    const uint8_t        halt  = stream_recv(name, samples, total, merged);
+    const SamplingStats &stats = sampling_stats                           ;
+    const double         secs  =   (stats.end - stats.triggered)
+                                 / static_cast<double>(Mcu::CPU_HZ)     ;
+
+    if (halt != HALT_DURATION && halt != HALT_OVERRUN)
+        fail("%s: halt code %u", name, halt);
+
+    size_t          missed  = 0                                    ;
+    const size_t    changes = verify(name                          ,
+                                     samples                       ,
+                                     stimulator                    ,
+                                     stats.triggered               ,
+                                     read_period(MODE_STREAM,
+                                                 CODE_MEM_RAM)     ,
+                                     &missed                       );
+
+    // only stalls in stream_drain() can lose changes at these gaps
+    if (missed && !merged)
+        fail("%s: %zu changes missed, firmware reported none merged",
+             name, missed                                            );
+
+    printf("%8u  %-8s  %8.1f  %8zu  %8zu  %7zu  %7u  %10.0f\n",
+           gap                                          ,
+           halt == HALT_OVERRUN ? "overrun" : "duration",
+           secs * 1e3                                   ,
+           samples.size()                               ,
+           changes                                      ,
+           missed                                       ,
+           merged                                       ,
+           samples.size() * 4 / secs                    );
+}
+
+
+
+// Duration halt at each phase around the sample which fills StreamRing
+// end, including between asm reaching end and ++filled or wrapping
+void stream_halt(
+Stimulator      &stimulator)
+{
+    static const unsigned   GAP    = 2000,  // no stalls merging changes
+                            PHASES =   2 * (  LoopCycles::STREAM     [0]
+                                            + LoopCycles::STREAM_HALF[0]);
+    static const char      *NAME   = "stream halt";
+    std::vector<uint32_t>   samples                 ;
+    uint32_t                total                   ,
+                            merged                  ;
+    unsigned                full   = 0              ;
+
+    // ring size
+    mcu.wait_idle();
+    logic(MODE_STREAM, CODE_MEM_RAM, false, 1);
+    stream_recv(NAME, samples, total, merged);
+
+    const uint32_t  half     = sampling_stats.stream_half               ,
+                    changes  = 2 * half - 2                             ;  // setup
+    const uint16_t  duration = changes * static_cast<uint64_t>(GAP) / 65536
+                               + 2                                      ;
+
+    // halt time with no changes
+    uint64_t    idle = mcu.wait_idle();
+    samples.clear();
+    logic(MODE_STREAM, CODE_MEM_RAM, false, duration);
+    if (   stream_recv(NAME, samples, total, merged) != HALT_DURATION
+        || samples.size()                            != 2            ) {
+        fail("%s: input not quiet", NAME);
+        return;
+    }
+
+    const uint64_t  triggered = sampling_stats.triggered - idle,
+                    end       = sampling_stats.end       - idle;
+
+    for (unsigned phase = 0 ; phase < PHASES ; ++phase) {
+        const uint64_t  last  = end - phase                   ,
+                        first = last - (changes - 1ULL) * GAP ;
+
+        if (first <= triggered + GAP) {
+            fail("%s: changes start before trigger", NAME);
+            return;
+        }
+
+        idle = mcu.wait_idle();
+        for (unsigned ndx = 0 ; ndx < changes ; ++ndx)
+            stimulator.add(idle + first + ndx * GAP, 1 + ndx % 0xfe);
+
+        samples.clear();
+        logic(MODE_STREAM, CODE_MEM_RAM, false, duration);
+
+        const uint8_t   halt   = stream_recv(NAME, samples, total, merged);
+        size_t          missed = 0                                        ;  // late
+
+        if (halt != HALT_DURATION)
+            fail("%s: phase %u halt code %u", NAME, phase, halt);
+
+        verify(NAME, samples, stimulator, sampling_stats.triggered,
+               read_period(MODE_STREAM, CODE_MEM_RAM), &missed    );
+
+        if (samples.size() == 2 * half)
+            ++full;
+    }
+
+    if (!full)
+        fail("%s: no phase filled ring", NAME);
+
+    printf("\nstream halt  %u phases at ring end, %u with ring full\n",
+           PHASES, full                                             );
+}
+
+
+
+// PA0, PA1 analog inputs constant, see main()
+const uint16_t  ANALOG_VALUES[2] = {1234, 3000};
+
+// mode: AnalogMode bits, decimation factor log2 in low nibble
+void analog(
+const unsigned  channels,
+const uint8_t   mode    )
+{
+    static const uint8_t    SAMP_HOLD  = 0   ;  // AdcSampHold.T_1_5
+    static const uint16_t   WORDS      = 4096;
+    static const double     NOMINAL    = 12e6 / (1.5 + 12.5);
+    const unsigned          factor     = 1 << (mode & 0xf)    ;
+    const bool              minmax     = mode & ANLG_MINMAX   ,
+                            decimating = mode & (ANLG_MINMAX | ANLG_AVERAGE);
+    uint8_t                 command[16];
+    uint8_t                 response[8];
+    Capture                 capture    ;
+    char                    name[16]   ;
+
+    mcu.wait_idle();
+
+    command[ 0] = ANLG_CMD                 ;
+    command[ 1] = 0                        ;  // PA0
+    command[ 2] = channels == 2 ? 1 : 0xff ;  // PA1 or none
+    command[ 3] = 0                        ;  // slope disabled
+    command[ 4] = SAMP_HOLD                ;
+    command[ 5] = 0                        ;  // not ganged
+    command[ 6] = WORDS & 0xff             ;
+    command[ 7] = WORDS >> 8               ;
+    command[ 8] = 0x00                     ;  // trigger level lo
+    command[ 9] = 0x00                     ;
+    command[10] = 0xff                     ;  // trigger level hi
+    command[11] = 0x0f                     ;
+    command[12] = mode                     ;
+    command[13] = 0                        ;
+    command[14] = 0                        ;
+    command[15] = 0                        ;
+
+    send(command , sizeof(command ));
+    recv(response, sizeof(response));
+    mcu.wait_idle();
+
+    // command arrival to response, including ADC calibration
+    const uint64_t  cycles = mcu.usb().last_in_at - mcu.usb().last_out_at;
+
+    capture.mode  = MODE_ANALOG;
+    capture.count = WORDS      ;
+    upload(capture);
+
+    size_t  errors = 0;
+    for (const uint32_t word : capture.samples) {
+        const uint16_t  lo = word & 0xffff,
+                        hi = word >> 16   ;
+        if (   lo != ANALOG_VALUES[0]
+            || hi != ANALOG_VALUES[channels == 2 ? 1 : 0])
+            ++errors;
+    }
+    if (errors)
+        fail("analog %u channel mode 0x%02x: %zu of %zu words wrong",
+             channels, mode, errors, capture.samples.size()         );
+
+    // raw ADC samples per second, before decimation
+    const double    rate =   WORDS * (minmax ? 1.0 : 2.0) / channels * factor
+                           * Mcu::CPU_HZ / cycles                        ;
+
+    snprintf(name, sizeof(name), "%s%s",
+             mode & ANLG_INTRLV ? "intrlv" : "normal",
+             !decimating ? "" : minmax ? "/min" : "/avg");
+    if (decimating)
+        snprintf(name + strlen(name), sizeof(name) - strlen(name),
+                 "%u", factor                                     );
+
+    printf("%8u  %-12s  %8u  %10.0f  %10.0f  %10.0f\n"                    ,
+           channels                                                       ,
+           name                                                           ,
+           WORDS                                                          ,
+           rate                                                           ,
+           NOMINAL * (mode & ANLG_INTRLV ? 2 : 1)                         ,
+           capture.upload_bytes * 1.0 * Mcu::CPU_HZ / capture.upload_cycles);
+}
+
+}  // namespace
+
+
+
+int main(
+int          argc,
+char *const  argv[])
+{
+    const uint32_t  seed = argc > 1 ? strtoul(argv[1], nullptr, 0) : 50;
+    int             fds[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) {
+        perror("socketpair");
+        return 1;
+    }
+    host = fds[0];
+
+    Stimulus        stimulus                  ;
+    Stimulator      stimulator(stimulus, seed);
+
+    stimulus.analog(0, 0, ANALOG_VALUES[0]);
+    stimulus.analog(0, 1, ANALOG_VALUES[1]);
+
+    mcu.stimulus(&stimulus);
+    mcu.start   (fds[1], false);
+
+    std::thread(buck50_main).detach();
+
+    send(SIGNATURE, sizeof(SIGNATURE));
+    if (recv<uint32_t>() != IDENTITY) {
+        fail("firmware identity");
+        _exit(1);
+    }
+    round_trip();
+
+    printf("seed %u, times in simulated 72 MHz cycles\n\n", seed);
+
+    printf("mode       mem    cyc/read  max MHz  samples    words"
+           "  changes  upload B/s\n");
+    for (const uint8_t mode : {MODE_MHZ_6  , MODE_IRREGULAR, MODE_UNIFORM,
+                               MODE_MHZ_4  , MODE_PACKED                 })
+        for (const uint8_t mem : {CODE_MEM_FLASH, CODE_MEM_RAM})
+            digital(stimulator, mode, mem);
+    packed_limit(stimulator);
+
+    printf("\ninstrument mem      edges     min     max   sends       sent"
+           "  waits\n");
+    for (const uint8_t mode : {MODE_UNIFORM, MODE_PACKED, MODE_STREAM})
+        instrument(stimulator, mode, CODE_MEM_RAM);
+
+    printf("\ntrigger code         mem      min    mean    max   mean ns\n");
+    for (const bool ganged : {false, true})
+        for (const uint8_t code : {TRIG_INTERP, TRIG_COMPILED})
+            for (const uint8_t mem : {CODE_MEM_FLASH, CODE_MEM_RAM})
+                latency(stimulator, code, mem, ganged);
+
+    // single bit, 8-bit pattern, and either of two bits
+    const uint32_t  BIT [1] = {trigger_word(0x01, 0, 1, 0x01)},
+                    BYTE[1] = {trigger_word(0xff, 0, 1, 0xa5)},
+                    OR  [2] = {trigger_word(0x01, 0, 2, 0x01),
+                               trigger_word(0x02, 0, 1, 0x02)};
+    printf("\npulse  code         mem    min cyc        ns\n");
+    for (const uint8_t code : {TRIG_INTERP, TRIG_COMPILED})
+        for (const uint8_t mem : {CODE_MEM_FLASH, CODE_MEM_RAM}) {
+            pulse(stimulator, "bit" , BIT , 1, 0x01, code, mem);
+            pulse(stimulator, "byte", BYTE, 1, 0xa5, code, mem);
+            pulse(stimulator, "or"  , OR  , 2, 0x02, code, mem);
+        }
+    trigger_random(stimulator, seed);
+
+    stream_halt(stimulator);
+
+    printf("\nstream gap  halt     sim msecs   samples   changes  missed"
+           "   merged  sample B/s\n");
+    for (const unsigned gap : {2000, 1000, 500, 300, 250, 200})
+        stream(stimulator, gap);
+
+    printf("\n    chans  mode             words   samples/s     nominal"
+           "  upload B/s\n");
+    analog(1, 0                             );
+    analog(2, 0                             );
+    analog(1, ANLG_INTRLV                   );
+    analog(1,               ANLG_MINMAX  | 4);
+    analog(1,               ANLG_AVERAGE | 4);
+    analog(1, ANLG_INTRLV | ANLG_MINMAX  | 4);
+
+    printf("\n%s\n", ok ? "all checks passed" : "FAIL");
+    fflush(stdout);
+
+    _exit(ok ? 0 : 1);  // firmware thread never returns
+}
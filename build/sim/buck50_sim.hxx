@@ -0,0 +1,37 @@
+// buck50: Test and measurement firmware for “Blue Pill” STM32F103 development board
+// Copyright (C) 2019,2020 Mark R. Rubin aka "thanks4opensource"
+//
+// This file is part of buck50.
+//
+// The buck50 program is free software: you can redistribute it
+// and/or modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The buck50 program is distributed in the hope that it will be
+// useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+// of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// (LICENSE.txt) along with the buck50 program.  If not, see
+// <https://www.gnu.org/licenses/gpl.html>
+
+
+// Replacements for Cortex-M3 instructions used by buck50.cxx when
+// compiled with BUCK50_SIM. Only header of sim/ included by firmware
+// translation unit (besides regbits_sim.hxx and usb_dev_cdc_acm.hxx),
+// so no standard library declarations leak into it.
+
+
+#ifndef BUCK50_SIM_HXX
+#define BUCK50_SIM_HXX
+
+namespace buck50_sim {
+
+// "wfi": advance simulated clock to next interrupt
+void    wfi();
+
+}  // namespace buck50_sim
+
+#endif  // ifndef BUCK50_SIM_HXX
@@ -0,0 +1,115 @@
+// buck50: Test and measurement firmware for “Blue Pill” STM32F103 development board
+// Copyright (C) 2019,2020 Mark R. Rubin aka "thanks4opensource"
+//
+// This file is part of buck50.
+//
+// The buck50 program is free software: you can redistribute it
+// and/or modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The buck50 program is distributed in the hope that it will be
+// useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+// of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// (LICENSE.txt) along with the buck50 program.  If not, see
+// <https://www.gnu.org/licenses/gpl.html>
+
+
+// Register storage for host simulation, included by regbits.hxx when
+// REGBITS_SIM defined. Same size and layout as plain WORD, so peripheral
+// structs and their static_assert()s are unchanged, but every read and
+// write of a peripheral address (memory-mapped at real address by
+// sim_mcu.cxx) goes through read()/writ() so simulator can advance its
+// clock and model side effects (GPIO BSRR->ODR, SysTick VAL, ADC EOC,
+// etc). Non-peripheral instances (regbits temporaries, RAM copies) are
+// plain storage.
+
+
+#ifndef REGBITS_SIM_HXX
+#define REGBITS_SIM_HXX
+
+#define REGBITS_SIM_MAJOR_VERSION   1
+#define REGBITS_SIM_MINOR_VERSION   0
+#define REGBITS_SIM_MICRO_VERSION   0
+
+#include <cstdint>
+
+
+namespace regbits_sim {
+
+uint32_t    read(const volatile void    *addr,
+                 const unsigned          size);
+void        writ(      volatile void    *addr,
+                 const unsigned          size,
+                 const uint32_t          word);
+
+// APB1/APB2/AHB peripherals, and Cortex-M3 private peripheral bus
+inline bool mapped(
+const volatile void     *addr)
+{
+    const uintptr_t     address = reinterpret_cast<uintptr_t>(addr);
+
+    return    address - 0x40000000U < 0x00030000U
+           || address - 0xE0000000U < 0x00100000U;
+}
+
+
+
+template<typename WORD> class Word {
+  public:
+    Word() = default;
+
+    constexpr
+    Word(
+    const WORD  word)
+    :   _word(word)
+    {}
+
+    operator WORD() const volatile
+    {
+        if (mapped(this))
+            return static_cast<WORD>(read(this, sizeof(WORD)));
+        return _word;
+    }
+    operator WORD() const
+    {
+        if (mapped(this))
+            return static_cast<WORD>(read(this, sizeof(WORD)));
+        return _word;
+    }
+
+    void operator=(const WORD   word) volatile
+    {
+        if (mapped(this))
+            writ(this, sizeof(WORD), word);
+        else
+            _word = word;
+    }
+    void operator=(const WORD   word)
+    {
+        if (mapped(this))
+            writ(this, sizeof(WORD), word);
+        else
+            _word = word;
+    }
+
+    // read-modify-write, as compiled firmware ldr/orr/str
+    void operator|=(const WORD  bits) volatile { *this = *this | bits; }
+    void operator|=(const WORD  bits)          { *this = *this | bits; }
+    void operator&=(const WORD  bits) volatile { *this = *this & bits; }
+    void operator&=(const WORD  bits)          { *this = *this & bits; }
+    void operator^=(const WORD  bits) volatile { *this = *this ^ bits; }
+    void operator^=(const WORD  bits)          { *this = *this ^ bits; }
+
+
+  protected:
+    WORD    _word;
+
+};  // template<typename WORD> class Word
+
+}  // namespace regbits_sim
+
+#endif  // ifndef REGBITS_SIM_HXX
@@ -0,0 +1,963 @@
+// buck50: Test and measurement firmware for “Blue Pill” STM32F103 development board
+// Copyright (C) 2019,2020 Mark R. Rubin aka "thanks4opensource"
+//
+// This file is part of buck50.
+//
+// The buck50 program is free software: you can redistribute it
+// and/or modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The buck50 program is distributed in the hope that it will be
+// useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+// of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// (LICENSE.txt) along with the buck50 program.  If not, see
+// <https://www.gnu.org/licenses/gpl.html>
+
+
+#include <algorithm>
+#include <csetjmp>
+#include <cstdio>
+#include <cstdlib>
+
+#include "sim_asm.hxx"
+#include "sim_mcu.hxx"
+#include "usb_dev_cdc_acm.hxx"
+
+
+
+#if 1  // (section identification for code browsing)
+//
+// buck50.cxx globals
+//
+
+struct StreamRing {
+    uint32_t    *begin  ,
+                *mid    ,
+                *end    ,
+                *read   ;
+    uint32_t     filled ,
+                 drained;
+};
+
+extern "C" {
+    void    halt_timers ();
+    bool    stream_drain();
+}
+
+extern uint32_t                             STORAGE      ,
+                                            STORAGE_END  ;
+extern uint32_t                             sampling_mode;
+extern uint32_t                             trigger_code_size;
+extern uint32_t                            *samples      ,
+                                           *samples_end  ;
+extern volatile StreamRing                  stream_ring  ;
+extern uint16_t                             in_progress  ;
+extern jmp_buf                              longjump_buf ;
+extern stm32f10_12357_xx::UsbDevCdcAcm      usb_dev      ;
+
+#endif  // #if 1 (buck50.cxx globals)
+
+
+
+namespace {
+
+// buck50_asm.s .equs
+const uint8_t   HALT_MEMORY         = 1     ,
+                HALT_DURATION       = 2     ,
+                HALT_USB            = 3     ,
+                HALT_OVERRUN        = 4     ;
+const uint16_t  IN_PROG_TRIGGERING  = 0x0100,
+                IN_PROG_EXTERN_TRIG = 0x0200,
+                IN_PROG_TRIGGERED   = 0x0800,
+                IN_PROG_SAMPLING    = 0x1000,
+                IN_PROG_COUNTING    = 0x2000;
+const uint32_t  GANGED_TRIG_SET     = 1 << 14,
+                GANGED_SYNC_SET     = 1 << 15,
+                GANGED_TRIG_CLR     = 1 << 30;
+const uint8_t   CODE_MEM_RAM        = 0     ;
+const uint32_t  SPEED_MHZ_6         = 0     ,
+                SPEED_IRREGULAR     = 1     ,
+                SPEED_UNIFORM       = 2     ,
+                SPEED_MHZ_4         = 3     ,
+                SPEED_STREAM        = 4     ,
+                SPEED_PACKED        = 5     ;
+
+const uintptr_t GPIOB_BSRR          = 0x40010c10,
+                ADV_TIM_1_CR1       = 0x40012c00,
+                NVIC_ISPR0          = 0xe000e200;
+const uint32_t  USB_LP_IRQ_BIT      = 1 << 20   ,
+                CEN                 = 1         ;
+
+// code sizes, cycle counts from assembled buck50_asm.s, [mem] first
+// (CODE_MEM_RAM == 0), see asm_loops.txt; COMPILED_ALU (also untaken
+// branch), COMPILED_LOAD, COMPILED_TAKEN same model for TriggerCompiler
+// code, always in RAM
+using namespace buck50_sim::asm_loops;
+
+const uintptr_t GPIOB               = 0x40010c00,
+                GPIOB_IDR           = 0x40010c08;
+
+// "registers", for IRQ handlers' irq_handler_enter
+uint32_t     r_state ;
+uint8_t     *r_sample;
+
+uint64_t     read_at ;  // last gpiob_idr(), for skip()
+
+}  // namespace
+
+
+
+namespace buck50_sim {
+
+SamplingStats   sampling_stats;
+
+}  // namespace buck50_sim
+
+
+
+namespace {
+
+using buck50_sim::mcu           ;
+using buck50_sim::sampling_stats;
+
+
+[[noreturn]] void irq_handler_exit(
+const uint8_t   code)
+{
+    sampling_stats.end = mcu.now();
+    mcu.irq_exit();
+    longjmp(longjump_buf, code);
+}
+
+
+
+uint16_t irq_handler_enter()
+{
+    const uint16_t  in_prog = in_progress;
+
+    if (in_prog & IN_PROG_TRIGGERING)
+        in_progress = in_prog | (r_state & 0xff);
+
+    if (in_prog & IN_PROG_SAMPLING)
+        samples_end = reinterpret_cast<uint32_t*>(r_sample);
+
+    return in_prog;
+}
+
+
+
+inline uint32_t gpiob_idr()
+{
+    read_at = mcu.now();
+    return mcu.gpio_idr(1, read_at);
+}
+
+
+
+// advance over loop iterations which will read same unchanged GPIOB
+// until input change (since last read, may already have happened during
+// current iteration) or next simulator event, whichever first
+inline uint64_t skip(
+const uint64_t  cycles)
+{
+    const uint64_t  now   = mcu.now()                                       ,
+                    until = std::min(mcu.next_input(1, read_at), mcu.next_due());
+
+    if (until <= now || until == buck50_sim::Mcu::NEVER)
+        return 0;
+
+    const uint64_t  loops = (until - now + cycles - 1) / cycles;
+
+    mcu.advance(loops * cycles);
+
+    return loops;
+}
+
+// as above, for unrolled loops with different cycle counts per read
+uint64_t skip(
+const uint8_t   *cycles,
+const unsigned   num   ,
+unsigned        &phase )
+{
+    const uint64_t  now    = mcu.now()                                        ,
+                    until  = std::min(mcu.next_input(1, read_at), mcu.next_due());
+    uint64_t        period = 0                                            ,
+                    loops  = 0                                            ;
+
+    if (until <= now || until == buck50_sim::Mcu::NEVER)
+        return 0;
+
+    for (unsigned ndx = 0 ; ndx < num ; ++ndx)
+        period += cycles[ndx];
+
+    const uint64_t  periods = (until - now) / period;
+
+    mcu.advance(periods * period);
+    loops = periods * num;
+
+    while (mcu.now() < until) {
+        mcu.advance(cycles[phase]);
+        phase = (phase + 1) % num;
+        ++loops;
+    }
+
+    return loops;
+}
+
+
+
+// records trigger state if changed, interpreted at each new state and
+// compiled at each "movs state, #n" (TriggerCompiler STATE_REG), so both
+// give same sequence for same trigger table and GPIOB inputs
+void trace_state(
+const uint8_t   state)
+{
+    const uint32_t  num = sampling_stats.num_states;
+
+    if (   num == buck50_sim::SamplingStats::MAX_STATES
+        || (num && sampling_stats.states[num - 1] == state))
+        return;
+
+    sampling_stats.state_at[num] = mcu.now();
+    sampling_stats.states  [num] = state    ;
+    ++sampling_stats.num_states;
+}
+
+
+
+inline void fault_check()
+{
+    if (r_sample >= reinterpret_cast<uint8_t*>(&STORAGE_END)) {
+        mcu.fault();
+        HardFault_Handler();
+    }
+}
+
+inline void store(
+const uint32_t  word)
+{
+    fault_check();
+    *reinterpret_cast<uint32_t*>(r_sample)  = word;
+    r_sample                               += 4   ;
+    ++sampling_stats.stores;
+}
+
+inline void store_half(
+const uint16_t  half)
+{
+    fault_check();
+    *reinterpret_cast<uint16_t*>(r_sample)  = half;
+    r_sample                               += 2   ;
+}
+
+
+
+// sets samples, samples_end, and stream_ring from memory left after
+// (optional) code copy
+void set_samples(
+uint8_t     *ram_dest   ,
+uint32_t     num_samples)
+{
+    uint8_t     *end_of_ram = reinterpret_cast<uint8_t*>(&STORAGE_END);
+    uint32_t     available  = end_of_ram - ram_dest                    ,
+                 bytes      = num_samples << 2                         ;
+
+    if (bytes > available)
+        bytes = available;
+
+    r_sample    = end_of_ram - bytes                    ;
+    samples     = reinterpret_cast<uint32_t*>(r_sample) ;
+    samples_end = samples                               ;
+
+    const uint32_t  half = (bytes >> 3) << 2;
+
+    stream_ring.begin   = samples                                    ;
+    stream_ring.read    = samples                                    ;
+    stream_ring.mid     = reinterpret_cast<uint32_t*>(r_sample + half);
+    stream_ring.end     = stream_ring.mid + (half >> 2)              ;
+    stream_ring.filled  = 0                                          ;
+    stream_ring.drained = 0                                          ;
+
+    sampling_stats.stream_half = half >> 2;
+}
+
+
+
+[[noreturn]] void stream_overrun()
+{
+    samples_end = reinterpret_cast<uint32_t*>(r_sample);
+    halt_timers();
+    sampling_stats.end = mcu.now();
+    longjmp(longjump_buf, HALT_OVERRUN);
+}
+
+
+
+// from sampling_setup to halt (via longjmp() from IRQ or overrun)
+[[noreturn]] void sampling(
+const unsigned  mem,
+uint32_t        prev)
+{
+    uint64_t    &reads = sampling_stats.sample_reads;
+
+    switch (sampling_mode) {
+        case SPEED_MHZ_6:
+        case SPEED_IRREGULAR: {
+            const uint8_t  *cycles =   sampling_mode == SPEED_MHZ_6
+                                     ? buck50_sim::LoopCycles::MHZ_6    [mem]
+                                     : buck50_sim::LoopCycles::IRREGULAR[mem];
+            const unsigned  num    = sampling_mode == SPEED_MHZ_6 ? 6 : 2;
+            unsigned        phase  = 0;
+
+            while (true) {
+                const uint32_t  crnt   = gpiob_idr()                     ,
+                                idrtim =   mcu.systick_val(mcu.now() + 2)
+                                         | crnt << 20                    ;
+                ++reads;
+                if (crnt != prev)
+                    store(idrtim);
+                prev = crnt;
+                mcu.advance(cycles[phase]);
+                phase = (phase + 1) % num;
+                reads += skip(cycles, num, phase);
+                mcu.check();
+            }
+        }
+
+        case SPEED_UNIFORM:
+        case SPEED_MHZ_4: {
+            const uint8_t   cycles =   sampling_mode == SPEED_UNIFORM
+                                     ? buck50_sim::LoopCycles::UNIFORM[mem]
+                                     : buck50_sim::LoopCycles::MHZ_4  [mem];
+
+            while (true) {
+                const uint32_t  crnt   = gpiob_idr()                     ,
+                                idrtim =   mcu.systick_val(mcu.now() + 2)
+                                         | crnt << 20                    ;
+                ++reads;
+                if (crnt != prev)
+                    store(idrtim);
+                prev = crnt;
+                mcu.advance(cycles);
+                reads += skip(cycles);
+                mcu.check();
+            }
+        }
+
+        case SPEED_STREAM: {
+            const uint8_t   cycles = buck50_sim::LoopCycles::STREAM[mem];
+            uint8_t        *limit  = reinterpret_cast<uint8_t*>(stream_ring.mid);
+
+            while (true) {
+                const uint32_t  crnt   = gpiob_idr()                     ,
+                                idrtim =   mcu.systick_val(mcu.now() + 2)
+                                         | crnt << 20                    ;
+                ++reads;
+                if (crnt != prev)
+                    store(idrtim);
+                prev = crnt;
+                mcu.advance(cycles);
+
+                if (r_sample == limit) {  // end of half
+                    // halt IRQ may land before ++filled or before wrap
+                    mcu.advance(STREAM_FILLED[mem]);
+                    mcu.check();
+                    const uint32_t  filled = ++stream_ring.filled;
+
+                    mcu.advance(STREAM_WRAP[mem]);
+                    mcu.check();
+                    limit = reinterpret_cast<uint8_t*>(stream_ring.end);
+                    if (r_sample == limit) {
+                        r_sample = reinterpret_cast<uint8_t*>(stream_ring.begin);
+                        limit    = reinterpret_cast<uint8_t*>(stream_ring.mid  );
+                    }
+                    mcu.advance(  STREAM_HALF  [mem]
+                                - STREAM_FILLED[mem]
+                                - STREAM_WRAP  [mem]);
+                    if (filled - stream_ring.drained >= 2)
+                        stream_overrun();
+                    mcu.writ(NVIC_ISPR0, 4, USB_LP_IRQ_BIT);  // may IRQ
+                }
+
+                reads += skip(cycles);
+                mcu.check();
+            }
+        }
+
+        case SPEED_PACKED: {
+            // PACKED[mem]: unchanged, then changed and escape for
+            //   packed_loop (swap 0) and packed_swap (swap 2)
+            const uint8_t  *cycles    = buck50_sim::LoopCycles::PACKED[mem]      ;
+            uint32_t        prev_tick =   reinterpret_cast<uint32_t*>(r_sample)[-1]
+                                        & 0xffffff                                ;
+            unsigned        swap      = 0;
+
+            while (true) {
+                const uint32_t  crnt   = gpiob_idr()                   ,
+                                idrtim = mcu.systick_val(mcu.now() + 2);
+                ++reads;
+                if (crnt == prev) {
+                    mcu.advance(cycles[0]);
+                    reads += skip(cycles[0]);
+                    mcu.check();
+                    continue;
+                }
+
+                // no 24-bit mask: systick reload between samples wraps
+                //   to > 255 and escapes
+                const uint32_t  delta = prev_tick - idrtim  ,
+                                bits  = (crnt & 0xff0) << 4;
+                prev      = crnt  ;
+                prev_tick = idrtim;
+                ++sampling_stats.stores;
+
+                if (delta > 0xff) {
+                    store_half(bits          );
+                    store_half(idrtim        );
+                    store_half(idrtim >> 16  );
+                    mcu.advance(cycles[2 + swap]);
+                }
+                else {
+                    store_half(bits | delta);
+                    mcu.advance(cycles[1 + swap]);
+                }
+                swap ^= 2;
+
+                mcu.check();
+            }
+        }
+
+        default:
+            fprintf(stderr, "bad sampling_mode %u\n", sampling_mode);
+            abort();
+    }
+}
+
+
+
+// wait for open-drain ganged line (PB14 or PB15) high
+void ganged_wait(
+const unsigned  mem ,
+const uint32_t  line)
+{
+    while (!(gpiob_idr() & line)) {
+        mcu.advance(HANDSHAKE[mem]);
+        skip(HANDSHAKE[mem]);
+        mcu.check();
+    }
+    mcu.advance(HANDSHAKE[mem]);
+}
+
+
+
+// trigger_and_sample_*() through ganged_ready, code_bytes (TriggerCompiler)
+// before optional copy to RAM of trigger_bytes plus sampling loop, or
+// else of epilogue_bytes (compiled_epilogue)
+void trigger_setup(
+const bool      ganged        ,
+const uint8_t   flash_or_ram  ,
+const uint16_t  num_samples   ,
+const uint16_t  trigger_bytes ,
+const uint32_t  code_bytes    ,
+const uint16_t  epilogue_bytes)
+{
+    const unsigned  mem      = flash_or_ram == CODE_MEM_RAM ? 0 : 1          ;
+    uint8_t        *ram_dest = reinterpret_cast<uint8_t*>(&STORAGE) + code_bytes;
+
+    sampling_stats              = buck50_sim::SamplingStats{};
+    sampling_stats.begin        = mcu.now()                 ;
+    sampling_stats.mode         = sampling_mode             ;
+    sampling_stats.flash_or_ram = flash_or_ram              ;
+
+    mcu.advance(ENTRY_CYCLES[1]);  // in flash
+
+    if (mem == 0) {  // copy code to RAM
+        const uint16_t  bytes = trigger_bytes + SAMPLING_BYTES[sampling_mode];
+        ram_dest += bytes;
+        mcu.advance((bytes >> 2) * COPY_WORD_CYCLES[1]);
+    }
+    else if (epilogue_bytes) {
+        ram_dest += epilogue_bytes;
+        mcu.advance((epilogue_bytes >> 2) * COPY_WORD_CYCLES[1]);
+    }
+
+    set_samples(ram_dest, num_samples);
+
+    mcu.check();
+
+    if (ganged) {  // ganged_ready
+        mcu.writ(GPIOB_BSRR, 4, GANGED_TRIG_SET);
+        ganged_wait(mem, GANGED_TRIG_SET);
+    }
+
+    sampling_stats.triggering = mcu.now();
+}
+
+
+
+void in_progress_triggered()
+{
+    r_state |=   IN_PROG_TRIGGERED | IN_PROG_SAMPLING;
+    r_state &= ~IN_PROG_TRIGGERING                   ;
+    in_progress = r_state;
+}
+
+
+
+// from trigger_tail "triggered:" (or TriggerCompiler code's branch to
+// compiled_triggered, always in RAM, stores sample before in_progress)
+// to halt
+[[noreturn]] void triggered(
+const bool      ganged  ,
+const bool      compiled,
+const unsigned  mem     ,
+const uint32_t  idr     )
+{
+    const unsigned  epilogue = compiled ? 0 : mem;
+
+    trace_state(r_state & 0xff);  // fail chain member which passed
+
+    if (compiled)
+        mcu.advance(COMPILED_STAMP[0]);
+    else {
+        in_progress_triggered();
+        mcu.advance(TRIGGERED_CYCLES[mem]);
+    }
+    sampling_stats.triggered = mcu.now();
+    store(mcu.systick_val(mcu.now()) | idr << 20);
+    if (compiled) {
+        in_progress_triggered();
+        mcu.advance(COMPILED_IN_PROG[0]);
+    }
+
+    if (ganged) {  // ganged_sync
+        mcu.writ(GPIOB_BSRR, 4, GANGED_TRIG_CLR | GANGED_SYNC_SET);
+        ganged_wait(epilogue, GANGED_SYNC_SET);
+    }
+
+    // sampling_setup
+    const uint32_t  prev = gpiob_idr();
+    store(mcu.systick_val(mcu.now() + 2) | prev << 20);
+    mcu.advance(SETUP_CYCLES[epilogue]);
+    mcu.writ(ADV_TIM_1_CR1, 4, CEN);
+
+    sampling(mem, prev);
+}
+
+
+
+[[noreturn]] void trigger_and_sample(
+const bool      ganged      ,
+const uint8_t   flash_or_ram,
+const uint16_t  num_samples )
+{
+    const unsigned      mem      = flash_or_ram == CODE_MEM_RAM ? 0 : 1;
+    const uint32_t     *triggers = reinterpret_cast<uint32_t*>(  // TRIGGERS
+                                         reinterpret_cast<uintptr_t>(&STORAGE_END)
+                                       - 4 * 256                                );
+
+    trigger_setup(ganged, flash_or_ram, num_samples, TRIGGER_BYTES[ganged], 0, 0);
+
+    uint32_t    trigger ,
+                trigbits,
+                fail    ,
+                idr     ;
+
+    r_state = 0;
+    trace_state(0);
+
+    while (true) {  // trigger_loop
+        trigger  = triggers[r_state]       ;
+        trigbits = trigger >> 24           ;
+        fail     = (trigger >> 16) & 0xff  ;
+
+        while (true) {  // loop_gpiob
+            idr = gpiob_idr();
+            ++sampling_stats.trigger_reads;
+
+            if (ganged) {
+                const bool  extern_trig = !(idr & GANGED_TRIG_SET);
+                idr &= ~0xf000;
+                if (extern_trig) {
+                    r_state |= IN_PROG_EXTERN_TRIG;
+                    goto triggered;
+                }
+            }
+
+            if ((trigger & (idr >> 4)) == trigbits)
+                goto pass;
+
+            mcu.advance(TRIGGER_SPIN[mem][ganged]);
+
+            if (fail == r_state) {  // most common, unchanged state
+                sampling_stats.trigger_reads += skip(TRIGGER_SPIN[mem][ganged]);
+                mcu.check();
+                continue;
+            }
+
+            // fail_loop, with state and fail swapped
+            fail    = r_state;
+            r_state = (trigger >> 16) & 0xff;
+
+            while (true) {
+                trigger  = triggers[r_state];
+                trigbits = trigger >> 24    ;
+                mcu.advance(TRIGGER_STEP[mem]);
+
+                if ((trigger & (idr >> 4)) == trigbits)
+                    goto pass;
+
+                r_state = (trigger >> 16) & 0xff;
+                if (r_state == fail)
+                    break;
+            }
+            mcu.check();
+            break;  // reload trigger
+
+          pass:
+            mcu.advance(TRIGGER_STEP[mem]);
+            if (!((trigger >> 8) & 0xff))
+                goto triggered;
+            r_state = (trigger >> 8) & 0xff;
+            trace_state(r_state);
+            mcu.check();
+            break;  // reload trigger
+        }
+    }
+
+  triggered:
+    triggered(ganged, false, mem, idr);
+}
+
+
+
+bool condition(
+const uint8_t   cond,
+const bool      n   ,
+const bool      z   ,
+const bool      c   ,
+const bool      v   )
+{
+    switch (cond) {
+        case  0: return  z           ;  // EQ
+        case  1: return !z           ;  // NE
+        case  2: return  c           ;  // CS
+        case  3: return !c           ;  // CC
+        case  4: return  n           ;  // MI
+        case  5: return !n           ;  // PL
+        case  6: return  v           ;  // VS
+        case  7: return !v           ;  // VC
+        case  8: return  c && !z     ;  // HI
+        case  9: return !c ||  z     ;  // LS
+        case 10: return  n == v      ;  // GE
+        case 11: return  n != v      ;  // LT
+        case 12: return !z && n == v ;  // GT
+        case 13: return  z || n != v ;  // LE
+        default: return true         ;  // AL
+    }
+}
+
+
+
+[[noreturn]] void unsupported(
+const uint16_t  half,
+const uint32_t  pc  )
+{
+    fprintf(stderr, "compiled triggers: unsupported instruction %04x at %u\n",
+            half, pc                                                          );
+    abort();
+}
+
+
+
+// Executes TriggerCompiler (buck50.cxx) code at STORAGE, decoding only
+// the Thumb-2 encodings it emits. Returns gpiob_idr at trigger, with
+// r_state as set by code. Loops which saw unchanged GPIOB for a whole
+// iteration are skipped ahead as by skip().
+uint32_t compiled_triggers()
+{
+    const uint16_t  *code       = reinterpret_cast<uint16_t*>(&STORAGE);
+    uint32_t         reg[16]    = {}                                    ,
+                     pc         = 0                                     ,
+                     loop_head  = UINT32_MAX                            ;
+    uint64_t         loop_begin = mcu.now()                             ,
+                     loop_reads = 0                                     ;
+    bool             n = false, z = false, c = false, v = false         ;
+
+    reg[0] = GPIOB;  // gpiob
+
+    while (pc < trigger_code_size) {  // branches or falls into epilogue
+        const uint16_t  half   = code[pc >> 1];
+        int32_t         offset = 0            ;
+        uint8_t         cond   = 0xe          ;  // AL
+
+        if ((half & 0xf800) == 0x2000) {  // MOVS Rd, #imm8
+            reg[(half >> 8) & 0x7] = half & 0xff;
+            if (((half >> 8) & 0x7) == 5)  // state
+                trace_state(half & 0xff);
+            n = false;
+            z = (half & 0xff) == 0;
+            mcu.advance(COMPILED_ALU);
+            pc += 2;
+            continue;
+        }
+        else if ((half & 0xf800) == 0x6800) {  // LDR Rt, [Rn, #imm5]
+            if (reg[(half >> 3) & 0x7] + ((half >> 4) & 0x7c) != GPIOB_IDR)
+                unsupported(half, pc);
+            reg[half & 0x7] = gpiob_idr();
+            ++sampling_stats.trigger_reads;
+            ++loop_reads;
+            mcu.advance(COMPILED_LOAD);
+            pc += 2;
+            continue;
+        }
+        else if ((half & 0xf800) == 0x0000 && (half & 0x07c0)) {  // LSLS #imm
+            const unsigned  shift = (half >> 6) & 0x1f        ,
+                            rm    = reg[(half >> 3) & 0x7]    ;
+            c = (rm >> (32 - shift)) & 1;
+            reg[half & 0x7] = rm << shift;
+            n = reg[half & 0x7] >> 31;
+            z = reg[half & 0x7] == 0;
+            mcu.advance(COMPILED_ALU);
+            pc += 2;
+            continue;
+        }
+        else if (half == 0xbf00) {  // NOP
+            mcu.advance(COMPILED_ALU);
+            pc += 2;
+            continue;
+        }
+        else if ((half & 0xf000) == 0xd000 && (half & 0x0f00) < 0x0e00) {
+            cond   = (half >> 8) & 0xf;                     // B<c> T1
+            offset = static_cast<int8_t>(half & 0xff) * 2;
+        }
+        else if ((half & 0xf800) == 0xe000)                 // B T2
+            offset = static_cast<int16_t>(half << 5) >> 4;
+        else if ((half & 0xf800) == 0xf000) {
+            const uint16_t  half2 = code[(pc >> 1) + 1]                     ,
+                            s     = (half  >> 10) & 1                       ,
+                            j1    = (half2 >> 13) & 1                       ,
+                            j2    = (half2 >> 11) & 1                       ;
+
+            if (!(half2 & 0x8000) && !(half & 0x0200)) {  // modified immediate
+                const uint32_t  imm12 =   ((half >> 10) & 1) << 11
+                                        | ((half2 >> 12) & 7) <<  8
+                                        | (half2 & 0xff)           ,
+                                rot   = imm12 >> 7                 ,
+                                rn    = reg[half & 0xf]            ;
+                uint32_t        imm   = imm12                      ,
+                                result                             ;
+                bool            carry = c                          ;
+
+                if (imm12 >> 10) {
+                    imm   = (0x80 | (imm12 & 0x7f)) >> rot
+                          | (0x80 | (imm12 & 0x7f)) << (32 - rot);
+                    carry = imm >> 31;
+                }
+                else if (imm12 >> 8)
+                    unsupported(half, pc);  // replicated byte patterns
+
+                switch ((half >> 5) & 0xf) {
+                    case 0x0:  // AND, TST
+                        result = rn & imm;
+                        c      = carry   ;
+                        break;
+                    case 0x2:  // ORR, MOV
+                        result = ((half & 0xf) == 0xf ? 0 : rn) | imm;
+                        c      = carry                               ;
+                        break;
+                    case 0xd:  // SUB, CMP
+                        result = rn - imm                               ;
+                        c      = rn >= imm                              ;
+                        v      = ((rn ^ imm) & (rn ^ result)) >> 31     ;
+                        break;
+                    default:
+                        unsupported(half, pc);
+                }
+                if (half & 0x0010) {
+                    n = result >> 31;
+                    z = result == 0 ;
+                }
+                if (((half2 >> 8) & 0xf) != 0xf)
+                    reg[(half2 >> 8) & 0xf] = result;
+                mcu.advance(COMPILED_ALU);
+                pc += 4;
+                continue;
+            }
+            else if ((half2 & 0xd000) == 0x8000) {  // B<c> T3
+                cond   = (half >> 6) & 0xf;
+                offset =   (  static_cast<int32_t>(  s    << 20 | j2 << 19
+                                                   | j1   << 18
+                                                   | (half  & 0x3f ) << 12
+                                                   | (half2 & 0x7ff) <<  1)
+                            << 11)
+                         >> 11;
+            }
+            else if ((half2 & 0xd000) == 0x9000) {  // B T4
+                const uint32_t  i1 = ~(j1 ^ s) & 1,
+                                i2 = ~(j2 ^ s) & 1;
+                offset =   (  static_cast<int32_t>(  s    << 24 | i1 << 23
+                                                   | i2   << 22
+                                                   | (half  & 0x3ff) << 12
+                                                   | (half2 & 0x7ff) <<  1)
+                            << 7)
+                         >> 7;
+            }
+            else
+                unsupported(half, pc);
+        }
+        else
+            unsupported(half, pc);
+
+        // branch
+        if (!condition(cond, n, z, c, v)) {
+            mcu.advance(COMPILED_ALU);
+            pc += (half & 0xf800) == 0xf000 ? 4 : 2;
+            continue;
+        }
+
+        const uint32_t  target = pc + 4 + offset;
+
+        mcu.advance(COMPILED_TAKEN);
+
+        if (target <= pc) {  // loop
+            const uint64_t  now = mcu.now();
+
+            if (target == loop_head && mcu.next_input(1, loop_begin) > now) {
+                const uint64_t  until  = std::min(mcu.next_input(1, loop_begin),
+                                                  mcu.next_due()              ),
+                                period = now - loop_begin                     ;
+
+                if (until > now && until != buck50_sim::Mcu::NEVER) {
+                    const uint64_t  loops = (until - now) / period;
+
+                    mcu.advance(loops * period);
+                    sampling_stats.trigger_reads += loops * loop_reads;
+                }
+            }
+
+            loop_head  = target   ;
+            loop_begin = mcu.now();
+            loop_reads = 0        ;
+            r_state    = reg[5]   ;  // state, for irq_handler_enter()
+            mcu.check();
+        }
+
+        pc = target;
+    }
+
+    r_state = reg[5];
+    return reg[4];  // gpiob_idr
+}
+
+
+
+[[noreturn]] void trigger_and_sample_compiled(
+const bool      ganged      ,
+const uint8_t   flash_or_ram,
+const uint16_t  num_samples )
+{
+    const unsigned      mem = flash_or_ram == CODE_MEM_RAM ? 0 : 1;
+
+    trigger_setup(ganged                 ,
+                  flash_or_ram           ,
+                  num_samples            ,
+                  COMPILED_BYTES[ganged] ,
+                  trigger_code_size      ,
+                  EPILOGUE_BYTES[ganged] );
+
+    r_state = 0;
+
+    const uint32_t  idr = compiled_triggers();
+
+    triggered(ganged, true, mem, idr);
+}
+
+}  // namespace
+
+
+
+extern "C" {
+
+void trigger_and_sample_plain(
+const uint8_t   flash_or_ram,
+const uint16_t  num_samples )
+{
+    trigger_and_sample(false, flash_or_ram, num_samples);
+}
+
+
+
+void trigger_and_sample_ganged(
+const uint8_t   flash_or_ram,
+const uint16_t  num_samples )
+{
+    trigger_and_sample(true, flash_or_ram, num_samples);
+}
+
+
+
+void trigger_and_sample_compiled_plain(
+const uint8_t   flash_or_ram,
+const uint16_t  num_samples )
+{
+    trigger_and_sample_compiled(false, flash_or_ram, num_samples);
+}
+
+
+
+void trigger_and_sample_compiled_ganged(
+const uint8_t   flash_or_ram,
+const uint16_t  num_samples )
+{
+    trigger_and_sample_compiled(true, flash_or_ram, num_samples);
+}
+
+
+
+void HardFault_Handler()
+{
+    const uint16_t  in_prog = irq_handler_enter();
+
+    if (!(in_prog & (IN_PROG_TRIGGERING | IN_PROG_SAMPLING))) {
+        // firmware hangs blinking user LED
+        fprintf(stderr, "HardFault outside of triggering/sampling\n");
+        abort();
+    }
+
+    halt_timers();
+    irq_handler_exit(HALT_MEMORY);
+}
+
+
+
+void TIM3_IRQHandler()
+{
+    irq_handler_enter();
+    halt_timers();
+    irq_handler_exit(HALT_DURATION);
+}
+
+
+
+void USB_LP_CAN1_RX0_IRQHandler()
+{
+    const uint16_t  in_prog = irq_handler_enter();
+
+    usb_dev.interrupt_handler();
+
+    if (!(in_prog & (IN_PROG_TRIGGERING | IN_PROG_SAMPLING | IN_PROG_COUNTING)))
+        return;
+
+    if ((in_prog & IN_PROG_SAMPLING) && stream_drain())
+        return;
+
+    halt_timers();
+    irq_handler_exit(HALT_USB);
+}
+
+}  // extern "C"
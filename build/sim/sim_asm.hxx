@@ -0,0 +1,73 @@
+// buck50: Test and measurement firmware for “Blue Pill” STM32F103 development board
+// Copyright (C) 2019,2020 Mark R. Rubin aka "thanks4opensource"
+//
+// This file is part of buck50.
+//
+// The buck50 program is free software: you can redistribute it
+// and/or modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The buck50 program is distributed in the hope that it will be
+// useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+// of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// (LICENSE.txt) along with the buck50 program.  If not, see
+// <https://www.gnu.org/licenses/gpl.html>
+
+
+// C++ equivalents of src/buck50_asm.s triggering/sampling loops and IRQ
+// handlers, same semantics (including HardFault at END_OF_RAM, longjmp()
+// with HaltCode) and per-instruction-sequence cycle counts. Code sizes and
+// cycle counts are generated into asm_loops.hxx from the assembled
+// buck50_asm.s (see asm_loops.py and asm_loops.txt): hardware-measured
+// counts for sampling loops, checked against the loops' object code, and
+// a calibrated Cortex-M3 model for triggering, setup, stream, and packed.
+
+
+#ifndef SIM_ASM_HXX
+#define SIM_ASM_HXX
+
+#define SIM_ASM_MAJOR_VERSION   1
+#define SIM_ASM_MINOR_VERSION   3
+#define SIM_ASM_MICRO_VERSION   0
+
+#include <cstdint>
+
+#include "asm_loops.hxx"
+
+
+namespace buck50_sim {
+
+// cycles per GPIOB read, indexed by flash_or_ram (CODE_MEM_RAM == 0):
+// MHZ_6[2][6], IRREGULAR[2][2], UNIFORM[2], MHZ_4[2], STREAM[2], and
+// PACKED[2][3] (unchanged, changed, escape)
+namespace LoopCycles = asm_loops;
+
+
+// for benchmark, last trigger_and_sample_*() call
+struct SamplingStats {
+    static const unsigned   MAX_STATES = 64;
+
+    uint64_t    begin       ,  // call
+                triggering  ,  // first trigger check
+                triggered   ,  // trigger (or ganged sync) satisfied
+                end         ;  // halt
+    uint64_t    trigger_reads,
+                sample_reads ,
+                stores       ;
+    uint32_t    stream_half  ;  // words per StreamRing half
+    uint64_t    state_at[MAX_STATES];  // trigger state changes (first
+    uint8_t     states  [MAX_STATES];  // MAX_STATES), see trace_state()
+    uint32_t    num_states          ;
+    uint8_t     mode         ,
+                flash_or_ram ;
+};
+
+extern SamplingStats     sampling_stats;
+
+}  // namespace buck50_sim
+
+#endif  // ifndef SIM_ASM_HXX
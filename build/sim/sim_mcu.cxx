@@ -0,0 +1,1020 @@
+// buck50: Test and measurement firmware for “Blue Pill” STM32F103 development board
+// Copyright (C) 2019,2020 Mark R. Rubin aka "thanks4opensource"
+//
+// This file is part of buck50.
+//
+// The buck50 program is free software: you can redistribute it
+// and/or modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The buck50 program is distributed in the hope that it will be
+// useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+// of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// (LICENSE.txt) along with the buck50 program.  If not, see
+// <https://www.gnu.org/licenses/gpl.html>
+
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "buck50_sim.hxx"
+#include "regbits_sim.hxx"
+#include "sim_mcu.hxx"
+
+
+namespace {
+
+// register addresses, RM0008 and PM0056
+namespace addr {
+    const uintptr_t     TIM3         = 0x40000400,
+                        SPI2         = 0x40003800,
+                        USART2       = 0x40004400,
+                        USART3       = 0x40004800,
+                        GPIOA        = 0x40010800,  // B, C at 0x400 spacing
+                        ADC1         = 0x40012400,
+                        ADC2         = 0x40012800,
+                        TIM1         = 0x40012c00,
+                        SPI1         = 0x40013000,
+                        USART1       = 0x40013800,
+                        DMA1         = 0x40020000,
+                        RCC          = 0x40021000,
+                        DWT          = 0xe0001000,
+                        SYSTICK      = 0xe000e010,
+                        NVIC_ISER    = 0xe000e100,
+                        NVIC_ICER    = 0xe000e180,
+                        NVIC_ISPR    = 0xe000e200,
+                        NVIC_ICPR    = 0xe000e280,
+                        FLASH_SIZE   = 0x1ffff7e0,
+                        UNIQUE_ID    = 0x1ffff7e8;
+}
+
+// register offsets
+namespace off {
+    const uintptr_t     RCC_CR       = 0x00,
+                        RCC_CFGR     = 0x04,
+                        RCC_APB2RSTR = 0x0c,
+                        RCC_APB1RSTR = 0x10,
+                        GPIO_CRL     = 0x00,
+                        GPIO_CRH     = 0x04,
+                        GPIO_IDR     = 0x08,
+                        GPIO_ODR     = 0x0c,
+                        GPIO_BSRR    = 0x10,
+                        GPIO_BRR     = 0x14,
+                        TIM_CR1      = 0x00,
+                        TIM_DIER     = 0x0c,
+                        TIM_SR       = 0x10,
+                        TIM_CNT      = 0x24,
+                        TIM_PSC      = 0x28,
+                        TIM_ARR      = 0x2c,
+                        TIM_CCR1     = 0x34,
+                        TIM_CCER     = 0x20,
+                        ADC_SR       = 0x00,
+                        ADC_CR1      = 0x04,
+                        ADC_CR2      = 0x08,
+                        ADC_SMPR1    = 0x0c,
+                        ADC_SMPR2    = 0x10,
+                        ADC_SQR1     = 0x2c,
+                        ADC_SQR2     = 0x30,
+                        ADC_SQR3     = 0x34,
+                        ADC_DR       = 0x4c,
+                        DMA_ISR      = 0x00,
+                        DMA_IFCR     = 0x04,
+                        DMA_CCR1     = 0x08,
+                        DMA_CNDTR1   = 0x0c,
+                        DMA_CMAR1    = 0x14,
+                        SYSTICK_CTRL = 0x00,
+                        SYSTICK_LOAD = 0x04,
+                        SYSTICK_VAL  = 0x08,
+                        DWT_CTRL     = 0x00,
+                        DWT_CYCCNT   = 0x04;
+}
+
+namespace bit {
+    const uint32_t      RCC_HSION    = 1 <<  0,
+                        RCC_HSEON    = 1 << 16,
+                        RCC_PLLON    = 1 << 24,
+                        TIM_CEN      = 1 <<  0,
+                        TIM_UIE      = 1 <<  0,
+                        TIM_UIF      = 1 <<  0,
+                        TIM_CC1E     = 1 <<  0,
+                        TIM_CC1NE    = 1 <<  2,
+                        ADC_EOC      = 1 <<  1,
+                        ADC_DISCEN   = 1 << 11,
+                        ADC_SCAN     = 1 <<  8,
+                        ADC_ADON     = 1 <<  0,
+                        ADC_CONT     = 1 <<  1,
+                        ADC_CAL      = 1 <<  2,
+                        ADC_RSTCAL   = 1 <<  3,
+                        ADC_DMA      = 1 <<  8,
+                        ADC_SWSTART  = 1 << 22,
+                        DMA_EN       = 1 <<  0,
+                        DMA_CIRC     = 1 <<  5,
+                        DMA_TCIF1    = 0x3     ,  // with GIF1
+                        DMA_HTIF1    = 0x5     ,  //   "    "
+                        SYSTICK_EN   = 1 <<  0,
+                        DWT_CYCCNTEN = 1 <<  0;  // DEMCR TRCENA not modeled
+}
+
+// ADC sample times (SMPx) in half ADC clocks, plus 12.5 for conversion
+const unsigned          ADC_HALF_CLOCKS[] = {3, 15, 27, 57, 83, 111, 143, 479},
+                        ADC_CONVERT_HALFS = 25,
+                        ADC_CAL_CYCLES    = 83 * 6,  // 83 ADC clocks at /6
+                        ADC_FAST_INTRLV   = 0b0111;  // ADC1 CR1 DUALMOD
+
+// internal channels
+const uint16_t          ADC_TEMPERATURE  = 1750,  // ~25C
+                        ADC_VREFINT      = 1490;  // 1.2V at 3.3V VDDA
+
+const uint64_t          PACE_SLIP_CYCLES = 72000 * 50;  // 50 ms
+
+const buck50_sim::PinLevels     NO_STIMULUS = {};
+
+
+inline unsigned adc_ndx(
+const uintptr_t     address)
+{
+    return address >= addr::ADC2;
+}
+
+}  // namespace
+
+
+
+namespace regbits_sim {
+
+uint32_t read(
+const volatile void     *addr,
+const unsigned           size)
+{
+    return buck50_sim::mcu.read(reinterpret_cast<uintptr_t>(addr), size);
+}
+
+void writ(
+      volatile void     *addr,
+const unsigned           size,
+const uint32_t           word)
+{
+    buck50_sim::mcu.writ(reinterpret_cast<uintptr_t>(addr), size, word);
+}
+
+}  // namespace regbits_sim
+
+
+
+namespace buck50_sim {
+
+Mcu     mcu;
+
+void wfi()
+{
+    mcu.wfi();
+}
+
+
+
+Mcu::Mcu()
+:   _stimulus    (nullptr),
+    _gpio        {      },
+    _adc         {      },
+    _now         (0     ),
+    _next_due    (0     ),
+    _next_poll   (0     ),
+    _systick_base(0     ),
+    _cyccnt_base (0     ),
+    _tim1_start  (0     ),
+    _tim3_expiry (NEVER ),
+    _poll_idle_at(NEVER ),
+    _nvic_enabled(0     ),
+    _nvic_pending(0     ),
+    _dma_reload  (0     ),
+    _fd          (-1    ),
+    _paced       (false ),
+    _in_irq      (false ),
+    _tim1_running(false ),
+    _dma_running (false ),
+    _blocked     (false ),
+    _blocked_at  (0     )
+{
+}
+
+
+
+void Mcu::start(
+const int   fd   ,
+const bool  paced)
+{
+    static const struct {
+        uintptr_t   address;
+        size_t      size   ;
+    } REGIONS[] = {{0x40000000, 0x00030000},   // peripherals
+                   {0xe0000000, 0x00100000},   // Cortex-M3 private
+                   {0x1ffff000, 0x00001000},   // system memory, unique ID
+                   {0x20000000, 0x00005000}};  // SRAM (STORAGE, samples)
+
+    for (const auto &region : REGIONS) {
+        void    *mapped = mmap(reinterpret_cast<void*>(region.address),
+                               region.size                             ,
+                               PROT_READ | PROT_WRITE                  ,
+                               MAP_PRIVATE | MAP_ANONYMOUS
+                                           | MAP_FIXED_NOREPLACE       ,
+                               -1                                      ,
+                               0                                       );
+        if (mapped != reinterpret_cast<void*>(region.address)) {
+            fprintf(stderr, "can't map simulated memory at 0x%08lx\n",
+                    static_cast<unsigned long>(region.address));
+            exit(1);
+        }
+    }
+
+    reset_periphs(0xffffffff, 0xffffffff);
+
+    reg(addr::FLASH_SIZE) = 64;  // KB
+    reg(addr::UNIQUE_ID ) = 0x0b50cafe;
+    reg(addr::UNIQUE_ID + 4) = 0x484f5354;  // "HOST"
+    reg(addr::UNIQUE_ID + 8) = 0x53494d00;  // "SIM"
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    _fd        = fd                            ;
+    _paced     = paced                         ;
+    _wall_base = std::chrono::steady_clock::now();
+    _usb.fd(fd, paced);
+}
+
+
+
+void Mcu::reset_periphs(
+const uint32_t  apb1,
+const uint32_t  apb2)
+{
+    static const struct {
+        uint32_t    apb1,
+                    apb2;
+        uintptr_t   base;
+    } PERIPHS[] = {{1 <<  1, 0      , addr::TIM3         },
+                   {1 << 14, 0      , addr::SPI2         },
+                   {1 << 17, 0      , addr::USART2       },
+                   {1 << 18, 0      , addr::USART3       },
+                   {0      , 1 <<  2, addr::GPIOA        },
+                   {0      , 1 <<  3, addr::GPIOA + 0x400},
+                   {0      , 1 <<  4, addr::GPIOA + 0x800},
+                   {0      , 1 <<  9, addr::ADC1         },
+                   {0      , 1 << 10, addr::ADC2         },
+                   {0      , 1 << 11, addr::TIM1         },
+                   {0      , 1 << 12, addr::SPI1         },
+                   {0      , 1 << 14, addr::USART1       }};
+
+    for (const auto &periph : PERIPHS) {
+        if (!(periph.apb1 & apb1) && !(periph.apb2 & apb2))
+            continue;
+
+        memset(reinterpret_cast<void*>(periph.base), 0, 0x400);
+
+        switch (periph.base) {
+            case addr::GPIOA:
+            case addr::GPIOA + 0x400:
+            case addr::GPIOA + 0x800:
+                reg(periph.base + off::GPIO_CRL) = 0x44444444;  // floating
+                reg(periph.base + off::GPIO_CRH) = 0x44444444;
+                _gpio[(periph.base - addr::GPIOA) >> 10].dirty = true;
+                break;
+
+            case addr::USART1:
+            case addr::USART2:
+            case addr::USART3:
+                reg(periph.base) = 0xc0;  // SR TXE|TC
+                break;
+
+            case addr::SPI1:
+            case addr::SPI2:
+                reg(periph.base + 0x08) = 0x2;  // SR TXE
+                break;
+
+            case addr::ADC1:
+            case addr::ADC2:
+                _adc[adc_ndx(periph.base)] = Adc{};
+                break;
+
+            case addr::TIM1:
+                _tim1_running = false;
+                break;
+
+            case addr::TIM3:
+                _tim3_expiry = NEVER;
+                break;
+        }
+    }
+
+    if (apb1 == 0xffffffff) {  // power-on
+        reg(addr::RCC + off::RCC_CR) = 0x83;  // HSION|HSIRDY, HSITRIM
+        _dma_running = false;
+    }
+}
+
+
+
+void Mcu::gpio_masks(
+const unsigned  port)
+{
+    const uintptr_t      base  = addr::GPIOA + (port << 10);
+    const uint64_t       confs =   static_cast<uint64_t>(reg(base + off::GPIO_CRH))
+                                   << 32
+                                 | reg(base + off::GPIO_CRL)          ;
+    GpioMasks           &masks = _gpio[port]                          ;
+
+    masks = GpioMasks{};
+
+    for (unsigned pin = 0 ; pin < 16 ; ++pin) {
+        const unsigned  conf = (confs >> (pin << 2)) & 0xf,
+                        mode = conf & 0x3                 ,
+                        cnf  = conf >> 2                  ;
+        const uint16_t  bit  = 1 << pin                   ;
+
+        if (mode == 0) {        // input
+            if (cnf == 1 || cnf == 2) masks.input |= bit;
+            if (cnf == 2)             masks.pull  |= bit;
+        }                       // else analog, reads 0
+        else if (cnf & 1)       // open-drain, GP or AF
+            masks.drain  |= bit;
+        else if (port == 1 && pin == 13 && (cnf & 2))
+            masks.tim1_ch1n = true;
+        else                    // push-pull
+            masks.output |= bit;
+    }
+}
+
+
+
+uint32_t Mcu::gpio_idr(
+const unsigned  port,
+const uint64_t  at  )
+{
+    if (_gpio[port].dirty)
+        gpio_masks(port);
+
+    const GpioMasks     &masks  = _gpio[port]                         ;
+    const uintptr_t      base   = addr::GPIOA + (port << 10)          ;
+    const uint32_t       odr    = reg(base + off::GPIO_ODR)           ;
+    const PinLevels     &levels = _stimulus ? _stimulus->at(at)
+                                            : NO_STIMULUS             ;
+    const uint32_t       driven = levels.driven[port]                 ,
+                         level  = levels.levels[port]                 ;
+
+    // undriven open-drain lines (ganged PB14, PB15) assumed pulled up
+    uint32_t    idr =   (masks.input  &  driven & level  )
+                      | (masks.pull   & ~driven & odr    )
+                      | (masks.output &           odr    )
+                      | (masks.drain  &  odr    & (~driven | level));
+
+    // output compare drives pin from configuration, before counter
+    // enabled (CNT 0 after reset)
+    if (masks.tim1_ch1n) {
+        const uintptr_t     tim1   = addr::TIM1                             ;
+        const uint64_t      tick   = reg(tim1 + off::TIM_PSC) + 1ULL        ,
+                            period = reg(tim1 + off::TIM_ARR) + 1ULL        ,
+                            cnt    =   _tim1_running
+                                     ? ((at - _tim1_start) / tick) % period
+                                     : 0                                    ;
+        const uint32_t      ccer   = reg(tim1 + off::TIM_CCER)              ;
+        // PWM mode 2: OC1REF active when CNT >= CCR1, CH1N follows it
+        // unless CH1 also enabled (complementary pair, RM0008 table 83),
+        // so firmware's CC1NE alone is low until counter reaches CCR1
+        bool                high   = cnt >= reg(tim1 + off::TIM_CCR1)       ;
+
+        if (!(ccer & bit::TIM_CC1NE))
+            high = false;
+        else if (ccer & bit::TIM_CC1E)
+            high = !high;
+        if (high)
+            idr |= 1 << 13;
+    }
+
+    return idr;
+}
+
+
+
+uint64_t Mcu::next_input(
+const unsigned  port ,
+const uint64_t  after)
+{
+    uint64_t    next = _stimulus ? _stimulus->next_change(after) : NEVER;
+
+    if (port == 1 && _tim1_running) {
+        if (_gpio[port].dirty)
+            gpio_masks(port);
+
+        if (_gpio[port].tim1_ch1n) {
+            const uintptr_t     tim1   = addr::TIM1                      ;
+            const uint64_t      tick   = reg(tim1 + off::TIM_PSC) + 1ULL ,
+                                period = reg(tim1 + off::TIM_ARR) + 1ULL ,
+                                ccr1   = reg(tim1 + off::TIM_CCR1)       ,
+                                ticks  = (after - _tim1_start) / tick    ,
+                                cnt    = ticks % period                  ,
+                                target = cnt < ccr1 ? ccr1 : period      ;
+
+            next = std::min(next, _tim1_start + (ticks - cnt + target) * tick);
+        }
+    }
+
+    return next;
+}
+
+
+
+uint32_t Mcu::systick_val(
+const uint64_t  at)
+const
+{
+    const uintptr_t     base = addr::SYSTICK                            ;
+    const uint64_t      load = (  *reinterpret_cast<const uint32_t*>(
+                                      base + off::SYSTICK_LOAD)
+                                & 0xffffff                             )
+                               + 1ULL                                   ;
+
+    if (!(*reinterpret_cast<const uint32_t*>(base) & bit::SYSTICK_EN))
+        return *reinterpret_cast<const uint32_t*>(base + off::SYSTICK_VAL);
+
+    return (load - (at - _systick_base) % load) % load;
+}
+
+
+
+unsigned Mcu::adc_channel(
+const unsigned  adc,
+const unsigned  ndx)
+{
+    const uintptr_t     base = adc ? addr::ADC2 : addr::ADC1;
+    const uintptr_t     sqr  =   ndx < 6  ? off::ADC_SQR3
+                               : ndx < 12 ? off::ADC_SQR2
+                               :            off::ADC_SQR1;
+
+    return (reg(base + sqr) >> ((ndx % 6) * 5)) & 0x1f;
+}
+
+
+
+uint64_t Mcu::adc_cycles(
+const unsigned  adc ,
+const unsigned  chan)
+{
+    const uintptr_t     base   = adc ? addr::ADC2 : addr::ADC1           ;
+    const uint32_t      smpr   =   chan < 10
+                                 ? reg(base + off::ADC_SMPR2) >> (chan * 3)
+                                 : reg(base + off::ADC_SMPR1)
+                                   >> ((chan - 10) * 3)                  ;
+    const unsigned      adcpre = (reg(addr::RCC + off::RCC_CFGR) >> 14) & 3,
+                        div    = (adcpre + 1) * 2                        ;
+
+    return (ADC_HALF_CLOCKS[smpr & 7] + ADC_CONVERT_HALFS) * div / 2;
+}
+
+
+
+uint16_t Mcu::adc_value(
+const unsigned  chan,
+const uint64_t  at  )
+{
+    if (chan < PinLevels::NUM_ANALOGS)
+        return _stimulus ? _stimulus->at(at).analogs[chan] : 0;
+    if (chan == 16)
+        return ADC_TEMPERATURE;
+    if (chan == 17)
+        return ADC_VREFINT;
+    return 0;
+}
+
+
+
+// conversion started by CR2 write: ADON when already on, or SWSTART
+void Mcu::adc_control(
+const unsigned  ndx ,
+const uint32_t  prev,
+const uint32_t  cr2 )
+{
+    const uintptr_t      base = ndx ? addr::ADC2 : addr::ADC1;
+    Adc                 &adc  = _adc[ndx]                    ;
+
+    if (!(cr2 & bit::ADC_ADON)) {
+        adc.queued     = 0    ;
+        adc.continuous = false;
+        if (ndx == 0) _dma_running = false;
+        reg(base + off::ADC_CR2) = cr2;
+        return;
+    }
+
+    if (cr2 & (bit::ADC_CAL | bit::ADC_RSTCAL)) {
+        adc.ready_at = _now + ADC_CAL_CYCLES;
+        reg(base + off::ADC_CR2) = cr2;
+        return;
+    }
+
+    const bool  start =    (cr2  & bit::ADC_SWSTART)
+                        || (prev & bit::ADC_ADON   );
+
+    reg(base + off::ADC_CR2) = cr2 & ~bit::ADC_SWSTART;
+
+    if (!start)
+        return;
+
+    const uint32_t  cr1     = reg(base + off::ADC_CR1)                  ,
+                    length  = ((reg(base + off::ADC_SQR1) >> 20) & 0xf) + 1;
+
+    adc.channel_ndx = 0;
+    adc.start       = _now;
+    adc.cycles      = adc_cycles(ndx, adc_channel(ndx, 0));
+
+    if (cr2 & bit::ADC_CONT) {
+        adc.continuous = true;
+        adc.queued     = 0   ;
+        adc.converted  = 0   ;
+        if (    ndx == 0
+            && (cr2                            & bit::ADC_DMA)
+            && (reg(addr::DMA1 + off::DMA_CCR1) & bit::DMA_EN ))
+            _dma_running = true;
+    }
+    else {
+        adc.continuous = false;
+        adc.converted  = 0    ;
+        if (cr1 & bit::ADC_DISCEN)
+            adc.queued = std::min(((cr1 >> 13) & 0x7) + 1, length);
+        else if (cr1 & bit::ADC_SCAN)
+            adc.queued = length;
+        else
+            adc.queued = 1;
+    }
+}
+
+
+
+// single/discontinuous conversion results, one per status read with EOC
+// (firmware reads DR once after each EOC)
+void Mcu::adc_update(
+const unsigned  ndx)
+{
+    const uintptr_t      base = ndx ? addr::ADC2 : addr::ADC1;
+    Adc                 &adc  = _adc[ndx]                    ;
+    uint32_t            &sr   = reg(base + off::ADC_SR)      ;
+
+    sr &= ~bit::ADC_EOC;
+
+    if (   adc.converted >= adc.queued
+        || _now < adc.start + adc.cycles)
+        return;
+
+    const unsigned  chan   = adc_channel(ndx, adc.channel_ndx)   ;
+    const uint64_t  done   = adc.start + adc.cycles              ;
+    const uint32_t  length = ((reg(base + off::ADC_SQR1) >> 20) & 0xf) + 1;
+
+    reg(base + off::ADC_DR) = adc_value(chan, done);
+    sr |= bit::ADC_EOC;
+
+    ++adc.converted;
+    adc.channel_ndx = (adc.channel_ndx + 1) % length                   ;
+    adc.start       = done                                             ;
+    adc.cycles      = adc_cycles(ndx, adc_channel(ndx, adc.channel_ndx));
+}
+
+
+
+// continuous ADC1 (and ADC2 if dual) conversions into DMA1 channel 1,
+// calculated lazily when firmware looks at results. Fast interleaved
+// ADC2 conversion half a period before ADC1's, both same channel.
+void Mcu::dma_update()
+{
+    if (!_dma_running)
+        return;
+
+    Adc             &adc1 = _adc[0]                                 ;
+    uint32_t        &ndt  = reg(addr::DMA1 + off::DMA_CNDTR1)       ,
+                    &ccr  = reg(addr::DMA1 + off::DMA_CCR1  )       ,
+                    &isr  = reg(addr::DMA1 + off::DMA_ISR   )       ;
+    const unsigned   dual = (reg(addr::ADC1 + off::ADC_CR1) >> 16) & 0xf,
+                     chan1 = adc_channel(0, 0)                      ,
+                     chan2 = adc_channel(1, 0)                      ;
+    const uint64_t   done  = (_now - adc1.start) / adc1.cycles      ,
+                     skew  = dual == ADC_FAST_INTRLV
+                             ? adc1.cycles / 2
+                             : 0                                    ;
+    const uintptr_t  dest  = reg(addr::DMA1 + off::DMA_CMAR1)       ;
+
+    if (!(ccr & bit::DMA_EN)) {
+        _dma_running = false;
+        return;
+    }
+
+    while (adc1.converted < done && ndt) {
+        const uint64_t  at  = adc1.start + (adc1.converted + 1) * adc1.cycles;
+        const uint32_t  ndx = _dma_reload - ndt                              ;
+
+        if (dual)
+            reinterpret_cast<uint32_t*>(dest)[ndx]
+            =    adc_value(chan1, at)
+              | static_cast<uint32_t>(adc_value(chan2, at - skew)) << 16;
+        else
+            reinterpret_cast<uint16_t*>(dest)[ndx]
+            = adc_value(chan1, at);
+
+        ++adc1.converted;
+
+        if (--ndt == _dma_reload / 2)
+            isr |= bit::DMA_HTIF1;
+        else if (!ndt) {
+            isr |= bit::DMA_TCIF1;
+            if (ccr & bit::DMA_CIRC)
+                ndt = _dma_reload;
+        }
+    }
+
+    if (!ndt)
+        _dma_running = false;
+}
+
+
+
+void Mcu::tim3_update()
+{
+    if (_now < _tim3_expiry)
+        return;
+
+    _tim3_expiry = NEVER;
+
+    reg(addr::TIM3 + off::TIM_SR ) |=  bit::TIM_UIF;
+    reg(addr::TIM3 + off::TIM_CR1) &= ~bit::TIM_CEN;  // OPM
+
+    if (reg(addr::TIM3 + off::TIM_DIER) & bit::TIM_UIE)
+        set_pending(Irq::TIM3);
+}
+
+
+
+uint32_t Mcu::read(
+const uintptr_t     address,
+const unsigned      size   )
+{
+    const uintptr_t     word_addr = address & ~0x3;
+    uint32_t           &word      = reg(word_addr) ;
+
+    _now += ACCESS_CYCLES;
+
+    if (word_addr >= addr::GPIOA && word_addr < addr::GPIOA + 0xc00) {
+        if ((word_addr & 0x3ff) == off::GPIO_IDR)
+            word = gpio_idr((word_addr - addr::GPIOA) >> 10, _now);
+    }
+    else if (word_addr >= addr::ADC1 && word_addr < addr::ADC2 + 0x400) {
+        const unsigned  ndx = adc_ndx(word_addr);
+
+        switch (word_addr & 0x3ff) {
+            case off::ADC_SR:
+                adc_update(ndx);
+                break;
+
+            case off::ADC_CR2:
+                if (_now >= _adc[ndx].ready_at)
+                    word &= ~(bit::ADC_CAL | bit::ADC_RSTCAL);
+                break;
+        }
+        dma_update();
+    }
+    else if (word_addr == addr::DMA1 + off::DMA_ISR   ||
+             word_addr == addr::DMA1 + off::DMA_CNDTR1)
+        dma_update();
+    else if (word_addr == addr::SYSTICK + off::SYSTICK_VAL)
+        word = systick_val(_now);
+    else if (   word_addr == addr::DWT + off::DWT_CYCCNT
+             && reg(addr::DWT + off::DWT_CTRL) & bit::DWT_CYCCNTEN)
+        word = _now - _cyccnt_base;
+    else if (word_addr == addr::TIM3 + off::TIM_CNT && _tim3_expiry != NEVER)
+        word =   (_now - (  _tim3_expiry
+                          - (reg(addr::TIM3 + off::TIM_ARR ) + 1ULL)
+                          * (reg(addr::TIM3 + off::TIM_PSC ) + 1ULL)))
+               / (reg(addr::TIM3 + off::TIM_PSC) + 1ULL);
+
+    uint32_t    value = 0;
+    memcpy(&value, reinterpret_cast<const void*>(address), size);
+
+    check();
+
+    return value;
+}
+
+
+
+void Mcu::writ(
+const uintptr_t     address,
+const unsigned      size   ,
+const uint32_t      value  )
+{
+    const uintptr_t     word_addr = address & ~0x3;
+    uint32_t           &word      = reg(word_addr) ;
+    const uint32_t      prev      = word           ;
+
+    _now += ACCESS_CYCLES;
+
+    uint32_t    next = prev;
+    memcpy(reinterpret_cast<uint8_t*>(&next) + (address & 0x3), &value, size);
+
+    if (word_addr >= addr::GPIOA && word_addr < addr::GPIOA + 0xc00) {
+        const uintptr_t     base   = word_addr & ~0x3ff        ,
+                            offset = word_addr &  0x3ff        ;
+        uint32_t           &odr    = reg(base + off::GPIO_ODR);
+
+        switch (offset) {
+            case off::GPIO_BSRR:
+                odr = (odr & ~(next >> 16)) | (next & 0xffff);
+                break;
+
+            case off::GPIO_BRR:
+                odr &= ~(next & 0xffff);
+                break;
+
+            case off::GPIO_CRL:
+            case off::GPIO_CRH:
+                _gpio[(base - addr::GPIOA) >> 10].dirty = true;
+                word = next;
+                break;
+
+            case off::GPIO_IDR:
+                break;  // read-only
+
+            default:
+                word = next;
+        }
+    }
+    else if (word_addr == addr::RCC + off::RCC_CR) {
+        // ready flags follow enables immediately
+        word =   (next & ~0x02020002)
+               | (next & bit::RCC_HSION) << 1
+               | (next & bit::RCC_HSEON) << 1
+               | (next & bit::RCC_PLLON) << 1;
+    }
+    else if (word_addr == addr::RCC + off::RCC_CFGR)
+        word = (next & ~0xc) | (next & 0x3) << 2;  // SWS = SW
+    else if (word_addr == addr::RCC + off::RCC_APB1RSTR) {
+        reset_periphs(next & ~prev, 0);
+        word = next;
+    }
+    else if (word_addr == addr::RCC + off::RCC_APB2RSTR) {
+        reset_periphs(0, next & ~prev);
+        word = next;
+    }
+    else if (word_addr >= addr::ADC1 && word_addr < addr::ADC2 + 0x400) {
+        dma_update();
+        if ((word_addr & 0x3ff) == off::ADC_CR2)
+            adc_control(adc_ndx(word_addr), prev, next);
+        else
+            word = next;
+    }
+    else if (word_addr >= addr::DMA1 && word_addr < addr::DMA1 + 0x400) {
+        dma_update();
+        if (word_addr == addr::DMA1 + off::DMA_IFCR) {
+            // CGIF1 clears all channel 1 flags
+            const uint32_t  clear = next & 0x1 ? 0xf : next & 0xf;
+            reg(addr::DMA1 + off::DMA_ISR) &= ~clear;
+        }
+        else if (word_addr != addr::DMA1 + off::DMA_ISR) {
+            // CNDTR1 plain uint32_t in firmware, not seen by write(), but
+            //   must be set before enabling
+            if (   word_addr == addr::DMA1 + off::DMA_CCR1
+                && (next & ~prev & bit::DMA_EN)           )
+                _dma_reload = reg(addr::DMA1 + off::DMA_CNDTR1);
+            word = next;
+        }
+    }
+    else if (word_addr == addr::TIM1 + off::TIM_CR1) {
+        if ((next & bit::TIM_CEN) && !_tim1_running)
+            _tim1_start = _now;
+        _tim1_running = next & bit::TIM_CEN;
+        word = next;
+    }
+    else if (word_addr == addr::TIM3 + off::TIM_CR1) {
+        if (!(next & bit::TIM_CEN))
+            _tim3_expiry = NEVER;
+        else if (!(prev & bit::TIM_CEN))
+            _tim3_expiry =   _now
+                           +   (reg(addr::TIM3 + off::TIM_ARR) + 1ULL)
+                             * (reg(addr::TIM3 + off::TIM_PSC) + 1ULL);
+        word = next;
+        _next_due = 0;
+    }
+    else if (word_addr == addr::SYSTICK + off::SYSTICK_VAL) {
+        word          = 0   ;  // any write clears
+        _systick_base = _now;
+    }
+    else if (word_addr == addr::SYSTICK + off::SYSTICK_CTRL) {
+        if ((next & bit::SYSTICK_EN) && !(prev & bit::SYSTICK_EN))
+            _systick_base = _now - reg(addr::SYSTICK + off::SYSTICK_VAL);
+        else if (!(next & bit::SYSTICK_EN) && (prev & bit::SYSTICK_EN))
+            reg(addr::SYSTICK + off::SYSTICK_VAL) = systick_val(_now);
+        word = next;
+    }
+    else if (word_addr == addr::DWT + off::DWT_CYCCNT) {
+        word         = next       ;
+        _cyccnt_base = _now - next;
+    }
+    else if (word_addr == addr::DWT + off::DWT_CTRL) {
+        if ((next & bit::DWT_CYCCNTEN) && !(prev & bit::DWT_CYCCNTEN))
+            _cyccnt_base = _now - reg(addr::DWT + off::DWT_CYCCNT);
+        else if (!(next & bit::DWT_CYCCNTEN) && (prev & bit::DWT_CYCCNTEN))
+            reg(addr::DWT + off::DWT_CYCCNT) = _now - _cyccnt_base;
+        word = next;
+    }
+    else if (word_addr >= addr::NVIC_ISER && word_addr < addr::NVIC_ICPR + 0x20) {
+        if (word_addr == addr::NVIC_ISER) _nvic_enabled |=  value;
+        if (word_addr == addr::NVIC_ICER) _nvic_enabled &= ~value;
+        if (word_addr == addr::NVIC_ISPR) _nvic_pending |=  value;
+        if (word_addr == addr::NVIC_ICPR) _nvic_pending &= ~value;
+        reg(addr::NVIC_ISER) = reg(addr::NVIC_ICER) = _nvic_enabled;
+        reg(addr::NVIC_ISPR) = reg(addr::NVIC_ICPR) = _nvic_pending;
+        _next_due = 0;
+    }
+    else
+        word = next;
+
+    check();
+}
+
+
+
+void Mcu::set_pending(
+const Irq   irq)
+{
+    _nvic_pending |= 1 << static_cast<unsigned>(irq);
+    reg(addr::NVIC_ISPR) = reg(addr::NVIC_ICPR) = _nvic_pending;
+    _next_due = 0;
+}
+
+
+
+uint64_t Mcu::next_timed()
+const
+{
+    return std::min(_usb.next_event(), _tim3_expiry);
+}
+
+
+
+void Mcu::service()
+{
+    if (_now >= _next_poll) {
+        if (_paced)
+            pace();
+        if (!_usb.receive(_now))
+            exit(0);  // host closed connection
+        _next_poll = _now - _now % POLL_CYCLES + POLL_CYCLES;
+    }
+
+    if (_usb.update(_now))
+        set_pending(Irq::USB_LP_CAN1_RX0);
+
+    tim3_update();
+
+    _next_due = std::min(_next_poll, next_timed());
+
+    while (!_in_irq && (_nvic_pending & _nvic_enabled))
+        dispatch();
+}
+
+
+
+void Mcu::dispatch()
+{
+    const unsigned  irq = __builtin_ctz(_nvic_pending & _nvic_enabled);
+
+    _nvic_pending &= ~(1 << irq);
+    reg(addr::NVIC_ISPR) = reg(addr::NVIC_ICPR) = _nvic_pending;
+
+    _in_irq  = true      ;
+    _now    += IRQ_CYCLES;
+
+    switch (static_cast<Irq>(irq)) {
+        case Irq::USB_LP_CAN1_RX0:  USB_LP_CAN1_RX0_IRQHandler();  break;
+        case Irq::TIM3           :  TIM3_IRQHandler           ();  break;
+    }
+
+    _now    += IRQ_CYCLES;
+    _in_irq  = false     ;
+
+    // events which came due during handler
+    if (_now >= _next_due) {
+        if (_usb.update(_now))
+            set_pending(Irq::USB_LP_CAN1_RX0);
+        tim3_update();
+        _next_due = std::min(_next_poll, next_timed());
+    }
+}
+
+
+
+void Mcu::wfi()
+{
+    if (!(_nvic_pending & _nvic_enabled))
+        _now = std::max(_now, _next_due);
+    service();
+}
+
+
+
+void Mcu::poll_idle()
+{
+    if (_now == _poll_idle_at)  // nothing else since last empty poll
+        idle();
+
+    _now          += ACCESS_CYCLES;
+    _poll_idle_at  = _now         ;
+    check();
+}
+
+
+
+void Mcu::idle()
+{
+    const uint64_t  next = next_timed();
+
+    if (_paced) {
+        const uint64_t  wall = wall_cycles();
+
+        if (wall > _now)
+            _now = std::min(wall, next);
+        if (next > _now)
+            block(next);
+        _now = std::max(_now, std::min(wall_cycles(), next));
+    }
+    else if (next != NEVER)
+        _now = std::max(_now, next);
+    else
+        block(NEVER);
+
+    _next_poll = _now;
+    service();
+}
+
+
+
+void Mcu::block(
+const uint64_t  until)
+{
+    struct pollfd   pfd = {_fd, POLLIN, 0};
+    int             timeout;
+
+    if (until == NEVER)
+        timeout = -1;
+    else {
+        const uint64_t  wall = wall_cycles();
+        timeout = until > wall ? (until - wall) / (CPU_HZ / 1000) + 1 : 0;
+    }
+
+    _blocked_at = _now;
+    _blocked    = true;
+    poll(&pfd, 1, timeout);
+    _blocked    = false;
+}
+
+
+
+uint64_t Mcu::wait_idle()
+const
+{
+    while (!_blocked)
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+
+    return _blocked_at;
+}
+
+
+
+uint64_t Mcu::wall_cycles()
+const
+{
+    const auto  elapsed = std::chrono::steady_clock::now() - _wall_base;
+
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed)
+           .count() * 72 / 1000;
+}
+
+
+
+void Mcu::pace()
+{
+    const uint64_t  wall = wall_cycles();
+
+    if (_now > wall)
+        std::this_thread::sleep_for(
+            std::chrono::nanoseconds((_now - wall) * 1000 / 72));
+    else if (wall - _now > PACE_SLIP_CYCLES)  // e.g. fast-forwarded idle
+        _wall_base += std::chrono::nanoseconds((wall - _now) * 1000 / 72);
+}
+
+}  // namespace buck50_sim
@@ -0,0 +1,285 @@
+// buck50: Test and measurement firmware for “Blue Pill” STM32F103 development board
+// Copyright (C) 2019,2020 Mark R. Rubin aka "thanks4opensource"
+//
+// This file is part of buck50.
+//
+// The buck50 program is free software: you can redistribute it
+// and/or modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The buck50 program is distributed in the hope that it will be
+// useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+// of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// (LICENSE.txt) along with the buck50 program.  If not, see
+// <https://www.gnu.org/licenses/gpl.html>
+
+
+// Simulated STM32F103 for running buck50.cxx on Linux host.
+//
+// Time is 72 MHz CPU cycles. Compiled C++ firmware code runs in zero
+// simulated time except for ACCESS_CYCLES per peripheral register access
+// (via regbits_sim::Word, see regbits_sim.hxx), so polling loops advance
+// clock. C++ equivalents of buck50_asm.s (sim_asm.cxx) advance clock per
+// instruction cycle counts documented in buck50_asm.s. Interrupts are
+// taken at register access boundaries and in wfi(), lowest IRQ number
+// first (all same NVIC priority, as firmware).
+//
+// Peripherals modeled: RCC ready/switch/reset bits, GPIOA/B/C with
+// pin configuration and external Stimulus, SysTick, TIM1 PB13 rollover
+// output, TIM3 one-shot duration interrupt, ADC1/ADC2 single,
+// discontinuous, continuous-with-DMA1-channel-1 (normal or circular,
+// regular simultaneous or fast interleaved dual) conversions, NVIC
+// enable/pending. Others (USART/SPI/I2C/TIM2) are reset-value storage
+// only, no external devices. USB is host link behind UsbDev API, see
+// sim_usb.cxx.
+//
+// Optionally paced to wall clock (sleeps if ahead) so interactive
+// buck50.py sessions see real time durations.
+
+
+#ifndef SIM_MCU_HXX
+#define SIM_MCU_HXX
+
+#define SIM_MCU_MAJOR_VERSION   1
+#define SIM_MCU_MINOR_VERSION   0
+#define SIM_MCU_MICRO_VERSION   0
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+
+#include "stimulus.hxx"
+
+
+// buck50_asm.s equivalents, in sim_asm.cxx
+extern "C" {
+    void  HardFault_Handler         ();
+    void  TIM3_IRQHandler           ();
+    void  USB_LP_CAN1_RX0_IRQHandler();
+}
+
+
+namespace buck50_sim {
+
+// arm::NvicIrqn
+enum class Irq : unsigned {
+    USB_LP_CAN1_RX0 = 20,
+    TIM3            = 29,
+};
+
+
+
+// CDC data endpoints <-> host file descriptor (pty master or socket),
+// at USB full-speed bulk transaction timing. OUT: host bytes in packets
+// of at most 64, next packet not transferred until previous consumed
+// (endpoint NAKs until UsbDev::recv_done()). IN: two packet buffers
+// (double-buffered endpoint), each written to fd when its transaction
+// completes; transactions don't cross 1 ms frames. Host assumed to poll
+// IN/OUT endpoints immediately (no NAK re-poll delay). If not paced to
+// wall-clock time, host also assumed to read IN data immediately: waits
+// for fd instead of NAKing, so simulated transfer times don't depend on
+// host thread scheduling.
+class UsbLink {
+  public:
+    static const unsigned   PACKET_SIZE      = 64   ,
+                            BYTE_CYCLES      = 48   ,  // 72 MHz / 12 Mbit * 8
+                            OVERHEAD_BYTES   = 13   ,  // token, handshake, etc
+                            FRAME_CYCLES     = 72000,  // 1 ms
+                            SOF_CYCLES       = 216  ,  // 3 us
+                            PMA_CYCLES       = 24   ,  // writ_pma_data() setup
+                            PMA_BYTE_CYCLES  = 4    ;  //   and per byte
+
+    struct Packet {
+        uint64_t    time          ;  // OUT: available, IN: transaction end
+        uint16_t    length        ,
+                    sent          ;  // IN: bytes host has read
+        uint8_t     data[PACKET_SIZE];
+    };
+
+    UsbLink() : last_out_at(0), last_in_at(0), _fd(-1), _paced(true),
+                _out_scheduled(false), _out_ready(false), _out_ctr(false),
+                _in_ctr(false), _out_free_at(0), _bus_free_at(0)            {}
+
+    void        fd(const int    fd   ,
+                   const bool   paced) { _fd = fd; _paced = paced; }
+
+    // from fd, non-blocking, returns false if closed
+    bool        receive(const uint64_t  now);
+    // deliver OUT packet / complete IN transactions due by now
+    bool        update (const uint64_t  now);  // true if CTR_RX/CTR_TX
+    uint64_t    next_event() const;
+
+    // UsbDev side
+    const Packet*   out_packet() const { return _out_ready ? &_outs.front()
+                                                           : nullptr        ; }
+    void            out_done  (const uint64_t   now);
+    bool            in_full   () const { return _ins.size() == 2; }
+    void            in_send   (const uint64_t    now   ,
+                               const uint8_t    *data  ,
+                               const uint16_t    length);
+    // CTR_RX/CTR_TX, cleared by reading
+    bool            out_ctr() { bool ctr = _out_ctr; _out_ctr = false; return ctr; }
+    bool            in_ctr () { bool ctr = _in_ctr ; _in_ctr  = false; return ctr; }
+
+    // for benchmark: arrival of last OUT packet, end of last IN transaction
+    std::atomic<uint64_t>   last_out_at,
+                            last_in_at ;
+
+
+  protected:
+    uint64_t    schedule(const uint64_t     start ,
+                         const uint16_t     length);
+
+    std::deque<Packet>  _outs       ,
+                        _ins        ;
+    int                 _fd         ;
+    bool                _paced      ,
+                        _out_scheduled,  // front of _outs on bus
+                        _out_ready  ,  // front of _outs in "PMA"
+                        _out_ctr    ,
+                        _in_ctr     ;
+    uint64_t            _out_free_at,
+                        _bus_free_at;
+
+};  // class UsbLink
+
+
+
+class Mcu {
+  public:
+    static const uint64_t   NEVER         = UINT64_MAX;
+    static const uint32_t   CPU_HZ        = 72000000  ,
+                            ACCESS_CYCLES =  2        ,  // register ldr/str
+                            IRQ_CYCLES    = 12        ,  // entry, also exit
+                            POLL_CYCLES   = 72000     ;  // host fd, pacing
+
+    Mcu();
+
+    // maps peripheral and RAM addresses, resets registers
+    void        start(const int          fd      ,
+                      const bool         paced   );
+    void        stimulus(Stimulus  *stimulus) { _stimulus = stimulus; }
+
+    uint64_t    now     () const { return _now     ; }
+    uint64_t    next_due() const { return _next_due; }
+    void        advance (const uint64_t     cycles) { _now += cycles; }
+    void        check   () { if (_now >= _next_due) service(); }
+    void        service ();
+
+    void        wfi     ();
+    void        idle    ();  // firmware polling for host input
+    void        poll_idle();  // UsbDev::recv_lnth() found nothing
+
+    // regbits_sim hooks
+    uint32_t    read(const uintptr_t    address,
+                     const unsigned     size   );
+    void        writ(const uintptr_t    address,
+                     const unsigned     size   ,
+                     const uint32_t     word   );
+
+    // direct access for sim_asm.cxx loops which account own cycles
+    uint32_t    gpio_idr   (const unsigned  port,
+                            const uint64_t  at  );
+    uint32_t    systick_val(const uint64_t  at  ) const;
+    uint64_t    next_input (const unsigned  port,  // next possible change
+                            const uint64_t  after);
+
+    void        set_pending(const Irq   irq);
+    void        fault      () { _in_irq = true; _now += IRQ_CYCLES; }
+    void        irq_exit   () { _in_irq = false; }  // handler longjmp()
+
+    UsbLink&    usb() { return _usb; }
+    // UsbDev started IN or freed OUT endpoint, transaction may be sooner
+    void        usb_scheduled()
+                { _next_due = std::min(_next_due, _usb.next_event()); }
+
+    // benchmark thread: block until firmware idle waiting for host,
+    // return simulated time
+    uint64_t    wait_idle() const;
+
+
+  protected:
+    static const unsigned   NUM_PORTS = PinLevels::NUM_PORTS;
+
+    struct GpioMasks {  // derived from CRL/CRH, recalculated when dirty
+        uint16_t    input  ,  // digital input
+                    pull   ,  // input with pull-up/down (ODR)
+                    output ,  // push-pull (GP or AF)
+                    drain  ;  // open-drain (GP or AF)
+        bool        tim1_ch1n;  // PB13 AF, TIM1 output
+        bool        dirty  ;
+    };
+
+    struct Adc {
+        uint64_t    ready_at    ,  // CAL/RSTCAL done
+                    start       ,  // first conversion start
+                    cycles      ;  // per conversion
+        unsigned    queued      ,  // single/discontinuous conversions
+                    converted   ,  //   of which read from DR
+                    channel_ndx ;  // next in regular sequence
+        bool        continuous  ;
+    };
+
+    uint32_t&   reg(const uintptr_t     address)
+                { return *reinterpret_cast<uint32_t*>(address); }
+
+    void        reset_periphs(const uint32_t    apb1,
+                              const uint32_t    apb2);
+    void        gpio_masks   (const unsigned    port);
+    unsigned    adc_channel  (const unsigned    adc ,
+                              const unsigned    ndx );
+    uint64_t    adc_cycles   (const unsigned    adc ,
+                              const unsigned    chan);
+    uint16_t    adc_value    (const unsigned    chan,
+                              const uint64_t    at  );
+    void        adc_control  (const unsigned    adc ,
+                              const uint32_t    prev,
+                              const uint32_t    cr2 );
+    void        adc_update   (const unsigned    adc );
+    void        dma_update   ();
+    void        tim3_update  ();
+    void        dispatch     ();
+    void        pace         ();
+    uint64_t    next_timed   () const;  // excluding POLL_CYCLES checkpoint
+    uint64_t    wall_cycles  () const;
+    void        block        (const uint64_t    until);
+
+    UsbLink                 _usb             ;
+    Stimulus               *_stimulus        ;
+    GpioMasks               _gpio[NUM_PORTS] ;
+    Adc                     _adc [2]         ;
+    uint64_t                _now             ,
+                            _next_due        ,
+                            _next_poll       ,
+                            _systick_base    ,
+                            _cyccnt_base     ,  // DWT CYCCNT == _now - base
+                            _tim1_start      ,
+                            _tim3_expiry     ,
+                            _poll_idle_at    ;
+    uint32_t                _nvic_enabled    ,
+                            _nvic_pending    ,
+                            _dma_reload      ;  // CNDTR1 at enable
+    int                     _fd              ;
+    bool                    _paced           ,
+                            _in_irq          ,
+                            _tim1_running    ,
+                            _dma_running     ;
+    std::chrono::steady_clock::time_point
+                            _wall_base       ;
+    std::atomic<bool>       _blocked         ;
+    std::atomic<uint64_t>   _blocked_at      ;
+
+};  // class Mcu
+
+
+extern Mcu  mcu;
+
+}  // namespace buck50_sim
+
+#endif  // ifndef SIM_MCU_HXX
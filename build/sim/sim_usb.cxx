@@ -0,0 +1,306 @@
+// buck50: Test and measurement firmware for “Blue Pill” STM32F103 development board
+// Copyright (C) 2019,2020 Mark R. Rubin aka "thanks4opensource"
+//
+// This file is part of buck50.
+//
+// The buck50 program is free software: you can redistribute it
+// and/or modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The buck50 program is distributed in the hope that it will be
+// useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+// of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// (LICENSE.txt) along with the buck50 program.  If not, see
+// <https://www.gnu.org/licenses/gpl.html>
+
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <poll.h>
+#include <unistd.h>
+
+#include <bin_to_hex.hxx>
+
+#include "sim_mcu.hxx"
+#include "usb_dev_cdc_acm.hxx"
+
+
+namespace buck50_sim {
+
+bool UsbLink::receive(
+const uint64_t  now)
+{
+    uint8_t     buffer[4096];
+    ssize_t     length;
+
+    while ((length = ::read(_fd, buffer, sizeof(buffer))) > 0)
+        for (ssize_t ndx = 0 ; ndx < length ; ndx += PACKET_SIZE) {
+            Packet  packet;
+
+            packet.time   = now                                          ;
+            packet.length = std::min<ssize_t>(length - ndx, PACKET_SIZE);
+            memcpy(packet.data, buffer + ndx, packet.length);
+            _outs.push_back(packet);
+        }
+
+    if (length == 0 || (errno != EAGAIN && errno != EINTR))
+        return false;
+
+    if (!_out_ready && !_out_scheduled && !_outs.empty()) {
+        // endpoint free, start OUT transaction
+        _outs.front().time = schedule(std::max(now, _out_free_at),
+                                      _outs.front().length       );
+        _out_scheduled     = true;
+    }
+
+    return true;
+}
+
+
+
+// allocate bus time for transaction, in whole-frame slots after SOF
+uint64_t UsbLink::schedule(
+const uint64_t  start ,
+const uint16_t  length)
+{
+    const uint64_t  cycles = (length + OVERHEAD_BYTES) * BYTE_CYCLES;
+    uint64_t        begin  = std::max(start, _bus_free_at)          ,
+                    frame  = begin - begin % FRAME_CYCLES           ;
+
+    if (begin < frame + SOF_CYCLES)
+        begin = frame + SOF_CYCLES;
+    if (begin + cycles > frame + FRAME_CYCLES)
+        begin = frame + FRAME_CYCLES + SOF_CYCLES;
+
+    return _bus_free_at = begin + cycles;
+}
+
+
+
+bool UsbLink::update(
+const uint64_t  now)
+{
+    bool    event = false;
+
+    if (_out_scheduled && _outs.front().time <= now) {
+        _out_scheduled = false             ;
+        _out_ready     = true              ;
+        _out_ctr       = true              ;
+        last_out_at    = _outs.front().time;
+        event          = true              ;
+    }
+
+    while (!_ins.empty() && _ins.front().time <= now) {
+        Packet  &packet = _ins.front();
+
+        while (packet.sent < packet.length) {
+            const ssize_t   wrote = ::write(_fd                        ,
+                                            packet.data  + packet.sent ,
+                                            packet.length - packet.sent);
+            if (wrote > 0)
+                packet.sent += wrote;
+            else if (wrote < 0 && errno == EINTR)
+                continue;
+            else if (wrote < 0 && errno == EAGAIN && !_paced) {
+                // host reads immediately in simulated time
+                struct pollfd   pfd = {_fd, POLLOUT, 0};
+                poll(&pfd, 1, -1);
+            }
+            else if (wrote < 0 && errno == EAGAIN) {
+                // host not reading, NAK: endpoint stays full, retry next
+                // frame (firmware send()s block or fail, as on hardware)
+                packet.time = now - now % FRAME_CYCLES + FRAME_CYCLES;
+                return event;
+            }
+            else
+                break;  // host gone, drop
+        }
+
+        last_in_at = packet.time;
+        _ins.pop_front();
+        _in_ctr = true;
+        event   = true;
+    }
+
+    return event;
+}
+
+
+
+uint64_t UsbLink::next_event()
+const
+{
+    uint64_t    next = Mcu::NEVER;
+
+    if (_out_scheduled)
+        next = _outs.front().time;
+    if (!_ins.empty())
+        next = std::min(next, _ins.front().time);
+
+    return next;
+}
+
+
+
+void UsbLink::out_done(
+const uint64_t  now)
+{
+    if (!_out_ready)
+        return;
+
+    _outs.pop_front();
+    _out_ready   = false;
+    _out_free_at = now  ;
+
+    if (!_outs.empty()) {
+        _outs.front().time = schedule(std::max(now, _outs.front().time),
+                                      _outs.front().length             );
+        _out_scheduled     = true;
+    }
+}
+
+
+
+void UsbLink::in_send(
+const uint64_t   now   ,
+const uint8_t   *data  ,
+const uint16_t   length)
+{
+    Packet  packet;
+
+    packet.length = length;
+    packet.sent   = 0     ;
+    memcpy(packet.data, data, length);
+    packet.time   = schedule(now, length);
+
+    _ins.push_back(packet);
+}
+
+}  // namespace buck50_sim
+
+
+
+namespace stm32f10_12357_xx {
+
+using buck50_sim::mcu;
+
+
+void UsbDev::serial_number_init()
+{
+    const uint32_t  *unique_id = reinterpret_cast<const uint32_t*>(0x1ffff7e8);
+    char             serial_number[_SERIAL_NUMBER_STRING_LEN];
+
+    bitops::BinToHex::uint32(unique_id[2]          , &serial_number[ 0]);
+    bitops::BinToHex::uint32(unique_id[1]          , &serial_number[ 8]);
+    bitops::BinToHex::uint16(unique_id[0] >> 16    , &serial_number[16]);
+    bitops::BinToHex::uint16(unique_id[0] &  0xffff, &serial_number[20]);
+
+    for (uint8_t ndx = 0 ; ndx < _SERIAL_NUMBER_STRING_LEN ; ++ndx)
+        _serial_number[ndx] = serial_number[ndx];
+}
+
+
+
+// already enumerated and configured by host
+bool UsbDev::init()
+{
+    _recv_readys  = 0                                     ;
+    _send_readys  = 1 << UsbDevCdcAcm::CDC_ENDPOINT_IN    ;
+    _device_state = DeviceState::CONFIGURED               ;
+
+    return true;
+}
+
+
+
+void UsbDev::interrupt_handler()
+{
+    buck50_sim::UsbLink     &usb = mcu.usb();
+
+    if (usb.out_ctr())
+        _recv_readys |= 1 << UsbDevCdcAcm::CDC_ENDPOINT_OUT;
+
+    if (usb.in_ctr() && !usb.in_full())
+        _send_readys |= 1 << UsbDevCdcAcm::CDC_ENDPOINT_IN;
+}
+
+
+
+bool UsbDev::send(
+const uint8_t           endpoint,
+const uint8_t* const    data    ,
+const uint16_t          length  )
+{
+    if (!(_send_readys & (1 << endpoint)))
+        return false;
+
+    buck50_sim::UsbLink     &usb = mcu.usb();
+
+    mcu.advance(  buck50_sim::UsbLink::PMA_CYCLES
+                + buck50_sim::UsbLink::PMA_BYTE_CYCLES * length);
+    usb.in_send(mcu.now(), data, length);
+    mcu.usb_scheduled();
+
+    if (usb.in_full())
+        _send_readys &= ~(1 << endpoint);
+
+    mcu.check();
+
+    return true;
+}
+
+
+
+uint16_t UsbDev::recv_lnth(
+const uint8_t   endpoint)
+{
+    const buck50_sim::UsbLink::Packet   *packet = mcu.usb().out_packet();
+
+    if ((_recv_readys & (1 << endpoint)) && packet)
+        return packet->length;
+
+    mcu.poll_idle();
+
+    return 0;
+}
+
+
+
+uint16_t UsbDev::read(
+const uint8_t   endpoint,
+const uint8_t   data_ndx)
+{
+    const buck50_sim::UsbLink::Packet   *packet = mcu.usb().out_packet();
+
+    (void)endpoint;
+
+    mcu.advance(1);  // PMA read
+
+    if (!packet)
+        return 0;
+
+    return packet->data[data_ndx << 1] | packet->data[(data_ndx << 1) + 1] << 8;
+}
+
+
+
+bool UsbDev::recv_done(
+const uint8_t   endpoint)
+{
+    _recv_readys &= ~(1 << endpoint);
+
+    mcu.advance(buck50_sim::Mcu::ACCESS_CYCLES);  // EPnR write
+    mcu.usb().out_done(mcu.now());
+    mcu.usb_scheduled();
+    mcu.check();
+
+    return true;
+}
+
+}  // namespace stm32f10_12357_xx
@@ -0,0 +1,325 @@
+// buck50: Test and measurement firmware for “Blue Pill” STM32F103 development board
+// Copyright (C) 2019,2020 Mark R. Rubin aka "thanks4opensource"
+//
+// This file is part of buck50.
+//
+// The buck50 program is free software: you can redistribute it
+// and/or modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The buck50 program is distributed in the hope that it will be
+// useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+// of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// (LICENSE.txt) along with the buck50 program.  If not, see
+// <https://www.gnu.org/licenses/gpl.html>
+
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "stimulus.hxx"
+
+
+namespace buck50_sim {
+
+Stimulus::Stimulus()
+:   _initial{{0, 0, 0}, {0, 0, 0}, {0, 0, 0, 0, 0, 0, 0, 0}},
+    _period (0                                             ),
+    _cursor (0                                             )
+{
+}
+
+
+
+bool Stimulus::load(
+const char  *filename)
+{
+    FILE    *file = fopen(filename, "r");
+
+    if (!file) {
+        _error = std::string(filename) + ": " + strerror(errno);
+        return false;
+    }
+
+    char        line[256];
+    unsigned    line_num = 0;
+    bool        ok       = true;
+
+    while (ok && fgets(line, sizeof(line), file))
+        ok = parse(line, ++line_num);
+
+    fclose(file);
+
+    if (ok && _period && !_changes.empty() && _period <= _changes.back().time) {
+        _error = std::string(filename) + ": repeat period not after last change";
+        ok     = false;
+    }
+
+    return ok;
+}
+
+
+
+bool Stimulus::parse(
+const char      *line    ,
+const unsigned   line_num)
+{
+    char        copy[256],
+               *tokens[4];
+    unsigned    num_tokens = 0;
+
+    strncpy(copy, line, sizeof(copy) - 1);
+    copy[sizeof(copy) - 1] = '\0';
+
+    if (char *comment = strchr(copy, '#'))
+        *comment = '\0';
+
+    for (char *token = strtok(copy, " \t\r\n") ;
+         token && num_tokens < 4               ;
+         token = strtok(nullptr, " \t\r\n")    )
+        tokens[num_tokens++] = token;
+
+    if (num_tokens == 0)
+        return true;
+
+    auto    error = [&](const char *message)
+                    {
+                        _error =   "line " + std::to_string(line_num) + ": "
+                                 + message;
+                        return false;
+                    };
+
+    if (!strcmp(tokens[0], "repeat")) {
+        uint64_t    period;
+        if (num_tokens != 2 || !parse_time(tokens[1], period) || !period)
+            return error("bad \"repeat PERIOD\"");
+        _period = period;
+        return true;
+    }
+
+    uint64_t    time;
+    if (num_tokens != 3 || !parse_time(tokens[0], time))
+        return error("expected \"TIME PIN VALUE\"");
+
+    if (!_changes.empty() && time < _changes.back().time)
+        return error("time before previous line's");
+
+    const char     *pin   = tokens[1],
+                   *value = tokens[2];
+    char           *end  ;
+
+    if (!strcmp(pin, "pb")) {
+        const unsigned long     bits = strtoul(value, &end, 0);
+        if (*end || bits > 0xff)
+            return error("\"pb\" value not 0...255");
+        byte(time, bits);
+        return true;
+    }
+
+    if (pin[0] != 'p' || pin[1] < 'a' || pin[1] > 'c')
+        return error("pin not pa0...pa15, pb0...pb15, pc0...pc15, or pb");
+
+    const unsigned      port    = pin[1] - 'a'              ;
+    const unsigned long pin_num = strtoul(pin + 2, &end, 10);
+
+    if (!pin[2] || *end || pin_num > 15)
+        return error("pin number not 0...15");
+
+    if (value[0] == 'a') {
+        const unsigned long     level = strtoul(value + 1, &end, 0);
+        if (port != 0 || pin_num > 7)
+            return error("analog value only for pa0...pa7");
+        if (!value[1] || *end || level > 4095)
+            return error("analog value not a0...a4095");
+        analog(time, pin_num, level);
+        return true;
+    }
+
+    if (!strcmp(value, "0"))
+        drive(time, port, pin_num,  0);
+    else if (!strcmp(value, "1"))
+        drive(time, port, pin_num,  1);
+    else if (!strcmp(value, "z") || !strcmp(value, "Z"))
+        drive(time, port, pin_num, -1);
+    else
+        return error("value not 0, 1, z, or aN");
+
+    return true;
+}
+
+
+
+bool Stimulus::parse_time(
+const char  *text,
+uint64_t    &time)
+{
+    static const struct {
+        const char  *suffix    ;
+        double       per_second;
+    } UNITS[] = {{"s" , 1e0}, {"ms", 1e3}, {"us", 1e6}, {"ns", 1e9}};
+
+    char    *end;
+
+    if (text[0] == '-')
+        return false;
+
+    const double    number = strtod(text, &end);
+
+    if (end == text)
+        return false;
+
+    if (!*end) {  // cycles, integer only
+        time = strtoull(text, &end, 0);
+        return !*end;
+    }
+
+    for (const auto &unit : UNITS)
+        if (!strcmp(end, unit.suffix)) {
+            time = llround(number * 72e6 / unit.per_second);
+            return true;
+        }
+
+    return false;
+}
+
+
+
+PinLevels& Stimulus::change(
+const uint64_t  time)
+{
+    if (!_changes.empty() && _changes.back().time == time)
+        return _changes.back().levels;
+
+    _changes.push_back({time, _changes.empty() ? _initial
+                                               : _changes.back().levels});
+
+    return _changes.back().levels;
+}
+
+
+
+void Stimulus::drive(
+const uint64_t  time ,
+const unsigned  port ,
+const unsigned  pin  ,
+const int       level)
+{
+    PinLevels       &levels = change(time) ;
+    const uint16_t   bit    = 1 << pin     ;
+
+    if (level < 0)
+        levels.driven[port] &= ~bit;
+    else {
+        levels.driven[port] |= bit;
+        if (level) levels.levels[port] |=  bit;
+        else       levels.levels[port] &= ~bit;
+    }
+}
+
+
+
+void Stimulus::byte(
+const uint64_t  time,
+const uint8_t   bits)
+{
+    PinLevels   &levels = change(time);
+
+    levels.driven[1] |= 0x0ff0                                 ;
+    levels.levels[1]  = (levels.levels[1] & ~0x0ff0) | bits << 4;
+}
+
+
+
+void Stimulus::analog(
+const uint64_t  time ,
+const unsigned  chan ,
+const uint16_t  value)
+{
+    PinLevels       &levels = change(time);
+    const uint16_t   bit    = 1 << chan   ;
+
+    levels.analogs[chan]  = value;
+    levels.driven [0   ] |= bit  ;
+
+    if (value >= 2048) levels.levels[0] |=  bit;
+    else               levels.levels[0] &= ~bit;
+}
+
+
+
+size_t Stimulus::find(
+const uint64_t  time)
+{
+    const size_t    size = _changes.size();
+
+    // usually same or next as previous query
+    if (   _cursor < size
+        && _changes[_cursor].time <= time) {
+        if (_cursor + 1 == size || _changes[_cursor + 1].time > time)
+            return _cursor;
+        if (   _cursor + 2 == size || _changes[_cursor + 2].time > time)
+            return ++_cursor;
+    }
+
+    const auto  after = std::upper_bound(_changes.begin(),
+                                         _changes.end  (),
+                                         time            ,
+                                         [](const uint64_t   t,
+                                            const Change    &c)
+                                           { return t < c.time; });
+
+    if (after == _changes.begin())
+        return SIZE_MAX;
+
+    return _cursor = after - _changes.begin() - 1;
+}
+
+
+
+const PinLevels& Stimulus::at(
+const uint64_t  time)
+{
+    const uint64_t  offset = _period ? time % _period : time  ;
+    const size_t    ndx    = find(offset)                     ;
+
+    if (ndx != SIZE_MAX)
+        return _changes[ndx].levels;
+
+    // before first change: still in previous repetition's last
+    if (_period && time >= _period && !_changes.empty())
+        return _changes.back().levels;
+
+    return _initial;
+}
+
+
+
+uint64_t Stimulus::next_change(
+const uint64_t  after)
+{
+    if (_changes.empty())
+        return NEVER;
+
+    const uint64_t  offset = _period ? after % _period : after,
+                    base   = after - offset                  ;
+    const size_t    ndx    = find(offset)                     ;
+    const size_t    next   = ndx == SIZE_MAX ? 0 : ndx + 1    ;
+
+    if (next < _changes.size())
+        return base + _changes[next].time;
+
+    if (_period)
+        return base + _period + _changes.front().time;
+
+    return NEVER;
+}
+
+}  // namespace buck50_sim
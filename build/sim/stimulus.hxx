@@ -0,0 +1,119 @@
+// buck50: Test and measurement firmware for “Blue Pill” STM32F103 development board
+// Copyright (C) 2019,2020 Mark R. Rubin aka "thanks4opensource"
+//
+// This file is part of buck50.
+//
+// The buck50 program is free software: you can redistribute it
+// and/or modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The buck50 program is distributed in the hope that it will be
+// useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+// of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// (LICENSE.txt) along with the buck50 program.  If not, see
+// <https://www.gnu.org/licenses/gpl.html>
+
+
+// External signals driven onto simulated GPIO pins: piecewise-constant
+// in simulated time (72 MHz CPU cycles since simulator start).
+//
+// Stimulus file, one change per line, times non-decreasing:
+//     # comment (also after any line)
+//     TIME  PIN    VALUE
+//     TIME  pb     BYTE        PB4...PB11 (logic sampling ports) at once
+//     repeat PERIOD            whole file repeats every PERIOD
+// TIME/PERIOD: integer or decimal number, with unit suffix s, ms, us, or
+// ns, else CPU cycles. PIN: pa0...pa15, pb0...pb15, pc0...pc15. VALUE:
+// 0 or 1 (driven low/high), z (not driven, pin reads per its GPIO
+// configuration), or aN (PA0...PA7 analog, N 0...4095, digital level
+// high if N >= 2048). All pins not driven, all analog 0, before first
+// change.
+// e.g.
+//     0       pb      0x00
+//     100us   pb4     1
+//     1.5ms   pa0     a3000
+//     2ms     pb      0x5a
+//     repeat  4ms
+
+
+#ifndef STIMULUS_HXX
+#define STIMULUS_HXX
+
+#define STIMULUS_MAJOR_VERSION   1
+#define STIMULUS_MINOR_VERSION   0
+#define STIMULUS_MICRO_VERSION   0
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+namespace buck50_sim {
+
+struct PinLevels {
+    static const unsigned   NUM_PORTS   = 3,  // GPIOA, GPIOB, GPIOC
+                            NUM_ANALOGS = 8;  // PA0...PA7
+
+    uint16_t    driven [NUM_PORTS  ],  // bit set: pin driven externally
+                levels [NUM_PORTS  ],  //   to this level
+                analogs[NUM_ANALOGS];  // 12-bit ADC input
+};
+
+
+
+class Stimulus {
+  public:
+    static const uint64_t   NEVER = UINT64_MAX;
+
+    Stimulus();
+
+    // false, with message in error(), if syntax error
+    bool        load (const char    *filename);
+    bool        parse(const char    *line    ,
+                      const unsigned line_num);
+
+    // programmatic changes, times non-decreasing
+    void        drive (const uint64_t   time ,
+                       const unsigned   port ,
+                       const unsigned   pin  ,
+                       const int        level);  // 0, 1, or -1 for "z"
+    void        byte  (const uint64_t   time ,   // PB4...PB11
+                       const uint8_t    bits );
+    void        analog(const uint64_t   time ,
+                       const unsigned   chan ,
+                       const uint16_t   value);
+    void        repeat(const uint64_t   period) { _period = period; }
+
+    const PinLevels&    at         (const uint64_t  time);
+    uint64_t            next_change(const uint64_t  after);
+
+    const std::string&  error() const { return _error; }
+
+    static bool         parse_time(const char   *text,
+                                   uint64_t     &time);
+
+
+  protected:
+    struct Change {
+        uint64_t    time  ;
+        PinLevels   levels;
+    };
+
+    PinLevels&  change(const uint64_t   time);
+    size_t      find  (const uint64_t   time);  // last change <= time
+
+    std::vector<Change>     _changes;
+    PinLevels               _initial;
+    uint64_t                _period ;
+    size_t                  _cursor ;
+    std::string             _error  ;
+
+};  // class Stimulus
+
+}  // namespace buck50_sim
+
+#endif  // ifndef STIMULUS_HXX
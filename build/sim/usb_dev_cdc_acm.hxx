@@ -0,0 +1,129 @@
+// buck50: Test and measurement firmware for “Blue Pill” STM32F103 development board
+// Copyright (C) 2019,2020 Mark R. Rubin aka "thanks4opensource"
+//
+// This file is part of buck50.
+//
+// The buck50 program is free software: you can redistribute it
+// and/or modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The buck50 program is distributed in the hope that it will be
+// useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+// of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// (LICENSE.txt) along with the buck50 program.  If not, see
+// <https://www.gnu.org/licenses/gpl.html>
+
+
+// Host simulation replacement for util/stm32f10_12357xx/usb_dev_cdc_acm.hxx
+// (found first via include path order, same include guard). Subset of
+// UsbDev/UsbDevCdcAcm API used by buck50.cxx, already enumerated, with
+// CDC endpoints connected to simulator's host link (pty or socket, see
+// sim_usb.cxx) instead of USB peripheral registers and PMA. Keeps
+// UsbDev's send()/recv semantics: OUT endpoint NAKs until recv_done(),
+// CDC IN double-buffered, readys updated by interrupt_handler().
+
+
+#ifndef USB_DEV_CDC_ACM_HXX
+#define USB_DEV_CDC_ACM_HXX
+
+#include <stdint.h>
+
+
+namespace stm32f10_12357_xx {
+
+class UsbDev {
+  public:
+    enum class DeviceState {
+        CONSTRUCTED = 0,
+        INITIALIZED    ,
+        RESET          ,
+        ADDRESSED      ,
+        CONFIGURED
+    };
+
+    constexpr UsbDev()
+    :   _recv_readys (0                       ),
+        _send_readys (0                       ),
+        _device_state(DeviceState::CONSTRUCTED),
+        _serial_number{'0', '0', '0', '0', '0', '0', '0', '0',
+                       '0', '0', '0', '0', '0', '0', '0', '0',
+                       '0', '0', '0', '0', '0', '0', '0', '0'}
+    {}
+
+    static constexpr unsigned serial_number_length()
+    {
+        return _SERIAL_NUMBER_STRING_LEN;
+    }
+    uint8_t serial_number_digit(
+    const uint8_t   digit)
+    const
+    {
+        return _serial_number[digit];
+    }
+
+    void    serial_number_init();
+
+    bool    init();
+
+    DeviceState     device_state() const { return _device_state ; }
+
+    void interrupt_handler();
+
+    uint16_t    recv_readys() const volatile { return _recv_readys; }
+    uint16_t    send_readys() const volatile { return _send_readys; }
+
+    bool    recv_ready(const uint16_t   endpoints) const volatile
+            { return _recv_readys & endpoints; }
+    bool    send_ready(const uint16_t   endpoints) const volatile
+            { return _send_readys & endpoints; }
+
+    bool send(const uint8_t         endpoint,
+              const uint8_t* const  data    ,
+              const uint16_t        length  );
+
+    uint16_t recv_lnth(
+    const uint8_t   endpoint);
+
+    bool recv_done(
+    const uint8_t   endpoint);
+
+    uint16_t read(              // no checking of parameters
+    const uint8_t   endpoint,
+    const uint8_t   data_ndx);  // uint16_t index, i.e. byte index divided by 2
+
+
+  protected:
+    static const uint8_t    _SERIAL_NUMBER_STRING_LEN = 24;
+
+    volatile uint16_t   _recv_readys ,
+                        _send_readys ;
+    DeviceState         _device_state;
+    uint8_t             _serial_number[_SERIAL_NUMBER_STRING_LEN];
+
+};  // class UsbDev
+
+
+
+class UsbDevCdcAcm : public UsbDev
+{
+  public:
+    static const uint8_t    ACM_ENDPOINT             =  2,
+                            CDC_ENDPOINT_IN          =  1,
+                            CDC_ENDPOINT_OUT         =  3,
+                            CDC_IN_DATA_SIZE         = 64,
+                            CDC_OUT_DATA_SIZE        = 64,
+                            ACM_DATA_SIZE            =  8;
+
+    constexpr UsbDevCdcAcm()
+    :   UsbDev()
+    {}
+
+};  // class UsbDevCdcAcm
+
+}  // namespace stm32f10_12357_xx
+
+#endif  // ifndef USB_DEV_CDC_ACM_HXX
@@ -28,6 +28,11 @@
 
 #include <usb_dev_cdc_acm.hxx>
 
+#ifdef BUCK50_SIM
+#include <csetjmp>          // host simulation, see build/sim/
+#include <buck50_sim.hxx>
+#endif
+
 #if STM32F103XB_MAJOR_VERSION == 1
 #if STM32F103XB_MINOR_VERSION  < 3
 #warning STM32F103XB_MINOR_VERSION < 3
@@ -47,13 +52,15 @@ using namespace stm32f10_12357_xx;
 // constants
 //
 
+#ifndef BUCK50_SIM
 #define _JBLEN      (10)
 typedef uint32_t    jmp_buf[_JBLEN];
+#endif
 
 static const uint32_t   IDENTITY              = 0xea017af5;
 static const uint8_t    MAX_BRIDGE_DATA_LEN   = 62        ,
                         MAX_ADC_CHANNEL_NUM   =  7        ,
-                        VERSION            [] = {0, 9, 2},
+                        VERSION            [] = {0,10, 0},
                         CONNECT_SIG_BYTE_0    = 0xf2      ;
 
 // See wait_connect_signature()
@@ -111,6 +118,7 @@ namespace Command {    // enum class would require casting to/from uint8_t
                                 I2C_BRIDGE       = 15,
                                 SERIAL_NUMBER    = 16,
                                 BLINK_USER_LED   = 17,
+                                INSTRUMENT       = 18,
                                 CONNECT_SIG      = CONNECT_SIG_BYTE_0;
 }
 
@@ -122,7 +130,8 @@ namespace HaltCode {
                             NONE     = 0,
                             MEMORY   = 1,
                             DURATION = 2,
-                            USB      = 3;
+                            USB      = 3,
+                            OVERRUN  = 4;  // SamplingMode::STREAM ring full
 }
 
 namespace SamplingMode {
@@ -130,10 +139,36 @@ namespace SamplingMode {
                             IRREGULAR =   1 ,
                             UNIFORM   =   2 ,
                             MHZ_4     =   3 ,
+                            STREAM    =   4 ,
+                            PACKED    =   5 ,  // 16-bit, see buck50_asm.s
                             ANALOG    = 0x0f,
                             UNSET     = 0xff;
 }
 
+namespace CodeMemory {  // as buck50_asm.s CODE_MEM_RAM and CODE_MEM_FLASH
+    static const uint8_t    RAM   = 0,
+                            FLASH = 1;
+}
+
+namespace TriggerCode {  // digital_sampling() triggers[] execution
+    static const uint8_t    INTERPRETED = 0,  // buck50_asm.s trigger_tail
+                            COMPILED    = 1;  // TriggerCompiler, RAM
+}
+
+namespace StreamPacket {  // SamplingMode::STREAM packet header, send_buf[0]
+    static const uint8_t    SAMPLES   = 1                   ,
+                            END       = 2                   ,
+                            MAX_WORDS = SEND_BUF_UINT32S - 1;  // plus header
+}
+
+namespace LiveBatch {  // live() batched packets, see live_batch_send()
+    static const uint8_t    HEADER     = 8,  // count, dropped, 48-bit time
+                            // short packet, no ZLP needed to end transfer
+                            MAX_LENGTH = UsbDevCdcAcm::CDC_IN_DATA_SIZE - 1,
+                            MAX_RECORD = MAX_LENGTH - HEADER               ;
+    static const uint32_t   MAX_DELTA  = 0xffff;  // 16-bit record timestamp
+}
+
 namespace InProgress {
                             // no good way to access static consts
                             //   or #defines in asm
@@ -166,6 +201,19 @@ namespace AnalogSlope {
                             POSITIVE = 1;
 }
 
+namespace AnalogMode {  // analog_sampling() command, send_samples() header
+    static const uint8_t    NORMAL        = 0x00,
+                            INTERLEAVED   = 0x80,  // ADC1+ADC2 fast interleaved
+                            DECIMATE_MASK = 0x30,
+                            MINMAX        = 0x10,  // min low, max high halfword
+                            AVERAGE       = 0x20,  // two means per word
+                            FACTOR_MASK   = 0x0f,  // log2 of samples per value
+                            MAX_FACTOR    =   12,  // 4096 12-bit sums in 24 bits
+                            SAMP_HOLD     =    0;  // INTERLEAVED only 1.5+12.5
+    static const unsigned   RING_WORDS    =  256,  // decimation DMA ring
+                            RING_HALF     = RING_WORDS;  // uint16_t samples
+}
+
 
 // ordered from "best" to "worst"
 // USART_n and I2C_n are context dependent, don't conflict with each other
@@ -191,6 +239,22 @@ enum class PeriphStatus {
 
 
 
+// SamplingMode::STREAM: sample memory used as ring buffer split into two
+// halves. Sampling loop (buck50_asm.s) fills halves, USB interrupt sends
+// filled halves to host. Member offsets hardcoded in buck50_asm.s, manually
+// search for "STREAM_RING_" and edit if any change.
+struct StreamRing {
+    uint32_t    *begin  ,  // == samples
+                *mid    ,  // end of first half, beginning of second
+                *end    ,  // end of second half, <= END_OF_RAM
+                *read   ;  // next sample to send to host
+    uint32_t     filled ,  // count of halves completed by sampling loop
+                 drained,  // count of halves completely sent to host
+                 merged ;  // PB4...PB11 changes during stream_drain(), C++
+};                         //   only, see stream_stall_poll()
+
+
+
 struct Trigger {
     union {
         struct {
@@ -205,6 +269,115 @@ struct Trigger {
 
 
 
+/* Translates triggers[] state machine into Thumb-2 code in RAM at STORAGE,
+   run by buck50_asm.s trigger_and_sample_compiled_{plain,ganged} instead of
+   its generic trigger_head/trigger_tail loop. Same semantics: each state
+   reads gpiob->idr once and tests it against its own, then its chain of
+   "fail" states' (logical "OR"), mask and bits, re-reading only when the
+   chain returns to the state. Each test is specialized:
+     - single bit or all-zero bits: one TST instead of AND plus CMP
+     - bits outside mask (can never match): no code
+     - "xxxxxxxx" passing to another state: no gpiob read
+   Self-looping single-test states (the common case) are unrolled, and
+   states are laid out so that each falls through to its "pass" state.
+   Registers as in buck50_asm.s triggering, see "_REG" constants. Exits
+   branch directly to buck50_asm.s compiled_triggered epilogue, always
+   copied to RAM right after the code.
+   Code is generated twice: first pass only measures to lay out states,
+   stubs, and branch sizes, second pass writes.
+*/
+class TriggerCompiler {
+  public:
+    static const unsigned   MAX_CODE_BYTES = 4096,
+                            UNROLL         =    4;  // self-looping state
+
+    // returns code size for trigger_code_size, 0 if too large
+    uint32_t    compile(const bool      ganged);
+
+  protected:
+    struct Scratch {  // in sample memory, below triggers[]
+        uint16_t    enter  [MAX_TRIGGERS],  // state's code offset
+                    stub   [MAX_TRIGGERS],  // movs state, #n; b.w epilogue
+                    member [MAX_TRIGGERS];  // test in current fail chain
+        uint8_t     order  [MAX_TRIGGERS],  // of states' code in memory
+                    stack  [MAX_TRIGGERS];  // pass states not yet placed
+        uint32_t    placed [MAX_TRIGGERS / 32],
+                    queued [MAX_TRIGGERS / 32],
+                    stubbed[MAX_TRIGGERS / 32],
+                    chained[MAX_TRIGGERS / 32];
+    };
+
+    // buck50_asm.s trigger register aliases
+    static const uint8_t    GPIOB_REG     = 0,  // gpiob
+                            GPIOB_IDR_REG = 4,  // gpiob_idr
+                            STATE_REG     = 5,  // state
+                            VALU_REG      = 7,  // valu
+                            PC_REG        = 15;
+
+    // condition codes, pass condition ^ 1 is fail condition
+    static const uint8_t    EQ = 0,
+                            NE = 1,
+                            PL = 5,
+                            AL = 0xe;
+
+    enum class Test {
+        NEVER ,
+        ALWAYS,
+        MATCH ,
+    };
+
+    static bool     _bit (const uint32_t   *bits ,
+                          const uint8_t     state)
+                    { return bits[state >> 5] & (1 << (state & 0x1f)); }
+    static void     _set (uint32_t         *bits ,
+                          const uint8_t     state)
+                    { bits[state >> 5] |= 1 << (state & 0x1f); }
+    static void     _zero(uint32_t         *bits )
+                    { for (unsigned ndx = 0 ; ndx < MAX_TRIGGERS / 32 ; ++ndx)
+                          bits[ndx] = 0;                                      }
+
+    static Test     _test(const Trigger    &trigger);
+
+    void    _state      (const uint8_t  state  ,
+                         const bool     last   );
+    uint8_t _match      (const Trigger &trigger);  // returns pass condition
+    void    _pass_branch(const uint8_t  cond   ,
+                         const uint8_t  member ,
+                         const uint8_t  state  );
+    void    _pass       (const uint8_t  member ,
+                         const uint8_t  state  ,
+                         const bool     last   );
+
+    // instruction encodings
+    void    _half  (const uint16_t  half  );
+    void    _exit  ();
+    void    _movs  (const uint8_t   reg   ,
+                    const uint8_t   imm   );
+    void    _dp_imm(const uint8_t   op    ,  // data processing, immediate
+                    const bool      flags ,
+                    const uint8_t   rn    ,
+                    const uint8_t   rd    ,
+                    const uint32_t  imm   );
+    void    _branch(const uint8_t   cond  ,  // AL: unconditional
+                    const unsigned  target,
+                    const bool      known );  // else always 32-bit
+
+    Scratch     *_scratch    ;
+    uint16_t    *_code       ;
+    unsigned     _pos        ,
+                 _end        ,  // of code, RAM epilogue (pass 2 only)
+                 _exit_at    ,  // after last inline "b.w epilogue"
+                 _ext        ,  // ganged external trigger stub
+                 _depth      ;  // of _scratch->stack
+    int          _fall       ;  // state to place next, else -1
+    bool         _ganged     ,
+                 _write      ,
+                 _fallthrough,  // last state's exit falls into epilogue
+                 _overflow   ;
+};
+
+
+
 /* Circular buffer. Assume that host will never send message(s) totalling
    more than _SIZE (64 byte CDC_OUT_DATA_SIZE) before firmware consumes
    them by calling flush(), but don't assume that host CDC-ACM driver always
@@ -250,6 +423,149 @@ class UsbRecv {
 
 
 
+/* Optional cycle accounting, see "instrument" command. Cycles are from
+   Cortex-M3 DWT CYCCNT (72 MHz main clock, free-running, wraps 2**32)
+   which is independent of SysTick so doesn't disturb sys_tick_timer or
+   sample timestamps. Every hook is a single _enabled test when disabled.
+   Assembly sampling loops are not instrumented (would change their
+   timing); edges() instead measures their spacing from the captured
+   samples' SysTick timestamps (also main clock cycles), at halt or, for
+   SamplingMode::STREAM, from each packet in stream_pack() (lengthening
+   stream_drain() sampling stalls while enabled).
+*/
+class Instruments {
+  public:
+    struct Histogram {
+        static const uint8_t    BINS = 16;
+
+        void clear();
+
+        // bin N counts values in [4**(N-1), 4**N), bin 0 counts zeros
+        void add(
+        const uint32_t  cycles)
+        {
+            unsigned    bin = cycles ? (33 - __builtin_clz(cycles)) >> 1 : 0;
+
+            if (bin >= BINS)
+                bin = BINS - 1;
+
+            ++bins[bin];
+            ++count     ;
+            if (cycles < min) min = cycles;
+            if (cycles > max) max = cycles;
+        }
+
+        uint32_t    count      ,
+                    min        ,
+                    max        ,
+                    bins[BINS];
+    };
+
+    static const uint8_t    // histograms
+                            LOOP_PERIOD    = 0,  // live/bridge/counter loops
+                            EDGE_SPACING   = 1,  // between captured changes
+                            SEND_WAIT      = 2,  // usb_send() wfi, host behind
+                            RECV_WAIT      = 3,  // partial command from host
+                            NUM_HISTOGRAMS = 4,
+                            // counters
+                            SENDS          = 0,  // USB IN packets
+                            SENT_BYTES     = 1,
+                            RECV_BYTES     = 2,
+                            SAMPLE_BYTES   = 3,  // captured, non-streamed
+                            CYCLES         = 4,  // since enable(), wraps
+                            NUM_COUNTERS   = 5,
+                            NUM_WORDS      =   NUM_COUNTERS
+                                             +   NUM_HISTOGRAMS
+                                               * sizeof(Histogram) / 4;
+
+    Instruments()
+    :   _edge_setup(0    ),
+        _enabled   (false)
+    {}
+
+    void    enable ();
+    void    disable() { _enabled = false; }
+    void    resume () { _enabled = true ; }  // after disable(), no clear
+    bool    enabled() const { return _enabled; }
+
+    void    edges(const uint32_t *begin, const uint32_t *end, bool packed);
+
+    // SamplingMode::STREAM, samples in order over successive calls
+    void    stream_begin() { _edge_setup = 2; }  // trigger, setup samples
+    void    stream_edges(const uint32_t *begin, const uint32_t *end);
+
+    // snapshot of CYCLES counter, then report words in order
+    const uint32_t* words();
+
+    uint32_t cycles() const
+    {
+        return _enabled ? static_cast<uint32_t>(arm::dwt->cyccnt) : 0;
+    }
+
+    void loop_begin() { _looping = false; }
+
+    void loop()
+    {
+        if (!_enabled)
+            return;
+
+        const uint32_t  now = arm::dwt->cyccnt;
+
+        if (_looping)
+            _histograms[LOOP_PERIOD].add(now - _loop_start);
+
+        _loop_start = now ;
+        _looping    = true;
+    }
+
+    void waited(
+    const uint8_t   histogram,
+    const uint32_t  start    )
+    {
+        if (_enabled)
+            _histograms[histogram].add(arm::dwt->cyccnt - start);
+    }
+
+    void sent(
+    const unsigned  bytes)
+    {
+        if (_enabled) {
+            ++_counters[SENDS     ]        ;
+              _counters[SENT_BYTES] += bytes;
+        }
+    }
+
+    void received(
+    const unsigned  bytes)
+    {
+        if (_enabled)
+            _counters[RECV_BYTES] += bytes;
+    }
+
+  protected:
+    void    _edge(uint32_t tick, uint32_t bits);
+
+    union {
+        struct {
+            uint32_t    _counters  [NUM_COUNTERS  ];
+            Histogram   _histograms[NUM_HISTOGRAMS];
+        };
+        uint32_t        _words[NUM_WORDS];
+    };
+    uint32_t            _enable_at   ,
+                        _loop_start  ,
+                        _edge_tick   ,  // previous sample, edges() and
+                        _edge_bits   ,  //   stream_edges()
+                        _edge_elapsed;  // since last change
+    uint8_t             _edge_setup  ;  // stream samples before changes
+    bool                _enabled     ,
+                        _looping     ,
+                        _edge_timed  ;  // after first change (its delay
+                                        //   from setup not known)
+};
+
+
+
 class Sbrk {
   public:
     Sbrk()
@@ -438,9 +754,10 @@ namespace live_command {
     DURATION_HI   =  3,  // (0-0xffffffff)
     RATE_LO       =  4,  // (0-0xffffffff)
     RATE_HI       =  5,  // (0-0xffffffff)
+    BATCH_WNDW    =  6,  // (0-0xffffffff) batch latency, 0: unbatched
 
     // usb_recv.bytes(NDX)
-          CMD_LEN = 24;  // command length
+          CMD_LEN = 28;  // command length
 
 }  // namespace live_command
 
@@ -456,6 +773,21 @@ namespace adc_command {
 
 }  // namespace adc_command
 
+
+namespace instrument_command {
+    static const uint8_t
+    // usb_recv.bytes(NDX)
+    CMD       = 0,  // placeholder/alignment
+    ACTION    = 1,  // see below
+    CMD_LEN   = 4,
+
+    // ACTION values
+    REPORT    = 0,  // send Instruments::words()
+    ENABLE    = 1,  // clear and start
+    DISABLE   = 2;  // stop, keep for REPORT
+
+}  // namespace instrument_command
+
 #endif  // #if 1 (command message layouts_
 
 
@@ -474,7 +806,7 @@ UsbRecv     usb_recv;
 uint32_t    *send_uint32s = reinterpret_cast<uint32_t*>(send_buf);
 uint16_t    *send_uint16s = reinterpret_cast<uint16_t*>(send_buf);
 
-jmp_buf     longjump_buf = {0};
+jmp_buf     longjump_buf = {};
 
 // 128 sufficient size from analysis of assembly output and experimentation
 // add 16 (words) for safety
@@ -482,15 +814,25 @@ uint32_t     STACK[144] __attribute__((section (".stack")));
 
 UsbDevCdcAcm        usb_dev;
 arm::SysTickTimer   sys_tick_timer;
+Instruments         instruments;
 
 Trigger     *triggers = reinterpret_cast<Trigger*>(&STORAGE_END) - MAX_TRIGGERS;
 
             // must be global for asm and send_samples() access
 uint32_t    sampling_mode = SamplingMode::UNSET;
 
+// bytes of TriggerCompiler code at STORAGE, 0 if triggers interpreted
+// must be global for asm timers_mode_codeloc
+uint32_t    trigger_code_size = 0;
+
+TriggerCompiler     trigger_compiler;
+
 uint32_t    *samples     = &STORAGE_END,    // init in case SEND_SAMPLES
             *samples_end = &STORAGE_END;    //   before START_SAMPLING
 
+// set by asm set_samples(), updated by asm sampling loop and stream_drain()
+volatile StreamRing     stream_ring;
+
 // globals for setting in analog_sampling() and returning in send_samples()
 uint32_t    analog_sample_rate;  // s/h+adc for host to calculate rate
 uint16_t    num_analog_words  ;  // two samples/word, either two single channel
@@ -511,6 +853,7 @@ union {
     uint8_t         byte       ;
 } analog_channels;
 uint8_t     num_analog_channels;
+uint8_t     analog_mode        ;  // AnalogMode bits
 
 #endif  // #if 1 (globals)
 
@@ -574,6 +917,8 @@ void UsbRecv::_fill()
     if (!rcvd)
         return;
 
+    instruments.received(rcvd);
+
     // Should only be getting non-modulo-4-sized packets from CDC-ACM
     //    startup, which are ignored, so okay to pad.
     // But also pad in case host sends non-mod-4
@@ -607,6 +952,14 @@ unsigned     need)   // must be <= UsbDevCdcAcm::CDC_OUT_DATA_SIZE
     if (need == 0 && _level == 0)
         _fill();   // poll/check
 
+    if (_level && _level < need && instruments.enabled()) {
+        // rest of partially-received message not yet sent by host
+        const uint32_t  start = instruments.cycles();
+        while (_level < need)
+            _fill();
+        instruments.waited(Instruments::RECV_WAIT, start);
+    }
+
     while (_level < need)
         _fill();
 
@@ -629,6 +982,492 @@ unsigned     used)
 
 
 
+void Instruments::Histogram::clear()
+{
+    count = 0         ;
+    min   = 0xffffffff;
+    max   = 0         ;
+
+    for (unsigned ndx = 0 ; ndx < BINS ; ++ndx)
+        bins[ndx] = 0;
+}
+
+
+
+void Instruments::enable()
+{
+    for (unsigned ndx = 0 ; ndx < NUM_COUNTERS ; ++ndx)
+        _counters[ndx] = 0;
+
+    for (unsigned ndx = 0 ; ndx < NUM_HISTOGRAMS ; ++ndx)
+        _histograms[ndx].clear();
+
+    arm::core_debug->demcr |= arm::CoreDebug::Demcr::TRCENA  ;
+    arm::dwt       ->ctrl  |= arm::Dwt      ::Ctrl ::CYCCNTENA;
+
+    _enable_at = arm::dwt->cyccnt;
+    _looping   = false           ;
+    _enabled   = true            ;
+}
+
+
+
+const uint32_t* Instruments::words()
+{
+    if (_enabled)
+        _counters[CYCLES] = arm::dwt->cyccnt - _enable_at;
+
+    return _words;
+}
+
+
+
+// Digital samples: first trigger, then setup, then changes interleaved
+// with SysTick rollover samples (same bits as previous). Packed halves as
+// buck50_asm.s/unpack_samples() in buck50.py: bits<<8|delta, delta 0
+// escapes to full 24 bit tick in next two halves.
+void Instruments::edges(
+const uint32_t  *begin ,
+const uint32_t  *end   ,
+const bool       packed)
+{
+    if (!_enabled || end - begin < 2)
+        return;
+
+    _counters[SAMPLE_BYTES] += (end - begin) << 2;
+
+    _edge_tick    = begin[1] & 0xffffff;
+    _edge_bits    = begin[1] >> 24     ;
+    _edge_elapsed = 0                  ;
+    _edge_timed   = false              ;
+
+    if (!packed) {
+        for (const uint32_t *sample = begin + 2 ; sample < end ; ++sample)
+            _edge(*sample & 0xffffff, *sample >> 24);
+        return;
+    }
+
+    const uint16_t  *halves  = reinterpret_cast<const uint16_t*>(begin + 2),
+                    *halfend = reinterpret_cast<const uint16_t*>(end      );
+
+    while (halves < halfend) {
+        const uint32_t  delta = *halves & 0xff;
+
+        if (delta) {
+            _edge((_edge_tick - delta) & 0xffffff, *halves >> 8);
+            halves += 1;
+        }
+        else if (halves + 2 < halfend) {
+            _edge(halves[1] | (halves[2] & 0xff) << 16, *halves >> 8);
+            halves += 3;
+        }
+        else
+            break;
+    }
+}
+
+
+
+void Instruments::stream_edges(
+const uint32_t  *begin,
+const uint32_t  *end  )
+{
+    if (!_enabled)
+        return;
+
+    for (const uint32_t *sample = begin ; sample < end ; ++sample) {
+        if (_edge_setup == 0)
+            _edge(*sample & 0xffffff, *sample >> 24);
+        else if (--_edge_setup == 0) {  // setup, trigger already skipped
+            _edge_tick    = *sample & 0xffffff;
+            _edge_bits    = *sample >> 24     ;
+            _edge_elapsed = 0                 ;
+            _edge_timed   = false             ;
+        }
+    }
+}
+
+
+
+void Instruments::_edge(
+const uint32_t  tick,
+const uint32_t  bits)
+{
+    _edge_elapsed += (_edge_tick - tick) & 0xffffff;
+    _edge_tick     = tick                          ;
+
+    if (bits == _edge_bits)
+        return;  // SysTick rollover sample
+
+    if (_edge_timed)
+        _histograms[EDGE_SPACING].add(_edge_elapsed);
+
+    _edge_bits    = bits;
+    _edge_elapsed = 0   ;
+    _edge_timed   = true;
+}
+
+
+
+TriggerCompiler::Test TriggerCompiler::_test(
+const Trigger   &trigger)
+{
+    if (trigger.bits & ~trigger.mask)
+        return Test::NEVER;
+    else if (trigger.mask == 0)
+        return Test::ALWAYS;
+    else
+        return Test::MATCH;
+}
+
+
+
+void TriggerCompiler::_half(
+const uint16_t  half)
+{
+    if (_pos + 2 > MAX_CODE_BYTES)
+        _overflow = true;
+    else if (_write)
+        _code[_pos >> 1] = half;
+
+    _pos += 2;
+}
+
+
+
+// B.W to epilogue, always 32-bit because _end unknown in first pass
+void TriggerCompiler::_exit()
+{
+    _branch(AL, _end, false);
+}
+
+
+
+void TriggerCompiler::_movs(
+const uint8_t   reg,
+const uint8_t   imm)
+{
+    _half(0x2000 | reg << 8 | imm);
+}
+
+
+
+// imm must be 8 bit pattern shifted left (or less than 256), as are all
+// PB4...PB11 masks and bits in gpiob->idr bit positions
+void TriggerCompiler::_dp_imm(
+const uint8_t   op   ,
+const bool      flags,
+const uint8_t   rn   ,
+const uint8_t   rd   ,
+const uint32_t  imm  )
+{
+    uint32_t    imm12 = imm;
+
+    if (imm > 0xff) {  // '1':imm12<6:0> rotated right by imm12<11:7>
+        unsigned    rot = 8;
+        uint32_t    bits = (imm << rot) | (imm >> (32 - rot));
+        while (bits < 0x80 || bits > 0xff) {
+            ++rot;
+            bits = (imm << rot) | (imm >> (32 - rot));
+        }
+        imm12 = rot << 7 | (bits & 0x7f);
+    }
+
+    _half(0xf000 | (imm12 >> 11) << 10 | op << 5 | flags << 4 | rn);
+    _half(((imm12 >> 8) & 0x7) << 12 | rd << 8 | (imm12 & 0xff));
+}
+
+
+
+// 16-bit if target known and in range, else 32-bit so that instruction
+// sizes are same in both passes
+void TriggerCompiler::_branch(
+const uint8_t   cond  ,
+const unsigned  target,
+const bool      known )
+{
+    const int   offset = static_cast<int>(target) - static_cast<int>(_pos + 4);
+
+    if (known && cond == AL && offset >= -2048 && offset <= 2046)
+        _half(0xe000 | ((offset >> 1) & 0x7ff));
+    else if (known && cond != AL && offset >= -256 && offset <= 254)
+        _half(0xd000 | cond << 8 | ((offset >> 1) & 0xff));
+    else if (cond == AL) {
+        const unsigned  s  = (offset >> 24) & 1                ,
+                        j1 = ~((offset >> 23) ^ s) & 1         ,
+                        j2 = ~((offset >> 22) ^ s) & 1         ;
+        _half(0xf000 | s << 10 | ((offset >> 12) & 0x3ff));
+        _half(0x9000 | j1 << 13 | j2 << 11 | ((offset >> 1) & 0x7ff));
+    }
+    else {
+        _half(  0xf000 | ((offset >> 20) & 1) << 10 | cond << 6
+              | ((offset >> 12) & 0x3f)                        );
+        _half(  0x8000 | ((offset >> 18) & 1) << 13
+              | ((offset >> 19) & 1) << 11 | ((offset >> 1) & 0x7ff));
+    }
+}
+
+
+
+// emits test of gpiob_idr against trigger (Test::MATCH only)
+uint8_t TriggerCompiler::_match(
+const Trigger   &trigger)
+{
+    static const uint8_t    AND = 0x0,  // data processing opcodes
+                            SUB = 0xd;  // CMP is SUBS discarding result
+
+    const uint32_t  mask = trigger.mask << 4,  // PB4...PB11 in gpiob->idr
+                    bits = trigger.bits << 4;
+
+    if (trigger.bits == 0) {
+        _dp_imm(AND, true, GPIOB_IDR_REG, PC_REG, mask);  // TST
+        return EQ;
+    }
+    else if (num_bits_set(trigger.mask) == 1) {
+        _dp_imm(AND, true, GPIOB_IDR_REG, PC_REG, mask);  // TST
+        return NE;
+    }
+    else {
+        _dp_imm(AND, false, GPIOB_IDR_REG, VALU_REG, mask);
+        _dp_imm(SUB, true , VALU_REG     , PC_REG  , bits);  // CMP
+        return EQ;
+    }
+}
+
+
+
+// conditional branch to member's pass state, directly to RAM epilogue
+// if state already is member, or else to stub which sets state to member
+// (for irq_handler_enter and triggered) and exits
+void TriggerCompiler::_pass_branch(
+const uint8_t   cond  ,
+const uint8_t   member,
+const uint8_t   state )
+{
+    const uint8_t   pass = triggers[member].pass;
+
+    if (pass) {
+        _branch(cond, _scratch->enter[pass], _bit(_scratch->placed, pass));
+        if (   !_bit(_scratch->placed, pass)
+            && !_bit(_scratch->queued, pass)
+            && !_write                      ) {
+            _set(_scratch->queued, pass);
+            _scratch->stack[_depth++] = pass;
+        }
+    }
+    else if (member == state)
+        _branch(cond, _end, false);
+    else {
+        _set(_scratch->stubbed, member);
+        _branch(cond, _scratch->stub[member], false);
+    }
+}
+
+
+
+// unconditional, always last code of state
+void TriggerCompiler::_pass(
+const uint8_t   member,
+const uint8_t   state ,
+const bool      last  )
+{
+    const uint8_t   pass = triggers[member].pass;
+
+    if (pass) {
+        if (_bit(_scratch->placed, pass))
+            _branch(AL, _scratch->enter[pass], true);
+        else
+            _fall = pass;  // placed next, fall through
+    }
+    else {
+        if (member != state)
+            _movs(STATE_REG, member);
+        if (!(_write && _fallthrough && last))
+            _exit();
+        _exit_at = _pos;
+    }
+}
+
+
+
+void TriggerCompiler::_state(
+const uint8_t   state,
+const bool      last )
+{
+    if (!_write)
+        _scratch->enter[state] = _pos;
+    else if (_scratch->enter[state] != _pos)
+        _overflow = true;  // passes disagree, shouldn't happen
+
+    _movs(STATE_REG, state);  // for irq_handler_enter if halted here
+
+    const Trigger   &trigger = triggers[state];
+
+    if (trigger.mask == 0 && trigger.pass != 0) {
+        _pass(state, state, last);
+        return;
+    }
+
+    const unsigned  loop   = _pos                                   ,
+                    copies =    _test(trigger)  == Test::MATCH
+                             && trigger.fail    == state
+                           ? UNROLL : 1                             ;
+
+    _zero(_scratch->chained);
+
+    for (unsigned copy = 0 ; copy < copies ; ++copy) {
+        _half(0x6800 | 2 << 6 | GPIOB_REG << 3 | GPIOB_IDR_REG);  // IDR
+        if (_ganged) {  // PB14 low if any ganged unit triggered
+            _half(0x0000 | 17 << 6 | GPIOB_IDR_REG << 3 | VALU_REG);  // LSLS
+            _branch(PL, _ext, false);
+        }
+
+        uint8_t     member = state;
+        while (true) {
+            _set(_scratch->chained, member);
+            _scratch->member[member] = _pos;
+
+            const Trigger   &chain = triggers[member]                     ;
+            const uint8_t    fail  = chain.fail                           ;
+            const bool       back  =    fail == state
+                                     || _bit(_scratch->chained, fail)     ;
+            const Test       test  = _test(chain)                         ;
+
+            if (test == Test::ALWAYS) {
+                _pass(member, state, last);
+                return;
+            }
+
+            if (back && copy == copies - 1) {  // fail re-reads or loops
+                const unsigned  target = fail == state
+                                       ? loop
+                                       : _scratch->member[fail];
+
+                if (test == Test::MATCH) {
+                    _branch(_match(chain) ^ 1, target, true);
+                    _pass(member, state, last);
+                }
+                else
+                    _branch(AL, target, true);
+                return;
+            }
+
+            if (test == Test::MATCH)
+                _pass_branch(_match(chain), member, state);
+
+            if (back)
+                break;  // next unrolled copy
+
+            member = fail;
+        }
+    }
+}
+
+
+
+uint32_t TriggerCompiler::compile(
+const bool      ganged)
+{
+    static const uint8_t    ORR = 0x2;
+
+    _scratch     = reinterpret_cast<Scratch*>(triggers) - 1;
+    _code        = reinterpret_cast<uint16_t*>(&STORAGE)   ;
+    _ganged      = ganged                                  ;
+    _write       = false                                   ;
+    _fallthrough = false                                   ;
+    _overflow    = false                                   ;
+    _pos         = 0                                       ;
+    _end         = 0                                       ;
+    _exit_at     = 0                                       ;
+    _ext         = 0                                       ;
+    _depth       = 0                                       ;
+
+    _zero(_scratch->placed );
+    _zero(_scratch->queued );
+    _zero(_scratch->stubbed);
+
+    // first pass: depth-first from state 0 following "pass" states,
+    // measuring at offset 0
+    unsigned    num_states = 0;
+    uint8_t     state      = 0;
+    while (true) {
+        _set(_scratch->placed, state);
+        _fall = -1;
+        _state(state, false);
+        _scratch->order[num_states++] = state;
+        if (_overflow)
+            return 0;
+        if (_fall >= 0) {
+            state = _fall;
+            continue;
+        }
+        do
+            if (_depth == 0)
+                goto placed;
+        while (_bit(_scratch->placed, state = _scratch->stack[--_depth]));
+    }
+  placed:
+
+    unsigned        num_stubs = 0;
+    for (unsigned ndx = 0 ; ndx < MAX_TRIGGERS ; ++ndx)
+        if (_bit(_scratch->stubbed, ndx))
+            ++num_stubs;
+
+    _fallthrough = _exit_at == _pos;
+
+    // stubs (and branch to state 0 around them) before states, pad for
+    // 4-byte aligned epilogue (executed once if no stubs)
+    const bool      around   = num_stubs || _ganged                        ;
+    const unsigned  states   = _pos - (_fallthrough ? 4 : 0)               ,
+                    prefix   =   (around ? 4 : 0) + num_stubs * 6
+                               + (_ganged ? 8 : 0)                         ,
+                    pad      = (prefix + states) & 2                       ,
+                    base     = prefix + pad                                ;
+
+    unsigned        offset   = (around ? 4 : 0) + pad;
+    for (unsigned ndx = 0 ; ndx < MAX_TRIGGERS ; ++ndx)
+        if (_bit(_scratch->stubbed, ndx)) {
+            _scratch->stub[ndx]  = offset;
+            offset              += 6     ;
+        }
+    _ext = offset;
+
+    for (unsigned ndx = 0 ; ndx < num_states ; ++ndx)
+        _scratch->enter[_scratch->order[ndx]] += base;
+    _end = base + states;
+
+    // second pass, writing
+    _write = true;
+    _pos   = 0   ;
+
+    if (around)
+        _branch(AL, base, false);
+    if (pad)
+        _half(0xbf00);  // NOP
+    for (unsigned ndx = 0 ; ndx < MAX_TRIGGERS ; ++ndx)
+        if (_bit(_scratch->stubbed, ndx)) {
+            _movs(STATE_REG, ndx);
+            _exit();
+        }
+    if (_ganged) {
+        _dp_imm(ORR, false, STATE_REG, STATE_REG, InProgress::EXTERN_TRIG);
+        _exit();
+    }
+
+    _zero(_scratch->placed);
+    for (unsigned ndx = 0 ; ndx < num_states ; ++ndx) {
+        _set(_scratch->placed, _scratch->order[ndx]);
+        _state(_scratch->order[ndx], ndx == num_states - 1);
+    }
+
+    if (_overflow || _pos != _end)
+        return 0;
+
+    return _pos;
+}
+
+
+
 template <typename ENR, typename RSTR, typename ENR_BITS, typename RSTR_BITS>
 inline void __attribute__((always_inline)) rcc_periph_enable_and_reset(
 volatile ENR        &enr      ,
@@ -668,11 +1507,27 @@ void inline __attribute__((always_inline)) user_led_off()
 
 
 
+// Returns as soon as packet is copied to USB peripheral. CDC IN endpoint
+// is double-buffered (see UsbDev::double_buffer_sends()) so only waits
+// if both previous packets still queued, and caller's next send_buf fill
+// overlaps current packet's transmission.
 INLINE_DECL void INLINE_ATTR usb_send(
 uint8_t     length)
 {
-    while (!usb_dev.send(UsbDevCdcAcm::CDC_ENDPOINT_IN, send_buf, length))
-        asm("wfi");
+    if (!usb_dev.send(UsbDevCdcAcm::CDC_ENDPOINT_IN, send_buf, length)) {
+        const uint32_t  start = instruments.cycles();
+
+        while (!usb_dev.send(UsbDevCdcAcm::CDC_ENDPOINT_IN, send_buf, length))
+#ifdef BUCK50_SIM
+            buck50_sim::wfi();
+#else
+            asm("wfi");
+#endif
+
+        instruments.waited(Instruments::SEND_WAIT, start);
+    }
+
+    instruments.sent(length);
 }
 
 
@@ -2332,6 +3187,11 @@ extern "C" {
     void trigger_and_sample_ganged(const uint8_t    flash_or_ram   ,
                                    const uint16_t   num_samples    );
                                 // const bool       dura_enabled
+    // TriggerCompiler code already at STORAGE, trigger_code_size bytes
+    void trigger_and_sample_compiled_plain (const uint8_t    flash_or_ram,
+                                            const uint16_t   num_samples );
+    void trigger_and_sample_compiled_ganged(const uint8_t    flash_or_ram,
+                                            const uint16_t   num_samples );
 }
 
 
@@ -2346,6 +3206,82 @@ INLINE_DECL uint16_t INLINE_ATTR dma_adc()
 
 
 
+// Sampling loop for AnalogMode::MINMAX and ::AVERAGE. DMA fills circular
+// ring of uint16_t samples at start of STORAGE; each half is reduced into
+// samples...samples_end as soon as DMA has moved on to the other half.
+// Order of samples within a block doesn't matter, so INTERLEAVED ADC2:ADC1
+// pairs are treated the same as single ADC samples.
+// Loop is a few cycles per sample vs. 42 per sample at fastest
+// (INTERLEAVED) ADC rate, so DMA never overwrites unprocessed half.
+void analog_decimate()
+{
+    const unsigned   shift  = analog_mode & AnalogMode::FACTOR_MASK,
+                     factor = 1 << shift                           ;
+    const bool       minmax =    (analog_mode & AnalogMode::DECIMATE_MASK)
+                              == AnalogMode::MINMAX                      ;
+    const uint16_t  *ring   = reinterpret_cast<uint16_t*>(&STORAGE)   ;
+    uint32_t        *write  = samples                                 ;
+    uint32_t         sum    = 0                                       ;
+    unsigned         count  = factor                                  ,
+                     lo     = 0xffff                                  ,
+                     hi     = 0                                       ;
+    bool             upper  = false                                   ,
+                     second = false                                   ;
+
+    while (write < samples_end) {
+        // wait for DMA to finish filling next half of ring
+        if (second) {
+            while (!dma1->isr.any(Dma::Isr::TCIF1))
+                asm("nop");
+            dma1->ifcr = Dma::Ifcr::CTCIF1;
+        }
+        else {
+            while (!dma1->isr.any(Dma::Isr::HTIF1))
+                asm("nop");
+            dma1->ifcr = Dma::Ifcr::CHTIF1;
+        }
+
+        const uint16_t  *raw = second ? ring + AnalogMode::RING_HALF : ring,
+                        *end = raw + AnalogMode::RING_HALF                 ;
+
+        if (minmax)
+            for ( ; raw < end ; ++raw) {
+                const unsigned  value = *raw;
+                if (value < lo) lo = value;
+                if (value > hi) hi = value;
+                if (--count == 0) {
+                    *write++ = lo | (hi << 16);
+                    if (write == samples_end)
+                        break;
+                    lo    = 0xffff;
+                    hi    = 0     ;
+                    count = factor;
+                }
+            }
+        else  // AnalogMode::AVERAGE
+            for ( ; raw < end ; ++raw) {
+                sum += *raw;
+                if (--count == 0) {
+                    const uint32_t  mean = (sum + (factor >> 1)) >> shift;
+                    if (upper) {
+                        *write++ |= mean << 16;
+                        if (write == samples_end)
+                            break;
+                    }
+                    else
+                        *write = mean;
+                    upper = !upper;
+                    sum   = 0     ;
+                    count = factor;
+                }
+            }
+
+        second = !second;
+    }
+}  // analog_decimate()
+
+
+
 void analog_sampling()
 {
                             // usb_recv.byte(NDX)
@@ -2354,12 +3290,13 @@ void analog_sampling()
                               TRIGGER_SLOPE_NDX =  3, // (0,1,2) see below
                                        RATE_NDX =  4, // (0,7) s&h+adc code
                                      GANGED_NDX =  5, // (0,1) disabled/enabled
+                                       MODE_NDX = 12, // AnalogMode bits
                             // usb_recv.shrt(NDX)
                                 NUM_SAMPLES_NDX =  3, // (0-0xffff)
                                  TRIGGER_LO_NDX =  4, // (0-0xfff)
                                  TRIGGER_HI_NDX =  5, // (0-0xfff)
                             // other constants
-                                COMMAND_LENGTH  = 12,
+                                COMMAND_LENGTH  = 16,
                 // unneeded     SLOPE_NONE      =  0,  // no trigger, immediate
                                 SLOPE_POSITIVE  =  1,  // trigger slope
                                 SLOPE_NEGATIVE  =  2;  //    "      "
@@ -2380,12 +3317,31 @@ void analog_sampling()
                     num_analog_channels =     second_channel
                                             > MAX_ADC_CHANNEL_NUM
                                           ? 1
-                                          : 2                                ;
+                                          : 2                                ,
+                    analog_mode         = usb_recv.byte(            MODE_NDX);
 
     usb_recv.flush(COMMAND_LENGTH);
 
     if (num_analog_words == 0) return;
 
+    // both ADCs busy with two channels, decimation only of single channel
+    if (num_analog_channels == 2)
+        analog_mode = AnalogMode::NORMAL;
+    if ((analog_mode & AnalogMode::FACTOR_MASK) > AnalogMode::MAX_FACTOR)
+        analog_mode =   (analog_mode & ~AnalogMode::FACTOR_MASK)
+                      | AnalogMode::MAX_FACTOR                  ;
+    if ((analog_mode & AnalogMode::FACTOR_MASK) == 0)
+        analog_mode &= ~AnalogMode::DECIMATE_MASK;
+    // RM0008: sample time must be < 7 ADC clocks to avoid ADC1 and
+    //   ADC2 sampling phases overlapping on same channel
+    if (analog_mode & AnalogMode::INTERLEAVED)
+        analog_sample_rate = AnalogMode::SAMP_HOLD;
+
+    const bool  interleaved =    analog_mode & AnalogMode::INTERLEAVED   ,
+                decimating  =    analog_mode & AnalogMode::DECIMATE_MASK ,
+                // both ADCs, 32-bit DMA
+                dual_adc    = num_analog_channels == 2 || interleaved    ;
+
     analog_channels.trigger = trigger_channel;
     analog_channels.second  =  second_channel;
 
@@ -2403,6 +3359,8 @@ void analog_sampling()
     // each channel requires uint16_t (to store 12 bit ADC values)
     unsigned    memory_available = static_cast<unsigned>(  &STORAGE_END
                                                          - &STORAGE    );
+    if (decimating)  // DMA ring at start of STORAGE
+        memory_available -= AnalogMode::RING_WORDS;
     if (num_analog_words > memory_available)
         num_analog_words = memory_available;
 
@@ -2440,7 +3398,7 @@ void analog_sampling()
                                 rcc->apb2rstr         ,
                                 Rcc::Apb2enr ::ADC1EN ,
                                 Rcc::Apb2rstr::ADC1RST);
-    if (num_analog_channels == 2)
+    if (dual_adc)
         rcc_periph_enable_and_reset(rcc->apb2enr          ,
                                     rcc->apb2rstr         ,
                                     Rcc::Apb2enr ::ADC2EN ,
@@ -2464,7 +3422,7 @@ void analog_sampling()
     while (adc1->cr2.any(Adc::Cr2::CAL))     // need timeout safety
         asm("nop");
 
-    if (num_analog_channels == 2) {  // same procedure as adc1
+    if (dual_adc) {  // same procedure as adc1
         adc2->cr2 |= Adc::Cr2::ADON;
         sys_tick_timer.delay32(36);
         adc2->cr2 |= Adc::Cr2::ADON | Adc::Cr2::RSTCAL;
@@ -2483,7 +3441,25 @@ void analog_sampling()
     Adc::Cr1::bits_t    adc1_cr1;
     Adc::Cr2::bits_t    adc1_cr2;
 
-    if (num_analog_channels == 1) {
+    if (interleaved) {
+        // ADC2 starts first, ADC1 7 ADC clocks later, so 32-bit DMA
+        //   word has earlier sample in high halfword
+        adc1_cr2 =    Adc::Cr2::EXTTRIG
+                    | Adc::Cr2::EXTSEL_SWSTART
+                    | Adc::Cr2::DMA
+                    | Adc::Cr2::CONT
+                    | Adc::Cr2::ADON                 ;
+        adc1_cr1 =    Adc::Cr1::DUALMOD_FAST_INTRLV  ;
+        adc2->cr2 =   Adc::Cr2::EXTTRIG
+                    | Adc::Cr2::EXTSEL_SWSTART
+                    | Adc::Cr2::CONT
+                    | Adc::Cr2::ADON                 ;
+
+        adc2->sqr1  = Adc::Sqr1::L<0>       (                  );  // 1 channel
+        adc2->sqr3  = Adc::Sqr3::sq1        (trigger_channel   );  // same chan
+        adc2->smpr2 = analog_sample_rate << (trigger_channel * 3);  // chan# pos
+    }
+    else if (num_analog_channels == 1) {
         adc1_cr2 =    Adc::Cr2::EXTTRIG
                     | Adc::Cr2::EXTSEL_SWSTART
                     | Adc::Cr2::DMA
@@ -2525,30 +3501,37 @@ void analog_sampling()
     // must be disabled when setting parameters/flags/bits
     dma1_channel1->ccr = 0;
 
-    dma1_channel1->pa  = reinterpret_cast<uint32_t>(&adc1->dr.dr);
-    dma1_channel1->ma  = reinterpret_cast<uint32_t>(samples     );  // 16bit OK
+    dma1_channel1->pa  = reinterpret_cast<uintptr_t>(&adc1->dr.dr);
+    dma1_channel1->ma  = reinterpret_cast<uintptr_t>(  decimating   // 16bit OK
+                                                     ? &STORAGE
+                                                     : samples    );
 
     // finish and enable
     uint32_t      dma_ccr;   // save for fast resetting after triggering
-    if (num_analog_channels == 1)
+    if (!dual_adc)
         dma_ccr = (  DmaChannel::Ccr::MINC
                    | DmaChannel::Ccr::DIR_PERIPH2MEM
                    | DmaChannel::Ccr::PSIZE_16_BITS
                    | DmaChannel::Ccr::MSIZE_16_BITS
                    | DmaChannel::Ccr::PL_LOW
                    | DmaChannel::Ccr::EN             ).bits();
-    else  //  num_analog_channels == 2
+    else  //  num_analog_channels == 2 or interleaved
         dma_ccr = (  DmaChannel::Ccr::MINC
                     | DmaChannel::Ccr::DIR_PERIPH2MEM
                     | DmaChannel::Ccr::PSIZE_32_BITS
                     | DmaChannel::Ccr::MSIZE_32_BITS
                     | DmaChannel::Ccr::PL_LOW
                     | DmaChannel::Ccr::EN            ).bits();
+    if (decimating)
+        dma_ccr |= DmaChannel::Ccr::CIRC.bits();
     // set for triggering
-    dma1_channel1->ndt =   num_analog_channels == 1
-                         ? num_analog_words << 1    // two samples per word
-                         : num_analog_words         ;
-    dma1_channel1->ccr = dma_ccr                    ;
+    const unsigned  dma_words =   decimating
+                                ? AnalogMode::RING_WORDS
+                                : num_analog_words      ;
+    dma1_channel1->ndt =   dual_adc
+                         ? dma_words
+                         : dma_words << 1;  // two samples per word
+    dma1_channel1->ccr = dma_ccr;
 
 
     // optional ganged sync
@@ -2647,8 +3630,11 @@ void analog_sampling()
                 | Adc::Cr2::DMA
                 | Adc::Cr2::CONT
                 | Adc::Cr2::ADON          ;
-    while (!dma1->isr.any(Dma::Isr::TCIF1))
-        asm("nop");
+    if (decimating)
+        analog_decimate();
+    else
+        while (!dma1->isr.any(Dma::Isr::TCIF1))
+            asm("nop");
 
     // clean up
     adc_disable             ();
@@ -2677,6 +3663,7 @@ void digital_sampling()
                                      GANG_NDX =  3,  // (0,1) disabled/enabled
                              DURA_ENABLED_NDX =  4,  // (0,1) disabled/enabled
                               CODE_MEMORY_NDX =  5,  // (0,1) ram/flash
+                                TRIG_CODE_NDX = 10,  // TriggerCode
                             // usb_recv.shrt(NDX)
                                  DURATION_NDX =  3,  // gen_tim_3 arr
                               NUM_SAMPLES_NDX =  4,  // num_samples
@@ -2692,7 +3679,8 @@ void digital_sampling()
     const bool      dura_enabled  = usb_recv.byte(DURA_ENABLED_NDX),
                     ganged        = usb_recv.byte(        GANG_NDX);
     const uint8_t   num_triggers  = usb_recv.byte( MAX_TRIGGER_NDX),
-                    code_memory   = usb_recv.byte( CODE_MEMORY_NDX);
+                    code_memory   = usb_recv.byte( CODE_MEMORY_NDX),
+                    trigger_code  = usb_recv.byte(   TRIG_CODE_NDX);
 
     usb_recv.flush(CMD_LEN);
 
@@ -2703,6 +3691,21 @@ void digital_sampling()
     if (num_samples < 3)
         num_samples = 3;
 
+    // host's limit is decoded samples: two 32-bit words then (at most)
+    // one per 16-bit half, fewer if escapes (see buck50_asm.s)
+    if (sampling_mode == SamplingMode::PACKED)
+        num_samples = num_samples < 4 ? 3 : (num_samples >> 1) + 1;
+
+    if (sampling_mode == SamplingMode::STREAM) {
+        // ring buffer is all available memory, host halts if limit reached
+        num_samples = 0xffff;
+        // in case halted before asm set_samples() re-initializes
+        stream_ring.filled  = stream_ring.drained = stream_ring.merged = 0;
+        stream_ring.begin   = stream_ring.mid     =
+        stream_ring.end     = stream_ring.read    = samples_end = samples;
+        instruments.stream_begin();
+    }
+
     // triggers
     for (unsigned ndx= 0 ; ndx < num_triggers ; ++ndx) {
         usb_recv.fill(sizeof(Trigger));
@@ -2710,6 +3713,12 @@ void digital_sampling()
         usb_recv.flush(sizeof(Trigger));
     }
 
+    // falls back to interpreting triggers[] if code too large
+    if (trigger_code == TriggerCode::COMPILED)
+        trigger_code_size = trigger_compiler.compile(ganged);
+    else
+        trigger_code_size = 0;
+
     // GPIOB CRL 4 through 11  sampling pins: input, pull-down (default)
     // GPIOB 2 is BOOT1, tied to GND (normally) or Vdd, is OK, constant
     // all others disconnected same, (default)
@@ -2726,8 +3735,13 @@ void digital_sampling()
     // in_progress already set at function entry
     if (ganged) {
         gpiob->bsrr = Gpio::Bsrr::BS14; // raise, tell others self is ready
-        trigger_and_sample_ganged(code_memory, num_samples); // dura_enabled
+        if (trigger_code_size)
+            trigger_and_sample_compiled_ganged(code_memory, num_samples);
+        else
+            trigger_and_sample_ganged(code_memory, num_samples); // dura_enabled
     }
+    else if (trigger_code_size)
+        trigger_and_sample_compiled_plain (code_memory, num_samples);
     else
         trigger_and_sample_plain (code_memory, num_samples); // dura_enabled
 
@@ -2746,7 +3760,10 @@ void wait_connect_signature()
     while (bytes_matched < CONNECT_SIGNATURE_LENGTH) {
         unsigned    rcvd = usb_recv.fill(CONNECT_SIGNATURE_LENGTH);
 
-        for (uint8_t ndx = 0 ; ndx < rcvd ; ++ndx) {
+        // stop at full match, don't compare padding past end of signature
+        for (uint8_t ndx = 0                                          ;
+             ndx < rcvd && bytes_matched < CONNECT_SIGNATURE_LENGTH  ;
+             ++ndx                                                   ) {
             if (usb_recv.byte(ndx) == CONNECT_SIGNATURE[bytes_matched])
                 ++bytes_matched;
             else
@@ -2777,11 +3794,18 @@ void send_samples()
     usb_recv.flush((COUNT_NDX + 1) << 1);
 
     if (   sampling_mode          == SamplingMode::ANALOG
-        && analog_channels.second  > MAX_ADC_CHANNEL_NUM ) {
+        && analog_channels.second  > MAX_ADC_CHANNEL_NUM
+        &&    (analog_mode & AnalogMode::DECIMATE_MASK)
+           != AnalogMode::MINMAX                         ) {
         // two samples per uint32_t
         first >>= 1;
         count >>= 1;
     }
+    else if (sampling_mode == SamplingMode::PACKED) {
+        // host needs all to decode, applies first/count itself
+        first = 0     ;
+        count = 0xffff;
+    }
 
     uint32_t    *smpl = samples + first;
     if (smpl > samples_end)
@@ -2800,7 +3824,9 @@ void send_samples()
     send_buf    [10] = analog_channels.byte   ;
     send_buf    [11] = analog_sample_rate     ;
     send_uint16s[ 6] = num_analog_words       ;
-    usb_send(14);
+    send_buf    [14] = analog_mode            ;
+    send_buf    [15] = 0                      ;  // 16-bit alignment
+    usb_send(16);
 
     unsigned    buf_ndx = 0;
 
@@ -2823,6 +3849,199 @@ void send_samples()
 
 
 
+// Number of samples SamplingMode::PACKED words decode to, as
+// unpack_samples() in buck50.py: two full words then halves, escape
+// (delta 0) takes three, truncated escape at end dropped
+uint16_t packed_samples(
+const uint32_t  *begin,
+const uint32_t  *end  )
+{
+    if (end - begin <= 2)
+        return end - begin;
+
+    const uint16_t  *half    = reinterpret_cast<const uint16_t*>(begin + 2),
+                    *halfend = reinterpret_cast<const uint16_t*>(end      );
+    uint16_t         count   = 2                                           ;
+
+    while (half < halfend) {
+        if (*half & 0xff)
+            half += 1;
+        else if (half + 2 < halfend)
+            half += 3;
+        else
+            break;
+        ++count;
+    }
+
+    return count;
+}
+
+
+
+// Copy up to StreamPacket::MAX_WORDS samples from stream_ring.read, wrapping
+// at ring end, into send_buf following StreamPacket::SAMPLES header.
+// Returns send length in bytes.
+uint8_t stream_pack(
+const unsigned  count)
+{
+    uint32_t    *read = stream_ring.read;
+
+    send_buf    [0] = StreamPacket::SAMPLES;
+    send_buf    [1] = count                ;
+    send_uint16s[1] = 0                    ;
+
+    for (unsigned ndx = 1 ; ndx <= count ; ++ndx) {
+        send_uint32s[ndx] = *read++;
+        if (read == stream_ring.end)
+            read = stream_ring.begin;
+    }
+
+    instruments.stream_edges(&send_uint32s[1], &send_uint32s[count + 1]);
+
+    stream_ring.read = read;
+
+    return (count + 1) << 2;
+}
+
+
+
+// Sampling loop is stalled while stream_drain() runs: any PB4...PB11
+// change seen here is an edge the loop will record late (merged with
+// later ones into a single change) or not at all if it changes back.
+// Polled at entry, between packets, and at exit, so count is lower bound.
+INLINE_DECL void INLINE_ATTR stream_stall_poll(
+uint32_t    &idr)
+{
+    const uint32_t  crnt = gpiob->idr.word() & 0xff0;
+
+    if (crnt != idr) {
+        ++stream_ring.merged;
+        idr = crnt;
+    }
+}
+
+
+
+// Called from USB_LP_CAN1_RX0_IRQHandler (buck50_asm.s) during digital
+// sampling, either because of USB activity or because sampling loop
+// filled a ring half and set interrupt pending.
+// Returns false if sampling should halt (not streaming, or host sent
+// command e.g. Command::HALT), true after sending next packet(s) (if any
+// filled half not yet drained and IN endpoint not busy). Fills both of
+// double-buffered IN endpoint's buffers if free so next packet is already
+// queued when current one completes.
+extern "C" bool __attribute__((noinline)) stream_drain()
+{
+    if (   sampling_mode != SamplingMode::STREAM
+        || usb_dev.recv_ready(1 << UsbDevCdcAcm::CDC_ENDPOINT_OUT))
+        return false;
+
+    uint32_t    idr = gpiob->idr.word() & 0xff0;  // see stream_stall_poll()
+
+    while (   stream_ring.filled != stream_ring.drained
+           && usb_dev.send_ready(1 << UsbDevCdcAcm::CDC_ENDPOINT_IN)) {
+        // never send across half boundary so drained count stays exact
+        uint32_t    *half_end =   stream_ring.drained & 1
+                                ? stream_ring.end
+                                : stream_ring.mid ;
+        unsigned     count    = half_end - stream_ring.read;
+
+        if (count > StreamPacket::MAX_WORDS)
+            count = StreamPacket::MAX_WORDS;
+
+        const unsigned  length = stream_pack(count);
+
+        usb_dev.send(UsbDevCdcAcm::CDC_ENDPOINT_IN, send_buf, length);
+        instruments.sent(length);
+
+        if (   stream_ring.read == stream_ring.mid
+            || stream_ring.read == stream_ring.begin)  // wrapped from end
+            ++stream_ring.drained;
+
+        stream_stall_poll(idr);
+    }
+
+    stream_stall_poll(idr);
+
+    return true;
+}
+
+
+
+// After SamplingMode::STREAM halt, send all samples not yet drained by
+// stream_drain() (including partially-filled half) followed by
+// StreamPacket::END with halt code, trigger state, total sample count, and
+// count of edges merged or lost while stream_drain() stalled sampling
+void stream_finish(
+const uint16_t  triggered)
+{
+    const unsigned  half_words = stream_ring.mid - stream_ring.begin;
+
+    const uint32_t  *write_half = stream_ring.filled  & 1 ? stream_ring.mid
+                                                          : stream_ring.begin,
+                    * read_half = stream_ring.drained & 1 ? stream_ring.mid
+                                                          : stream_ring.begin;
+
+    // Halt IRQ can land anywhere in buck50_asm.s stream end of half
+    // path. Before ++filled, samples_end is at end of write_half: all of
+    // it written. After, but before wrapping from ring end to begin,
+    // samples_end == end with filled even: none of new (first) half.
+    const uint32_t  *write    =      samples_end == stream_ring.end
+                                  && write_half  == stream_ring.begin
+                                ? stream_ring.begin
+                                : samples_end                        ;
+    const unsigned  written   = write - write_half;
+    unsigned        remaining =   (stream_ring.filled - stream_ring.drained)
+                                * half_words
+                                + written
+                                - (stream_ring.read - read_half)       ;
+
+    while (remaining) {
+        unsigned    count =   remaining > StreamPacket::MAX_WORDS
+                            ? StreamPacket::MAX_WORDS
+                            : remaining                           ;
+        usb_send(stream_pack(count));
+        remaining -= count;
+    }
+
+    send_buf    [0] = StreamPacket::END                          ;
+    send_buf    [1] = halt_code                                  ;
+    send_uint16s[1] = triggered                                  ;
+    send_uint32s[1] = stream_ring.filled * half_words + written  ;
+    send_uint32s[2] = stream_ring.merged                         ;
+    usb_send(12);
+
+    // all samples sent, none left for send_samples()
+    samples_end = samples;
+}
+
+
+
+// Send live() batch packet built in send_buf, if any records. Unless
+// "wait", fails (batch kept) if USB IN buffers both still busy.
+bool live_batch_send(
+      unsigned  &length    ,
+const unsigned   record_len,
+const bool       wait      )
+{
+    if (length == LiveBatch::HEADER)
+        return true;
+
+    send_buf[0] = (length - LiveBatch::HEADER) / record_len;
+
+    if (wait)
+        usb_send(length);
+    else if (!usb_dev.send(UsbDevCdcAcm::CDC_ENDPOINT_IN, send_buf, length))
+        return false;
+    else
+        instruments.sent(length);
+
+    length = LiveBatch::HEADER;
+    return true;
+}
+
+
+
 void live()
 {
     namespace live  =  live_command;
@@ -2841,6 +4060,8 @@ void live()
                  live_speed    =   (static_cast<uint64_t>
                                    (usb_recv.word(live::RATE_HI)) << 32)
                                  |  usb_recv.word(live::RATE_LO)            ;
+    const
+    uint32_t     batch_window  = usb_recv.word(live::BATCH_WNDW)            ;
     volatile
     Usart           *usart_n                                                ;
 #pragma GCC diagnostic push
@@ -3009,6 +4230,35 @@ void live()
     }
 
 
+    // "monitor batch=": many fixed-length records per packet:
+    //   uint16_t   cycles since previous record (0 if first in packet)
+    //   uint8_t    PB4...PB11
+    //   uint16_t   per ADC, status << 12 | filtered value
+    //   uint8_t    USART status, rx_len data bytes        (if enabled)
+    //   uint8_t    SPI   status, tx_len data bytes        (if enabled)
+    //   uint8_t    I2C   status, oar_gc, rx_len bytes     (if enabled)
+    // after LiveBatch::HEADER: record count, records dropped before this
+    // packet (any over 255 carried into following packets), and 48-bit
+    // timestamp of first record. Packet sent when no room for next
+    // record, next record's delta won't fit, or batch_window cycles after
+    // first record. If USB can't keep up, records dropped instead of
+    // slowing sampling.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+    const unsigned  batch_len   =   3
+                                  + (num_adcs << 1)
+                                  + (usart_enable ? 1 + usart_rx_len : 0)
+                                  + (  spi_enable ? 1 + spi_tx_len   : 0)
+                                  + (  i2c_enable ? 2 + i2c_rx_len   : 0);
+#pragma GCC diagnostic pop
+    const bool      batching    =    batch_window
+                                  && batch_len <= LiveBatch::MAX_RECORD;
+    uint64_t        batch_begin = 0                ,
+                    batch_prev  = 0                ;
+    unsigned        batch_ndx   = LiveBatch::HEADER,
+                    dropped     = 0                ;
+
+
     // initial values other than ADCs
     //
     PeriphStatus           spi_status   = PeriphStatus::OK,
@@ -3023,17 +4273,25 @@ void live()
                            spi_chng     = false           ,
                          usart_chng     = false           ,
                            i2c_chng     = false           ;
-    uint16_t              gpio_prev     = 0x0100          ; // force != 1st time
+    uint16_t              gpio_prev     = 0x0100          , // force != 1st time
+                          gpio_seen     = 0x0100          ; // sent or dropped
     uint8_t              gpio_crnt      = 0               ,
                          i2c_sent                         ,
                          i2c_rcvd       = 0               ;
 
     sys_tick_timer.begin64();  // timestamp
+    instruments.loop_begin();
     while (sys_tick_timer.elapsed64() < duration) {
+        instruments.loop();
         sys_tick_timer.update64();
         if (slowing && slowdown_timer.elapsed64() >= live_speed)
             slowing = false;
 
+        if (   batching
+            && batch_ndx > LiveBatch::HEADER
+            && sys_tick_timer.elapsed64() - batch_begin >= batch_window)
+            live_batch_send(batch_ndx, batch_len, false);
+
         if (usb_recv.fill(0))
             break;
 
@@ -3152,11 +4410,84 @@ void live()
         if (  i2c_enable &&      i2c_rcvd)   i2c_chng = true;
 #pragma GCC diagnostic pop
 
-        if (    gpio_chng
-            ||   adc_chng
-            || usart_chng
-            ||   spi_chng
-            ||   i2c_chng) {
+        const bool  changed =    gpio_chng
+                              ||  adc_chng
+                              || usart_chng
+                              ||   spi_chng
+                              ||   i2c_chng;
+
+        if (changed && batching) {
+            const uint64_t  timestamp = sys_tick_timer.elapsed64();
+            bool            room      = true                      ;
+
+            if (   batch_ndx + batch_len > LiveBatch::MAX_LENGTH
+                || timestamp - batch_prev > LiveBatch::MAX_DELTA)
+                room = live_batch_send(batch_ndx, batch_len, false);
+
+            if (!room) {  // previous batch still pending
+                // gpio_prev stays last value sent so PB4...PB11 change
+                // is retried until sent, count it as dropped only once
+                if (   gpio_crnt != gpio_seen
+                    || adc_chng || usart_chng || spi_chng || i2c_chng)
+                    ++dropped;
+            }
+            else {
+                if (batch_ndx == LiveBatch::HEADER) {
+                    send_buf    [1] = dropped > 0xff ? 0xff : dropped;
+                    send_uint16s[1] = timestamp       & 0xffff       ;
+                    send_uint32s[1] = timestamp >> 16                ;
+                    batch_begin     = timestamp                      ;
+                    batch_prev      = timestamp                      ;
+                    dropped        -= send_buf[1]                    ;
+                }
+
+                const uint16_t  delta  = timestamp - batch_prev    ;
+                uint8_t        *record = &send_buf[batch_ndx]      ;
+
+                *record++  = delta                     ;
+                *record++  = delta >> 8                ;
+                *record++  = gpio_crnt                 ;
+                gpio_prev  = gpio_crnt                 ;
+                batch_prev = timestamp                 ;
+                batch_ndx += batch_len                 ;
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+                for (unsigned ndx = 0 ; ndx < num_adcs ; ++ndx) {
+                    const uint16_t  adc =   (static_cast<uint8_t>(adc_stati[ndx])
+                                             << 12                              )
+                                          | adc_fltds[ndx]                       ;
+                    *record++ = adc     ;
+                    *record++ = adc >> 8;
+                }
+
+                if (usart_enable) {
+                    *record++ = static_cast<uint8_t>(usart_status);
+                    for (unsigned ndx = 0 ; ndx < usart_rx_len ; ++ndx)
+                        *record++ = ndx < usart_rcvd ? usart_rx_data[ndx] : 0;
+                }
+
+                if (spi_enable) {
+                    *record++ = static_cast<uint8_t>(spi_status);
+                    for (unsigned ndx = 0 ; ndx < spi_tx_len ; ++ndx)
+                        *record++ = ndx < spi_sent_rcvd ? spi_rx_data[ndx] : 0;
+                }
+
+                if (i2c_enable) {
+                    *record++ = static_cast<uint8_t>(i2c_status);
+                    *record++ =                      i2c_oar_gc ;
+                    for (unsigned ndx = 0 ; ndx < i2c_rx_len ; ++ndx)
+                        *record++ = ndx < i2c_rcvd ? i2c_rx_data[ndx] : 0;
+                }
+#pragma GCC diagnostic pop
+            }
+
+            gpio_seen     = gpio_crnt;
+            usart_rcvd    = 0        ;
+            spi_sent_rcvd = 0        ;
+            i2c_rcvd      = 0        ;
+        }
+        else if (changed) {
 
             uint64_t    timestamp      = sys_tick_timer.elapsed64();
             uint8_t     gpio_adc_words = 3                         ;
@@ -3229,6 +4560,21 @@ void live()
         slowdown_timer.begin64();
     }  // while (true)
 
+    if (batching) {
+        live_batch_send(batch_ndx, batch_len, true);
+
+        // drops carried past last batch, in packets with no records
+        const uint64_t  timestamp = sys_tick_timer.elapsed64();
+        while (dropped) {
+            send_buf    [0] = 0                                  ;
+            send_buf    [1] = dropped > 0xff ? 0xff : dropped    ;
+            send_uint16s[1] = timestamp       & 0xffff           ;
+            send_uint32s[1] = timestamp >> 16                    ;
+            dropped        -= send_buf[1]                        ;
+            usb_send(LiveBatch::HEADER);
+        }
+    }
+
     // disable
     if (  adcs_enabled)   adc_disable(       );
     if ( usart_enable ) usart_disable(usart_n);
@@ -3393,7 +4739,9 @@ void spi_bridge()
 
     xmit_end = xmit_ptr = tx_data = sbrk(0);     // use rest of storage
 
+    instruments.loop_begin();
     while (true) {
+        instruments.loop();
         uint8_t     data_len;
         if (bridge_recv(&data_len           ,
                          xmit_end           ,
@@ -3488,7 +4836,9 @@ void i2c_bridge()
 
     usb_recv.flush(i2c::CMD_LEN + dflt_size);
 
+    instruments.loop_begin();
     while (true) {
+        instruments.loop();
         uint8_t     header[3];
         if (bridge_recv(header             ,
                         xmit_end           ,
@@ -3590,7 +4940,9 @@ void usart_bridge()
 
     usb_recv.flush(usart::CMD_LEN);
 
+    instruments.loop_begin();
     while (true) {
+        instruments.loop();
         uint8_t     data_len;
         if (bridge_recv(&data_len           ,
                          xmit_end           ,
@@ -3684,7 +5036,9 @@ void parallel_bridge()
 
     usb_recv.flush(CMD_LEN);
 
+    instruments.loop_begin();
     while (true) {
+        instruments.loop();
         uint8_t     data_len;
         if (bridge_recv(&data_len          ,
                           xmit_end         ,
@@ -3781,7 +5135,9 @@ void counter()
 
     halt_code = HaltCode::DURATION;
 
+    instruments.loop_begin();
     while (duratimer.elapsed64() <  duration) {
+        instruments.loop();
         if (gray) {
             gpioa->odr = count ^ (count >> 1);
             ++count;
@@ -3822,6 +5178,50 @@ void serial_number()
 
 
 
+void instrument()
+{
+    namespace inst = instrument_command;
+
+    usb_recv.fill(inst::CMD_LEN);
+
+    const uint8_t   action = usb_recv.byte(inst::ACTION);
+
+    usb_recv.flush(inst::CMD_LEN);
+
+    if (action == inst::ENABLE) {
+        instruments.enable();
+        return;
+    }
+
+    const bool          enabled = instruments.enabled();
+    const uint32_t     *words   = instruments.words()  ;
+
+    instruments.disable();   // don't count report's own sends
+
+    if (action == inst::DISABLE)
+        return;
+
+    send_buf[0] = enabled                            ;
+    send_buf[1] = Instruments::Histogram::BINS       ;
+    send_buf[2] = Instruments::NUM_HISTOGRAMS        ;
+    send_buf[3] = Instruments::NUM_COUNTERS          ;
+
+    unsigned    ndx = 1;
+    for (unsigned word = 0 ; word < Instruments::NUM_WORDS ; ++word) {
+        send_uint32s[ndx++] = words[word];
+        if (ndx == UsbDevCdcAcm::CDC_IN_DATA_SIZE >> 2) {
+            usb_send(UsbDevCdcAcm::CDC_IN_DATA_SIZE);
+            ndx = 0;
+        }
+    }
+    usb_send_w_zlp(ndx << 2);  // may be zero length
+
+    if (enabled)
+        instruments.resume();
+}
+
+
+
 void blink_user_led()
 {
     usb_recv.flush(1);
@@ -3865,6 +5265,10 @@ int main()
     // see CONNECT_SIGNATURE
     wait_connect_signature();
 
+#ifdef BUCK50_SIM
+    // sim IRQ handlers (build/sim/sim_asm.cxx) longjmp() with HaltCode
+    halt_code = setjmp(longjump_buf);
+#else
     __asm__ volatile (
     // setjmp
     "movw       r0, #:lower16:longjump_buf                      ;"
@@ -3893,6 +5297,7 @@ int main()
     :
     : "r0", "ip", "lr"
     );
+#endif
 
     if (halt_code != HaltCode::SETJMP) {
         if (in_progress & InProgress::SAMPLING_ETC) {
@@ -3924,14 +5329,31 @@ int main()
                 send_uint16s[3] = in_progress              ;
                 usb_send(8);
             }
+            else if (sampling_mode == SamplingMode::STREAM) {
+                const uint16_t  triggered =   in_progress
+                                            & InProgress::SAMPLING_ETC;
+                // stop stream_drain() from USB interrupts during sends
+                in_progress = InProgress::IDLE;
+                stream_finish(triggered);
+            }
             else {  // digital sampling only ends via interrupt (mem/tim/USB)
                 // might have incremented one past if HardFault trap
                 if (samples_end > &STORAGE_END)
                     samples_end = &STORAGE_END;
+                // halfword stores, drop trailing odd one (if any)
+                if (sampling_mode == SamplingMode::PACKED)
+                    samples_end = reinterpret_cast<uint32_t*>(
+                                    reinterpret_cast<uintptr_t>(samples_end)
+                                  & ~0x3                                 );
+                instruments.edges(samples                               ,
+                                  samples_end                           ,
+                                  sampling_mode == SamplingMode::PACKED);
                 send_buf    [0] = sampling_mode                         ;
                 send_buf    [1] = halt_code                             ;
                 send_uint16s[1] = in_progress & InProgress::SAMPLING_ETC;
-                send_uint16s[2] = samples_end - samples                 ;
+                send_uint16s[2] =   sampling_mode == SamplingMode::PACKED
+                                  ? packed_samples(samples, samples_end)
+                                  : samples_end - samples               ;
                 usb_send(6);
             }
         }
@@ -4030,6 +5452,10 @@ int main()
                 blink_user_led();
                 break;
 
+            case Command::INSTRUMENT:
+                instrument();
+                break;
+
             default:  // shouldn't ever happen
                 usb_recv.flush(1);
                 break;
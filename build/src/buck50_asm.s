@@ -41,6 +41,7 @@
 .equ    HALT_MEMORY  ,  1
 .equ    HALT_DURATION,  2
 .equ    HALT_USB     ,  3
+.equ    HALT_OVERRUN ,  4
 
 // InProgress bits
 .equ    IN_PROG_TRIGGERING , 0x0100
@@ -254,6 +255,8 @@ irq_handler_exit HALT_DURATION
 //      if (in_progress & (  InProgress::TRIGGERING
 //                         | InProgress::SAMPLING
 //                         | InProgress::COUNTING) {
+//          if (in_progress & InProgress::SAMPLING && stream_drain())
+//              return;  // SamplingMode::STREAM, continue sampling
 //          halt_timers();
 //          longjmp(&longjump_buf); // return HALT_USB
 //      }
@@ -278,6 +281,12 @@ pop     {in_prog}                       // in_prog = *sp++
 tst     in_prog, IN_PROG_TRIGGERING | IN_PROG_SAMPLING | IN_PROG_COUNTING
 it      eq                  // if (!(in_progress & TRIGGERING_etc)
 popeq   {pc}                //     return; }
+tst     in_prog, IN_PROG_SAMPLING       // if (in_prog & SAMPLING) {
+beq     .L_usb_halt
+bl      stream_drain                    //     C++ extern "C" function
+cbz     return_code, .L_usb_halt        //     if (stream_drain())
+pop     {pc}                            //         return; }
+.L_usb_halt:
 // doing longjump ...
 bl      halt_timers                     // C++ extern "C" function
 irq_handler_exit HALT_USB
@@ -356,6 +365,7 @@ systick     .req    r1
 //                    ganged_check
 //                  _ trigger_tail
 //  systick         = trigger_tail
+//                    trigger_and_sample_compiled_{plain,ganged}
 //                    ganged_sync
 //                  > sampling_setup
 //                    sampling_speed
@@ -503,8 +513,8 @@ valu        .req    r7      // scratch register, brief local lifetimes
 //                    irq_handler_exit
 
 //  r8
-fail    .req    r8
-lr_save .req    r8
+fail        .req    r8
+lr_save     .req    r8
 //                    trigger_and_sample_{plain,ganged}
 //                  : timers_mode_codeloc
 //                    flash_to_ram
@@ -512,7 +522,7 @@ lr_save .req    r8
 //                    ganged_ready
 //  fail            = trigger_head
 //                    ganged_check
-//                  _ trigger_tail
+//  fail            _ trigger_tail
 //                    ganged_sync
 //                    sampling_setup
 //                    sampling_speed
@@ -637,7 +647,21 @@ sample_func .req    r12
 .equ    SPEED_IRREGULAR ,   1
 .equ    SPEED_UNIFORM   ,   2
 .equ    SPEED_MHZ_4     ,   3
-.equ    SPEED_CODE_LIMIT,   3
+.equ    SPEED_STREAM    ,   4
+.equ    SPEED_PACKED    ,   5
+.equ    SPEED_CODE_LIMIT,   5
+
+// C++ struct StreamRing offsets
+.equ    STREAM_RING_BEGIN  ,   0
+.equ    STREAM_RING_MID    ,   4
+.equ    STREAM_RING_END    ,   8
+.equ    STREAM_RING_READ   ,  12
+.equ    STREAM_RING_FILLED ,  16
+.equ    STREAM_RING_DRAINED,  20
+
+// NVIC interrupt set-pending register for USB_LP_CAN1_RX0 (IRQ 20)
+.equ    NVIC_ISPR0      ,   0xE000E200
+.equ    USB_LP_IRQ_BIT  ,   1 << 20
 
 #endif  // .reqs and .equs
 
@@ -681,6 +705,20 @@ str     sample, [addr]                  // samples = sample
 movw    addr,:lower16:samples_end       // addr = &samples_end
 movt    addr,:upper16:samples_end       //   "   =       "
 str     sample, [addr]                  // samples_end = sample
+# stream_ring, only used if SamplingMode::STREAM but harmless otherwise
+movw    addr,:lower16:stream_ring       // addr = &stream_ring
+movt    addr,:upper16:stream_ring       //   "   =      "
+str     sample, [addr, STREAM_RING_BEGIN]   // stream_ring.begin = sample
+str     sample, [addr, STREAM_RING_READ ]   // stream_ring.read  = sample
+lsrs    num_samples, #3                 // num_samples = bytes / 2 halves
+lsls    num_samples, #2                 //   rounded down to words
+add     valu, sample, num_samples       // valu = sample + half
+str     valu, [addr, STREAM_RING_MID]   // stream_ring.mid = valu
+add     valu, num_samples               // valu += half
+str     valu, [addr, STREAM_RING_END]   // stream_ring.end = valu
+movs    valu, #0                        // valu = 0
+str     valu, [addr, STREAM_RING_FILLED ]   // stream_ring.filled  = 0
+str     valu, [addr, STREAM_RING_DRAINED]   // stream_ring.drained = 0
 mov     pc, lr                          // return
 
 #endif  // setup utils
@@ -809,6 +847,11 @@ cbz     valu, funcname&_triggered   // if (valu == 0) goto triggered
 mov     state, valu                 // else { state = valu;
 b       funcname&_trigger_loop      //    continue; }
 
+triggered   funcname
+.endm
+
+
+.macro triggered        funcname
 funcname&_triggered:
 // state might also have IN_PROG_EXTERN_TRIG
 // see irq_handler_enter for how race state of interrupt anywhere in
@@ -829,6 +872,36 @@ str     valu, [sample], 4               // *sample++ = valu
 .endm
 
 
+// entered from C++ TriggerCompiler code by branch to its end, with
+//   gpiob_idr and state set as by trigger_tail and systick preloaded
+// trigger sample stored before in_progress: interrupt in between finds
+//   still TRIGGERING and ignores it, same as halting just before trigger
+.macro compiled_triggered
+ldr     valu, [systick, VAL]            // valu = systick->val
+orr     valu, valu, gpiob_idr, lsl #20  // valu |= (gpiob << 20)
+str     valu, [sample], 4               // *sample++ = valu
+orr     state, IN_PROG_TRIGGERED | IN_PROG_SAMPLING
+bic     state, IN_PROG_TRIGGERING
+strh    state, [in_prog_addr]           // in_progress  = ...
+.endm
+
+
+// compiled_triggered/sampling_setup epilogue always in RAM directly after
+//   C++ TriggerCompiler code so that it can branch there: if code-mem=ram
+//   timers_mode_codeloc already copied it, else copy it (plus its jump
+//   to sampling loop in flash) to ram_dest, before set_samples
+.macro compiled_epilogue    epilogue_beg, epilogue_end
+cmp     flash_or_ram, CODE_MEM_RAM          // if (flash_or_ram != RAM) {
+itttt   ne
+movwne  flash_beg, :lower16:epilogue_beg    //    flash_beg = epilogue_beg
+movtne  flash_beg, :upper16:epilogue_beg    //        "     =      "
+movwne  flash_end, :lower16:epilogue_end    //    flash_end = epilogue_end
+movtne  flash_end, :upper16:epilogue_end    //        "     =      "
+it      ne
+blne    flash_to_ram                        //    flash_to_ram() }
+.endm
+
+
 .macro ganged_sync
 // unset trigger pin, regardless of whether another did or not
 // and set sync/ack
@@ -887,6 +960,8 @@ here:
 .short  (irregular - here) >> 1
 .short  (uniform   - here) >> 1
 .short  (mhz_4     - here) >> 1
+.short  (stream    - here) >> 1
+.short  (packed    - here) >> 1
 .else
 tbb     [pc, valu]
 here:
@@ -894,6 +969,8 @@ here:
 .byte   (irregular - here) >> 1
 .byte   (uniform   - here) >> 1
 .byte   (mhz_4     - here) >> 1
+.byte   (stream    - here) >> 1
+.byte   (packed    - here) >> 1
 .endif
 
 
@@ -917,7 +994,10 @@ movw    tim_1,      :lower16:adv_tim_1      // tim_1 = &adv_tim_1
 movt    tim_1,      :upper16:adv_tim_1      //   for later in sampling_setup()
 movw    ram_beg,    :lower16:STORAGE        // for jump to start
 movt    ram_beg,    :upper16:STORAGE        //  "   "   "    "
-mov     ram_dest,   ram_beg                 // for flash_to_ram &  set_samples()
+movw    addr,       :lower16:trigger_code_size  // compiled triggers at
+movt    addr,       :upper16:trigger_code_size  //   ram_beg, else 0 bytes
+ldr     valu,       [addr]                  // valu = trigger_code_size
+add     ram_dest,   ram_beg, valu           // for flash_to_ram &  set_samples()
 movw    in_prog_addr, :lower16:in_progress  // = &in_progress, for triggered:
 movt    in_prog_addr, :upper16:in_progress  //        "
 mov     lr_save,    lr                      // save for func return
@@ -953,6 +1033,20 @@ cmp     valu,       SPEED_MHZ_4             // if (valu == SPEED_MHZ_4) {
 itttt   eq
 movweq  flash_beg,  :lower16:mhz_4          //    flash_beg = mhz_4
 movteq  flash_beg,  :upper16:mhz_4          //        "     =   "
+movweq  flash_end,  :lower16:stream         //    flash_end = stream
+movteq  flash_end,  :upper16:stream         //        "     =   "      }
+
+cmp     valu,       SPEED_STREAM            // if (valu == SPEED_STREAM) {
+itttt   eq
+movweq  flash_beg,  :lower16:stream         //    flash_beg = stream
+movteq  flash_beg,  :upper16:stream         //        "     =   "
+movweq  flash_end,  :lower16:packed         //    flash_end = packed
+movteq  flash_end,  :upper16:packed         //        "     =   "      }
+
+cmp     valu,       SPEED_PACKED            // if (valu == SPEED_PACKED) {
+itttt   eq
+movweq  flash_beg,  :lower16:packed         //    flash_beg = packed
+movteq  flash_beg,  :upper16:packed         //        "     =   "
 movweq  flash_end,  :lower16:sampling_end   //    flash_end = <end>
 movteq  flash_end,  :upper16:sampling_end   //        "     =   "      }
 
@@ -1038,6 +1132,74 @@ mov     pc, sample_func
 
 
 
+// C++ TriggerCompiler has already written specialized per-state code for
+//   triggers[] to RAM at STORAGE (trigger_code_size bytes), replacing
+//   trigger_head/ganged_check/trigger_tail. Always runs from RAM, as does
+//   compiled_triggered/sampling_setup epilogue (see compiled_epilogue),
+//   only sampling loop obeys flash_or_ram.
+.balign 4
+.thumb_func
+.global trigger_and_sample_compiled_ganged
+trigger_and_sample_compiled_ganged:
+# entry
+#   flash_or_ram(r0)    // arg: copy/run in RAM (0) or leave/run in FLASH (1)
+#   num_samples (r1)    // arg: will be clamped to available memory size
+movw                flash_beg,  :lower16:compiled_ganged_beg
+movt                flash_beg,  :upper16:compiled_ganged_beg
+movw                flash_end,  :lower16:compiled_ganged_end
+movt                flash_end,  :upper16:compiled_ganged_end
+bl                  timers_mode_codeloc                 // sets ram_dest
+compiled_epilogue   compiled_ganged_beg, compiled_ganged_exit
+bl                  set_samples
+movw                systick,        :lower16:SYSTICK    // &systick
+movt                systick,        :upper16:SYSTICK    //     "
+movw                gpiob,          :lower16:GPIOB      // &gpiob
+movt                gpiob,          :upper16:GPIOB      //     "
+ganged_ready
+mov                 pc,             ram_beg             // goto compiled code
+.balign 4
+compiled_ganged_beg:
+compiled_triggered
+ganged_sync
+sampling_setup
+.balign 4
+compiled_ganged_end:
+mov     pc, sample_func
+.balign 4
+compiled_ganged_exit:
+
+
+.balign 4
+.thumb_func
+.global trigger_and_sample_compiled_plain
+trigger_and_sample_compiled_plain:
+# entry
+#   flash_or_ram(r0)    // arg: copy/run in RAM (0) or leave/run in FLASH (1)
+#   num_samples (r1)    // arg: will be clamped to available memory size
+movw                flash_beg,  :lower16:compiled_plain_beg
+movt                flash_beg,  :upper16:compiled_plain_beg
+movw                flash_end,  :lower16:compiled_plain_end
+movt                flash_end,  :upper16:compiled_plain_end
+bl                  timers_mode_codeloc                 // sets ram_dest
+compiled_epilogue   compiled_plain_beg, compiled_plain_exit
+bl                  set_samples
+movw                systick,        :lower16:SYSTICK    // &systick
+movt                systick,        :upper16:SYSTICK    //     "
+movw                gpiob,          :lower16:GPIOB      // &gpiob
+movt                gpiob,          :upper16:GPIOB      //     "
+mov                 pc,             ram_beg             // goto compiled code
+.balign 4
+compiled_plain_beg:
+compiled_triggered
+sampling_setup
+.balign 4
+compiled_plain_end:
+mov     pc, sample_func
+.balign 4
+compiled_plain_exit:
+
+
+
 
 // remove (triggering-specific) register aliases
 // others remain set for use in sampling
@@ -1121,6 +1283,136 @@ nop     // flash=??, ram=19 with      2 nops
 nop     // flash=18, ram=21 with      3 nops
 b   mhz_4
 
+// SamplingMode::STREAM
+// same as uniform but stores into two-half ring buffer (see C++
+//   struct StreamRing) instead of until HardFault at END_OF_RAM
+// at end of each half (rare path): count half filled, wrap at end of ring,
+//   halt if next half not yet sent to host by C++ stream_drain(),
+//   else set USB interrupt pending so stream_drain() starts sending
+// stream_drain() runs in USB interrupt, stalling sampling loop briefly
+//   for each packet sent
+stream_limit    .req    r6      // end of current half
+stream_addr     .req    r12     // &stream_ring
+
+.balign     4
+stream:
+movw        stream_addr,  :lower16:stream_ring
+movt        stream_addr,  :upper16:stream_ring
+ldr         stream_limit, [stream_addr, STREAM_RING_MID]
+.balign     4
+stream_loop:    // flash=16 ram=19 (uniform plus cmp)
+sample_crnt
+mov         prev, crnt
+cmp         sample, stream_limit            // if (sample != stream_limit)
+bne         stream_loop                     //     continue;
+// end of half
+ldr         valu, [stream_addr, STREAM_RING_FILLED]
+adds        valu, #1                        // ++stream_ring.filled
+str         valu, [stream_addr, STREAM_RING_FILLED]
+ldr         stream_limit, [stream_addr, STREAM_RING_END]
+cmp         sample, stream_limit            // if (sample == ring end) {
+itt         eq
+ldreq       sample, [stream_addr, STREAM_RING_BEGIN]    // sample = begin
+ldreq       stream_limit, [stream_addr, STREAM_RING_MID]//  limit = mid }
+// else limit = end (loaded above)
+ldr         idrtim, [stream_addr, STREAM_RING_DRAINED]
+subs        idrtim, valu, idrtim            // halves not yet sent to host
+cmp         idrtim, #2                      // if (both halves) {
+bge         stream_overrun                  //     goto overrun; }
+movw        idrtim, :lower16:NVIC_ISPR0     // set USB interrupt pending
+movt        idrtim, :upper16:NVIC_ISPR0     //   "   "      "        "
+mov         valu,   USB_LP_IRQ_BIT          //   "   "      "        "
+str         valu,   [idrtim]                //   "   "      "        "
+b           stream_loop
+
+// equivalent of irq_handler_enter+halt_timers+irq_handler_exit(HALT_OVERRUN)
+// but without IRQ stack frame
+// absolute addresses because might be executing copy in RAM
+stream_overrun:
+movw        valu, :lower16:samples_end      // valu = &samples_end
+movt        valu, :upper16:samples_end      //   "  =      "
+str         sample, [valu]                  // samples_end = sample
+movw        valu, :lower16:halt_timers      // C++ extern "C" function
+movt        valu, :upper16:halt_timers      //  "     "     "     "
+blx         valu                            // halt_timers()
+movw        valu, :lower16:longjump_buf     // valu = &longjump_buf
+movt        valu, :upper16:longjump_buf     //   "  =      "
+ldr         valu, [valu, #36]               // valu = longjump_buf[address]
+orr         valu, #1                        // thumb
+movs        r0,   HALT_OVERRUN              // longjmp return value
+bx          valu                            // longjmp(&longjump_buf)
+
+.unreq  stream_limit
+.unreq  stream_addr
+
+// SamplingMode::PACKED
+// 16-bit instead of 32-bit samples after the two full 32-bit trigger and
+//   sampling_setup samples:
+//      bbbbbbbb dddddddd   PB11...PB4 bits, 1...255 systick ticks since
+//                          previous sample
+//   or, if more than 255 ticks (including systick overflow PB13 samples
+//   and systick reload between samples):
+//      bbbbbbbb 00000000   escape
+//      ssssssss ssssssss   systick->val 15:0
+//      00000000 ssssssss   systick->val 23:16
+// branches instead of it/strne: not uniform timing like other modes, but
+//   no-change loop is shortest of all
+// changed path is longer than 32-bit modes' (delta, range check, and bit
+//   packing are at least 5 more instructions than mhz_6's orr/it/strne),
+//   so packed trades sampling rate on busy inputs for twice the depth
+// unrolled 2x: packed_swap is packed_loop with crnt/prev and
+//   idrtim/prev_tick exchanged, so no moves to keep previous sample and
+//   previous sample's registers free as scratch after compare/subtract
+// host decodes, see unpack_samples() in buck50.py
+prev_tick       .req    r6      // systick->val of previous sample
+
+.balign     4
+packed:
+ldr         prev_tick, [sample, #-4]        // prev_tick = sampling_setup
+bfc         prev_tick, #24, #8              //   sample, systick bits only
+.balign     4
+packed_loop:    // flash=10,15,25 ram=12,17,31 (unchanged, changed, escape)
+ldr         crnt,   [gpiob, IDR]            // crnt   = gpiob->idr
+ldr         idrtim, [systick, VAL]          // idrtim = systick->val
+cmp         crnt,   prev                    // if (crnt == prev)
+beq         packed_loop                     //     continue;
+subs        prev_tick, prev_tick, idrtim    // prev_tick -= idrtim (delta)
+cmp         prev_tick, #0xff                // if (delta > 255 or reload)
+bhi         packed_escape                   //     goto escape;
+ubfx        prev,   crnt, #4, #8            // prev = PB11...PB4
+orr         prev_tick, prev_tick, prev, lsl #8  // delta |= prev << 8
+strh        prev_tick, [sample], #2         // *sample++ = delta (uint16_t)
+packed_swap:    // flash=10,18,25 ram=12,21,31 (unchanged, changed, escape)
+ldr         prev,   [gpiob, IDR]            // prev      = gpiob->idr
+ldr         prev_tick, [systick, VAL]       // prev_tick = systick->val
+cmp         prev,   crnt                    // if (prev == crnt)
+beq         packed_swap                     //     continue;
+subs        idrtim, idrtim, prev_tick       // idrtim -= prev_tick (delta)
+cmp         idrtim, #0xff                   // if (delta > 255 or reload)
+bhi         packed_swap_escape              //     goto escape;
+ubfx        crnt,   prev, #4, #8            // crnt = PB11...PB4
+orr         idrtim, idrtim, crnt, lsl #8    // delta |= crnt << 8
+strh        idrtim, [sample], #2            // *sample++ = delta (uint16_t)
+b           packed_loop
+packed_escape:
+ubfx        prev,   crnt, #4, #8            // prev = PB11...PB4
+lsls        prev,   #8                      //   at 15:8, delta 0
+strh        prev,   [sample], #2            // *sample++ = bits, delta 0
+strh        idrtim, [sample], #2            // *sample++ = systick 15:0
+lsrs        prev_tick, idrtim, #16          // prev_tick = idrtim >> 16
+strh        prev_tick, [sample], #2         // *sample++ = systick 23:16
+b           packed_swap
+packed_swap_escape:
+ubfx        crnt,   prev, #4, #8            // crnt = PB11...PB4
+lsls        crnt,   #8                      //   at 15:8, delta 0
+strh        crnt,   [sample], #2            // *sample++ = bits, delta 0
+strh        prev_tick, [sample], #2         // *sample++ = systick 15:0
+lsrs        idrtim, prev_tick, #16          // idrtim = prev_tick >> 16
+strh        idrtim, [sample], #2            // *sample++ = systick 23:16
+b           packed_loop
+
+.unreq  prev_tick
+
 .balign 4
 sampling_end:
 
@@ -164,9 +164,14 @@ bool UsbDev::init()
 
         uint16_t    adjusted_packet_size;
 
-        if (endpoint_dir)  // IN / send / tx
+        if (endpoint_dir) {  // IN / send / tx
             // keep 32-bit alignment
             adjusted_packet_size = (max_packet_size + 3) & ~0x3;
+
+            // two ping-pong buffers, see dbl_buf_send()
+            if (_dbl_buf_sends & (1 << endpoint_addr))
+                adjusted_packet_size <<= 1;
+        }
         else { // OUT / recv / rx
             // converts to allowed modulo 2 or modulo 32 values
              _pma_descs
@@ -208,6 +213,20 @@ bool UsbDev::init()
             = reinterpret_cast<uint32_t*>(  USB_PMAADDR
                                           + _BTABLE_OFFSET
                                           + (pma_addr << 1));
+
+            // second buffer in upper half, in hardware's "rx" buffer
+            // descriptor slot (endpoint must be send-only)
+            if (_dbl_buf_sends & (1 << endpoint_addr)) {
+                uint16_t    dbl_buf_addr =   pma_addr
+                                           + (adjusted_packet_size >> 1);
+
+                _pma_descs.eprn(eprn_ndx).addr_rx = dbl_buf_addr;
+
+                  _endpoints[eprn_ndx].recv_pma
+                = reinterpret_cast<uint32_t*>(  USB_PMAADDR
+                                              + _BTABLE_OFFSET
+                                              + (dbl_buf_addr << 1));
+            }
         }
         else {
             // use original value
@@ -303,6 +322,16 @@ const uint16_t          data_length)  // trust caller <= max_send_packet
 
     uint8_t     eprn_ndx = _epaddr2eprn[endpoint];
 
+    if (_dbl_buf_sends & (1 << endpoint)) {
+        writ_pma_data(data                                                    ,
+                      usb->eprn(eprn_ndx).all(Usb::Epr::DTOG_RX_DATA1)  // SW_BUF
+                      ? _endpoints[eprn_ndx].recv_pma
+                      : _endpoints[eprn_ndx].send_pma                         ,
+                      data_length                                             );
+        dbl_buf_send(endpoint, data_length);
+        return true;
+    }
+
     writ_pma_data(data, _endpoints[eprn_ndx].send_pma, data_length);
 
     _pma_descs.eprn(eprn_ndx).count_tx =   UsbBufDesc
@@ -421,9 +450,16 @@ void UsbDev::reset()
         }
 
         else if (_endpoints[eprn_ndx].max_send_packet) {
-            usb->eprn(eprn_ndx) =   Usb::Epr::STAT_TX_NAK
-                                  | endpoint_type
-                                  | Usb::Epr::ea(endpoint_addr);
+            if (_dbl_buf_sends & (1 << endpoint_addr))
+                // DTOG_TX == SW_BUF == 0, both buffers empty
+                usb->eprn(eprn_ndx) =   (  Usb::Epr::STAT_TX_NAK
+                                         | endpoint_type
+                                         | Usb::Epr::ea(endpoint_addr)).bits()
+                                      | Usb::Epr::DBL_BUF.bits();
+            else
+                usb->eprn(eprn_ndx) =   Usb::Epr::STAT_TX_NAK
+                                      | endpoint_type
+                                      | Usb::Epr::ea(endpoint_addr);
             _send_readys_pending |= 1 << endpoint_addr;
         }
 
@@ -876,4 +912,44 @@ const uint8_t   address)
 
 }  // set_address()
 
+
+
+// STM32F10xx double-buffered bulk IN endpoint. Peripheral sends buffer
+// selected by DTOG_TX, client fills one selected by SW_BUF (DTOG_RX bit
+// position in IN endpoint's register) and hands it over by toggling SW_BUF.
+// Buffer 0 is addr_tx/count_tx, buffer 1 addr_rx/count_rx. Peripheral
+// sets STAT_TX to NAK when both empty (DTOG_TX == SW_BUF after sending).
+//
+// If DTOG_TX != SW_BUF on entry other buffer is still queued or on the
+// wire so both are now full: not ready again until next CTR_TX in ctr().
+// If other completes between test and clear, the lost ready bit is
+// restored by this buffer's CTR_TX.
+void UsbDev::dbl_buf_send(
+const uint8_t   endpoint,
+const uint16_t  length  )
+{
+    uint8_t     eprn_ndx = _epaddr2eprn[endpoint];
+    bool        sw_buf   = usb->eprn(eprn_ndx).all(Usb::Epr::DTOG_RX_DATA1),
+                dtog_tx  = usb->eprn(eprn_ndx).all(Usb::Epr::DTOG_TX_DATA1);
+
+    if (sw_buf)
+          _pma_descs.eprn(eprn_ndx).count_rx
+        = UsbBufDesc::CountRx::count_0(length);
+    else
+          _pma_descs.eprn(eprn_ndx).count_tx
+        = UsbBufDesc::CountTx::count_0(length);
+
+    if (sw_buf != dtog_tx)
+        _send_readys &= ~(1 << endpoint);
+
+    // toggle SW_BUF (write 1 to toggle-only bit, 0 to all others)
+    usb->eprn(eprn_ndx).write(Usb::Epr::DTOG_RX_DATA1);
+
+    // was NAK because both buffers empty, peripheral won't set NAK again
+    //   until after sending the one just handed over
+    if (usb->eprn(eprn_ndx).all(Usb::Epr::STAT_TX_NAK))
+        usb->eprn(eprn_ndx).stat_tx(Usb::Epr::STAT_TX_VALID);
+
+}  // dbl_buf_send()
+
 } // namespace stm32f10_12357_xx
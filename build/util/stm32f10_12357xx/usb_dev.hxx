@@ -22,8 +22,8 @@
 #define USB_DEV_HXX
 
 #define USB_DEV_MAJOR_VERSION   1
-#define USB_DEV_MINOR_VERSION   2
-#define USB_DEV_MICRO_VERSION   1
+#define USB_DEV_MINOR_VERSION   3
+#define USB_DEV_MICRO_VERSION   0
 
 #include <stm32f103xb.hxx>
 
@@ -115,6 +115,7 @@ class UsbDev {
         _recv_readys          (0x0000                   ),
         _send_readys          (0x0000                   ),
         _send_readys_pending  (0x0000                   ),
+        _dbl_buf_sends        (0x0000                   ),
         _last_send_size       (0                        ),
         _num_eprns            (1                        ), // parse descriptor,
                                                            // always endpoint 0
@@ -165,6 +166,18 @@ class UsbDev {
     //   MCU peripheral, clock, etc. configuration/initialization.
     bool    init();
 
+    // Optional, must be called before init().
+    // Bit N set: send-only (IN, no OUT with same number) bulk endpoint with
+    //   USB descriptor address N uses STM32F10xx double-buffered mode, two
+    //   PMA packet buffers in ping-pong. send() then returns as soon as
+    //   either is free, so client fills one while other is being sent to
+    //   host instead of waiting for each packet to complete.
+    void    double_buffer_sends(
+    const uint16_t  endpoints)
+    {
+        _dbl_buf_sends = endpoints;
+    }
+
 #ifdef USB_DEV_FORCE_RESET_CAPABILITY
     // Experimental
     // Not useful, doesn't reset USB bus (pull D+ line low) to indicate
@@ -374,6 +387,11 @@ class UsbDev {
         if (!(_send_readys & (1 << endpoint)))
             return false;
 
+        if (_dbl_buf_sends & (1 << endpoint)) {
+            dbl_buf_send(endpoint, length);
+            return true;
+        }
+
           _pma_descs.eprn(_epaddr2eprn[endpoint]).count_tx
         = stm32f103xb::UsbBufDesc::CountTx::count_0(length);
 
@@ -401,7 +419,7 @@ class UsbDev {
     const uint16_t  data    ,
     const uint8_t   data_ndx)   // uint16_t index, i.e. byte index divided by 2
     {
-        *(_endpoints[_epaddr2eprn[endpoint]].send_pma + data_ndx) = data;
+        *(send_buf(endpoint) + data_ndx) = data;
     }
 
     // e.g. for DMA from/to peripheral
@@ -412,10 +430,21 @@ class UsbDev {
         return _endpoints[_epaddr2eprn[endpoint]].recv_pma;
     }
 
+    // if double-buffered, is buffer for next send() -- only valid
+    //   while send_ready()
     volatile uint32_t* send_buf(
     const uint8_t   endpoint)
     {
-        return _endpoints[_epaddr2eprn[endpoint]].send_pma;
+        uint8_t     eprn_ndx = _epaddr2eprn[endpoint];
+
+        if (   (_dbl_buf_sends & (1 << endpoint))
+            && stm32f103xb::usb->eprn(eprn_ndx).all(  stm32f103xb
+                                                    ::Usb
+                                                    ::Epr
+                                                    ::DTOG_RX_DATA1))
+            return _endpoints[eprn_ndx].recv_pma;   // SW_BUF, see dbl_buf_send()
+
+        return _endpoints[eprn_ndx].send_pma;
     }
 
 
@@ -425,7 +454,8 @@ class UsbDev {
     // configuration descriptor(s). Must be saved for subsequent execution
     // of reset() via USB request from host.
     struct Endpoint {
-        uint32_t        *recv_pma       , // buffer, CPU addressing
+        uint32_t        *recv_pma       , // buffer, CPU addressing, or second
+                                          //   send buffer if double-buffered
                         *send_pma       ; //   "   ,  "      "
         uint16_t         max_recv_packet, // maximum USB tranfer size
                          max_send_packet; //    "     "     "      "
@@ -626,6 +656,9 @@ class UsbDev {
 
     void    set_address(const uint8_t   address);
 
+    void    dbl_buf_send(const uint8_t      endpoint,
+                         const uint16_t     length  );
+
     void    writ_pma_data(const uint8_t*  const     data,
                                 uint32_t* const     addr,
                           const uint16_t            size),
@@ -675,7 +708,8 @@ class UsbDev {
                                 // bit N indicates USB endpoint descriptor addr
       uint16_t                  _recv_readys          ,
                                 _send_readys          ,
-                                _send_readys_pending  ;
+                                _send_readys_pending  ,
+                                _dbl_buf_sends        ;
 
       uint16_t                  _last_send_size       ;
       uint8_t                   _num_eprns            ,
@@ -159,6 +159,10 @@ bool UsbDevCdcAcm::init()
 {
     _CONFIG_DESC[UsbDev::CONFIG_DESC_SIZE_NDX]  = sizeof(_CONFIG_DESC);
 
+#if CDC_IN_DOUBLE_BUFFER
+    double_buffer_sends(1 << CDC_ENDPOINT_IN);
+#endif
+
     return UsbDev::init();
 }
 
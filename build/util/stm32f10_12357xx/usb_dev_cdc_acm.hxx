@@ -26,12 +26,16 @@
 #define CDC_OUT_EP_SIZE 64  // must be modulo 4, max 64)
 #endif
 
+#ifndef CDC_IN_DOUBLE_BUFFER
+#define CDC_IN_DOUBLE_BUFFER 1  // see UsbDev::double_buffer_sends()
+#endif
+
 
 #include <usb_dev.hxx>
 
 #if USB_DEV_MAJOR_VERSION == 1
-#if USB_DEV_MINOR_VERSION  < 0
-#warning USB_DEV_MINOR_VERSION < 0 with required USB_DEV_MAJOR_VERSION == 1
+#if USB_DEV_MINOR_VERSION  < 3
+#warning USB_DEV_MINOR_VERSION < 3 with required USB_DEV_MAJOR_VERSION == 1
 #endif
 #else
 #error USB_DEV_MAJOR_VERSION != 1